@@ -0,0 +1,230 @@
+/*
+ * The kernel functions that pmm.c, balloc.c and mmu.c call out to, for a
+ * host process. See host_shim.h.
+ */
+#define _GNU_SOURCE
+
+#include "../../kernel/arch/x86_64/feature.h"
+#include "../../kernel/arch/x86_64/memops.h"
+#include "../../kernel/arch/x86_64/tlb.h"
+#include "../../kernel/mutex.h"
+#include "../../kernel/rcu.h"
+#include "../../kernel/thread.h"
+#include "../../kernel/vm/balloc.h"
+#include "../../kernel/workqueue.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/* Room for the page arrays of the arenas. */
+#define HOST_BALLOC_SIZE    (64UL << 20)
+
+/* Spins on a held mutex before giving up the cpu, like the kernel's. */
+#define HOST_MUTEX_SPINS    1000
+
+uint8_t *host_phys_base;
+size_t host_phys_size;
+
+__thread x86_percpu_t host_percpu;
+host_tlb_stats_t host_tlb_stats;
+
+x86_cpu_info_t x86_cpu_info;
+
+/* balloc.c starts at the end of the kernel image, host_shim_init() moves it */
+int __end;
+
+static void *host_worker(void *arg);
+
+int host_shim_init(size_t phys_size) {
+    void *phys = mmap(NULL, phys_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (phys == MAP_FAILED)
+        return -1;
+
+    void *boot = malloc(HOST_BALLOC_SIZE);
+    if (!boot) {
+        munmap(phys, phys_size);
+        return -1;
+    }
+
+    host_phys_base = phys;
+    host_phys_size = phys_size;
+
+    boot_alloc_start = boot_alloc_end = (uintptr_t)boot;
+
+    host_shim_thread_init(0);
+
+    pthread_t worker;
+    if (pthread_create(&worker, NULL, host_worker, NULL) != 0)
+        return -1;
+    pthread_detach(worker);
+
+    return 0;
+}
+
+void host_shim_thread_init(uint32_t cpu_num) {
+    thread_t *t = calloc(1, sizeof(*t));
+    if (!t)
+        abort();
+
+    t->magic = THREAD_MAGIC;
+    strcpy(t->name, "host");
+    t->state = THREAD_RUNNING;
+    t->curr_cpu = cpu_num;
+
+    host_percpu.direct = &host_percpu;
+    host_percpu.current_thread = t;
+    host_percpu.cpu_num = cpu_num;
+}
+
+/* ------------------------------ Locking ------------------------------ */
+
+/*
+ * One cmpxchg when uncontended like the real thing. Otherwise spin for a
+ * while and then yield, where the kernel would queue up and block. There
+ * is no hand off, so waiters are not served in order.
+ */
+int mutex_acquire_timeout(mutex_t *m, ktime_t timeout) {
+    uintptr_t self = (uintptr_t)get_current_thread();
+
+    for (;;) {
+        uintptr_t expected = 0;
+
+        if (__atomic_compare_exchange_n(&m->owner, &expected, self, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+
+        if (timeout == 0)
+            return ERR_MUTEX_TIMED_OUT;
+
+        for (int i = 0; i < HOST_MUTEX_SPINS; ++i) {
+            if (!__atomic_load_n(&m->owner, __ATOMIC_RELAXED))
+                break;
+            __builtin_ia32_pause();
+        }
+
+        if (__atomic_load_n(&m->owner, __ATOMIC_RELAXED))
+            sched_yield();
+    }
+
+    return MUTEX_NO_ERROR;
+}
+
+int mutex_release(mutex_t *m) {
+    __atomic_store_n(&m->owner, 0, __ATOMIC_RELEASE);
+    return MUTEX_NO_ERROR;
+}
+
+/* With one thread there are no readers to wait for. */
+void synchronize_rcu(void) {
+}
+
+void thread_yield(void) {
+}
+
+/* Arenas are added long after boot here. */
+void boot_mark(const char *label) {
+}
+
+/* ------------------------------ Workqueue ------------------------------ */
+
+/*
+ * One worker for the work of every cpu, it runs next to the thread that
+ * queued it like a kernel worker on another cpu would. A FIFO under a
+ * mutex stands in for the per cpu queues.
+ */
+workqueue_t system_wq;
+
+static pthread_mutex_t work_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static mpsc_node_t *work_head, **work_tail = &work_head;
+static uint64_t work_queued, work_done;
+
+static void *host_worker(void *arg) {
+    host_shim_thread_init(HOST_WORKER_CPU);
+
+    pthread_mutex_lock(&work_lock);
+
+    for (;;) {
+        while (!work_head)
+            pthread_cond_wait(&work_cond, &work_lock);
+
+        mpsc_node_t *node = work_head;
+        work_head = node->next;
+        if (!work_head)
+            work_tail = &work_head;
+
+        pthread_mutex_unlock(&work_lock);
+
+        work_t *work = container_of(node, work_t, node);
+
+        /* may be queued again from here on */
+        atomic_store(&work->pending, 0);
+        work->func(work);
+
+        pthread_mutex_lock(&work_lock);
+        work_done++;
+        pthread_cond_broadcast(&work_cond);
+    }
+
+    return NULL;
+}
+
+bool workqueue_ready(workqueue_t *wq) {
+    return true;
+}
+
+bool queue_work(workqueue_t *wq, work_t *work) {
+    if (atomic_exchange(&work->pending, 1))
+        return false;
+
+    pthread_mutex_lock(&work_lock);
+
+    work->node.next = NULL;
+    *work_tail = &work->node;
+    work_tail = &work->node.next;
+    work_queued++;
+
+    pthread_cond_broadcast(&work_cond);
+    pthread_mutex_unlock(&work_lock);
+
+    return true;
+}
+
+void host_shim_flush_work(void) {
+    pthread_mutex_lock(&work_lock);
+
+    while (work_done != work_queued)
+        pthread_cond_wait(&work_cond, &work_lock);
+
+    pthread_mutex_unlock(&work_lock);
+}
+
+/* ------------------------------ TLB ------------------------------ */
+
+void tlb_batch_init(tlb_batch_t *batch, paddr_t pml4_phys) {
+    memset(batch, 0, sizeof(*batch));
+    batch->pml4_phys = pml4_phys;
+}
+
+void tlb_batch_add(tlb_batch_t *batch, vaddr_t base, size_t pages) {
+    batch->pages += pages;
+}
+
+void tlb_batch_flush(tlb_batch_t *batch) {
+    if (batch->pages || batch->tables) {
+        host_tlb_stats.flushes++;
+        host_tlb_stats.pages += batch->pages;
+    }
+
+    tlb_batch_init(batch, batch->pml4_phys);
+}
+
+/* ------------------------------ Memory ------------------------------ */
+
+void arch_clear_page(void *page) {
+    memset(page, 0, PAGE_SIZE);
+}
@@ -0,0 +1,102 @@
+#ifndef _BENCH_HOST_SHIM_H_
+#define _BENCH_HOST_SHIM_H_
+
+/*
+ * Pre-included with -include into the kernel sources built for the host
+ * benchmarks. It claims the include guards of the headers that touch the
+ * hardware and puts plain C in their place:
+ *
+ *  - aspace.h: the physmap starts at host_phys_base, a buffer from mmap()
+ *    that serves as physical memory. Physical address 0 is its first byte,
+ *    so page tables and kpages allocated from the pmm are ordinary memory.
+ *  - percpu.h: every host thread is a cpu with its own thread_t, the per
+ *    cpu block is a thread local variable instead of being reached
+ *    through GS.
+ *
+ * Everything else the kernel code calls out to that would need a running
+ * kernel (mutex, rcu, tlb shootdowns, workqueues) is stubbed in
+ * host_shim.c. Queued work runs on a worker thread of its own, as cpu
+ * HOST_WORKER_CPU.
+ */
+
+#include "../../kernel/arch/x86_64/defines.h"
+#include "../../kernel/compiler.h"
+#include "../../kernel/types.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* ------------------------------ aspace.h ------------------------------ */
+
+#define _ASPACE_H_
+
+extern uint8_t *host_phys_base;
+extern size_t host_phys_size;
+
+#define KERNEL_ASPACE_BASE  ((uintptr_t)host_phys_base)
+#define KERNEL_ASPACE_SIZE  ((uintptr_t)host_phys_size)
+
+#define USER_ASPACE_BASE    0x0000000000200000UL
+
+/* ------------------------------ percpu.h ------------------------------ */
+
+#define _X86_PERCPU_H_
+
+struct thread;
+
+typedef struct x86_percpu {
+    struct x86_percpu   *direct;
+    struct thread       *current_thread;
+
+    uint32_t            cpu_num;
+    uint32_t            apic_id;
+
+    uintptr_t           int_ip;
+    uintptr_t           int_fp;
+} ALIGNED(CACHE_LINE_SIZE) x86_percpu_t;
+
+extern __thread x86_percpu_t host_percpu;
+
+#define X86_PERCPU_OFFSET(field)    offsetof(x86_percpu_t, field)
+
+static inline x86_percpu_t *x86_get_percpu(void) {
+    return &host_percpu;
+}
+
+static inline uint32_t x86_get_percpu_cpu_num(void) {
+    return host_percpu.cpu_num;
+}
+
+static inline struct thread *x86_get_percpu_current_thread(void) {
+    return host_percpu.current_thread;
+}
+
+static inline void x86_set_percpu_current_thread(struct thread *t) {
+    host_percpu.current_thread = t;
+}
+
+/* ------------------------------ Control ------------------------------ */
+
+#define HOST_WORKER_CPU     (SMP_MAX_CPUS - 1)
+
+typedef struct host_tlb_stats {
+    uint64_t    flushes;        /* Batches flushed with something in them. */
+    uint64_t    pages;          /* Pages queued for invalidation. */
+} host_tlb_stats_t;
+
+extern host_tlb_stats_t host_tlb_stats;
+
+/**
+ * @brief   Map phys_size bytes of simulated physical memory and set up the
+ *          boot allocator and the calling thread as cpu 0. Call before
+ *          anything else.
+ * @returns 0 on success, -1 if the memory could not be mapped.
+ */
+int host_shim_init(size_t phys_size);
+
+/** @brief  Make the calling thread cpu_num, before it calls kernel code. */
+void host_shim_thread_init(uint32_t cpu_num);
+
+/** @brief  Wait until the worker has run everything queued so far. */
+void host_shim_flush_work(void);
+
+#endif /* _BENCH_HOST_SHIM_H_ */
@@ -0,0 +1,287 @@
+/*
+ * Throughput of the lock-free containers in kernel/lockfree.h under
+ * contention, against a list.h stack behind a pthread mutex. The work
+ * stealing deque run also reports the share of entries stolen.
+ *
+ * usage: lockfree_bench [max_threads] [ops_per_thread]
+ */
+#define _GNU_SOURCE
+
+#include "../kernel/list.h"
+#include "../kernel/lockfree.h"
+#include "../kernel/stdlib.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NODES_PER_THREAD    64
+
+typedef struct item {
+    lf_stack_node_t stack_node;
+    mpsc_node_t     queue_node;
+    list_node_t     list_node;
+} item_t;
+
+typedef struct bench_ctx {
+    pthread_barrier_t   start;
+    size_t              ops;
+    uint32_t            nthreads;
+
+    lf_stack_t          stack;
+    mpsc_queue_t        queue;
+
+    pthread_mutex_t     list_lock;
+    list_node_t         list;
+
+    ws_deque_t          deque;
+    int                 owner_done;
+    size_t              stolen;
+
+    size_t              consumed;
+} bench_ctx_t;
+
+typedef struct worker {
+    pthread_t   thread;
+    bench_ctx_t *ctx;
+    uint32_t    id;
+    item_t      *items;
+} worker_t;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* ------------------------------ Workloads ------------------------------ */
+
+static void *treiber_worker(void *arg) {
+    worker_t *w = arg;
+    bench_ctx_t *ctx = w->ctx;
+
+    for (int i = 0; i < NODES_PER_THREAD; ++i)
+        lf_stack_push(&ctx->stack, &w->items[i].stack_node);
+
+    pthread_barrier_wait(&ctx->start);
+
+    /* pop one, push it back */
+    for (size_t i = 0; i < ctx->ops; ++i) {
+        lf_stack_node_t *node = lf_stack_pop(&ctx->stack);
+        if (node)
+            lf_stack_push(&ctx->stack, node);
+    }
+
+    return NULL;
+}
+
+static void *locked_list_worker(void *arg) {
+    worker_t *w = arg;
+    bench_ctx_t *ctx = w->ctx;
+
+    pthread_mutex_lock(&ctx->list_lock);
+    for (int i = 0; i < NODES_PER_THREAD; ++i)
+        list_add(&ctx->list, &w->items[i].list_node);
+    pthread_mutex_unlock(&ctx->list_lock);
+
+    pthread_barrier_wait(&ctx->start);
+
+    for (size_t i = 0; i < ctx->ops; ++i) {
+        pthread_mutex_lock(&ctx->list_lock);
+        list_node_t *node = list_remove_head(&ctx->list);
+        pthread_mutex_unlock(&ctx->list_lock);
+
+        if (node) {
+            pthread_mutex_lock(&ctx->list_lock);
+            list_add(&ctx->list, node);
+            pthread_mutex_unlock(&ctx->list_lock);
+        }
+    }
+
+    return NULL;
+}
+
+static void *mpsc_producer(void *arg) {
+    worker_t *w = arg;
+    bench_ctx_t *ctx = w->ctx;
+    item_t *items = w->items;
+
+    pthread_barrier_wait(&ctx->start);
+
+    /* nodes are not recycled, every push uses its own item */
+    for (size_t i = 0; i < ctx->ops; ++i)
+        mpsc_queue_push(&ctx->queue, &items[i].queue_node);
+
+    return NULL;
+}
+
+static void *mpsc_consumer(void *arg) {
+    worker_t *w = arg;
+    bench_ctx_t *ctx = w->ctx;
+    size_t expected = ctx->ops * (ctx->nthreads - 1);
+
+    pthread_barrier_wait(&ctx->start);
+
+    while (ctx->consumed < expected) {
+        if (mpsc_queue_pop(&ctx->queue))
+            ctx->consumed++;
+    }
+
+    return NULL;
+}
+
+/* The owner pushes a batch and pops it back, thieves steal from the top. */
+static void *deque_owner(void *arg) {
+    worker_t *w = arg;
+    bench_ctx_t *ctx = w->ctx;
+    size_t popped = 0;
+
+    pthread_barrier_wait(&ctx->start);
+
+    for (size_t i = 0; i < ctx->ops; i += NODES_PER_THREAD) {
+        for (int j = 0; j < NODES_PER_THREAD; ++j)
+            ws_deque_push(&ctx->deque, &w->items[j]);
+
+        while (ws_deque_pop(&ctx->deque))
+            popped++;
+    }
+
+    atomic_store(&ctx->owner_done, 1);
+    return (void *)popped;
+}
+
+static void *deque_thief(void *arg) {
+    worker_t *w = arg;
+    bench_ctx_t *ctx = w->ctx;
+    size_t stolen = 0;
+
+    pthread_barrier_wait(&ctx->start);
+
+    while (!atomic_load_relaxed(&ctx->owner_done)) {
+        if (ws_deque_steal(&ctx->deque))
+            stolen++;
+    }
+
+    atomic_fetch_add(&ctx->stolen, stolen);
+    return NULL;
+}
+
+/* ------------------------------------------------------------------------ */
+
+typedef enum bench_kind {
+    BENCH_TREIBER,
+    BENCH_LOCKED_LIST,
+    BENCH_MPSC,
+    BENCH_DEQUE,
+} bench_kind_t;
+
+/** @returns Million operations per second over all threads. */
+static double run(bench_kind_t kind, uint32_t nthreads, size_t ops, double *steal_pct) {
+    bench_ctx_t ctx = { .ops = ops, .nthreads = nthreads };
+    worker_t *workers = calloc(nthreads, sizeof(worker_t));
+
+    lf_stack_init(&ctx.stack);
+    mpsc_queue_init(&ctx.queue);
+    pthread_mutex_init(&ctx.list_lock, NULL);
+    list_initialize(&ctx.list);
+    ws_deque_init(&ctx.deque);
+
+    /* the main thread joins the barrier to start the clock */
+    pthread_barrier_init(&ctx.start, NULL, nthreads + 1);
+
+    size_t items_per_worker = kind == BENCH_MPSC ? ops : NODES_PER_THREAD;
+
+    for (uint32_t i = 0; i < nthreads; ++i) {
+        void *(*fn)(void *);
+
+        workers[i].ctx = &ctx;
+        workers[i].id = i;
+        workers[i].items = calloc(items_per_worker, sizeof(item_t));
+
+        switch (kind) {
+        case BENCH_TREIBER:     fn = treiber_worker; break;
+        case BENCH_LOCKED_LIST: fn = locked_list_worker; break;
+        case BENCH_DEQUE:       fn = i == 0 ? deque_owner : deque_thief; break;
+        case BENCH_MPSC:
+        default:                fn = i == 0 ? mpsc_consumer : mpsc_producer; break;
+        }
+
+        pthread_create(&workers[i].thread, NULL, fn, &workers[i]);
+    }
+
+    pthread_barrier_wait(&ctx.start);
+    double start = now_sec();
+
+    size_t popped = 0;
+    for (uint32_t i = 0; i < nthreads; ++i) {
+        void *ret;
+        pthread_join(workers[i].thread, &ret);
+        if (i == 0 && kind == BENCH_DEQUE)
+            popped = (size_t)ret;
+    }
+
+    double elapsed = now_sec() - start;
+
+    size_t total_ops;
+    if (kind == BENCH_DEQUE) {
+        size_t pushed = ROUNDUP(ops, NODES_PER_THREAD);
+
+        /* every pushed entry is either popped or stolen exactly once */
+        if (popped + ctx.stolen != pushed) {
+            fprintf(stderr, "deque lost entries: pushed %zu popped %zu stolen %zu\n",
+                    pushed, popped, ctx.stolen);
+            exit(1);
+        }
+
+        if (steal_pct)
+            *steal_pct = 100.0 * ctx.stolen / pushed;
+        total_ops = 2 * pushed;
+    } else if (kind == BENCH_MPSC) {
+        /* one push and one pop per item */
+        total_ops = 2 * ops * (nthreads - 1);
+    } else {
+        total_ops = 2 * ops * nthreads;
+    }
+
+    for (uint32_t i = 0; i < nthreads; ++i)
+        free(workers[i].items);
+    free(workers);
+    pthread_barrier_destroy(&ctx.start);
+    pthread_mutex_destroy(&ctx.list_lock);
+
+    return total_ops / elapsed / 1e6;
+}
+
+int main(int argc, char **argv) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t max_threads = argc > 1 ? (uint32_t)atoi(argv[1]) : (uint32_t)(ncpu > 1 ? ncpu : 2);
+    size_t ops = argc > 2 ? (size_t)atol(argv[2]) : 1000000;
+
+    if (max_threads < 2)
+        max_threads = 2;
+
+    printf("lock-free containers, %zu ops per thread, Mops/s\n", ops);
+    printf("%8s %14s %14s %14s %14s %8s\n", "threads", "treiber", "mutex+list", "mpsc",
+           "ws deque", "stolen%");
+
+    for (uint32_t n = 1; n <= max_threads; n *= 2) {
+        double treiber = run(BENCH_TREIBER, n, ops, NULL);
+        double locked = run(BENCH_LOCKED_LIST, n, ops, NULL);
+        double steal_pct = 0;
+        double deque = run(BENCH_DEQUE, n, ops, &steal_pct);
+
+        /* mpsc needs a consumer and at least one producer */
+        if (n >= 2) {
+            double mpsc = run(BENCH_MPSC, n, ops, NULL);
+            printf("%8u %14.2f %14.2f %14.2f %14.2f %8.2f\n", n, treiber, locked, mpsc,
+                   deque, steal_pct);
+        } else {
+            printf("%8u %14.2f %14.2f %14s %14.2f %8.2f\n", n, treiber, locked, "-",
+                   deque, steal_pct);
+        }
+    }
+
+    return 0;
+}
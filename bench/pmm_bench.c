@@ -0,0 +1,554 @@
+/*
+ * The physical memory manager and the x86 page table code, built for the
+ * host against bench/host/, in ns per operation: single page and batch
+ * alloc and free, contiguous runs with more and more of memory pinned at
+ * random, single pages of a tag held to a tight budget, single pages
+ * until memory runs out with a cache to shrink, mapping and unmapping
+ * ranges of pages, and compacting memory full of movable pages.
+ *
+ * Physical memory is an mmap() buffer and page tables come out of it the
+ * way they do on hardware. The results are checked on the way, every
+ * mapping is looked up again and the page tables must all be freed after
+ * the unmaps, the budget must stop the tag at exactly its pages, every
+ * page of the cache must be reclaimed before an allocation fails,
+ * compaction must open up runs and keep every moved page mapped with its
+ * contents, and every tag must be back to 0 at the end. The run fails on
+ * any mismatch.
+ *
+ * usage: pmm_bench [phys_mib] [iterations]
+ */
+#define _GNU_SOURCE
+
+#include "../kernel/arch/x86_64/mmu.h"
+#include "../kernel/list.h"
+#include "../kernel/vm/pmm.h"
+#include "../kernel/vm/reclaim.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BATCH_PAGES         64
+#define CONTIG_PAGES        16
+#define CONTIG_ALIGN_LOG2   16      /* 64 KiB */
+#define MAP_BASE            0x0000100000000000UL
+#define MOVABLE_BASE        0x0000200000000000UL
+#define MAX_ERRORS          10
+
+static int errors;
+
+#define FAIL(...)                                   \
+    do {                                            \
+        if (errors++ < MAX_ERRORS)                  \
+            printf("FAIL: " __VA_ARGS__);           \
+    } while (0)
+
+static pmm_arena_t arena = {
+    .flags = PMM_ARENA_FLAG_KMAP,
+    .priority = 1,
+};
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static void report(const char *what, double secs, size_t ops) {
+    printf("  %-34s %10.1f ns/op\n", what, secs * 1e9 / ops);
+}
+
+/* ------------------------------ Allocation ------------------------------ */
+
+static void bench_single(size_t iters) {
+    size_t free_before = arena.free_count;
+    double t0 = now_sec();
+
+    for (size_t i = 0; i < iters; ++i) {
+        vm_page_t *page = pmm_alloc_page(ALLOC_TAG_BENCH);
+        if (!page) {
+            FAIL("pmm_alloc_page() out of pages\n");
+            return;
+        }
+        pmm_free_page(page);
+    }
+
+    report("alloc_page + free_page", now_sec() - t0, iters);
+
+    if (arena.free_count != free_before)
+        FAIL("free count %zu after single pages, want %zu\n", arena.free_count, free_before);
+}
+
+static void bench_batch(size_t iters) {
+    size_t rounds = iters / BATCH_PAGES + 1;
+    double alloc = 0, free = 0;
+
+    for (size_t i = 0; i < rounds; ++i) {
+        LIST_NODE(list);
+
+        double t0 = now_sec();
+        int got = pmm_alloc_pages(BATCH_PAGES, &list, ALLOC_TAG_BENCH);
+        double t1 = now_sec();
+        size_t freed = pmm_free(&list);
+        double t2 = now_sec();
+
+        alloc += t1 - t0;
+        free += t2 - t1;
+
+        if (got != BATCH_PAGES || freed != BATCH_PAGES)
+            FAIL("batch got %d and freed %zu pages, want %d\n", got, freed, BATCH_PAGES);
+    }
+
+    char what[64];
+    snprintf(what, sizeof(what), "alloc_pages(%d), per page", BATCH_PAGES);
+    report(what, alloc, rounds * BATCH_PAGES);
+    snprintf(what, sizeof(what), "free(%d pages), per page", BATCH_PAGES);
+    report(what, free, rounds * BATCH_PAGES);
+}
+
+/* Hold a random pinned_pct percent of the pages, so runs get rarer. */
+static size_t pin_pages(unsigned pinned_pct, list_node_t *pinned) {
+    size_t pages = arena.size / PAGE_SIZE, count = 0;
+
+    for (size_t i = 0; i < pages; ++i) {
+        if (rng_next() % 100 < pinned_pct)
+            count += pmm_alloc_range(arena.base + i * PAGE_SIZE, 1, pinned, ALLOC_TAG_BENCH);
+    }
+
+    return count;
+}
+
+static void bench_contiguous(size_t iters) {
+    static const unsigned levels[] = { 0, 5, 25, 50 };
+    size_t free_before = arena.free_count;
+
+    for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); ++l) {
+        LIST_NODE(pinned);
+        pin_pages(levels[l], &pinned);
+
+        /* a failed search walks the whole arena, keep those runs short */
+        size_t n = levels[l] >= 25 ? iters / 64 + 1 : iters;
+        size_t found = 0;
+        double t0 = now_sec();
+
+        for (size_t i = 0; i < n; ++i) {
+            LIST_NODE(run);
+            paddr_t pa;
+
+            if (pmm_alloc_contiguous(CONTIG_PAGES, CONTIG_ALIGN_LOG2, NULL, &pa, &run,
+                                     ALLOC_TAG_BENCH) != NO_ERROR)
+                continue;
+
+            if (pa & ((1UL << CONTIG_ALIGN_LOG2) - 1))
+                FAIL("contiguous run at %#lx is not aligned\n", (unsigned long)pa);
+
+            found++;
+            pmm_free(&run);
+        }
+
+        char what[64];
+        snprintf(what, sizeof(what), "contiguous(%d), %2u%% pinned", CONTIG_PAGES, levels[l]);
+        report(what, now_sec() - t0, n);
+        printf("  %-34s %10.1f %%\n", "  runs found", 100.0 * found / n);
+
+        pmm_free(&pinned);
+    }
+
+    if (arena.free_count != free_before)
+        FAIL("free count %zu after contiguous, want %zu\n", arena.free_count, free_before);
+}
+
+/*
+ * A budget below the slack of the per cpu counts, every charge near it
+ * sums the deltas of all cpus.
+ */
+static void bench_budget(size_t iters) {
+    const size_t budget = 64;
+    vm_page_t *pages[64], *page;
+    size_t rounds = iters / budget + 1, ops = 0;
+    double secs = 0;
+
+    alloc_tag_set_budget(ALLOC_TAG_DMA, budget);
+
+    for (size_t r = 0; r < rounds; ++r) {
+        size_t got = 0;
+        double t0 = now_sec();
+
+        while (got < budget && (pages[got] = pmm_alloc_page(ALLOC_TAG_DMA)))
+            got++;
+        page = pmm_alloc_page(ALLOC_TAG_DMA);
+
+        secs += now_sec() - t0;
+        ops += got + 1;
+
+        if (got != budget || page) {
+            FAIL("budget of %zu pages let %zu through\n", budget, got + !!page);
+            if (page)
+                pmm_free_page(page);
+        }
+
+        if (r == 0 && pmm_alloc_contiguous(2, PAGE_SIZE_SHIFT, NULL, NULL, NULL,
+                                           ALLOC_TAG_DMA) != ERR_OVER_BUDGET)
+            FAIL("contiguous run over the budget\n");
+
+        for (size_t i = 0; i < got; ++i)
+            pmm_free_page(pages[i]);
+    }
+
+    alloc_tag_set_budget(ALLOC_TAG_DMA, 0);
+    report("alloc_page with a budget", secs, ops);
+}
+
+/* ------------------------------ Reclaim ------------------------------ */
+
+/* A cache that keeps pages it does not need and gives them up when asked. */
+static LIST_NODE(cache);
+static size_t cache_pages;
+
+static size_t cache_count(shrinker_t *s) {
+    return cache_pages;
+}
+
+static size_t cache_scan(shrinker_t *s, size_t nr) {
+    size_t freed = 0;
+
+    while (freed < nr && cache_pages) {
+        vm_page_t *page = list_remove_head_type(&cache, vm_page_t, node);
+
+        cache_pages--;
+        freed += pmm_free_page(page);
+    }
+
+    return freed;
+}
+
+static shrinker_t cache_shrinker = {
+    .name = "bench_cache",
+    .count = cache_count,
+    .scan = cache_scan,
+};
+
+/* Half of memory in the cache, then single pages until there are none. */
+static void bench_reclaim(void) {
+    size_t free_before = arena.free_count, got = 0;
+    reclaim_stats_t rs;
+    vm_page_t *page;
+    LIST_NODE(held);
+
+    while (cache_pages < free_before / 2 && (page = pmm_alloc_page(ALLOC_TAG_SLAB))) {
+        list_add_tail(&cache, &page->node);
+        cache_pages++;
+    }
+
+    shrinker_register(&cache_shrinker);
+
+    /* the slowest allocation shows whether it waited for reclaim */
+    double t0 = now_sec(), slowest = 0;
+    for (;;) {
+        double t = now_sec();
+
+        if (!(page = pmm_alloc_page(ALLOC_TAG_BENCH)))
+            break;
+
+        t = now_sec() - t;
+        if (t > slowest)
+            slowest = t;
+
+        list_add_tail(&held, &page->node);
+        got++;
+    }
+    double secs = now_sec() - t0;
+
+    host_shim_flush_work();
+    shrinker_unregister(&cache_shrinker);
+    reclaim_get_stats(&rs);
+
+    if (got != free_before || cache_pages)
+        FAIL("%zu pages before running out with %zu left in the cache, want %zu\n",
+             got, cache_pages, free_before);
+    if (!rs.async_runs)
+        FAIL("no reclaim in the background\n");
+
+    uint64_t reclaimed = rs.async_pages + rs.direct_pages;
+
+    report("alloc_page until out, shrinking", secs, got + 1);
+    printf("  %-34s %10.1f ns\n", "  slowest", slowest * 1e9);
+    printf("  %-34s %10.1f %%\n", "  reclaimed in the background",
+           reclaimed ? 100.0 * rs.async_pages / reclaimed : 0.0);
+    printf("  %-34s %10llu\n", "  in place, cycles per run",
+           (unsigned long long)(rs.direct_runs ? rs.direct_cycles / rs.direct_runs : 0));
+
+    pmm_free(&held);
+
+    if (arena.free_count != free_before)
+        FAIL("free count %zu after reclaim, want %zu\n", arena.free_count, free_before);
+}
+
+/* ------------------------------ Mapping ------------------------------ */
+
+static void check_range(addr_t pml4, vaddr_t vaddr, paddr_t paddr, size_t pages) {
+    for (size_t i = 0; i < pages; i += 1 + pages / 16) {
+        mmu_status_t ret = mmu_check_mapping(vaddr + i * PAGE_SIZE, paddr + i * PAGE_SIZE, pml4);
+        if (ret != MMU_NO_ERROR)
+            FAIL("page %zu of %#lx not mapped, %d\n", i, (unsigned long)vaddr, ret);
+    }
+}
+
+static void bench_map(size_t iters) {
+    static const size_t sizes[] = { 1, 16, 512, 4096 };
+    addr_t pml4 = (addr_t)pmm_alloc_kpage(ALLOC_TAG_PAGE_TABLE);
+
+    if (!pml4) {
+        FAIL("no page for the pml4\n");
+        return;
+    }
+    memset((void *)pml4, 0, PAGE_SIZE);
+
+    size_t free_before = arena.free_count;
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        size_t pages = sizes[s];
+        size_t rounds = iters / pages + 1;
+        double map = 0, unmap = 0;
+        uint64_t flushes = host_tlb_stats.flushes;
+
+        for (size_t r = 0; r < rounds; ++r) {
+            /* move around so the upper tables come and go too */
+            vaddr_t vaddr = MAP_BASE + (rng_next() % 1024) * (2UL << 20) * 8;
+            paddr_t paddr = (rng_next() % (arena.size / PAGE_SIZE - pages)) * PAGE_SIZE;
+
+            double t0 = now_sec();
+            mmu_status_t ret = mmu_map_range(vaddr, paddr, pages, pml4,
+                                             X86_PAGE_BIT_RW | X86_PAGE_BIT_U);
+            double t1 = now_sec();
+
+            if (ret != MMU_NO_ERROR)
+                FAIL("map of %zu pages at %#lx, %d\n", pages, (unsigned long)vaddr, ret);
+            else if (r < 8)
+                check_range(pml4, vaddr, paddr, pages);
+
+            double t2 = now_sec();
+            ret = mmu_unmap_range(vaddr, pages, pml4);
+            double t3 = now_sec();
+
+            if (ret != MMU_NO_ERROR)
+                FAIL("unmap of %zu pages at %#lx, %d\n", pages, (unsigned long)vaddr, ret);
+
+            map += t1 - t0;
+            unmap += t3 - t2;
+        }
+
+        char what[64];
+        snprintf(what, sizeof(what), "map_range(%zu), per page", pages);
+        report(what, map, rounds * pages);
+        snprintf(what, sizeof(what), "unmap_range(%zu), per page", pages);
+        report(what, unmap, rounds * pages);
+        printf("  %-34s %10.2f\n", "  shootdowns per map + unmap",
+               (double)(host_tlb_stats.flushes - flushes) / rounds);
+    }
+
+    /* every table below the pml4 went back to the pmm */
+    if (arena.free_count != free_before)
+        FAIL("free count %zu after unmapping, want %zu\n", arena.free_count, free_before);
+
+    pmm_free_kpages((void *)pml4, 1);
+}
+
+/* ------------------------------ Compaction ------------------------------ */
+
+typedef struct movable_set {
+    addr_t          pml4;
+    vaddr_t         *live;
+    size_t          count;
+    list_node_t     pinned;
+} movable_set_t;
+
+static void release_movable(addr_t pml4, vaddr_t vaddr) {
+    vm_page_t *page = pmm_clear_movable(pml4, vaddr);
+
+    if (!page) {
+        FAIL("no movable page at %#lx\n", (unsigned long)vaddr);
+        return;
+    }
+
+    mmu_unmap_range(vaddr, 1, pml4);
+    pmm_free_page(page);
+}
+
+/*
+ * Every free page made movable, mapped and holding its own address, the
+ * leftovers the page tables did not take pinned, then the movable pages
+ * at even frames freed again, so no two free pages are next to each other.
+ */
+static void fill_fragmented(movable_set_t *set) {
+    LIST_NODE(pages);
+    size_t n = 0;
+
+    set->count = 0;
+    list_initialize(&set->pinned);
+
+    /* room for a page table per 512 pages, and the tables above them */
+    pmm_alloc_pages(arena.free_count - arena.free_count / 512 - 8, &pages, ALLOC_TAG_USER);
+
+    while (!list_is_empty(&pages)) {
+        vm_page_t *page = list_remove_head_type(&pages, vm_page_t, node);
+        paddr_t pa = page_to_paddr(page);
+        vaddr_t vaddr = MOVABLE_BASE + n * PAGE_SIZE;
+
+        *(vaddr_t *)paddr_to_kvaddr(pa) = vaddr;
+
+        if (mmu_map_range(vaddr, pa, 1, set->pml4, X86_PAGE_BIT_RW) != MMU_NO_ERROR ||
+            pmm_set_movable(page, set->pml4, vaddr) != NO_ERROR) {
+            FAIL("cannot make the page at %#lx movable\n", (unsigned long)pa);
+            list_add_tail(&set->pinned, &page->node);
+            continue;
+        }
+
+        set->live[n++] = vaddr;
+    }
+
+    vm_page_t *page;
+    while ((page = pmm_alloc_page(ALLOC_TAG_BENCH)))
+        list_add_tail(&set->pinned, &page->node);
+
+    for (size_t i = 0; i < n; ++i) {
+        pt_entry_t pa;
+        uint64_t flags;
+        uint32_t level;
+
+        if (mmu_get_mapping(set->live[i], set->pml4, &pa, &flags, &level) != MMU_NO_ERROR)
+            continue;
+
+        if ((pa / PAGE_SIZE) & 1)
+            set->live[set->count++] = set->live[i];
+        else
+            release_movable(set->pml4, set->live[i]);
+    }
+}
+
+static void empty_set(movable_set_t *set) {
+    for (size_t i = 0; i < set->count; ++i) {
+        pt_entry_t pa;
+        uint64_t flags;
+        uint32_t level;
+
+        if (mmu_get_mapping(set->live[i], set->pml4, &pa, &flags, &level) != MMU_NO_ERROR ||
+            *(vaddr_t *)paddr_to_kvaddr(pa) != set->live[i])
+            FAIL("movable page at %#lx lost\n", (unsigned long)set->live[i]);
+
+        release_movable(set->pml4, set->live[i]);
+    }
+
+    pmm_free(&set->pinned);
+}
+
+static void bench_compact(void) {
+    movable_set_t set = { .live = malloc(arena.free_count * sizeof(vaddr_t)) };
+    size_t free_before = arena.free_count;
+    pmm_compact_stats_t cs;
+    LIST_NODE(run);
+
+    set.pml4 = (addr_t)pmm_alloc_kpage(ALLOC_TAG_PAGE_TABLE);
+    if (!set.live || !set.pml4) {
+        FAIL("no memory for the compaction run\n");
+        return;
+    }
+    memset((void *)set.pml4, 0, PAGE_SIZE);
+
+    /* small requests fail until enough of them queue compaction */
+    fill_fragmented(&set);
+
+    uint32_t failed = 0;
+    while (failed <= PMM_COMPACT_FAILURES &&
+           pmm_alloc_contiguous(2, PAGE_SIZE_SHIFT, NULL, NULL, &run, ALLOC_TAG_BENCH) != NO_ERROR) {
+        host_shim_flush_work();
+        failed++;
+    }
+
+    pmm_get_compact_stats(&cs);
+    if (failed != PMM_COMPACT_FAILURES || cs.background_runs != 1 || !cs.moved)
+        FAIL("%u small requests failed, %llu compactions in the background, want %d and 1\n",
+             failed, (unsigned long long)cs.background_runs, PMM_COMPACT_FAILURES);
+
+    pmm_free(&run);
+    empty_set(&set);
+
+    /* a large request compacts before it fails */
+    fill_fragmented(&set);
+
+    uint64_t moved = cs.moved;
+    double t0 = now_sec();
+    pmm_status_t ret = pmm_alloc_contiguous(64, PAGE_SIZE_SHIFT, NULL, NULL, &run, ALLOC_TAG_BENCH);
+    double secs = now_sec() - t0;
+
+    pmm_get_compact_stats(&cs);
+    if (ret != NO_ERROR || cs.rescued != 1)
+        FAIL("64 pages after compacting, %d\n", ret);
+
+    report("compaction, per page moved", secs, cs.moved - moved + 1);
+    printf("  %-34s %10llu\n", "  pages moved", (unsigned long long)(cs.moved - moved));
+
+    pmm_free(&run);
+    empty_set(&set);
+
+    pmm_free_kpages((void *)set.pml4, 1);
+    free(set.live);
+
+    if (arena.free_count != free_before)
+        FAIL("free count %zu after compaction, want %zu\n", arena.free_count, free_before);
+}
+
+int main(int argc, char **argv) {
+    size_t phys_mib = argc > 1 ? strtoul(argv[1], NULL, 0) : 256;
+    size_t iters = argc > 2 ? strtoul(argv[2], NULL, 0) : 1000000;
+
+    if (phys_mib < 32 || iters == 0) {
+        fprintf(stderr, "usage: %s [phys_mib >= 32] [iterations]\n", argv[0]);
+        return 2;
+    }
+
+    if (host_shim_init(phys_mib << 20) != 0) {
+        fprintf(stderr, "cannot map %zu MiB of physical memory\n", phys_mib);
+        return 2;
+    }
+
+    arena.base = 0;
+    arena.size = phys_mib << 20;
+    if (pmm_add_arena(&arena) != NO_ERROR) {
+        fprintf(stderr, "pmm_add_arena failed\n");
+        return 2;
+    }
+
+    printf("pmm and mmu, %zu MiB, %zu iterations\n", phys_mib, iters);
+
+    bench_single(iters);
+    bench_batch(iters);
+    bench_contiguous(iters);
+    bench_budget(iters);
+    bench_reclaim();
+    bench_map(iters);
+    bench_compact();
+
+    for (alloc_tag_t tag = 0; tag < ALLOC_TAG_COUNT; ++tag) {
+        if (alloc_tag_pages(tag))
+            FAIL("%zu pages left on tag %s\n", alloc_tag_pages(tag), alloc_tag_name(tag));
+    }
+
+    if (errors) {
+        printf("%d errors\n", errors);
+        return 1;
+    }
+
+    return 0;
+}
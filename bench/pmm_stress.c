@@ -0,0 +1,442 @@
+/*
+ * Scalability of the physical memory manager, built for the host against
+ * bench/host/ like pmm_bench. Each thread allocates with a mix of
+ * pmm_alloc_page(), pmm_alloc_pages() and pmm_alloc_contiguous(), keeps a
+ * number of allocations live and frees the one it replaces. Runs go from
+ * 1 to max_threads threads and report throughput, alloc and free latency
+ * percentiles and how fragmented the free memory is when the threads stop.
+ *
+ * The mix is a comma separated list of kind[pages]:weight, the kinds are
+ * p for pmm_alloc_page(), b for a pmm_alloc_pages() batch and c for a
+ * contiguous run, e.g. the default p:80,b8:15,c16:5. Allocations are
+ * replaced oldest first, or at random with -r for spread out lifetimes.
+ *
+ * Build with -DBENCH_TSAN=ON to run it under ThreadSanitizer.
+ *
+ * usage: pmm_stress [-t max_threads] [-n ops_per_thread] [-m mix]
+ *                   [-l live_per_thread] [-r] [-p phys_mib] [-c csv_file]
+ */
+#define _GNU_SOURCE
+
+#include "../kernel/list.h"
+#include "../kernel/vm/pmm.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_MIX             8
+#define FRAG_ORDER          4       /* Runs of 16 pages, what the fragmentation index is for. */
+
+typedef enum alloc_kind {
+    ALLOC_PAGE,
+    ALLOC_BATCH,
+    ALLOC_CONTIGUOUS,
+} alloc_kind_t;
+
+typedef struct mix_entry {
+    alloc_kind_t    kind;
+    uint32_t        pages;
+    uint32_t        weight;
+} mix_entry_t;
+
+/* One live allocation, the pages are on the list except for single ones. */
+typedef struct slot {
+    vm_page_t       *page;
+    list_node_t     list;
+    uint32_t        pages;
+} slot_t;
+
+typedef struct config {
+    uint32_t        max_threads;
+    size_t          ops;
+    size_t          live;
+    bool            random_replace;
+    size_t          phys_mib;
+    const char      *csv;
+    const char      *mix_str;
+    mix_entry_t     mix[MAX_MIX];
+    uint32_t        mix_count;
+    uint32_t        mix_total;
+} config_t;
+
+typedef struct worker {
+    pthread_t       thread;
+    const config_t  *cfg;
+    pthread_barrier_t *start;
+    uint32_t        id;
+    uint64_t        rng;
+
+    slot_t          *slots;
+    uint32_t        *alloc_ns;
+    uint32_t        *free_ns;
+    size_t          allocs;
+    size_t          frees;
+    size_t          failed;
+} worker_t;
+
+static pmm_arena_t arena = {
+    .flags = PMM_ARENA_FLAG_KMAP,
+    .priority = 1,
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t rng_next(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static int parse_mix(config_t *cfg) {
+    char *str = strdup(cfg->mix_str), *save = NULL;
+
+    cfg->mix_count = cfg->mix_total = 0;
+
+    for (char *tok = strtok_r(str, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        mix_entry_t *e = &cfg->mix[cfg->mix_count];
+        char *end;
+
+        if (cfg->mix_count == MAX_MIX)
+            goto bad;
+
+        switch (tok[0]) {
+        case 'p': e->kind = ALLOC_PAGE; break;
+        case 'b': e->kind = ALLOC_BATCH; break;
+        case 'c': e->kind = ALLOC_CONTIGUOUS; break;
+        default: goto bad;
+        }
+
+        e->pages = tok[1] == ':' ? 1 : strtoul(tok + 1, &end, 10);
+        if (tok[1] != ':' && *end != ':')
+            goto bad;
+
+        e->weight = strtoul(strchr(tok, ':') + 1, &end, 10);
+        if (*end || e->pages == 0 || (e->kind == ALLOC_PAGE && e->pages != 1))
+            goto bad;
+
+        cfg->mix_total += e->weight;
+        cfg->mix_count++;
+    }
+
+    free(str);
+    return cfg->mix_count && cfg->mix_total ? 0 : -1;
+
+bad:
+    free(str);
+    return -1;
+}
+
+/* ------------------------------ Workers ------------------------------ */
+
+static size_t slot_free(slot_t *slot) {
+    size_t freed;
+
+    if (slot->page)
+        freed = pmm_free_page(slot->page);
+    else
+        freed = pmm_free(&slot->list);
+
+    slot->page = NULL;
+    slot->pages = 0;
+    return freed;
+}
+
+static bool slot_alloc(slot_t *slot, const mix_entry_t *e) {
+    switch (e->kind) {
+    case ALLOC_PAGE:
+        slot->page = pmm_alloc_page(ALLOC_TAG_BENCH);
+        slot->pages = slot->page ? 1 : 0;
+        break;
+
+    case ALLOC_BATCH:
+        slot->pages = pmm_alloc_pages(e->pages, &slot->list, ALLOC_TAG_BENCH);
+        /* a short batch is kept, it is freed like any other */
+        break;
+
+    case ALLOC_CONTIGUOUS:
+        if (pmm_alloc_contiguous(e->pages, PAGE_SIZE_SHIFT, NULL, NULL, &slot->list,
+                                 ALLOC_TAG_BENCH) == NO_ERROR)
+            slot->pages = e->pages;
+        break;
+    }
+
+    return slot->pages == e->pages;
+}
+
+static const mix_entry_t *pick_mix(worker_t *w) {
+    uint32_t r = rng_next(&w->rng) % w->cfg->mix_total;
+
+    for (uint32_t i = 0; i < w->cfg->mix_count; ++i) {
+        if (r < w->cfg->mix[i].weight)
+            return &w->cfg->mix[i];
+        r -= w->cfg->mix[i].weight;
+    }
+
+    return &w->cfg->mix[0];
+}
+
+static void *worker_main(void *arg) {
+    worker_t *w = arg;
+    const config_t *cfg = w->cfg;
+
+    host_shim_thread_init(w->id);
+    pthread_barrier_wait(w->start);
+
+    for (size_t i = 0; i < cfg->ops; ++i) {
+        size_t idx = cfg->random_replace ? rng_next(&w->rng) % cfg->live : i % cfg->live;
+        slot_t *slot = &w->slots[idx];
+
+        if (slot->pages) {
+            uint64_t t0 = now_ns();
+            slot_free(slot);
+            w->free_ns[w->frees++] = now_ns() - t0;
+        }
+
+        const mix_entry_t *e = pick_mix(w);
+        uint64_t t0 = now_ns();
+        bool ok = slot_alloc(slot, e);
+        w->alloc_ns[w->allocs++] = now_ns() - t0;
+
+        if (!ok)
+            w->failed++;
+    }
+
+    return NULL;
+}
+
+/* ------------------------------ Results ------------------------------ */
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* The samples are sorted. */
+static uint32_t percentile(uint32_t *ns, size_t n, double p) {
+    if (!n)
+        return 0;
+
+    return ns[(size_t)(p * (n - 1))];
+}
+
+static uint32_t *merge_samples(worker_t *workers, uint32_t nthreads, bool alloc, size_t *out_n) {
+    size_t n = 0;
+
+    for (uint32_t i = 0; i < nthreads; ++i)
+        n += alloc ? workers[i].allocs : workers[i].frees;
+
+    uint32_t *all = malloc((n ? n : 1) * sizeof(uint32_t)), *p = all;
+
+    for (uint32_t i = 0; i < nthreads; ++i) {
+        size_t count = alloc ? workers[i].allocs : workers[i].frees;
+
+        memcpy(p, alloc ? workers[i].alloc_ns : workers[i].free_ns, count * sizeof(uint32_t));
+        p += count;
+    }
+
+    qsort(all, n, sizeof(uint32_t), cmp_u32);
+    *out_n = n;
+    return all;
+}
+
+static int run(const config_t *cfg, uint32_t nthreads, FILE *csv) {
+    worker_t *workers = calloc(nthreads, sizeof(worker_t));
+    pthread_barrier_t start;
+
+    pthread_barrier_init(&start, NULL, nthreads + 1);
+
+    for (uint32_t i = 0; i < nthreads; ++i) {
+        worker_t *w = &workers[i];
+
+        w->cfg = cfg;
+        w->start = &start;
+        w->id = i + 1;
+        w->rng = 0x9e3779b97f4a7c15ULL * (i + 1);
+        w->slots = calloc(cfg->live, sizeof(slot_t));
+        w->alloc_ns = malloc(cfg->ops * sizeof(uint32_t));
+        w->free_ns = malloc(cfg->ops * sizeof(uint32_t));
+
+        for (size_t s = 0; s < cfg->live; ++s)
+            list_initialize(&w->slots[s].list);
+
+        pthread_create(&w->thread, NULL, worker_main, w);
+    }
+
+    pthread_barrier_wait(&start);
+    uint64_t t0 = now_ns();
+
+    for (uint32_t i = 0; i < nthreads; ++i)
+        pthread_join(workers[i].thread, NULL);
+
+    double secs = (now_ns() - t0) * 1e-9;
+
+    /* with the live allocations still held */
+    pmm_frag_info_t frag;
+    pmm_get_frag_info(&arena, &frag);
+    double unusable = pmm_frag_index(&frag, FRAG_ORDER) / 1000.0;
+
+    size_t ops = 0, failed = 0, na, nf;
+    for (uint32_t i = 0; i < nthreads; ++i) {
+        ops += workers[i].allocs + workers[i].frees;
+        failed += workers[i].failed;
+    }
+
+    uint32_t *alloc_ns = merge_samples(workers, nthreads, true, &na);
+    uint32_t *free_ns = merge_samples(workers, nthreads, false, &nf);
+
+    double mops = ops / secs * 1e-6;
+    uint32_t a50 = percentile(alloc_ns, na, 0.5), a99 = percentile(alloc_ns, na, 0.99);
+    uint32_t a999 = percentile(alloc_ns, na, 0.999);
+    uint32_t f50 = percentile(free_ns, nf, 0.5), f99 = percentile(free_ns, nf, 0.99);
+    uint32_t f999 = percentile(free_ns, nf, 0.999);
+
+    printf("%7u %9.2f %7.2f%% %7u %7u %8u %7u %7u %8u %9zu %8zu %8zu %7.3f\n",
+           nthreads, mops, na ? 100.0 * failed / na : 0.0, a50, a99, a999, f50, f99, f999,
+           frag.free_pages, frag.free_runs, frag.largest_run, unusable);
+
+    if (csv)
+        fprintf(csv, "%u,\"%s\",%zu,%d,%.4f,%zu,%u,%u,%u,%u,%u,%u,%zu,%zu,%zu,%.4f\n",
+                nthreads, cfg->mix_str, cfg->live, cfg->random_replace, mops, failed,
+                a50, a99, a999, f50, f99, f999,
+                frag.free_pages, frag.free_runs, frag.largest_run, unusable);
+
+    /* give everything back for the next run */
+    int ret = 0;
+    for (uint32_t i = 0; i < nthreads; ++i) {
+        for (size_t s = 0; s < cfg->live; ++s)
+            slot_free(&workers[i].slots[s]);
+
+        free(workers[i].slots);
+        free(workers[i].alloc_ns);
+        free(workers[i].free_ns);
+    }
+
+    if (arena.free_count != arena.size / PAGE_SIZE) {
+        printf("FAIL: %zu pages free after the run, want %zu\n", arena.free_count,
+               arena.size / PAGE_SIZE);
+        ret = 1;
+    }
+
+    if (alloc_tag_pages(ALLOC_TAG_BENCH)) {
+        printf("FAIL: %zu pages left on the bench tag\n", alloc_tag_pages(ALLOC_TAG_BENCH));
+        ret = 1;
+    }
+
+    /* every page the pmm counted out has to be counted back in */
+    uint64_t alloc_pages = 0, free_pages = 0;
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; ++cpu) {
+        pmm_cpu_stats_t s;
+
+        pmm_get_cpu_stats(cpu, &s);
+        alloc_pages += s.alloc_pages;
+        free_pages += s.free_pages;
+    }
+
+    if (alloc_pages != free_pages) {
+        printf("FAIL: pmm stats have %llu pages allocated and %llu freed\n",
+               (unsigned long long)alloc_pages, (unsigned long long)free_pages);
+        ret = 1;
+    }
+
+    free(alloc_ns);
+    free(free_ns);
+    free(workers);
+    pthread_barrier_destroy(&start);
+    return ret;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-t max_threads] [-n ops_per_thread] [-m mix] "
+            "[-l live_per_thread] [-r] [-p phys_mib] [-c csv_file]\n", name);
+}
+
+int main(int argc, char **argv) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    config_t cfg = {
+        .max_threads = cpus > 0 ? cpus : 4,
+        .ops = 200000,
+        .live = 64,
+        .phys_mib = 256,
+        .mix_str = "p:80,b8:15,c16:5",
+    };
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:n:m:l:rp:c:")) != -1) {
+        switch (opt) {
+        case 't': cfg.max_threads = strtoul(optarg, NULL, 0); break;
+        case 'n': cfg.ops = strtoul(optarg, NULL, 0); break;
+        case 'm': cfg.mix_str = optarg; break;
+        case 'l': cfg.live = strtoul(optarg, NULL, 0); break;
+        case 'r': cfg.random_replace = true; break;
+        case 'p': cfg.phys_mib = strtoul(optarg, NULL, 0); break;
+        case 'c': cfg.csv = optarg; break;
+        default: usage(argv[0]); return 2;
+        }
+    }
+
+    if (!cfg.max_threads || !cfg.ops || !cfg.live || cfg.phys_mib < 16 || parse_mix(&cfg)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    /* thread i runs as cpu i + 1, below the worker of the shim */
+    if (cfg.max_threads >= HOST_WORKER_CPU)
+        cfg.max_threads = HOST_WORKER_CPU - 1;
+
+    if (host_shim_init(cfg.phys_mib << 20) != 0) {
+        fprintf(stderr, "cannot map %zu MiB of physical memory\n", cfg.phys_mib);
+        return 2;
+    }
+
+    arena.base = 0;
+    arena.size = cfg.phys_mib << 20;
+    if (pmm_add_arena(&arena) != NO_ERROR) {
+        fprintf(stderr, "pmm_add_arena failed\n");
+        return 2;
+    }
+
+    FILE *csv = NULL;
+    if (cfg.csv) {
+        csv = fopen(cfg.csv, "w");
+        if (!csv) {
+            perror(cfg.csv);
+            return 2;
+        }
+        fprintf(csv, "threads,mix,live,random,mops,failed,alloc_p50_ns,alloc_p99_ns,"
+                "alloc_p999_ns,free_p50_ns,free_p99_ns,free_p999_ns,free_pages,free_runs,"
+                "largest_run,unusable_%d\n", 1 << FRAG_ORDER);
+    }
+
+    printf("pmm, %zu MiB, mix %s, %zu live per thread%s, %zu ops per thread\n",
+           cfg.phys_mib, cfg.mix_str, cfg.live, cfg.random_replace ? " (random)" : "", cfg.ops);
+    printf("%7s %9s %8s %7s %7s %8s %7s %7s %8s %9s %8s %8s %7s\n",
+           "threads", "Mops/s", "failed", "a_p50", "a_p99", "a_p999", "f_p50", "f_p99",
+           "f_p999", "free_pgs", "runs", "largest", "unus16");
+
+    int ret = 0;
+    /* powers of two, and max_threads last */
+    for (uint32_t n = 1; ; n *= 2) {
+        if (n > cfg.max_threads)
+            n = cfg.max_threads;
+
+        ret |= run(&cfg, n, csv);
+
+        if (n == cfg.max_threads)
+            break;
+    }
+
+    if (csv)
+        fclose(csv);
+
+    return ret;
+}
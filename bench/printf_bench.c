@@ -0,0 +1,238 @@
+/*
+ * printf_core from kernel/util/printf.c against the host libc snprintf, in
+ * ns per call for integer and floating point formats. Every format is first
+ * compared with libc on random values and mismatches are printed, a correct
+ * but slow formatter is no use either.
+ *
+ * usage: printf_bench [iterations] [check_values]
+ */
+#define _GNU_SOURCE
+
+#include "../kernel/printf.h"
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BUF_SIZE            1024
+#define MAX_MISMATCHES      10
+
+typedef struct buf_sink {
+    char    *str;
+    size_t  len;
+} buf_sink_t;
+
+static int buf_out(const char *str, size_t len, void *arg) {
+    buf_sink_t *sink = arg;
+    size_t n = len < sink->len ? len : sink->len;
+
+    memcpy(sink->str, str, n);
+    sink->str += n;
+    sink->len -= n;
+
+    return 0;
+}
+
+static int PRINTFLIKE(3, 4) k_snprintf(char *str, size_t len, const char *fmt, ...) {
+    buf_sink_t sink = { str, len - 1 };
+    va_list ap;
+
+    va_start(ap, fmt);
+    int ret = printf_core(buf_out, &sink, fmt, ap);
+    va_end(ap);
+
+    *sink.str = 0;
+    return ret;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+/* ------------------------------ Checking ------------------------------ */
+
+static const char *int_formats[] = {
+    "%d", "%i", "%u", "%x", "%X", "%o", "%#x", "%#o", "%08d", "%-8d|", "%+d", "% d",
+    "%.5d", "%.0d", "%12.6x", "%-+9i|", "%hhd", "%hu", "%c",
+};
+
+static const char *ll_formats[] = {
+    "%lld", "%llu", "%llx", "%#llo", "%020lld", "%lu", "%zu", "%jd", "%ld", "%p",
+};
+
+static const char *double_formats[] = {
+    "%f", "%.0f", "%.3f", "%.17f", "%#.0f", "%e", "%.0e", "%.10e", "%E", "%g", "%.17g",
+    "%#g", "%G", "%.1g", "%10.4f", "%-12.3e|", "%+.2f", "% g", "%08.3f", "%a", "%.3a",
+    "%A", "%.0a", "%#.0a", "%.20a",
+};
+
+#define ARRAY_SIZE(a)   (sizeof(a) / sizeof((a)[0]))
+
+static size_t mismatches;
+
+static void check(const char *fmt, const char *kbuf, int kret, const char *lbuf, int lret) {
+    if (kret == lret && !strcmp(kbuf, lbuf))
+        return;
+
+    if (++mismatches <= MAX_MISMATCHES)
+        printf("mismatch '%s': kernel '%s' (%d), libc '%s' (%d)\n", fmt, kbuf, kret, lbuf, lret);
+}
+
+static double random_double(void) {
+    uint64_t r = rng_next();
+    double d;
+
+    switch (r & 3) {
+    case 0:
+        /* any bit pattern, mostly huge or tiny, nan and inf included */
+        r = rng_next();
+        memcpy(&d, &r, sizeof(d));
+        return d;
+
+    case 1:
+        /* values seen in benchmark output */
+        return (double)(int64_t)(rng_next() % 2000000000) / 1000.0 - 1e6;
+
+    case 2:
+        /* ties and near ties of short decimals */
+        return (double)(rng_next() % 100000) / 8.0;
+
+    default:
+        return (double)(int64_t)rng_next() / (double)(1ULL << (rng_next() % 64));
+    }
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+#pragma GCC diagnostic ignored "-Wformat"
+
+static void check_all(size_t values) {
+    static char kbuf[BUF_SIZE], lbuf[BUF_SIZE];
+
+    for (size_t v = 0; v < values; ++v) {
+        uint64_t r = rng_next();
+        int i = (int)(r >> (rng_next() % 64));
+        long long ll = (long long)rng_next() >> (rng_next() % 64);
+        double d = random_double();
+
+        for (size_t f = 0; f < ARRAY_SIZE(int_formats); ++f) {
+            int kret = k_snprintf(kbuf, sizeof(kbuf), int_formats[f], i);
+            int lret = snprintf(lbuf, sizeof(lbuf), int_formats[f], i);
+            check(int_formats[f], kbuf, kret, lbuf, lret);
+        }
+
+        for (size_t f = 0; f < ARRAY_SIZE(ll_formats); ++f) {
+            /* libc prints (nil) for null pointers */
+            if (!ll && !strcmp(ll_formats[f], "%p"))
+                continue;
+
+            int kret = k_snprintf(kbuf, sizeof(kbuf), ll_formats[f], ll);
+            int lret = snprintf(lbuf, sizeof(lbuf), ll_formats[f], ll);
+            check(ll_formats[f], kbuf, kret, lbuf, lret);
+        }
+
+        for (size_t f = 0; f < ARRAY_SIZE(double_formats); ++f) {
+            int kret = k_snprintf(kbuf, sizeof(kbuf), double_formats[f], d);
+            int lret = snprintf(lbuf, sizeof(lbuf), double_formats[f], d);
+            check(double_formats[f], kbuf, kret, lbuf, lret);
+        }
+    }
+}
+
+#pragma GCC diagnostic pop
+
+/* ------------------------------- Timing ------------------------------- */
+
+/* globals so the compiler cannot fold the calls */
+static volatile int v_int = 123456789;
+static volatile unsigned long long v_ull = 18446744073709551615ULL;
+static volatile unsigned int v_hex = 0xdeadbeef;
+static volatile long long v_sec = 12, v_usec = 345678;
+static volatile double v_small = 3.14159265358979;
+static volatile double v_big = 6.02214076e23;
+static volatile double v_tiny = 1.602176634e-19;
+static const char *volatile v_str = "work stealing scheduler";
+
+#define BENCH_CASE(name, fmt, ...)                                          \
+    static int name##_kernel(char *buf) {                                   \
+        return k_snprintf(buf, BUF_SIZE, fmt, __VA_ARGS__);                 \
+    }                                                                       \
+    static int name##_libc(char *buf) {                                     \
+        return snprintf(buf, BUF_SIZE, fmt, __VA_ARGS__);                   \
+    }
+
+BENCH_CASE(dec, "%d", v_int)
+BENCH_CASE(u64, "%llu", v_ull)
+BENCH_CASE(hex, "%08x", v_hex)
+BENCH_CASE(klog, "[%5lld.%06lld %2u] ", v_sec, v_usec, 3u)
+BENCH_CASE(str, "%-24s|", v_str)
+BENCH_CASE(fix, "%f", v_small)
+BENCH_CASE(fix2, "%.2f", v_big)
+BENCH_CASE(exp, "%e", v_tiny)
+BENCH_CASE(gen, "%.17g", v_small)
+BENCH_CASE(hexf, "%a", v_small)
+
+typedef struct bench_case {
+    const char  *fmt;
+    int         (*kernel)(char *buf);
+    int         (*libc)(char *buf);
+} bench_case_t;
+
+#define CASE(name, fmt)     { fmt, name##_kernel, name##_libc }
+
+static const bench_case_t cases[] = {
+    CASE(dec, "%d"),
+    CASE(u64, "%llu"),
+    CASE(hex, "%08x"),
+    CASE(klog, "[%5lld.%06lld %2u]"),
+    CASE(str, "%-24s|"),
+    CASE(fix, "%f"),
+    CASE(fix2, "%.2f 6e23"),
+    CASE(exp, "%e"),
+    CASE(gen, "%.17g"),
+    CASE(hexf, "%a"),
+};
+
+static double time_ns(int (*fn)(char *buf), size_t iterations) {
+    static char buf[BUF_SIZE];
+    double start = now_sec();
+
+    for (size_t i = 0; i < iterations; ++i)
+        fn(buf);
+
+    return (now_sec() - start) * 1e9 / iterations;
+}
+
+int main(int argc, char **argv) {
+    size_t iterations = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+    size_t values = argc > 2 ? strtoul(argv[2], NULL, 0) : 100000;
+
+    check_all(values);
+    printf("checked %zu values against libc: %zu mismatches\n\n", values, mismatches);
+
+    printf("printf_core vs libc snprintf, %zu iterations, ns per call\n", iterations);
+    printf("%-20s %10s %10s %8s\n", "format", "kernel", "libc", "speedup");
+
+    for (size_t i = 0; i < ARRAY_SIZE(cases); ++i) {
+        double k = time_ns(cases[i].kernel, iterations);
+        double l = time_ns(cases[i].libc, iterations);
+
+        printf("%-20s %10.1f %10.1f %8.2f\n", cases[i].fmt, k, l, l / k);
+    }
+
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,429 @@
+/*
+ * rbtree.h and interval_tree.h against a sorted list.h list, in ns per
+ * operation. The trees are first checked on random inserts and erases
+ * against a sorted array: the red-black rules, the parent pointers, the
+ * in order and postorder walks and the interval tree's subtree maxima and
+ * overlap queries. The run fails on any mismatch.
+ *
+ * usage: rbtree_bench [max_nodes] [check_ops]
+ */
+#define _GNU_SOURCE
+
+#include "../kernel/interval_tree.h"
+#include "../kernel/rbtree.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CHECK_KEYS          512     /* Small key space, many duplicates. */
+#define CHECK_EVERY         64
+#define LIST_MAX_NODES      4096    /* The list is quadratic, stop there. */
+#define MAX_ERRORS          10
+
+typedef struct item {
+    rb_node_t       rb;
+    list_node_t     node;
+    uint64_t        key;
+    size_t          visit;          /* Postorder check pass that saw it. */
+} item_t;
+
+typedef struct range {
+    interval_node_t it;
+    int             in_tree;
+} range_t;
+
+static int errors;
+
+#define FAIL(...)                                   \
+    do {                                            \
+        if (errors++ < MAX_ERRORS)                  \
+            printf("FAIL: " __VA_ARGS__);           \
+    } while (0)
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static inline bool item_less(const rb_node_t *a, const rb_node_t *b) {
+    return rb_entry(a, item_t, rb)->key < rb_entry(b, item_t, rb)->key;
+}
+
+static inline int item_cmp(const void *key, const rb_node_t *node) {
+    uint64_t k = *(const uint64_t *)key, n = rb_entry(node, item_t, rb)->key;
+    return k < n ? -1 : k > n;
+}
+
+/* ------------------------------ Checks ------------------------------ */
+
+static bool node_is_red(const rb_node_t *node) {
+    return node && !(node->parent_color & RB_BLACK);
+}
+
+/* @returns Black height of the subtree, -1 once something is wrong. */
+static int check_subtree(const rb_node_t *node, const rb_node_t *parent) {
+    if (!node)
+        return 1;
+
+    if (rb_parent(node) != parent) {
+        FAIL("bad parent pointer\n");
+        return -1;
+    }
+
+    if (node_is_red(node) && (node_is_red(node->left) || node_is_red(node->right))) {
+        FAIL("red node with a red child\n");
+        return -1;
+    }
+
+    int lh = check_subtree(node->left, node);
+    int rh = check_subtree(node->right, node);
+
+    if (lh < 0 || rh < 0)
+        return -1;
+
+    if (lh != rh) {
+        FAIL("black heights %d and %d\n", lh, rh);
+        return -1;
+    }
+
+    return lh + !node_is_red(node);
+}
+
+static void check_tree(const rb_root_t *root, const uint64_t *ref, size_t n) {
+    if (node_is_red(root->node))
+        FAIL("red root\n");
+
+    check_subtree(root->node, NULL);
+
+    /* in order both ways gives the sorted keys */
+    size_t i = 0;
+    for (rb_node_t *rb = rb_first(root); rb; rb = rb_next(rb), ++i) {
+        if (i >= n || rb_entry(rb, item_t, rb)->key != ref[i]) {
+            FAIL("in order walk differs at %zu\n", i);
+            return;
+        }
+    }
+    if (i != n)
+        FAIL("in order walk has %zu nodes, want %zu\n", i, n);
+
+    for (rb_node_t *rb = rb_last(root); rb; rb = rb_prev(rb)) {
+        if (!i || rb_entry(rb, item_t, rb)->key != ref[--i]) {
+            FAIL("reverse walk differs at %zu\n", i);
+            return;
+        }
+    }
+
+    /* every node once, each after its children */
+    static size_t pass;
+    size_t count = 0;
+
+    pass++;
+    for (rb_node_t *rb = rb_first_postorder(root); rb; rb = rb_next_postorder(rb), ++count) {
+        if ((rb->left && rb_entry(rb->left, item_t, rb)->visit != pass) ||
+            (rb->right && rb_entry(rb->right, item_t, rb)->visit != pass)) {
+            FAIL("postorder visited a parent first\n");
+            return;
+        }
+        rb_entry(rb, item_t, rb)->visit = pass;
+    }
+    if (count != n)
+        FAIL("postorder walk has %zu nodes, want %zu\n", count, n);
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void check_rbtree(int ops) {
+    item_t *items = calloc(CHECK_KEYS, sizeof(*items));
+    uint64_t *ref = calloc(CHECK_KEYS, sizeof(*ref));
+    rb_root_t root = RB_ROOT_INITIAL_VALUE;
+    size_t n = 0;
+
+    for (int i = 0; i < CHECK_KEYS; ++i)
+        rb_clear_node(&items[i].rb);
+
+    for (int op = 0; op < ops; ++op) {
+        item_t *it = &items[rng_next() % CHECK_KEYS];
+
+        if (rb_is_in_tree(&it->rb)) {
+            rb_erase(&it->rb, &root);
+        } else {
+            it->key = rng_next() % (CHECK_KEYS / 4);
+            rb_add(&it->rb, &root, item_less);
+        }
+
+        if (op % CHECK_EVERY)
+            continue;
+
+        n = 0;
+        for (int i = 0; i < CHECK_KEYS; ++i) {
+            if (rb_is_in_tree(&items[i].rb))
+                ref[n++] = items[i].key;
+        }
+        qsort(ref, n, sizeof(*ref), cmp_u64);
+
+        check_tree(&root, ref, n);
+
+        /* lookups, and the first node not before each key */
+        for (uint64_t k = 0; k <= CHECK_KEYS / 4; ++k) {
+            bool present = bsearch(&k, ref, n, sizeof(*ref), cmp_u64) != NULL;
+            rb_node_t *found = rb_find(&k, &root, item_cmp);
+
+            if (!!found != present || (found && rb_entry(found, item_t, rb)->key != k))
+                FAIL("rb_find(%lu) wrong\n", (unsigned long)k);
+
+            size_t lo = 0;
+            while (lo < n && ref[lo] < k)
+                lo++;
+
+            rb_node_t *ge = rb_find_first_ge(&k, &root, item_cmp);
+            if ((lo == n) != !ge || (ge && rb_entry(ge, item_t, rb)->key != ref[lo]))
+                FAIL("rb_find_first_ge(%lu) wrong\n", (unsigned long)k);
+        }
+    }
+
+    free(items);
+    free(ref);
+}
+
+static uint64_t check_subtree_last(const rb_node_t *rb) {
+    if (!rb)
+        return 0;
+
+    const interval_node_t *node = rb_entry(rb, interval_node_t, rb);
+    uint64_t max = node->last;
+    uint64_t l = check_subtree_last(rb->left), r = check_subtree_last(rb->right);
+
+    if (rb->left && l > max)
+        max = l;
+    if (rb->right && r > max)
+        max = r;
+
+    if (node->subtree_last != max)
+        FAIL("subtree_last %lu, want %lu\n", (unsigned long)node->subtree_last,
+             (unsigned long)max);
+
+    return node->subtree_last;
+}
+
+static void check_interval_tree(int ops) {
+    range_t *ranges = calloc(CHECK_KEYS, sizeof(*ranges));
+    interval_tree_t tree = INTERVAL_TREE_INITIAL_VALUE;
+
+    for (int op = 0; op < ops; ++op) {
+        range_t *r = &ranges[rng_next() % CHECK_KEYS];
+
+        if (r->in_tree) {
+            interval_tree_remove(&tree, &r->it);
+        } else {
+            r->it.start = rng_next() % 4096;
+            r->it.last = r->it.start + rng_next() % 64;
+            interval_tree_insert(&tree, &r->it);
+        }
+        r->in_tree = !r->in_tree;
+
+        if (op % CHECK_EVERY)
+            continue;
+
+        check_subtree(tree.root.node, NULL);
+        check_subtree_last(tree.root.node);
+
+        /* a query finds exactly the overlapping ranges, in start order */
+        for (int q = 0; q < 16; ++q) {
+            uint64_t start = rng_next() % 4200, last = start + rng_next() % 128;
+            size_t want = 0, got = 0;
+            uint64_t prev = 0;
+
+            for (int i = 0; i < CHECK_KEYS; ++i) {
+                if (ranges[i].in_tree && ranges[i].it.start <= last && ranges[i].it.last >= start)
+                    want++;
+            }
+
+            interval_node_t *node;
+            interval_tree_for_each(node, &tree, start, last) {
+                if (node->start > last || node->last < start)
+                    FAIL("[%lu, %lu] does not overlap the query\n", (unsigned long)node->start,
+                         (unsigned long)node->last);
+                if (node->start < prev)
+                    FAIL("query out of order\n");
+                prev = node->start;
+                got++;
+            }
+
+            if (got != want)
+                FAIL("query [%lu, %lu] found %zu ranges, want %zu\n", (unsigned long)start,
+                     (unsigned long)last, got, want);
+        }
+    }
+
+    free(ranges);
+}
+
+/* ------------------------------ Benchmarks ------------------------------ */
+
+static void list_insert_sorted(list_node_t *head, item_t *it) {
+    list_node_t *pos = head->next;
+
+    while (pos != head && list_entry(pos, item_t, node)->key <= it->key)
+        pos = pos->next;
+
+    list_add_tail(pos, &it->node);
+}
+
+static item_t *list_find(list_node_t *head, uint64_t key) {
+    for (list_node_t *pos = head->next; pos != head; pos = pos->next) {
+        item_t *it = list_entry(pos, item_t, node);
+        if (it->key >= key)
+            return it->key == key ? it : NULL;
+    }
+
+    return NULL;
+}
+
+static void bench_size(size_t n) {
+    item_t *items = calloc(n, sizeof(*items));
+    rb_root_t root = RB_ROOT_INITIAL_VALUE;
+    volatile uint64_t sink = 0;
+
+    for (size_t i = 0; i < n; ++i)
+        items[i].key = rng_next();
+
+    double t = now_sec();
+    for (size_t i = 0; i < n; ++i)
+        rb_add(&items[i].rb, &root, item_less);
+    double insert = now_sec() - t;
+
+    t = now_sec();
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t key = items[rng_next() % n].key;
+        sink += rb_find(&key, &root, item_cmp) != NULL;
+    }
+    double lookup = now_sec() - t;
+
+    t = now_sec();
+    item_t *it;
+    rb_for_each_entry(it, &root, rb)
+        sink += it->key;
+    double walk = now_sec() - t;
+
+    t = now_sec();
+    for (size_t i = 0; i < n; ++i)
+        rb_erase(&items[i].rb, &root);
+    double erase = now_sec() - t;
+
+    printf("%-8s %9zu %10.1f %10.1f %10.1f %10.1f\n", "rbtree", n, insert * 1e9 / n,
+           lookup * 1e9 / n, walk * 1e9 / n, erase * 1e9 / n);
+
+    if (n <= LIST_MAX_NODES) {
+        list_node_t head;
+        list_initialize(&head);
+
+        t = now_sec();
+        for (size_t i = 0; i < n; ++i)
+            list_insert_sorted(&head, &items[i]);
+        insert = now_sec() - t;
+
+        t = now_sec();
+        for (size_t i = 0; i < n; ++i)
+            sink += list_find(&head, items[rng_next() % n].key) != NULL;
+        lookup = now_sec() - t;
+
+        t = now_sec();
+        list_node_t *pos;
+        for (pos = head.next; pos != &head; pos = pos->next)
+            sink += list_entry(pos, item_t, node)->key;
+        walk = now_sec() - t;
+
+        t = now_sec();
+        for (size_t i = 0; i < n; ++i)
+            list_delete(&items[i].node);
+        erase = now_sec() - t;
+
+        printf("%-8s %9zu %10.1f %10.1f %10.1f %10.1f\n", "list", n, insert * 1e9 / n,
+               lookup * 1e9 / n, walk * 1e9 / n, erase * 1e9 / n);
+    }
+
+    free(items);
+}
+
+static void bench_intervals(size_t n) {
+    range_t *ranges = calloc(n, sizeof(*ranges));
+    interval_tree_t tree = INTERVAL_TREE_INITIAL_VALUE;
+    uint64_t space = n * 64;
+    size_t queries = 100000, hits = 0;
+
+    for (size_t i = 0; i < n; ++i) {
+        ranges[i].it.start = rng_next() % space;
+        ranges[i].it.last = ranges[i].it.start + rng_next() % 256;
+        interval_tree_insert(&tree, &ranges[i].it);
+    }
+
+    double t = now_sec();
+    for (size_t q = 0; q < queries; ++q) {
+        uint64_t start = rng_next() % space;
+        interval_node_t *node;
+
+        interval_tree_for_each(node, &tree, start, start + 64)
+            hits++;
+    }
+    double tree_ns = (now_sec() - t) * 1e9 / queries;
+
+    size_t scan_queries = n <= LIST_MAX_NODES ? queries : queries * LIST_MAX_NODES / n;
+    volatile size_t scan_hits = 0;
+
+    t = now_sec();
+    for (size_t q = 0; q < scan_queries; ++q) {
+        uint64_t start = rng_next() % space;
+
+        for (size_t i = 0; i < n; ++i)
+            scan_hits += ranges[i].it.start <= start + 64 && ranges[i].it.last >= start;
+    }
+    double scan_ns = (now_sec() - t) * 1e9 / scan_queries;
+
+    printf("%9zu %10.1f %10.1f %10.2f\n", n, tree_ns, scan_ns, (double)hits / queries);
+
+    for (size_t i = 0; i < n; ++i)
+        interval_tree_remove(&tree, &ranges[i].it);
+
+    free(ranges);
+}
+
+int main(int argc, char **argv) {
+    size_t max_nodes = argc > 1 ? strtoul(argv[1], NULL, 0) : 1 << 20;
+    int check_ops = argc > 2 ? atoi(argv[2]) : 200000;
+
+    check_rbtree(check_ops);
+    check_interval_tree(check_ops);
+
+    if (errors) {
+        printf("%d errors\n", errors);
+        return 1;
+    }
+    printf("checks: %d random operations on each tree, ok\n\n", check_ops);
+
+    printf("%-8s %9s %10s %10s %10s %10s\n", "", "nodes", "insert ns", "lookup ns", "walk ns",
+           "erase ns");
+    for (size_t n = 64; n <= max_nodes; n *= 8)
+        bench_size(n);
+
+    printf("\n%9s %10s %10s %10s\n", "ranges", "tree ns", "scan ns", "hits");
+    for (size_t n = 64; n <= max_nodes; n *= 8)
+        bench_intervals(n);
+
+    return 0;
+}
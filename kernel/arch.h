@@ -4,4 +4,9 @@
 /* TODO: work on include directories */
 #include "arch/x86_64/defines.h"
 
-#endif /* _ARCH_H_ */
\ No newline at end of file
+#ifndef __ASSEMBLER__
+#include "arch/x86_64/arch_ops.h"
+#include "arch/x86_64/arch_thread.h"
+#endif
+
+#endif /* _ARCH_H_ */
@@ -0,0 +1,81 @@
+#include "alternative.h"
+#include "arch_ops.h"
+#include "reg_defs.h"
+#include "x86.h"
+
+/** One patch site, as ALT_ENTRY() lays it out. */
+typedef struct x86_alt {
+    int32_t     site;           /* Relative to this field. */
+    int32_t     repl;           /* Relative to this field. */
+    uint16_t    feature;
+    uint8_t     site_len;
+    uint8_t     repl_len;
+} PACKED x86_alt_t;
+
+/* from kernel.ld */
+extern const x86_alt_t __alternatives_start[];
+extern const x86_alt_t __alternatives_end[];
+
+/* the recommended long nops, a site tail is filled with as few as possible */
+#define ALT_MAX_NOP     8
+
+static const uint8_t alt_nops[ALT_MAX_NOP][ALT_MAX_NOP] = {
+    { 0x90 },
+    { 0x66, 0x90 },
+    { 0x0f, 0x1f, 0x00 },
+    { 0x0f, 0x1f, 0x40, 0x00 },
+    { 0x0f, 0x1f, 0x44, 0x00, 0x00 },
+    { 0x66, 0x0f, 0x1f, 0x44, 0x00, 0x00 },
+    { 0x0f, 0x1f, 0x80, 0x00, 0x00, 0x00, 0x00 },
+    { 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+};
+
+/*
+ * Byte stores, not memcpy(): memcpy() and memset() have sites of their
+ * own, and one of them may be what is being rewritten.
+ */
+static void alt_copy(volatile uint8_t *dst, const uint8_t *src, size_t len) {
+    for (size_t i = 0; i < len; ++i)
+        dst[i] = src[i];
+}
+
+static void alt_fill_nops(volatile uint8_t *dst, size_t len) {
+    while (len) {
+        size_t n = len < ALT_MAX_NOP ? len : ALT_MAX_NOP;
+
+        alt_copy(dst, alt_nops[n - 1], n);
+        dst += n;
+        len -= n;
+    }
+}
+
+uint32_t x86_apply_alternatives(void) {
+    uint32_t patched = 0;
+
+    /* no interrupt handler may run half patched code, and the text may be read only */
+    arch_irq_state_t state = arch_irq_save();
+    unsigned long cr0 = get_cr0();
+    set_cr0(cr0 & ~CR0_WP_BIT);
+
+    for (const x86_alt_t *a = __alternatives_start; a < __alternatives_end; ++a) {
+        if (!x86_feature_test(a->feature))
+            continue;
+
+        uint8_t *site = (uint8_t *)&a->site + a->site;
+        const uint8_t *repl = (const uint8_t *)&a->repl + a->repl;
+
+        alt_copy(site, repl, a->repl_len);
+        alt_fill_nops(site + a->repl_len, a->site_len - a->repl_len);
+        patched++;
+    }
+
+    set_cr0(cr0);
+
+    /* the old instructions may be prefetched, a serializing one drops them */
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0x0, &eax, &ebx, &ecx, &edx);
+
+    arch_irq_restore(state);
+
+    return patched;
+}
@@ -0,0 +1,77 @@
+#ifndef _X86_ALTERNATIVE_H_
+#define _X86_ALTERNATIVE_H_
+
+#include "feature.h"
+#include "../../compiler.h"
+#include <stdbool.h>
+
+/*
+ * Code patched once at boot for the features of the cpu.
+ *
+ * ALTERNATIVE(old, new, feature) emits the old instructions and records
+ * the site in the .alternatives section, along with the new ones, which
+ * are kept in .altinstr_replacement. x86_apply_alternatives() copies new
+ * over old at every site whose feature the cpu has and fills the rest of
+ * the site with nops. The site is padded to the longer of the two.
+ *
+ * The replacement is copied as is, so it must not hold a relative branch
+ * or a rip relative operand that reaches outside of it.
+ *
+ * x86_feature_static() is a branch that costs nothing once patched: a
+ * jump to the false path that becomes a nop when the cpu has the feature.
+ * It is false until x86_apply_alternatives() ran, so the false path must
+ * work on any cpu. The feature has to be a constant.
+ */
+
+#define __ALT_STR(x)    #x
+#define ALT_STR(x)      __ALT_STR(x)
+
+/* one .alternatives record, site 661 to 663 and replacement 664 to 665 */
+#define ALT_ENTRY(feature_str)                                  \
+    ".pushsection .alternatives, \"a\" \n\t"                    \
+    ".long 661b - . \n\t"                                       \
+    ".long 664f - . \n\t"                                       \
+    ".word " feature_str " \n\t"                                \
+    ".byte 663b - 661b \n\t"                                    \
+    ".byte 665f - 664f \n\t"                                    \
+    ".popsection \n\t"
+
+#define ALTERNATIVE(old, new, feature)                          \
+    "661: \n\t" old " \n"                                       \
+    "662: \n\t"                                                 \
+    ".skip -(((665f - 664f) - (662b - 661b)) > 0) * "           \
+        "((665f - 664f) - (662b - 661b)), 0x90 \n"              \
+    "663: \n\t"                                                 \
+    ALT_ENTRY(ALT_STR(feature))                                 \
+    ".pushsection .altinstr_replacement, \"ax\" \n"             \
+    "664: \n\t" new " \n"                                       \
+    "665: \n\t"                                                 \
+    ".popsection \n\t"
+
+static ALWAYS_INLINE bool x86_feature_static(uint32_t feature) {
+    /* a jmp rel32, so the site is 5 bytes and the nop over it a single one */
+    __asm__ goto(
+        "661: \n\t"
+        ".byte 0xe9 \n\t"
+        ".long %l[no] - 663f \n"
+        "663: \n\t"
+        ALT_ENTRY("%c0")
+        ".pushsection .altinstr_replacement, \"ax\" \n"
+        "664: \n"
+        "665: \n\t"
+        ".popsection \n\t"
+        : : "i"(feature) : : no);
+
+    return true;
+no:
+    return false;
+}
+
+/**
+ * @brief   Patch every site for the features in the registry, boot cpu,
+ *          after x86_feature_init() and before the other cpus run.
+ * @returns Number of sites patched.
+ */
+uint32_t x86_apply_alternatives(void);
+
+#endif /* _X86_ALTERNATIVE_H_ */
@@ -0,0 +1,177 @@
+#include "apic.h"
+#include "aspace.h"
+#include "feature.h"
+#include "idt.h"
+#include "mmu.h"
+#include "percpu.h"
+#include "reg_defs.h"
+#include "tsc.h"
+#include "x86.h"
+
+static bool x2apic_mode;
+static bool tsc_deadline_mode;
+
+/* xAPIC registers, through the kernel's physical map */
+static volatile uint32_t *lapic_mmio;
+
+/* apic timer ticks = (tsc cycles * apic_ticks_per_tsc) >> 32, one-shot mode only */
+static uint64_t apic_ticks_per_tsc;
+
+uint32_t apic_read(uint32_t reg) {
+    if (x2apic_mode)
+        return (uint32_t)read_msr(X2APIC_MSR_BASE + (reg >> 4));
+
+    return lapic_mmio[reg / sizeof(uint32_t)];
+}
+
+void apic_write(uint32_t reg, uint32_t val) {
+    if (x2apic_mode) {
+        write_msr(X2APIC_MSR_BASE + (reg >> 4), val);
+        return;
+    }
+
+    lapic_mmio[reg / sizeof(uint32_t)] = val;
+}
+
+void apic_send_ipi(uint32_t cpu, uint8_t vector) {
+    uint32_t dest = percpu[cpu].apic_id;
+    uint32_t low = LAPIC_ICR_LEVEL_ASSERT | vector;
+
+    /* x2apic takes the whole command in one msr write, which does not order
+       the stores the receiver is about to look at */
+    if (x2apic_mode) {
+        __asm__ __volatile__("mfence" ::: "memory");
+        write_msr(X2APIC_MSR_BASE + (LAPIC_REG_ICR_LOW >> 4), ((uint64_t)dest << 32) | low);
+        return;
+    }
+
+    /* the two halves must not interleave with an ipi sent from an irq handler */
+    x86_flags_t state = save_flags();
+    cli();
+
+    apic_write(LAPIC_REG_ICR_HIGH, dest << LAPIC_ICR_DEST_SHIFT);
+    apic_write(LAPIC_REG_ICR_LOW, low);
+
+    while (apic_read(LAPIC_REG_ICR_LOW) & LAPIC_ICR_DELIVERY_PENDING)
+        cpu_pause();
+
+    restore_flags(state);
+}
+
+bool apic_timer_has_tsc_deadline(void) {
+    return tsc_deadline_mode;
+}
+
+/**
+ * @brief   Measure the one-shot count down rate against the TSC, with the
+ *          divider already set.
+ */
+static void apic_timer_calibrate(void) {
+    /* 10ms worth of TSC cycles */
+    uint64_t window = tsc_clock.freq_hz / 100;
+
+    apic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED | LAPIC_TIMER_ONESHOT | APIC_TIMER_VECTOR);
+    apic_write(LAPIC_REG_TIMER_INIT_COUNT, 0xffffffff);
+
+    uint64_t start = rdtsc();
+    while (rdtsc() - start < window)
+        cpu_pause();
+
+    uint32_t ticks = 0xffffffff - apic_read(LAPIC_REG_TIMER_CURR_COUNT);
+    uint64_t elapsed = rdtsc() - start;
+
+    apic_write(LAPIC_REG_TIMER_INIT_COUNT, 0);
+
+    apic_ticks_per_tsc = ((uint64_t)ticks << 32) / elapsed;
+}
+
+/* Legacy 8259 pics */
+#define PIC1_CMD_PORT       0x20
+#define PIC1_DATA_PORT      0x21
+#define PIC2_CMD_PORT       0xa0
+#define PIC2_DATA_PORT      0xa1
+#define PIC_ICW1_INIT       0x11    /* edge triggered, cascade, icw4 follows */
+#define PIC_ICW4_8086       0x01
+
+/**
+ * @brief   Move the legacy pic vectors out of the exception range and mask
+ *          every line, a stray irq 7 would otherwise show up as vector 7.
+ */
+static void pic_disable(void) {
+    outb(PIC1_CMD_PORT, PIC_ICW1_INIT);
+    outb(PIC2_CMD_PORT, PIC_ICW1_INIT);
+    outb(PIC1_DATA_PORT, X86_INT_PLATFORM_BASE);
+    outb(PIC2_DATA_PORT, X86_INT_PLATFORM_BASE + 8);
+    outb(PIC1_DATA_PORT, 0x4);  /* slave on irq 2 */
+    outb(PIC2_DATA_PORT, 0x2);  /* cascade identity */
+    outb(PIC1_DATA_PORT, PIC_ICW4_8086);
+    outb(PIC2_DATA_PORT, PIC_ICW4_8086);
+
+    outb(PIC1_DATA_PORT, 0xff);
+    outb(PIC2_DATA_PORT, 0xff);
+}
+
+void apic_init_percpu(void) {
+    uint64_t base = read_msr(IA32_MSR_APIC_BASE);
+
+    /* the legacy pics are shared, the boot cpu shuts them up */
+    if (base & APIC_BASE_BSP)
+        pic_disable();
+
+    base |= APIC_BASE_GLOBAL_ENABLE;
+
+    x2apic_mode = x86_feature_test(X86_FEATURE_X2APIC);
+    if (x2apic_mode)
+        base |= APIC_BASE_X2APIC_ENABLE;
+    else
+        lapic_mmio = (volatile uint32_t *)X86_PHYS_TO_VIRT(base & APIC_BASE_ADDR_MASK);
+
+    write_msr(IA32_MSR_APIC_BASE, base);
+
+    /* accept every priority and software enable the apic */
+    apic_write(LAPIC_REG_TPR, 0);
+    apic_write(LAPIC_REG_SVR, LAPIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+
+    tsc_deadline_mode = x86_feature_test(X86_FEATURE_TSC_DEADLINE);
+    if (tsc_deadline_mode) {
+        apic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_TSC_DEADLINE | APIC_TIMER_VECTOR);
+        return;
+    }
+
+    apic_write(LAPIC_REG_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    if (!apic_ticks_per_tsc)
+        apic_timer_calibrate();
+
+    apic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_ONESHOT | APIC_TIMER_VECTOR);
+}
+
+void apic_timer_set_tsc_deadline(uint64_t tsc_deadline) {
+    if (tsc_deadline_mode) {
+        /* the msr write is not serializing, order the earlier stores first */
+        __asm__ __volatile__("mfence" ::: "memory");
+        write_msr(IA32_MSR_TSC_DEADLINE, tsc_deadline ? tsc_deadline : 1);
+        return;
+    }
+
+    uint64_t now = rdtsc();
+    uint64_t ticks = 1;
+
+    if (tsc_deadline > now) {
+        ticks = (uint64_t)(((unsigned __int128)(tsc_deadline - now) * apic_ticks_per_tsc) >> 32);
+
+        /* too far out fires early, the handler arms the timer again */
+        if (ticks > 0xffffffff)
+            ticks = 0xffffffff;
+        else if (ticks == 0)
+            ticks = 1;
+    }
+
+    apic_write(LAPIC_REG_TIMER_INIT_COUNT, (uint32_t)ticks);
+}
+
+void apic_timer_stop(void) {
+    if (tsc_deadline_mode)
+        write_msr(IA32_MSR_TSC_DEADLINE, 0);
+    else
+        apic_write(LAPIC_REG_TIMER_INIT_COUNT, 0);
+}
@@ -0,0 +1,79 @@
+#ifndef _X86_APIC_H_
+#define _X86_APIC_H_
+
+#include "../../types.h"
+#include <stdbool.h>
+
+/* Interrupt vectors owned by the local apic */
+#define APIC_TIMER_VECTOR           0xf0
+#define APIC_TLB_SHOOTDOWN_VECTOR   0xf1
+#define APIC_RESCHEDULE_VECTOR      0xf2
+#define APIC_SPURIOUS_VECTOR        0xff
+
+/* Local apic register offsets, x2apic msrs are 0x800 + (offset >> 4) */
+#define LAPIC_REG_ID                0x020
+#define LAPIC_REG_VERSION           0x030
+#define LAPIC_REG_TPR               0x080
+#define LAPIC_REG_EOI               0x0b0
+#define LAPIC_REG_SVR               0x0f0
+#define LAPIC_REG_ESR               0x280
+#define LAPIC_REG_ICR_LOW           0x300
+#define LAPIC_REG_ICR_HIGH          0x310
+#define LAPIC_REG_LVT_TIMER         0x320
+#define LAPIC_REG_LVT_PERF          0x340
+#define LAPIC_REG_TIMER_INIT_COUNT  0x380
+#define LAPIC_REG_TIMER_CURR_COUNT  0x390
+#define LAPIC_REG_TIMER_DIV         0x3e0
+
+#define X2APIC_MSR_BASE             0x800
+
+/* IA32_APIC_BASE msr */
+#define APIC_BASE_BSP               (1ULL << 8)
+#define APIC_BASE_X2APIC_ENABLE     (1ULL << 10)
+#define APIC_BASE_GLOBAL_ENABLE     (1ULL << 11)
+#define APIC_BASE_ADDR_MASK         0x000ffffffffff000ULL
+
+#define LAPIC_SVR_ENABLE            (1U << 8)
+
+/* LVT timer */
+#define LAPIC_LVT_MASKED            (1U << 16)
+#define LAPIC_TIMER_ONESHOT         (0U << 17)
+#define LAPIC_TIMER_PERIODIC        (1U << 17)
+#define LAPIC_TIMER_TSC_DEADLINE    (2U << 17)
+
+#define LAPIC_TIMER_DIV_16          0x3
+
+/* LVT performance counter, overflows come in as an nmi */
+#define LAPIC_LVT_DELIVERY_NMI      (4U << 8)
+
+/* Interrupt command register, fixed delivery to a physical destination */
+#define LAPIC_ICR_DELIVERY_PENDING  (1U << 12)
+#define LAPIC_ICR_LEVEL_ASSERT      (1U << 14)
+#define LAPIC_ICR_DEST_SHIFT        24      /* xAPIC only, in ICR_HIGH */
+
+/** @brief  Enable the local apic of the current cpu, x2apic mode if present. */
+void apic_init_percpu(void);
+
+uint32_t apic_read(uint32_t reg);
+void apic_write(uint32_t reg, uint32_t val);
+
+static inline void apic_eoi(void) {
+    apic_write(LAPIC_REG_EOI, 0);
+}
+
+/** @brief  Send a fixed interrupt on vector to another cpu. */
+void apic_send_ipi(uint32_t cpu, uint8_t vector);
+
+/** @brief  Whether or not the timer can be armed with an absolute TSC value. */
+bool apic_timer_has_tsc_deadline(void);
+
+/**
+ * @brief   Arm the local apic timer to fire once at the given TSC value.
+ *          Uses TSC-deadline mode if supported, otherwise the one-shot
+ *          count down calibrated against the TSC.
+ */
+void apic_timer_set_tsc_deadline(uint64_t tsc_deadline);
+
+void apic_timer_stop(void);
+
+#endif /* _X86_APIC_H_ */
@@ -0,0 +1,83 @@
+#include "alternative.h"
+#include "apic.h"
+#include "descriptor.h"
+#include "feature.h"
+#include "idt.h"
+#include "percpu.h"
+#include "pmu.h"
+#include "reg_defs.h"
+#include "tlb.h"
+#include "x86.h"
+#include "../../boot_trace.h"
+#include "../../interrupts.h"
+#include "../../sched.h"
+
+x86_percpu_t percpu[SMP_MAX_CPUS];
+
+bool x86_fpu_xsave;
+
+/* the interrupt alone wakes the cpu from its halt, the exit path reschedules */
+static handler_return_t x86_reschedule_irq(void *arg) {
+    return INT_RESCHEDULE;
+}
+
+void arch_reschedule_cpu(uint32_t cpu) {
+    apic_send_ipi(cpu, APIC_RESCHEDULE_VECTOR);
+}
+
+/** @brief  Let the kernel use SSE, and AVX where the cpu has xsave. */
+static void x86_simd_init_percpu(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0x1, &eax, &ebx, &ecx, &edx);
+
+    set_cr0((get_cr0() & ~CR0_EM_BIT) | CR0_MP_BIT);
+
+    unsigned long cr4 = get_cr4() | CR4_OSFXSR_BIT | CR4_OSXMMEXCPT_BIT;
+    if (ecx & X86_CPUID1_ECX_XSAVE)
+        cr4 |= CR4_OSXSAVE_BIT;
+    set_cr4(cr4);
+
+    if (ecx & X86_CPUID1_ECX_XSAVE) {
+        xsetbv(0, XCR0_X87 | XCR0_SSE | ((ecx & X86_CPUID1_ECX_AVX) ? XCR0_AVX : 0));
+        x86_fpu_xsave = true;
+    }
+}
+
+void x86_init_percpu(uint32_t cpu_num) {
+    x86_percpu_t *p = &percpu[cpu_num];
+
+    p->direct = p;
+    p->current_thread = NULL;
+    p->cpu_num = cpu_num;
+
+    /* initial apic id, cpuid leaf 1 ebx[31:24] */
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0x1, &eax, &ebx, &ecx, &edx);
+    p->apic_id = (ebx >> 24) & 0xff;
+
+    write_msr(IA32_MSR_GS_BASE, (uint64_t)p);
+
+    /* the idt is shared, the boot cpu fills it in */
+    if (cpu_num == 0) {
+        x86_idt_init();
+        register_int_handler(APIC_RESCHEDULE_VECTOR, x86_reschedule_irq, NULL);
+    }
+
+    x86_gdt_load();
+    x86_tss_init_percpu(cpu_num);
+    x86_idt_load();
+
+    x86_tlb_init_percpu();
+
+    x86_simd_init_percpu();
+
+    /* the other cpus are not up yet, nothing runs the code being patched */
+    if (cpu_num == 0) {
+        x86_feature_init();
+        x86_apply_alternatives();
+        x86_pmu_init();
+        boot_mark("cpu_features");
+    }
+
+    x86_pmu_init_percpu();
+}
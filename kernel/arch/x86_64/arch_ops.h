@@ -0,0 +1,157 @@
+#ifndef _X86_ARCH_OPS_H_
+#define _X86_ARCH_OPS_H_
+
+#include "aspace.h"
+#include "memops.h"
+#include "mmu.h"
+#include "percpu.h"
+#include "pmu.h"
+#include "tlb.h"
+#include "tsc.h"
+#include "x86.h"
+
+/* ------------------------------------------------------------------------
+ *  Architecture operations used by the generic kernel code
+ * ------------------------------------------------------------------------
+ */
+
+static inline uint32_t arch_curr_cpu_num(void) {
+    return x86_get_percpu_cpu_num();
+}
+
+static inline struct thread *arch_get_current_thread(void) {
+    return x86_get_percpu_current_thread();
+}
+
+static inline void arch_set_current_thread(struct thread *t) {
+    x86_set_percpu_current_thread(t);
+}
+
+static inline void arch_spinloop_pause(void) {
+    cpu_pause();
+}
+
+/** @brief  Free running cycle counter, not calibrated. */
+static inline uint64_t arch_cycle_count(void) {
+    return rdtsc();
+}
+
+/** @brief  arch_cycle_count() ticks to ns, once the TSC is calibrated. */
+static inline ktime_t arch_cycles_to_ns(uint64_t cycles) {
+    return tsc_to_ns(cycles);
+}
+
+/** @brief  Nanoseconds since boot, from the calibrated TSC. */
+static inline ktime_t arch_current_time(void) {
+    return tsc_to_ns(rdtsc() - tsc_clock.boot_tsc);
+}
+
+/* ------------------------------ Counters ------------------------------ */
+
+static inline bool arch_pmu_available(void) {
+    return x86_pmu.running;
+}
+
+/** @brief  Raw values of the counters of the first count pmu_event_t events. */
+static inline void arch_pmu_read(uint64_t *values, uint32_t count) {
+    x86_pmu_read(values, count);
+}
+
+/** @brief  Events counted between two arch_pmu_read() values of an event. */
+static inline uint64_t arch_pmu_delta(uint32_t event, uint64_t start, uint64_t end) {
+    return (end - start) & x86_pmu.counters[event].mask;
+}
+
+/** @brief  Whether the event has a counter at all. */
+static inline bool arch_pmu_counts(uint32_t event) {
+    return x86_pmu.counters[event].mask != 0;
+}
+
+static inline void arch_pmu_dump(void) {
+    x86_pmu_dump();
+}
+
+/**
+ * @brief   Interrupt the current cpu every period core cycles and call
+ *          profile_interrupt(), with a counter the events left over.
+ */
+static inline bool arch_pmu_sample_start(uint64_t period) {
+    return x86_pmu_sample_start(period);
+}
+
+static inline void arch_pmu_sample_stop(void) {
+    x86_pmu_sample_stop();
+}
+
+/* ------------------------------ Interrupts ------------------------------ */
+
+/**
+ * @brief   Where the interrupt being handled stopped the cpu: the ip and
+ *          the frame pointer at that point.
+ * @returns False outside an interrupt handler.
+ */
+static inline bool arch_interrupted_context(uintptr_t *ip, uintptr_t *fp) {
+    x86_percpu_t *p = x86_get_percpu();
+
+    *ip = p->int_ip;
+    *fp = p->int_fp;
+
+    return *ip != 0;
+}
+
+/* ------------------------------ Memory ------------------------------ */
+
+/** @brief  All of physical memory is mapped at the base of the kernel address space. */
+static inline void *arch_paddr_to_kvaddr(paddr_t pa) {
+    return (void *)X86_PHYS_TO_VIRT(pa);
+}
+
+static inline paddr_t arch_kvaddr_to_paddr(const void *va) {
+    return X86_VIRT_TO_PHYS(va);
+}
+
+typedef x86_flags_t arch_irq_state_t;
+
+static inline void arch_disable_ints(void) {
+    cli();
+}
+
+static inline void arch_enable_ints(void) {
+    sti();
+}
+
+static inline bool arch_ints_disabled(void) {
+    return !(save_flags() & X86_FLAGS_IF);
+}
+
+/** @brief  Disable interrupts and return the previous state. */
+static inline arch_irq_state_t arch_irq_save(void) {
+    arch_irq_state_t state = save_flags();
+    cli();
+    return state;
+}
+
+static inline void arch_irq_restore(arch_irq_state_t state) {
+    restore_flags(state);
+}
+
+/**
+ * @brief   Halt until the next interrupt, interrupts are enabled. Called
+ *          with them off, an interrupt that came in since is taken after
+ *          the halt and ends it.
+ */
+static inline void arch_idle(void) {
+    /* shootdowns of the loaded address space leave a halted cpu alone */
+    x86_tlb_enter_lazy();
+    __asm__ __volatile__("sti; hlt; cli" ::: "memory");
+    x86_tlb_leave_lazy();
+    sti();
+}
+
+/** @brief  Stop the current cpu for good. */
+static inline NORETURN void arch_halt(void) {
+    for (;;)
+        __asm__ __volatile__("cli; hlt" ::: "memory");
+}
+
+#endif /* _X86_ARCH_OPS_H_ */
@@ -0,0 +1,18 @@
+#ifndef _X86_ARCH_THREAD_H_
+#define _X86_ARCH_THREAD_H_
+
+#include "reg_defs.h"
+#include "../../compiler.h"
+#include "../../types.h"
+
+/** @brief  Architecture specific part of a thread. */
+struct arch_thread {
+    vaddr_t sp;     /* Saved stack pointer, callee saved registers
+                     * are pushed on the stack.
+                     */
+
+    /* x87, SSE and AVX registers while switched away */
+    uint8_t fpu_state[X86_FPU_STATE_SIZE] ALIGNED(X86_FPU_STATE_ALIGN);
+};
+
+#endif /* _X86_ARCH_THREAD_H_ */
@@ -6,4 +6,8 @@
 
 #define ARCH_DEFAULT_STACK_SIZE 8192    /* 8KiB */
 
+#define SMP_MAX_CPUS            32
+
+#define CACHE_LINE_SIZE         64
+
 #endif /* _X86_DEFINES_H_ */
\ No newline at end of file
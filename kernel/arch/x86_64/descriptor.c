@@ -0,0 +1,41 @@
+#include "descriptor.h"
+
+/* Filled in TSS descriptors, see gdt.S */
+extern uint64_t _gdt_tss[SMP_MAX_CPUS * 2];
+
+static x86_tss_t tss[SMP_MAX_CPUS];
+
+/* NMI, double fault and machine check run on their own known good stacks */
+static uint8_t ist_stacks[SMP_MAX_CPUS][X86_NUM_IST][X86_IST_STACK_SIZE] ALIGNED(16);
+
+#define TSS_DESC_TYPE_AVAILABLE 0x89    /* present, 64 bit TSS, available */
+
+static void gdt_set_tss(uint32_t cpu, x86_tss_t *t) {
+    uint64_t base = (uint64_t)t;
+    uint64_t limit = sizeof(*t) - 1;
+    uint64_t *desc = &_gdt_tss[cpu * 2];
+
+    desc[0] = (limit & 0xffff) |
+              ((base & 0xffffff) << 16) |
+              ((uint64_t)TSS_DESC_TYPE_AVAILABLE << 40) |
+              (((limit >> 16) & 0xf) << 48) |
+              (((base >> 24) & 0xff) << 56);
+    desc[1] = base >> 32;
+}
+
+void x86_tss_init_percpu(uint32_t cpu) {
+    x86_tss_t *t = &tss[cpu];
+
+    for (int i = 0; i < X86_NUM_IST; ++i)
+        t->ist[i] = (uint64_t)&ist_stacks[cpu][i][X86_IST_STACK_SIZE];
+
+    /* no io permission bitmap */
+    t->iomap_base = sizeof(*t);
+
+    gdt_set_tss(cpu, t);
+
+    __asm__ __volatile__(
+        "ltr %w0 \n\t"
+        : : "r"((uint16_t)TSS_SELECTOR(cpu))
+    );
+}
@@ -0,0 +1,47 @@
+#ifndef _X86_DESCRIPTOR_H_
+#define _X86_DESCRIPTOR_H_
+
+#include "defines.h"
+
+/* GDT selectors, the TSS descriptors take two slots per cpu */
+#define NULL_SELECTOR           0x00
+#define CODE_64_SELECTOR        0x08
+#define DATA_SELECTOR           0x10
+#define TSS_SELECTOR_BASE       0x18
+#define TSS_SELECTOR(cpu)       (TSS_SELECTOR_BASE + (cpu) * 16)
+
+/* Interrupt stack table entries, 0 means stay on the current stack */
+#define X86_IST_NONE            0
+#define X86_IST_NMI             1
+#define X86_IST_DOUBLE_FAULT    2
+#define X86_IST_MACHINE_CHECK   3
+#define X86_NUM_IST             3
+
+#define X86_IST_STACK_SIZE      4096
+
+#ifndef __ASSEMBLER__
+
+#include "../../compiler.h"
+#include "../../types.h"
+
+typedef struct x86_tss {
+    uint32_t    rsvd0;
+    uint64_t    rsp0;
+    uint64_t    rsp1;
+    uint64_t    rsp2;
+    uint64_t    rsvd1;
+    uint64_t    ist[7];
+    uint64_t    rsvd2;
+    uint16_t    rsvd3;
+    uint16_t    iomap_base;
+} PACKED x86_tss_t;
+
+/** @brief  Load the kernel GDT and reload the segment registers, but gs. */
+void x86_gdt_load(void);
+
+/** @brief  Set up the TSS and IST stacks of the current cpu and load it. */
+void x86_tss_init_percpu(uint32_t cpu);
+
+#endif /* __ASSEMBLER__ */
+
+#endif /* _X86_DESCRIPTOR_H_ */
@@ -0,0 +1,139 @@
+#include "feature.h"
+#include "reg_defs.h"
+#include "x86.h"
+#include "../../stdio.h"
+
+x86_cpu_info_t x86_cpu_info;
+
+static const struct {
+    uint16_t    feature;
+    const char  *name;
+} feature_names[] = {
+    { X86_FEATURE_SSE3,             "sse3" },
+    { X86_FEATURE_PCID,             "pcid" },
+    { X86_FEATURE_SSE4_2,           "sse4_2" },
+    { X86_FEATURE_X2APIC,           "x2apic" },
+    { X86_FEATURE_TSC_DEADLINE,     "tsc_deadline" },
+    { X86_FEATURE_XSAVE,            "xsave" },
+    { X86_FEATURE_OSXSAVE,          "osxsave" },
+    { X86_FEATURE_AVX,              "avx" },
+    { X86_FEATURE_RDRAND,           "rdrand" },
+    { X86_FEATURE_HYPERVISOR,       "hypervisor" },
+    { X86_FEATURE_TSC,              "tsc" },
+    { X86_FEATURE_APIC,             "apic" },
+    { X86_FEATURE_PGE,              "pge" },
+    { X86_FEATURE_CLFLUSH,          "clflush" },
+    { X86_FEATURE_FXSR,             "fxsr" },
+    { X86_FEATURE_SSE,              "sse" },
+    { X86_FEATURE_SSE2,             "sse2" },
+    { X86_FEATURE_FSGSBASE,         "fsgsbase" },
+    { X86_FEATURE_AVX2,             "avx2" },
+    { X86_FEATURE_SMEP,             "smep" },
+    { X86_FEATURE_ERMS,             "erms" },
+    { X86_FEATURE_INVPCID,          "invpcid" },
+    { X86_FEATURE_SMAP,             "smap" },
+    { X86_FEATURE_CLFLUSHOPT,       "clflushopt" },
+    { X86_FEATURE_UMIP,             "umip" },
+    { X86_FEATURE_XSAVEOPT,         "xsaveopt" },
+    { X86_FEATURE_XSAVEC,           "xsavec" },
+    { X86_FEATURE_XSAVES,           "xsaves" },
+    { X86_FEATURE_LZCNT,            "lzcnt" },
+    { X86_FEATURE_NX,               "nx" },
+    { X86_FEATURE_HUGE_PAGE,        "pdpe1gb" },
+    { X86_FEATURE_RDTSCP,           "rdtscp" },
+    { X86_FEATURE_LONG_MODE,        "lm" },
+    { X86_FEATURE_INVARIANT_TSC,    "invariant_tsc" },
+};
+
+#define NUM_FEATURE_NAMES   (sizeof(feature_names) / sizeof(feature_names[0]))
+
+static void feature_clear(uint32_t feature) {
+    x86_cpu_info.words[feature / 32] &= ~(1U << (feature % 32));
+}
+
+void x86_feature_init(void) {
+    x86_cpu_info_t *info = &x86_cpu_info;
+    uint32_t *w = info->words;
+    uint32_t eax, ebx, ecx, edx;
+
+    cpuid(0x0, &info->max_leaf, &ebx, &ecx, &edx);
+
+    /* the vendor string is in ebx, edx, ecx order */
+    for (int i = 0; i < 4; ++i) {
+        info->vendor[i] = (char)(ebx >> (i * 8));
+        info->vendor[i + 4] = (char)(edx >> (i * 8));
+        info->vendor[i + 8] = (char)(ecx >> (i * 8));
+    }
+    info->vendor[12] = '\0';
+
+    cpuid(0x1, &eax, &ebx, &w[X86_FEATURE_WORD_1_ECX], &w[X86_FEATURE_WORD_1_EDX]);
+
+    /* the extended family and model only count for families 6 and 15 */
+    info->stepping = eax & 0xf;
+    info->model = (eax >> 4) & 0xf;
+    info->family = (eax >> 8) & 0xf;
+    if (info->family == 0xf)
+        info->family += (eax >> 20) & 0xff;
+    if (info->family == 0x6 || info->family >= 0xf)
+        info->model |= ((eax >> 16) & 0xf) << 4;
+
+    if (info->max_leaf >= 0x7)
+        cpuid_c(0x7, 0, &eax, &w[X86_FEATURE_WORD_7_EBX], &w[X86_FEATURE_WORD_7_ECX], &edx);
+
+    if (info->max_leaf >= 0xd)
+        cpuid_c(0xd, 1, &w[X86_FEATURE_WORD_D_EAX], &ebx, &ecx, &edx);
+
+    cpuid(0x80000000, &info->max_ext_leaf, &ebx, &ecx, &edx);
+
+    if (info->max_ext_leaf >= 0x80000001)
+        cpuid(0x80000001, &eax, &ebx, &w[X86_FEATURE_WORD_81_ECX], &w[X86_FEATURE_WORD_81_EDX]);
+
+    if (info->max_ext_leaf >= 0x80000007)
+        cpuid(0x80000007, &eax, &ebx, &ecx, &w[X86_FEATURE_WORD_87_EDX]);
+
+    /* 48 bits linear and 32 bits physical if the cpu does not say */
+    info->vaddr_bits = 48;
+    info->paddr_bits = 32;
+    if (info->max_ext_leaf >= 0x80000008) {
+        cpuid(0x80000008, &eax, &ebx, &ecx, &edx);
+        info->paddr_bits = eax & 0xff;
+        info->vaddr_bits = (eax >> 8) & 0xff;
+    }
+
+    /* the ymm registers only work once the os has enabled their state */
+    if (!x86_feature_test(X86_FEATURE_OSXSAVE) ||
+        (xgetbv(0) & (XCR0_SSE | XCR0_AVX)) != (XCR0_SSE | XCR0_AVX)) {
+        feature_clear(X86_FEATURE_AVX);
+        feature_clear(X86_FEATURE_AVX2);
+    }
+
+    if (!x86_feature_test(X86_FEATURE_OSXSAVE)) {
+        feature_clear(X86_FEATURE_XSAVEOPT);
+        feature_clear(X86_FEATURE_XSAVEC);
+        feature_clear(X86_FEATURE_XSAVES);
+    }
+}
+
+const char *x86_feature_name(uint32_t feature) {
+    for (size_t i = 0; i < NUM_FEATURE_NAMES; ++i) {
+        if (feature_names[i].feature == feature)
+            return feature_names[i].name;
+    }
+
+    return NULL;
+}
+
+void x86_feature_dump(void) {
+    x86_cpu_info_t *info = &x86_cpu_info;
+
+    printf("cpu: %s family %#x model %#x stepping %u, %u bits physical, %u bits linear\n",
+           info->vendor, info->family, info->model, info->stepping, info->paddr_bits,
+           info->vaddr_bits);
+
+    printf("cpu:");
+    for (size_t i = 0; i < NUM_FEATURE_NAMES; ++i) {
+        if (x86_feature_test(feature_names[i].feature))
+            printf(" %s", feature_names[i].name);
+    }
+    printf("\n");
+}
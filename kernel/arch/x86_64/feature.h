@@ -0,0 +1,103 @@
+#ifndef _X86_FEATURE_H_
+#define _X86_FEATURE_H_
+
+#include "../../types.h"
+#include <stdbool.h>
+
+/*
+ * CPU feature registry.
+ *
+ * x86_feature_init() reads CPUID once on the boot cpu and keeps the
+ * registers that hold feature flags. A feature is the index of its bit in
+ * them, 32 per register, so a test is a load and a bit test. The other
+ * cpus are assumed to have what the boot cpu has.
+ *
+ * Features that need the kernel to turn them on are only reported once it
+ * did: AVX and AVX2 need the ymm state enabled in XCR0.
+ *
+ * The numbers are plain expressions so they can be used from assembly
+ * too, the alternatives in alternative.h record them in the patch sites.
+ */
+
+#define X86_FEATURE_WORD_1_ECX          0   /* CPUID.01H:ECX */
+#define X86_FEATURE_WORD_1_EDX          1   /* CPUID.01H:EDX */
+#define X86_FEATURE_WORD_7_EBX          2   /* CPUID.(EAX=07H, ECX=0):EBX */
+#define X86_FEATURE_WORD_7_ECX          3   /* CPUID.(EAX=07H, ECX=0):ECX */
+#define X86_FEATURE_WORD_D_EAX          4   /* CPUID.(EAX=0DH, ECX=1):EAX */
+#define X86_FEATURE_WORD_81_ECX         5   /* CPUID.80000001H:ECX */
+#define X86_FEATURE_WORD_81_EDX         6   /* CPUID.80000001H:EDX */
+#define X86_FEATURE_WORD_87_EDX         7   /* CPUID.80000007H:EDX */
+#define X86_FEATURE_WORDS               8
+
+#define X86_FEATURE(word, bit)          ((word) * 32 + (bit))
+
+#define X86_FEATURE_SSE3                X86_FEATURE(X86_FEATURE_WORD_1_ECX, 0)
+#define X86_FEATURE_PCID                X86_FEATURE(X86_FEATURE_WORD_1_ECX, 17)
+#define X86_FEATURE_SSE4_2              X86_FEATURE(X86_FEATURE_WORD_1_ECX, 20)
+#define X86_FEATURE_X2APIC              X86_FEATURE(X86_FEATURE_WORD_1_ECX, 21)
+#define X86_FEATURE_TSC_DEADLINE        X86_FEATURE(X86_FEATURE_WORD_1_ECX, 24)
+#define X86_FEATURE_XSAVE               X86_FEATURE(X86_FEATURE_WORD_1_ECX, 26)
+#define X86_FEATURE_OSXSAVE             X86_FEATURE(X86_FEATURE_WORD_1_ECX, 27)
+#define X86_FEATURE_AVX                 X86_FEATURE(X86_FEATURE_WORD_1_ECX, 28)
+#define X86_FEATURE_RDRAND              X86_FEATURE(X86_FEATURE_WORD_1_ECX, 30)
+#define X86_FEATURE_HYPERVISOR          X86_FEATURE(X86_FEATURE_WORD_1_ECX, 31)
+
+#define X86_FEATURE_TSC                 X86_FEATURE(X86_FEATURE_WORD_1_EDX, 4)
+#define X86_FEATURE_APIC                X86_FEATURE(X86_FEATURE_WORD_1_EDX, 9)
+#define X86_FEATURE_PGE                 X86_FEATURE(X86_FEATURE_WORD_1_EDX, 13)
+#define X86_FEATURE_CLFLUSH             X86_FEATURE(X86_FEATURE_WORD_1_EDX, 19)
+#define X86_FEATURE_FXSR                X86_FEATURE(X86_FEATURE_WORD_1_EDX, 24)
+#define X86_FEATURE_SSE                 X86_FEATURE(X86_FEATURE_WORD_1_EDX, 25)
+#define X86_FEATURE_SSE2                X86_FEATURE(X86_FEATURE_WORD_1_EDX, 26)
+
+#define X86_FEATURE_FSGSBASE            X86_FEATURE(X86_FEATURE_WORD_7_EBX, 0)
+#define X86_FEATURE_AVX2                X86_FEATURE(X86_FEATURE_WORD_7_EBX, 5)
+#define X86_FEATURE_SMEP                X86_FEATURE(X86_FEATURE_WORD_7_EBX, 7)
+#define X86_FEATURE_ERMS                X86_FEATURE(X86_FEATURE_WORD_7_EBX, 9)
+#define X86_FEATURE_INVPCID             X86_FEATURE(X86_FEATURE_WORD_7_EBX, 10)
+#define X86_FEATURE_SMAP                X86_FEATURE(X86_FEATURE_WORD_7_EBX, 20)
+#define X86_FEATURE_CLFLUSHOPT          X86_FEATURE(X86_FEATURE_WORD_7_EBX, 23)
+
+#define X86_FEATURE_UMIP                X86_FEATURE(X86_FEATURE_WORD_7_ECX, 2)
+
+#define X86_FEATURE_XSAVEOPT            X86_FEATURE(X86_FEATURE_WORD_D_EAX, 0)
+#define X86_FEATURE_XSAVEC              X86_FEATURE(X86_FEATURE_WORD_D_EAX, 1)
+#define X86_FEATURE_XSAVES              X86_FEATURE(X86_FEATURE_WORD_D_EAX, 3)
+
+#define X86_FEATURE_LZCNT               X86_FEATURE(X86_FEATURE_WORD_81_ECX, 5)
+
+#define X86_FEATURE_NX                  X86_FEATURE(X86_FEATURE_WORD_81_EDX, 20)
+#define X86_FEATURE_HUGE_PAGE           X86_FEATURE(X86_FEATURE_WORD_81_EDX, 26)  /* 1 GiB pages. */
+#define X86_FEATURE_RDTSCP              X86_FEATURE(X86_FEATURE_WORD_81_EDX, 27)
+#define X86_FEATURE_LONG_MODE           X86_FEATURE(X86_FEATURE_WORD_81_EDX, 29)
+
+#define X86_FEATURE_INVARIANT_TSC       X86_FEATURE(X86_FEATURE_WORD_87_EDX, 8)
+
+typedef struct x86_cpu_info {
+    char        vendor[13];
+    uint32_t    max_leaf;
+    uint32_t    max_ext_leaf;
+    uint32_t    family;
+    uint32_t    model;
+    uint32_t    stepping;
+    uint8_t     paddr_bits;
+    uint8_t     vaddr_bits;
+    uint32_t    words[X86_FEATURE_WORDS];
+} x86_cpu_info_t;
+
+extern x86_cpu_info_t x86_cpu_info;
+
+/** @brief  Fill the registry, boot cpu, after x86_simd_init_percpu(). */
+void x86_feature_init(void);
+
+static inline bool x86_feature_test(uint32_t feature) {
+    return x86_cpu_info.words[feature / 32] & (1U << (feature % 32));
+}
+
+/** @returns Name of the feature, NULL if the registry does not know it. */
+const char *x86_feature_name(uint32_t feature);
+
+/** @brief  Print the cpu and the features it has. */
+void x86_feature_dump(void);
+
+#endif /* _X86_FEATURE_H_ */
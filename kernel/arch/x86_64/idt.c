@@ -0,0 +1,269 @@
+#include "apic.h"
+#include "descriptor.h"
+#include "idt.h"
+#include "percpu.h"
+#include "x86.h"
+#include "../../atomic.h"
+#include "../../debug.h"
+#include "../../interrupts.h"
+#include "../../thread.h"
+
+typedef struct idt_entry {
+    uint16_t    offset_low;
+    uint16_t    selector;
+    uint8_t     ist;
+    uint8_t     type_attr;
+    uint16_t    offset_mid;
+    uint32_t    offset_high;
+    uint32_t    rsvd;
+} PACKED idt_entry_t;
+
+typedef struct idtr {
+    uint16_t    limit;
+    uint64_t    base;
+} PACKED idtr_t;
+
+/* present, dpl 0, 64 bit interrupt gate, interrupts are off on entry */
+#define IDT_GATE_INTERRUPT      0x8e
+
+typedef struct int_handler_entry {
+    int_handler handler;
+    void        *arg;
+} int_handler_entry_t;
+
+static idt_entry_t idt[X86_NUM_VECTORS] ALIGNED(16);
+static int_handler_entry_t int_handlers[X86_NUM_VECTORS];
+
+/* only written by the owning cpu with interrupts off */
+static int_stats_t int_stats[SMP_MAX_CPUS][X86_NUM_VECTORS];
+
+/* exceptions.S */
+extern uint8_t x86_isr_stubs[];
+
+static const char *exception_names[X86_INT_MAX_EXCEPTION + 1] = {
+    [X86_INT_DIVIDE_0]              = "divide error",
+    [X86_INT_DEBUG]                 = "debug",
+    [X86_INT_NMI]                   = "nmi",
+    [X86_INT_BREAKPOINT]            = "breakpoint",
+    [X86_INT_OVERFLOW]              = "overflow",
+    [X86_INT_BOUND_RANGE]           = "bound range exceeded",
+    [X86_INT_INVALID_OP]            = "invalid opcode",
+    [X86_INT_DEVICE_NA]             = "device not available",
+    [X86_INT_DOUBLE_FAULT]          = "double fault",
+    [X86_INT_INVALID_TSS]           = "invalid tss",
+    [X86_INT_SEGMENT_NP]            = "segment not present",
+    [X86_INT_STACK_FAULT]           = "stack fault",
+    [X86_INT_GP_FAULT]              = "general protection fault",
+    [X86_INT_PAGE_FAULT]            = "page fault",
+    [X86_INT_FPU_FP_ERROR]          = "x87 floating point error",
+    [X86_INT_ALIGNMENT_CHECK]       = "alignment check",
+    [X86_INT_MACHINE_CHECK]         = "machine check",
+    [X86_INT_SIMD_FP_ERROR]         = "simd floating point error",
+    [X86_INT_VIRT]                  = "virtualization exception",
+    [X86_INT_CONTROL_PROTECTION]    = "control protection",
+    [X86_INT_VMM_COMMUNICATION]     = "vmm communication",
+    [X86_INT_SECURITY]              = "security exception",
+};
+
+static void idt_set_gate(uint32_t vector, uint64_t handler, uint8_t ist) {
+    idt_entry_t *e = &idt[vector];
+
+    e->offset_low = handler & 0xffff;
+    e->selector = CODE_64_SELECTOR;
+    e->ist = ist;
+    e->type_attr = IDT_GATE_INTERRUPT;
+    e->offset_mid = (handler >> 16) & 0xffff;
+    e->offset_high = handler >> 32;
+    e->rsvd = 0;
+}
+
+void x86_idt_init(void) {
+    for (uint32_t v = 0; v < X86_NUM_VECTORS; ++v)
+        idt_set_gate(v, (uint64_t)x86_isr_stubs + v * X86_ISR_STUB_SIZE, X86_IST_NONE);
+
+    /* these can hit at any time, including on a bad kernel stack */
+    idt[X86_INT_NMI].ist = X86_IST_NMI;
+    idt[X86_INT_DOUBLE_FAULT].ist = X86_IST_DOUBLE_FAULT;
+    idt[X86_INT_MACHINE_CHECK].ist = X86_IST_MACHINE_CHECK;
+}
+
+void x86_idt_load(void) {
+    idtr_t idtr = {
+        .limit = sizeof(idt) - 1,
+        .base = (uint64_t)idt,
+    };
+
+    __asm__ __volatile__(
+        "lidt %0 \n\t"
+        : : "m"(idtr)
+    );
+}
+
+void register_int_handler(uint32_t vector, int_handler handler, void *arg) {
+    if (unlikely(vector >= X86_NUM_VECTORS)) {
+        panic("register_int_handler: bad vector %u\n", vector);
+    }
+
+    arch_irq_state_t state = arch_irq_save();
+
+    int_handlers[vector].arg = arg;
+    atomic_store_release(&int_handlers[vector].handler, handler);
+
+    arch_irq_restore(state);
+}
+
+static inline void int_account(uint32_t vector, uint64_t start) {
+    int_stats_t *s = &int_stats[arch_curr_cpu_num()][vector];
+    uint64_t cycles = rdtsc() - start;
+
+    s->count++;
+    s->cycles += cycles;
+    if (cycles > s->max_cycles)
+        s->max_cycles = cycles;
+}
+
+/* ------------------------------------------------------------------------ */
+
+void x86_irq_handler(x86_irq_frame_t *frame) {
+    uint64_t start = rdtsc();
+    uint32_t vector = (uint32_t)frame->vector;
+    int_handler_entry_t *entry = &int_handlers[vector];
+    int_handler handler = atomic_load_acquire(&entry->handler);
+    handler_return_t ret = INT_NO_RESCHEDULE;
+    x86_percpu_t *p = x86_get_percpu();
+
+    /*
+     * The entry does not save rbp, it still holds the interrupted frame
+     * pointer when this function pushes it.
+     */
+    p->int_ip = frame->ip;
+    p->int_fp = *(uintptr_t *)__builtin_frame_address(0);
+
+    if (likely(handler))
+        ret = handler(entry->arg);
+
+    p->int_ip = 0;
+
+    /* spurious interrupts are not in service and must not be acknowledged */
+    if (vector != APIC_SPURIOUS_VECTOR)
+        apic_eoi();
+
+    int_account(vector, start);
+
+    if (ret == INT_RESCHEDULE)
+        thread_preempt();
+}
+
+WEAK int vm_page_fault(vaddr_t addr, uint32_t flags) {
+    return -1;
+}
+
+void x86_page_fault_handler(x86_irq_frame_t *frame, vaddr_t fault_addr) {
+    uint64_t start = rdtsc();
+    uint64_t err = frame->err_code;
+    uint32_t flags = 0;
+
+    if (err & X86_PFE_PRESENT)
+        flags |= VM_FAULT_FLAG_PRESENT;
+    if (err & X86_PFE_WRITE)
+        flags |= VM_FAULT_FLAG_WRITE;
+    if (err & X86_PFE_USER)
+        flags |= VM_FAULT_FLAG_USER;
+    if (err & X86_PFE_INSTRUCTION)
+        flags |= VM_FAULT_FLAG_INSTRUCTION;
+
+    /* resolving the fault may block, restore the interrupted context's state */
+    if (frame->flags & X86_FLAGS_IF)
+        arch_enable_ints();
+
+    int ret = vm_page_fault(fault_addr, flags);
+
+    arch_disable_ints();
+
+    if (unlikely(ret != 0)) {
+        panic("page fault at %#lx, ip %#lx, error %#lx, cpu %u\n", (unsigned long)fault_addr,
+              (unsigned long)frame->ip, (unsigned long)err, arch_curr_cpu_num());
+    }
+
+    int_account(X86_INT_PAGE_FAULT, start);
+}
+
+static void dump_iframe(const x86_iframe_t *f) {
+    printf(" ip %#18lx cs %#6lx flags %#10lx err %#lx\n", (unsigned long)f->ip,
+           (unsigned long)f->cs, (unsigned long)f->flags, (unsigned long)f->err_code);
+    printf(" sp %#18lx ss %#6lx\n", (unsigned long)f->sp, (unsigned long)f->ss);
+    printf(" rax %#18lx rbx %#18lx rcx %#18lx rdx %#18lx\n", (unsigned long)f->rax,
+           (unsigned long)f->rbx, (unsigned long)f->rcx, (unsigned long)f->rdx);
+    printf(" rsi %#18lx rdi %#18lx rbp %#18lx\n", (unsigned long)f->rsi,
+           (unsigned long)f->rdi, (unsigned long)f->rbp);
+    printf(" r8  %#18lx r9  %#18lx r10 %#18lx r11 %#18lx\n", (unsigned long)f->r8,
+           (unsigned long)f->r9, (unsigned long)f->r10, (unsigned long)f->r11);
+    printf(" r12 %#18lx r13 %#18lx r14 %#18lx r15 %#18lx\n", (unsigned long)f->r12,
+           (unsigned long)f->r13, (unsigned long)f->r14, (unsigned long)f->r15);
+}
+
+void x86_exception_handler(x86_iframe_t *frame) {
+    uint64_t start = rdtsc();
+    uint32_t vector = (uint32_t)frame->vector;
+    int_handler_entry_t *entry = &int_handlers[vector];
+    int_handler handler = atomic_load_acquire(&entry->handler);
+
+    /* an installed handler owns the vector, e.g. nmi for profiling */
+    if (handler) {
+        x86_percpu_t *p = x86_get_percpu();
+        uintptr_t ip = p->int_ip, fp = p->int_fp;
+
+        /* an nmi may land in the middle of an irq handler */
+        p->int_ip = frame->ip;
+        p->int_fp = frame->rbp;
+
+        handler(entry->arg);
+
+        p->int_ip = ip;
+        p->int_fp = fp;
+
+        int_account(vector, start);
+        return;
+    }
+
+    switch (vector) {
+    case X86_INT_NMI:
+        break;
+
+    case X86_INT_DEBUG:
+    case X86_INT_BREAKPOINT:
+        printf("%s at ip %#lx\n", exception_names[vector], (unsigned long)frame->ip);
+        break;
+
+    default:
+        printf("unhandled exception %u (%s) on cpu %u\n", vector,
+               exception_names[vector] ? exception_names[vector] : "reserved",
+               arch_curr_cpu_num());
+        dump_iframe(frame);
+        panic("unhandled exception %u\n", vector);
+    }
+
+    int_account(vector, start);
+}
+
+/* ------------------------------------------------------------------------ */
+
+void int_get_stats(uint32_t cpu, uint32_t vector, int_stats_t *out) {
+    *out = int_stats[cpu][vector];
+}
+
+void int_dump_stats(void) {
+    printf("cpu vector       count  avg cycles  max cycles\n");
+
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; ++cpu) {
+        for (uint32_t v = 0; v < X86_NUM_VECTORS; ++v) {
+            int_stats_t *s = &int_stats[cpu][v];
+            if (!s->count)
+                continue;
+
+            printf("%3u %6u %11llu %11llu %11llu\n", cpu, v, (unsigned long long)s->count,
+                   (unsigned long long)(s->cycles / s->count),
+                   (unsigned long long)s->max_cycles);
+        }
+    }
+}
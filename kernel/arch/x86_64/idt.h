@@ -0,0 +1,86 @@
+#ifndef _X86_IDT_H_
+#define _X86_IDT_H_
+
+/* Exception vectors */
+#define X86_INT_DIVIDE_0            0
+#define X86_INT_DEBUG               1
+#define X86_INT_NMI                 2
+#define X86_INT_BREAKPOINT          3
+#define X86_INT_OVERFLOW            4
+#define X86_INT_BOUND_RANGE         5
+#define X86_INT_INVALID_OP          6
+#define X86_INT_DEVICE_NA           7
+#define X86_INT_DOUBLE_FAULT        8
+#define X86_INT_INVALID_TSS         10
+#define X86_INT_SEGMENT_NP          11
+#define X86_INT_STACK_FAULT         12
+#define X86_INT_GP_FAULT            13
+#define X86_INT_PAGE_FAULT          14
+#define X86_INT_FPU_FP_ERROR        16
+#define X86_INT_ALIGNMENT_CHECK     17
+#define X86_INT_MACHINE_CHECK       18
+#define X86_INT_SIMD_FP_ERROR       19
+#define X86_INT_VIRT                20
+#define X86_INT_CONTROL_PROTECTION  21
+#define X86_INT_VMM_COMMUNICATION   29
+#define X86_INT_SECURITY            30
+
+#define X86_INT_MAX_EXCEPTION       31
+#define X86_INT_PLATFORM_BASE       32
+#define X86_NUM_VECTORS             256
+
+/* Every entry stub is padded to this size, stub n is at x86_isr_stubs + n * size */
+#define X86_ISR_STUB_SIZE           16
+
+/* Page fault error code */
+#define X86_PFE_PRESENT             0x01
+#define X86_PFE_WRITE               0x02
+#define X86_PFE_USER                0x04
+#define X86_PFE_RSVD                0x08
+#define X86_PFE_INSTRUCTION         0x10
+
+#ifndef __ASSEMBLER__
+
+#include "../../types.h"
+
+/*
+ * Frame of the exception entry. Faults are rare and usually end in a
+ * register dump, so all general purpose registers are saved.
+ */
+typedef struct x86_iframe {
+    uint64_t r15, r14, r13, r12, r11, r10, r9, r8;
+    uint64_t rdi, rsi, rbp, rdx, rcx, rbx, rax;
+    uint64_t vector;
+    uint64_t err_code;
+    uint64_t ip, cs, flags;
+    uint64_t sp, ss;
+} x86_iframe_t;
+
+/*
+ * Frame of the interrupt and page fault entries. The handlers are C
+ * functions that preserve the callee saved registers themselves, so
+ * only the caller saved ones are pushed.
+ */
+typedef struct x86_irq_frame {
+    uint64_t r11, r10, r9, r8;
+    uint64_t rdi, rsi, rdx, rcx, rax;
+    uint64_t vector;
+    uint64_t err_code;
+    uint64_t ip, cs, flags;
+    uint64_t sp, ss;
+} x86_irq_frame_t;
+
+/** @brief  Fill in the IDT, boot cpu only. */
+void x86_idt_init(void);
+
+/** @brief  Load the IDT on the current cpu. */
+void x86_idt_load(void);
+
+/* Called from the entry stubs */
+void x86_exception_handler(x86_iframe_t *frame);
+void x86_irq_handler(x86_irq_frame_t *frame);
+void x86_page_fault_handler(x86_irq_frame_t *frame, vaddr_t fault_addr);
+
+#endif /* __ASSEMBLER__ */
+
+#endif /* _X86_IDT_H_ */
@@ -0,0 +1,57 @@
+#include "aspace.h"
+#include "ioapic.h"
+#include "mmu.h"
+#include "percpu.h"
+
+/* Indirect register access, select then read or write the window */
+#define IOAPIC_REGSEL               0x00
+#define IOAPIC_IOWIN                0x10
+
+#define IOAPIC_REG_VERSION          0x01
+#define IOAPIC_REG_REDTBL(n)        (0x10 + 2 * (n))
+
+/* Redirection entry, fixed delivery to a physical apic id */
+#define IOAPIC_REDTBL_MASKED        (1U << 16)
+#define IOAPIC_REDTBL_LEVEL         (1U << 15)
+#define IOAPIC_REDTBL_ACTIVE_LOW    (1U << 13)
+#define IOAPIC_REDTBL_DEST_SHIFT    24      /* In the high half. */
+
+static volatile uint32_t *ioapic_mmio;
+static uint32_t ioapic_lines;
+
+static uint32_t ioapic_read(uint32_t reg) {
+    ioapic_mmio[IOAPIC_REGSEL / sizeof(uint32_t)] = reg;
+    return ioapic_mmio[IOAPIC_IOWIN / sizeof(uint32_t)];
+}
+
+static void ioapic_write(uint32_t reg, uint32_t val) {
+    ioapic_mmio[IOAPIC_REGSEL / sizeof(uint32_t)] = reg;
+    ioapic_mmio[IOAPIC_IOWIN / sizeof(uint32_t)] = val;
+}
+
+void ioapic_init(void) {
+    ioapic_mmio = (volatile uint32_t *)X86_PHYS_TO_VIRT(IOAPIC_DEFAULT_PHYS);
+
+    /* version register bits 23:16, the highest redirection entry */
+    ioapic_lines = ((ioapic_read(IOAPIC_REG_VERSION) >> 16) & 0xff) + 1;
+
+    for (uint32_t gsi = 0; gsi < ioapic_lines; ++gsi)
+        ioapic_mask(gsi);
+}
+
+void ioapic_route(uint32_t gsi, uint8_t vector, uint32_t cpu) {
+    if (gsi >= ioapic_lines)
+        return;
+
+    /* masked while the halves are inconsistent */
+    ioapic_write(IOAPIC_REG_REDTBL(gsi), IOAPIC_REDTBL_MASKED);
+    ioapic_write(IOAPIC_REG_REDTBL(gsi) + 1, percpu[cpu].apic_id << IOAPIC_REDTBL_DEST_SHIFT);
+    ioapic_write(IOAPIC_REG_REDTBL(gsi), vector);
+}
+
+void ioapic_mask(uint32_t gsi) {
+    if (gsi >= ioapic_lines)
+        return;
+
+    ioapic_write(IOAPIC_REG_REDTBL(gsi), IOAPIC_REDTBL_MASKED);
+}
@@ -0,0 +1,30 @@
+#ifndef _X86_IOAPIC_H_
+#define _X86_IOAPIC_H_
+
+#include "idt.h"
+#include "../../types.h"
+
+/*
+ * I/O apic, routes the platform interrupt lines to local apic vectors.
+ *
+ * Only the first I/O apic at its architectural address is used until the
+ * MADT is parsed. ISA irqs are taken as identity mapped to GSIs, which
+ * holds for everything but the timer on QEMU and most PCs.
+ */
+
+#define IOAPIC_DEFAULT_PHYS         0xfec00000
+
+/* Vectors of ISA irqs, the same ones the legacy pics were moved to */
+#define IOAPIC_ISA_VECTOR(irq)      (X86_INT_PLATFORM_BASE + (irq))
+
+#define IOAPIC_ISA_IRQ_COM1         4
+
+/** @brief  Map the I/O apic and mask every line, boot cpu only. */
+void ioapic_init(void);
+
+/** @brief  Deliver gsi as an edge triggered, active high vector to a cpu. */
+void ioapic_route(uint32_t gsi, uint8_t vector, uint32_t cpu);
+
+void ioapic_mask(uint32_t gsi);
+
+#endif /* _X86_IOAPIC_H_ */
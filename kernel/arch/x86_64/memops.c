@@ -0,0 +1,544 @@
+#include "alternative.h"
+#include "memops.h"
+#include "x86.h"
+#include "../../compiler.h"
+#include "defines.h"
+
+#include <string.h>
+
+/*
+ * The small loops below look like memset and memcpy to the optimizer,
+ * which would turn them back into calls to the functions they are in.
+ */
+#pragma GCC optimize("no-tree-loop-distribute-patterns")
+
+typedef uint64_t u64_unaligned_t __attribute__((may_alias, aligned(1)));
+typedef uint32_t u32_unaligned_t __attribute__((may_alias, aligned(1)));
+
+typedef void *(*memset_fn_t)(void *dst, int c, size_t len);
+typedef void *(*memcpy_fn_t)(void *dst, const void *src, size_t len);
+
+static inline uint64_t memset_pattern(int c) {
+    return 0x0101010101010101ULL * (uint8_t)c;
+}
+
+/* interrupts off around the vector loops, see memops.h */
+static inline bool vector_begin(void) {
+    bool ints = save_flags() & X86_FLAGS_IF;
+
+    if (ints)
+        cli();
+
+    return ints;
+}
+
+static inline void vector_end(bool ints) {
+    if (ints)
+        sti();
+}
+
+/* ------------------------------ Small ------------------------------ */
+
+static inline void *memset_small(void *dst, int c, size_t len) {
+    uint8_t *d = dst;
+    uint64_t v = memset_pattern(c);
+
+    if (len >= 8) {
+        for (size_t i = 0; i + 8 < len; i += 8)
+            *(u64_unaligned_t *)(d + i) = v;
+        *(u64_unaligned_t *)(d + len - 8) = v;
+    } else if (len >= 4) {
+        *(u32_unaligned_t *)d = (uint32_t)v;
+        *(u32_unaligned_t *)(d + len - 4) = (uint32_t)v;
+    } else if (len) {
+        d[0] = (uint8_t)c;
+        d[len >> 1] = (uint8_t)c;
+        d[len - 1] = (uint8_t)c;
+    }
+
+    return dst;
+}
+
+static inline void *memcpy_small(void *dst, const void *src, size_t len) {
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+
+    if (len >= 8) {
+        uint64_t last = *(const u64_unaligned_t *)(s + len - 8);
+
+        for (size_t i = 0; i + 8 < len; i += 8)
+            *(u64_unaligned_t *)(d + i) = *(const u64_unaligned_t *)(s + i);
+        *(u64_unaligned_t *)(d + len - 8) = last;
+    } else if (len >= 4) {
+        uint32_t first = *(const u32_unaligned_t *)s;
+        uint32_t last = *(const u32_unaligned_t *)(s + len - 4);
+
+        *(u32_unaligned_t *)d = first;
+        *(u32_unaligned_t *)(d + len - 4) = last;
+    } else if (len) {
+        uint8_t a = s[0], b = s[len >> 1], z = s[len - 1];
+
+        d[0] = a;
+        d[len >> 1] = b;
+        d[len - 1] = z;
+    }
+
+    return dst;
+}
+
+/* ------------------------------ rep ------------------------------ */
+
+static void *memset_rep(void *dst, int c, size_t len) {
+    void *d = dst;
+    size_t n = len >> 3;
+
+    __asm__ __volatile__("rep stosq" : "+D"(d), "+c"(n) : "a"(memset_pattern(c)) : "memory");
+
+    n = len & 7;
+    __asm__ __volatile__("rep stosb" : "+D"(d), "+c"(n) : "a"(c) : "memory");
+
+    return dst;
+}
+
+static void *memset_erms(void *dst, int c, size_t len) {
+    void *d = dst;
+
+    __asm__ __volatile__("rep stosb" : "+D"(d), "+c"(len) : "a"(c) : "memory");
+
+    return dst;
+}
+
+static void *memcpy_rep(void *dst, const void *src, size_t len) {
+    void *d = dst;
+    size_t n = len >> 3;
+
+    __asm__ __volatile__("rep movsq" : "+D"(d), "+S"(src), "+c"(n) : : "memory");
+
+    n = len & 7;
+    __asm__ __volatile__("rep movsb" : "+D"(d), "+S"(src), "+c"(n) : : "memory");
+
+    return dst;
+}
+
+static void *memcpy_erms(void *dst, const void *src, size_t len) {
+    void *d = dst;
+
+    __asm__ __volatile__("rep movsb" : "+D"(d), "+S"(src), "+c"(len) : : "memory");
+
+    return dst;
+}
+
+/* ------------------------------ Vector ------------------------------ */
+
+/*
+ * An unaligned store at each end, aligned ones in between, the ends
+ * overlap them. len must be at least the vector size.
+ */
+
+static void *memset_sse2(void *dst, int c, size_t len) {
+    uint8_t save[16] ALIGNED(16);
+    uintptr_t end = (uintptr_t)dst + len;
+    uintptr_t p = ((uintptr_t)dst + 16) & ~(uintptr_t)15;
+    uintptr_t t;
+    bool ints = vector_begin();
+
+    __asm__ __volatile__(
+        "movdqa %%xmm0, (%[save]) \n\t"
+        "movq %[pat], %%xmm0 \n\t"
+        "punpcklqdq %%xmm0, %%xmm0 \n\t"
+        "movdqu %%xmm0, (%[dst]) \n\t"
+        "movdqu %%xmm0, -16(%[end]) \n\t"
+        "lea 64(%[p]), %[t] \n\t"
+        "cmp %[end], %[t] \n\t"
+        "ja 2f \n\t"
+        "1: \n\t"
+        "movdqa %%xmm0, (%[p]) \n\t"
+        "movdqa %%xmm0, 16(%[p]) \n\t"
+        "movdqa %%xmm0, 32(%[p]) \n\t"
+        "movdqa %%xmm0, 48(%[p]) \n\t"
+        "mov %[t], %[p] \n\t"
+        "lea 64(%[p]), %[t] \n\t"
+        "cmp %[end], %[t] \n\t"
+        "jbe 1b \n\t"
+        "2: \n\t"
+        "lea 16(%[p]), %[t] \n\t"
+        "cmp %[end], %[t] \n\t"
+        "ja 3f \n\t"
+        "movdqa %%xmm0, (%[p]) \n\t"
+        "mov %[t], %[p] \n\t"
+        "jmp 2b \n\t"
+        "3: \n\t"
+        "movdqa (%[save]), %%xmm0 \n\t"
+        : [p] "+r"(p), [t] "=&r"(t)
+        : [save] "r"(save), [pat] "r"(memset_pattern(c)), [dst] "r"(dst), [end] "r"(end)
+        : "memory", "cc"
+    );
+
+    vector_end(ints);
+    return dst;
+}
+
+static void *memset_avx2(void *dst, int c, size_t len) {
+    uint8_t save[32] ALIGNED(32);
+    uintptr_t end = (uintptr_t)dst + len;
+    uintptr_t p = ((uintptr_t)dst + 32) & ~(uintptr_t)31;
+    uintptr_t t;
+    bool ints = vector_begin();
+
+    /* the whole ymm register back, upper half too, the interrupted code may use it */
+    __asm__ __volatile__(
+        "vmovdqa %%ymm0, (%[save]) \n\t"
+        "vmovq %[pat], %%xmm0 \n\t"
+        "vpbroadcastq %%xmm0, %%ymm0 \n\t"
+        "vmovdqu %%ymm0, (%[dst]) \n\t"
+        "vmovdqu %%ymm0, -32(%[end]) \n\t"
+        "lea 128(%[p]), %[t] \n\t"
+        "cmp %[end], %[t] \n\t"
+        "ja 2f \n\t"
+        "1: \n\t"
+        "vmovdqa %%ymm0, (%[p]) \n\t"
+        "vmovdqa %%ymm0, 32(%[p]) \n\t"
+        "vmovdqa %%ymm0, 64(%[p]) \n\t"
+        "vmovdqa %%ymm0, 96(%[p]) \n\t"
+        "mov %[t], %[p] \n\t"
+        "lea 128(%[p]), %[t] \n\t"
+        "cmp %[end], %[t] \n\t"
+        "jbe 1b \n\t"
+        "2: \n\t"
+        "lea 32(%[p]), %[t] \n\t"
+        "cmp %[end], %[t] \n\t"
+        "ja 3f \n\t"
+        "vmovdqa %%ymm0, (%[p]) \n\t"
+        "mov %[t], %[p] \n\t"
+        "jmp 2b \n\t"
+        "3: \n\t"
+        "vmovdqa (%[save]), %%ymm0 \n\t"
+        : [p] "+r"(p), [t] "=&r"(t)
+        : [save] "r"(save), [pat] "r"(memset_pattern(c)), [dst] "r"(dst), [end] "r"(end)
+        : "memory", "cc"
+    );
+
+    vector_end(ints);
+    return dst;
+}
+
+static void *memcpy_sse2(void *dst, const void *src, size_t len) {
+    uint8_t save[64] ALIGNED(16);
+    uintptr_t end = (uintptr_t)dst + len;
+    uintptr_t p = ((uintptr_t)dst + 16) & ~(uintptr_t)15;
+    uintptr_t s = (uintptr_t)src + (p - (uintptr_t)dst);
+    uintptr_t t;
+    bool ints = vector_begin();
+
+    __asm__ __volatile__(
+        "movdqa %%xmm0, (%[save]) \n\t"
+        "movdqa %%xmm1, 16(%[save]) \n\t"
+        "movdqa %%xmm2, 32(%[save]) \n\t"
+        "movdqa %%xmm3, 48(%[save]) \n\t"
+        "movdqu (%[src]), %%xmm0 \n\t"
+        "movdqu -16(%[src], %[len]), %%xmm1 \n\t"
+        "movdqu %%xmm0, (%[dst]) \n\t"
+        "movdqu %%xmm1, -16(%[end]) \n\t"
+        "lea 64(%[p]), %[t] \n\t"
+        "cmp %[end], %[t] \n\t"
+        "ja 2f \n\t"
+        "1: \n\t"
+        "movdqu (%[s]), %%xmm0 \n\t"
+        "movdqu 16(%[s]), %%xmm1 \n\t"
+        "movdqu 32(%[s]), %%xmm2 \n\t"
+        "movdqu 48(%[s]), %%xmm3 \n\t"
+        "movdqa %%xmm0, (%[p]) \n\t"
+        "movdqa %%xmm1, 16(%[p]) \n\t"
+        "movdqa %%xmm2, 32(%[p]) \n\t"
+        "movdqa %%xmm3, 48(%[p]) \n\t"
+        "add $64, %[s] \n\t"
+        "mov %[t], %[p] \n\t"
+        "lea 64(%[p]), %[t] \n\t"
+        "cmp %[end], %[t] \n\t"
+        "jbe 1b \n\t"
+        "2: \n\t"
+        "lea 16(%[p]), %[t] \n\t"
+        "cmp %[end], %[t] \n\t"
+        "ja 3f \n\t"
+        "movdqu (%[s]), %%xmm0 \n\t"
+        "movdqa %%xmm0, (%[p]) \n\t"
+        "add $16, %[s] \n\t"
+        "mov %[t], %[p] \n\t"
+        "jmp 2b \n\t"
+        "3: \n\t"
+        "movdqa (%[save]), %%xmm0 \n\t"
+        "movdqa 16(%[save]), %%xmm1 \n\t"
+        "movdqa 32(%[save]), %%xmm2 \n\t"
+        "movdqa 48(%[save]), %%xmm3 \n\t"
+        : [p] "+r"(p), [s] "+r"(s), [t] "=&r"(t)
+        : [save] "r"(save), [src] "r"(src), [len] "r"(len), [dst] "r"(dst), [end] "r"(end)
+        : "memory", "cc"
+    );
+
+    vector_end(ints);
+    return dst;
+}
+
+static void *memcpy_avx2(void *dst, const void *src, size_t len) {
+    uint8_t save[128] ALIGNED(32);
+    uintptr_t end = (uintptr_t)dst + len;
+    uintptr_t p = ((uintptr_t)dst + 32) & ~(uintptr_t)31;
+    uintptr_t s = (uintptr_t)src + (p - (uintptr_t)dst);
+    uintptr_t t;
+    bool ints = vector_begin();
+
+    __asm__ __volatile__(
+        "vmovdqa %%ymm0, (%[save]) \n\t"
+        "vmovdqa %%ymm1, 32(%[save]) \n\t"
+        "vmovdqa %%ymm2, 64(%[save]) \n\t"
+        "vmovdqa %%ymm3, 96(%[save]) \n\t"
+        "vmovdqu (%[src]), %%ymm0 \n\t"
+        "vmovdqu -32(%[src], %[len]), %%ymm1 \n\t"
+        "vmovdqu %%ymm0, (%[dst]) \n\t"
+        "vmovdqu %%ymm1, -32(%[end]) \n\t"
+        "lea 128(%[p]), %[t] \n\t"
+        "cmp %[end], %[t] \n\t"
+        "ja 2f \n\t"
+        "1: \n\t"
+        "vmovdqu (%[s]), %%ymm0 \n\t"
+        "vmovdqu 32(%[s]), %%ymm1 \n\t"
+        "vmovdqu 64(%[s]), %%ymm2 \n\t"
+        "vmovdqu 96(%[s]), %%ymm3 \n\t"
+        "vmovdqa %%ymm0, (%[p]) \n\t"
+        "vmovdqa %%ymm1, 32(%[p]) \n\t"
+        "vmovdqa %%ymm2, 64(%[p]) \n\t"
+        "vmovdqa %%ymm3, 96(%[p]) \n\t"
+        "add $128, %[s] \n\t"
+        "mov %[t], %[p] \n\t"
+        "lea 128(%[p]), %[t] \n\t"
+        "cmp %[end], %[t] \n\t"
+        "jbe 1b \n\t"
+        "2: \n\t"
+        "lea 32(%[p]), %[t] \n\t"
+        "cmp %[end], %[t] \n\t"
+        "ja 3f \n\t"
+        "vmovdqu (%[s]), %%ymm0 \n\t"
+        "vmovdqa %%ymm0, (%[p]) \n\t"
+        "add $32, %[s] \n\t"
+        "mov %[t], %[p] \n\t"
+        "jmp 2b \n\t"
+        "3: \n\t"
+        "vmovdqa (%[save]), %%ymm0 \n\t"
+        "vmovdqa 32(%[save]), %%ymm1 \n\t"
+        "vmovdqa 64(%[save]), %%ymm2 \n\t"
+        "vmovdqa 96(%[save]), %%ymm3 \n\t"
+        : [p] "+r"(p), [s] "+r"(s), [t] "=&r"(t)
+        : [save] "r"(save), [src] "r"(src), [len] "r"(len), [dst] "r"(dst), [end] "r"(end)
+        : "memory", "cc"
+    );
+
+    vector_end(ints);
+    return dst;
+}
+
+/* ------------------------------ Dispatch ------------------------------ */
+
+static const char *const impl_names[MEMOPS_NUM_IMPLS] = {
+    [MEMOPS_REP]    = "rep",
+    [MEMOPS_ERMS]   = "erms",
+    [MEMOPS_SSE2]   = "sse2",
+    [MEMOPS_AVX2]   = "avx2",
+};
+
+static const memset_fn_t memset_impls[MEMOPS_NUM_IMPLS] = {
+    [MEMOPS_REP]    = memset_rep,
+    [MEMOPS_ERMS]   = memset_erms,
+    [MEMOPS_SSE2]   = memset_sse2,
+    [MEMOPS_AVX2]   = memset_avx2,
+};
+
+static const memcpy_fn_t memcpy_impls[MEMOPS_NUM_IMPLS] = {
+    [MEMOPS_REP]    = memcpy_rep,
+    [MEMOPS_ERMS]   = memcpy_erms,
+    [MEMOPS_SSE2]   = memcpy_sse2,
+    [MEMOPS_AVX2]   = memcpy_avx2,
+};
+
+/*
+ * The rep forms in place: stosq/movsq and a byte tail, rewritten to a
+ * single stosb/movsb on ERMS cpus. That is what runs until the sites are
+ * patched, it works on anything.
+ */
+static inline void *memset_large(void *dst, int c, size_t len) {
+    void *d = dst;
+
+    __asm__ __volatile__(
+        ALTERNATIVE("mov %%rcx, %%rdx \n\t"
+                    "shr $3, %%rcx \n\t"
+                    "rep stosq \n\t"
+                    "mov %%edx, %%ecx \n\t"
+                    "and $7, %%ecx \n\t"
+                    "rep stosb",
+                    "rep stosb", X86_FEATURE_ERMS)
+        : "+D"(d), "+c"(len)
+        : "a"(memset_pattern(c))
+        : "rdx", "memory", "cc"
+    );
+
+    return dst;
+}
+
+static inline void *memcpy_large(void *dst, const void *src, size_t len) {
+    void *d = dst;
+
+    __asm__ __volatile__(
+        ALTERNATIVE("mov %%rcx, %%rdx \n\t"
+                    "shr $3, %%rcx \n\t"
+                    "rep movsq \n\t"
+                    "mov %%edx, %%ecx \n\t"
+                    "and $7, %%ecx \n\t"
+                    "rep movsb",
+                    "rep movsb", X86_FEATURE_ERMS)
+        : "+D"(d), "+S"(src), "+c"(len)
+        :
+        : "rdx", "memory", "cc"
+    );
+
+    return dst;
+}
+
+void *memset(void *dst, int c, size_t len) {
+    if (len <= MEMOPS_SMALL_MAX)
+        return memset_small(dst, c, len);
+
+    if (len < MEMOPS_REP_MIN) {
+        if (x86_feature_static(X86_FEATURE_AVX2))
+            return memset_avx2(dst, c, len);
+        if (x86_feature_static(X86_FEATURE_SSE2))
+            return memset_sse2(dst, c, len);
+    }
+
+    return memset_large(dst, c, len);
+}
+
+void *memcpy(void *dst, const void *src, size_t len) {
+    if (len <= MEMOPS_SMALL_MAX)
+        return memcpy_small(dst, src, len);
+
+    if (len < MEMOPS_REP_MIN) {
+        if (x86_feature_static(X86_FEATURE_AVX2))
+            return memcpy_avx2(dst, src, len);
+        if (x86_feature_static(X86_FEATURE_SSE2))
+            return memcpy_sse2(dst, src, len);
+    }
+
+    return memcpy_large(dst, src, len);
+}
+
+void *x86_memset_impl(memops_impl_t impl, void *dst, int c, size_t len) {
+    if (len <= MEMOPS_SMALL_MAX)
+        return memset_small(dst, c, len);
+
+    return memset_impls[impl](dst, c, len);
+}
+
+void *x86_memcpy_impl(memops_impl_t impl, void *dst, const void *src, size_t len) {
+    if (len <= MEMOPS_SMALL_MAX)
+        return memcpy_small(dst, src, len);
+
+    return memcpy_impls[impl](dst, src, len);
+}
+
+bool x86_memops_supported(memops_impl_t impl) {
+    switch (impl) {
+        case MEMOPS_REP:
+            return true;
+        case MEMOPS_ERMS:
+            return x86_feature_test(X86_FEATURE_ERMS);
+        case MEMOPS_SSE2:
+            return x86_feature_test(X86_FEATURE_SSE2);
+        case MEMOPS_AVX2:
+            return x86_feature_test(X86_FEATURE_AVX2);
+        default:
+            return false;
+    }
+}
+
+const char *x86_memops_name(memops_impl_t impl) {
+    return impl < MEMOPS_NUM_IMPLS ? impl_names[impl] : "?";
+}
+
+/* ------------------------------ Pages ------------------------------ */
+
+void arch_clear_page(void *page) {
+    memset_large(page, 0, PAGE_SIZE);
+}
+
+void arch_copy_page(void *dst, const void *src) {
+    memcpy_large(dst, src, PAGE_SIZE);
+}
+
+void arch_clear_page_nt(void *page) {
+    uintptr_t p = (uintptr_t)page;
+    uintptr_t end = p + PAGE_SIZE;
+
+    /* movnti works from general purpose registers, no vector state to save */
+    __asm__ __volatile__(
+        "1: \n\t"
+        "movnti %[zero], (%[p]) \n\t"
+        "movnti %[zero], 8(%[p]) \n\t"
+        "movnti %[zero], 16(%[p]) \n\t"
+        "movnti %[zero], 24(%[p]) \n\t"
+        "movnti %[zero], 32(%[p]) \n\t"
+        "movnti %[zero], 40(%[p]) \n\t"
+        "movnti %[zero], 48(%[p]) \n\t"
+        "movnti %[zero], 56(%[p]) \n\t"
+        "add $64, %[p] \n\t"
+        "cmp %[end], %[p] \n\t"
+        "jne 1b \n\t"
+        "sfence \n\t"
+        : [p] "+r"(p)
+        : [zero] "r"(0UL), [end] "r"(end)
+        : "memory", "cc"
+    );
+}
+
+void arch_copy_page_nt(void *dst, const void *src) {
+    uint8_t save[64] ALIGNED(16);
+    uintptr_t p = (uintptr_t)dst;
+    uintptr_t s = (uintptr_t)src;
+    uintptr_t end = p + PAGE_SIZE;
+
+    if (!x86_feature_static(X86_FEATURE_SSE2)) {
+        memcpy_rep(dst, src, PAGE_SIZE);
+        return;
+    }
+
+    bool ints = vector_begin();
+
+    /* the stores are weakly ordered, the sfence puts them before what follows */
+    __asm__ __volatile__(
+        "movdqa %%xmm0, (%[save]) \n\t"
+        "movdqa %%xmm1, 16(%[save]) \n\t"
+        "movdqa %%xmm2, 32(%[save]) \n\t"
+        "movdqa %%xmm3, 48(%[save]) \n\t"
+        "1: \n\t"
+        "movdqa (%[s]), %%xmm0 \n\t"
+        "movdqa 16(%[s]), %%xmm1 \n\t"
+        "movdqa 32(%[s]), %%xmm2 \n\t"
+        "movdqa 48(%[s]), %%xmm3 \n\t"
+        "movntdq %%xmm0, (%[p]) \n\t"
+        "movntdq %%xmm1, 16(%[p]) \n\t"
+        "movntdq %%xmm2, 32(%[p]) \n\t"
+        "movntdq %%xmm3, 48(%[p]) \n\t"
+        "add $64, %[s] \n\t"
+        "add $64, %[p] \n\t"
+        "cmp %[end], %[p] \n\t"
+        "jne 1b \n\t"
+        "sfence \n\t"
+        "movdqa (%[save]), %%xmm0 \n\t"
+        "movdqa 16(%[save]), %%xmm1 \n\t"
+        "movdqa 32(%[save]), %%xmm2 \n\t"
+        "movdqa 48(%[save]), %%xmm3 \n\t"
+        : [p] "+r"(p), [s] "+r"(s)
+        : [save] "r"(save), [end] "r"(end)
+        : "memory", "cc"
+    );
+
+    vector_end(ints);
+}
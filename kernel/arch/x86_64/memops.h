@@ -0,0 +1,55 @@
+#ifndef _X86_MEMOPS_H_
+#define _X86_MEMOPS_H_
+
+#include "../../types.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * memset, memcpy and whole page clear and copy.
+ *
+ * Calls are split by size. Up to MEMOPS_SMALL_MAX bytes are done inline
+ * with a few overlapping stores. Sizes up to MEMOPS_REP_MIN go through the
+ * vector loop the cpu does best, and larger ones go to rep stos/movs. With
+ * ERMS that is the byte form, which the microcode turns into full cache
+ * line stores. There is no dispatch at run time: x86_apply_alternatives()
+ * patches the choice into the code, and until then the rep form does all
+ * of it.
+ *
+ * The vector loops run with interrupts off and save the registers they
+ * use, all 256 bits of the ymm ones, so they are safe from interrupt
+ * handlers and in the middle of the floating point code of the
+ * interrupted thread.
+ *
+ * Pages have a cached and a non-temporal variant. Use the non-temporal
+ * one for pages nobody will touch soon, it does not evict the working set.
+ */
+
+#define MEMOPS_SMALL_MAX    64
+#define MEMOPS_REP_MIN      2048
+
+typedef enum memops_impl {
+    MEMOPS_REP,         /* rep stosq/movsq and a byte tail, any cpu. */
+    MEMOPS_ERMS,        /* rep stosb/movsb. */
+    MEMOPS_SSE2,        /* 64 bytes per iteration, aligned stores. */
+    MEMOPS_AVX2,        /* 128 bytes per iteration, aligned stores. */
+    MEMOPS_NUM_IMPLS,
+} memops_impl_t;
+
+bool x86_memops_supported(memops_impl_t impl);
+const char *x86_memops_name(memops_impl_t impl);
+
+/* One implementation regardless of the size, for the benchmark */
+void *x86_memset_impl(memops_impl_t impl, void *dst, int c, size_t len);
+void *x86_memcpy_impl(memops_impl_t impl, void *dst, const void *src, size_t len);
+
+/** @brief  Zero a page that is about to be used. */
+void arch_clear_page(void *page);
+
+/** @brief  Zero a page with non-temporal stores, bypassing the caches. */
+void arch_clear_page_nt(void *page);
+
+void arch_copy_page(void *dst, const void *src);
+void arch_copy_page_nt(void *dst, const void *src);
+
+#endif /* _X86_MEMOPS_H_ */
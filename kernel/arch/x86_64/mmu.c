@@ -1,13 +1,21 @@
 #include "defines.h"
 #include "aspace.h"
+#include "feature.h"
 #include "mmu.h"
+#include "tlb.h"
 #include "x86.h"
+#include "arch_ops.h"
+#include "../../boot_trace.h"
+#include "../../list.h"
+#include "../../pmu.h"
+#include "../../stdlib.h"
+#include "../../trace.h"
 #include "../../vm/pmm.h"
 
 #include <string.h>
 
 /* Largest linear and physical address size. Assume 48 bits linear and
- * 32 bits physical. Use cpuid 80000008h query to update later.
+ * 32 bits physical until mmu_init() takes them from the feature registry.
  */
 unsigned char g_vaddr_width = 48; 
 unsigned char g_paddr_width = 32;
@@ -17,7 +25,8 @@ pt_entry_t pml4[NUM_PT_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
 pt_entry_t pdp[NUM_PT_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
 pt_entry_t pte[NUM_PT_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
 
-static bool supported_1gb_pages = false;
+/* from the feature registry in mmu_init() */
+static bool supported_1gb_pages;
 
 /* ------------------------- Address Validity ------------------------- */
 
@@ -34,7 +43,7 @@ int mmu_check_vaddr(vaddr_t vaddr) {
     unsigned long long lower_half_max = 0x00007fffffffffff;
 
     /* check if vaddr is cannonical */
-    return (vaddr > lower_half_max || vaddr < higher_half_min);
+    return (vaddr <= lower_half_max || vaddr >= higher_half_min);
 }
 
 int mmu_check_paddr(paddr_t paddr) {
@@ -46,416 +55,375 @@ int mmu_check_paddr(paddr_t paddr) {
     return paddr <= (((uint64_t)1ull << g_paddr_width) - 1);
 }
 
-/* -------------------- Page frame number getters -------------------- */
+/* -------------------------- Table helpers -------------------------- */
 
-/* 1GiB pages */
-static inline uint64_t get_pfn_from_pdpe(uint64_t pdpe) {
-    uint64_t pfn;
-    pfn = (pdpe & X86_1GB_PAGE_FRAME);
-    return pfn;
-}
+/* Leaf flags taken from mmu_flags, the rest are managed here. */
+#define X86_PAGE_LEAF_FLAGS     (X86_PAGE_BIT_RW | X86_PAGE_BIT_U | X86_PAGE_BIT_PWT | \
+                                 X86_PAGE_BIT_PCD | X86_PAGE_BIT_G)
 
-/* 2MiB pages */
-static inline uint64_t get_pfn_from_pde(uint64_t pde) {
-    uint64_t pfn;
-    pfn = (pde & X86_2MB_PAGE_FRAME);
-    return pfn;
+static inline uint32_t level_shift(page_level_t level) {
+    return PT_SHIFT + (level - PL_4K) * ADDR_OFFSET;
 }
 
-/* 4KiB pages */
-static inline uint64_t get_pfn_from_pte(uint64_t pte) {
-    uint64_t pfn;
-    pfn = (pte & X86_4KB_PAGE_FRAME);
-    return pfn;
+/* Bytes mapped by one entry of a table at level. */
+static inline size_t level_entry_size(page_level_t level) {
+    return (size_t)1 << level_shift(level);
 }
 
-/* -------------------- Table entry getter routines -------------------- */
-
-static inline uint64_t
-get_pml4e_from_pml4_table(vaddr_t vaddr, addr_t pml4t_base_addr) {
-    uint64_t *pml4_table_base_ptr = (uint64_t*)pml4t_base_addr;
-    uint32_t pml4e_index = VADDR_TO_PML4_INDEX(vaddr);
-    
-    return X86_PHYS_TO_VIRT(pml4_table_base_ptr[pml4e_index]);
+static inline uint32_t vaddr_to_index(vaddr_t vaddr, page_level_t level) {
+    return ((uint64_t)vaddr >> level_shift(level)) & (NUM_PT_ENTRIES - 1);
 }
 
-static inline uint64_t
-get_pdpe_from_pdp_table(vaddr_t vaddr, addr_t pdpt_base_addr) {
-    uint64_t *pdp_table_base_ptr = (uint64_t*)pdpt_base_addr;
-    uint32_t pdpe_index = VADDR_TO_PDP_INDEX(vaddr);
-    
-    return X86_PHYS_TO_VIRT(pdp_table_base_ptr[pdpe_index]);
+/* The table an upper level entry points to, through the physmap. */
+static inline pt_entry_t *entry_to_table(pt_entry_t entry) {
+    return (pt_entry_t *)X86_PHYS_TO_VIRT(entry & X86_4KB_PAGE_FRAME);
 }
 
-static inline uint64_t
-get_pde_from_pd_table(vaddr_t vaddr, addr_t pdt_base_addr) {
-    uint64_t *pd_table_base_ptr = (uint64_t*)pdt_base_addr;
-    uint32_t pde_index = VADDR_TO_PD_INDEX(vaddr);
-    
-    return X86_PHYS_TO_VIRT(pd_table_base_ptr[pde_index]);
+/* Tables pointed to by the upper levels are writable, the leaves decide. */
+static inline pt_entry_t table_to_entry(const pt_entry_t *table, uint64_t flags) {
+    return X86_VIRT_TO_PHYS(table) | X86_MMU_PG_FLAGS | (flags & X86_PAGE_BIT_U);
 }
 
-static inline uint64_t
-get_pte_from_ptable(vaddr_t vaddr, addr_t pt_base_addr) {
-    uint64_t *ptable_base_ptr = (uint64_t*)pt_base_addr;
-    uint32_t pte_index = VADDR_TO_PT_INDEX(vaddr);
-    
-    return X86_PHYS_TO_VIRT(ptable_base_ptr[pte_index]);
+/* 1 GiB pages in the PDP where the cpu has them, 2 MiB pages in the PD */
+static inline bool entry_is_large_page(pt_entry_t entry, page_level_t level) {
+    if (level == PL_1G)
+        return supported_1gb_pages && (entry & X86_PAGE_BIT_PS);
+
+    return level == PL_2M && (entry & X86_PAGE_BIT_PS);
 }
 
-/* ---------------------- Address mapping routines ---------------------- */
+/**
+ * @brief   Check wall the entires of the page table for present bit.
+ * @returns True if none of the entries has present bit set.
+ */
+static inline bool
+is_page_table_clear(const pt_entry_t* page_table) {
+    uint32_t lower_idx;
+    for (lower_idx = 0; lower_idx < NUM_PT_ENTRIES; ++lower_idx) {
+        if (page_table[lower_idx] & X86_PAGE_BIT_P) {
+            return false;
+        }
+    }
 
-mmu_status_t mmu_get_mapping(vaddr_t vaddr, addr_t pml4_base_addr,
-                    pt_entry_t *last_valid_entry, uint64_t *out_flags, uint32_t *out_level) {
-    uint64_t pml4e, pdpe, pde, pte;
-    pml4e = get_pml4e_from_pml4_table(vaddr, pml4_base_addr);
+    return true;
+}
 
-    /* TODO: assert(pml4_base_addr) */
+/** 
+ * @brief  Allocates a zeroed page table, returns its physmap address.
+ */
+static pt_entry_t *allocate_page_table(void) {
+    pt_entry_t *page_ptr = pmm_alloc_kpage(ALLOC_TAG_PAGE_TABLE);
 
-    if  (!(last_valid_entry) || !(out_flags) || !(out_level)) {
-        return ERR_INVALID_ARGS;
-    }
+    if (page_ptr)
+        arch_clear_page(page_ptr);
 
-    *out_level = PL_512G;
-    *last_valid_entry = pml4_base_addr;
-    *out_flags = 0;
+    return page_ptr;
+}
 
-    /* check if pml4 table entry present */
-    if (!(pml4e & X86_PAGE_BIT_P)) {
-        return ERR_ENTRY_NOT_PRESENT;
-    }
+/**
+ * @brief   Replace the large page in entry with a table of the next level
+ *          that maps the same range with the same flags.
+ * @returns The new table, NULL if out of memory.
+ */
+static pt_entry_t *
+split_large_page(pt_entry_t *entry, page_level_t level, vaddr_t vaddr, tlb_batch_t *tlb) {
+    pt_entry_t *table = allocate_page_table();
+    if (!table)
+        return NULL;
 
-    *out_level = PL_1G;
-    pdpe = get_pdpe_from_pdp_table(vaddr, pml4e);
+    size_t size = level_entry_size(level);
+    size_t sub_size = level_entry_size(level - 1);
+    paddr_t base = *entry & X86_4KB_PAGE_FRAME & ~(size - 1);
+    uint64_t flags = *entry & X86_PAGE_ENTRY_FLAGS_MASK;
 
-    if (!(pdpe & X86_PAGE_BIT_P)) {
-        *last_valid_entry = pml4e;
-        return ERR_ENTRY_NOT_PRESENT;
-    }
+    /* 4 KiB entries have no page size bit */
+    if (level - 1 == PL_4K)
+        flags &= ~(uint64_t)X86_PAGE_BIT_PS;
 
-    /* 1 GiB huge pages */
-    if ((pdpe & X86_PAGE_BIT_PS) && supported_1gb_pages) {
-        *last_valid_entry = get_pfn_from_pdpe(X86_VIRT_TO_PHYS(pdpe))
-                            + ((uint64_t)vaddr & X86_1GB_PAGE_OFFSET_MASK);
-        goto done;
-    }
+    for (uint32_t index = 0; index < NUM_PT_ENTRIES; ++index)
+        table[index] = (base + index * sub_size) | flags;
 
-    *out_level = PL_2M;
-    pde = get_pde_from_pd_table(vaddr, pdpe);
+    *entry = table_to_entry(table, flags);
 
-    if (!(pde & X86_PAGE_BIT_P)) {
-        *last_valid_entry = pdpe;
-        return ERR_ENTRY_NOT_PRESENT;
-    }
+    /* the old translation may be cached as a single large entry */
+    tlb_batch_add(tlb, ROUNDDOWN(vaddr, size), size / PAGE_SIZE);
 
-    /* 2 MiB huge pages */
-    if (pde & X86_PAGE_BIT_PS) {
-        *last_valid_entry = get_pfn_from_pde(X86_VIRT_TO_PHYS(pde))
-                            + ((uint64_t)vaddr & X86_2MB_PAGE_OFFSET_MASK);
-        goto done;
-    }
+    return table;
+}
 
-    /* 4 KiB pages */
-    *out_level = PL_4K;
-    pte = get_pte_from_ptable(vaddr, pde);
+/* -------------------------- Address lookup -------------------------- */
 
-    if (!(pte & X86_PAGE_BIT_P)) {
-        *last_valid_entry = pde;
-        return ERR_ENTRY_NOT_PRESENT;
+mmu_status_t mmu_get_mapping(vaddr_t vaddr, addr_t pml4_base_addr,
+                    pt_entry_t *last_valid_entry, uint64_t *out_flags, uint32_t *out_level) {
+    if (!pml4_base_addr || !last_valid_entry || !out_flags || !out_level) {
+        return ERR_MMU_INVALID_ARGS;
     }
 
-    *last_valid_entry = get_pfn_from_pte(X86_VIRT_TO_PHYS(pte))
-                        + ((uint64_t)vaddr & X86_4KB_PAGE_OFFSET_MASK);
-    
-    *out_flags = (pte & X86_PAGE_ENTRY_FLAGS_MASK);
-
-done:
-    *out_level = PL_FRAME;
-    return NO_ERROR;
-}
+    PMU_SCOPE("mmu_get_mapping");
 
-/* ---------------------- Table entry update routines ---------------------- */
+    pt_entry_t *table = (pt_entry_t *)pml4_base_addr;
+    pt_entry_t entry;
+    page_level_t level;
 
-static void
-update_pt_entry(vaddr_t vaddr, uint64_t pde, paddr_t paddr, uint64_t flags) {
-    uint64_t *pt_table_ptr = (uint64_t *)(pde & X86_4KB_PAGE_FRAME);
-    uint32_t pt_index = (((uint64_t)vaddr >> PT_SHIFT) & ((1UL << ADDR_OFFSET) - 1));
-    
-    /* set the address and present bit */
-    pt_table_ptr[pt_index] = (uint64_t)paddr;
-    pt_table_ptr[pt_index] |= X86_PAGE_BIT_P;
+    *last_valid_entry = pml4_base_addr;
+    *out_flags = 0;
 
-    if (flags & X86_PAGE_BIT_U)
-        pt_table_ptr[pt_index] |= X86_PAGE_BIT_U;
-}
+    for (level = PL_512G; ; --level) {
+        *out_level = level;
+        entry = table[vaddr_to_index(vaddr, level)];
 
-static void
-update_pd_entry(vaddr_t vaddr, uint64_t pdpe, pt_entry_t map, uint64_t flags) {
-    uint64_t *pd_table_ptr = (uint64_t *)(pdpe & X86_4KB_PAGE_FRAME);
-    uint32_t pd_index = (((uint64_t)vaddr >> PD_SHIFT) & ((1UL << ADDR_OFFSET) - 1));
-    
-    /* set the address and present bit */
-    pd_table_ptr[pd_index] = (uint64_t)map;
-    pd_table_ptr[pd_index] |= X86_MMU_PG_FLAGS;
+        if (!(entry & X86_PAGE_BIT_P)) {
+            return ERR_MMU_ENTRY_NOT_PRESENT;
+        }
 
-    if (flags & X86_PAGE_BIT_U)
-        pd_table_ptr[pd_index] |= X86_PAGE_BIT_U;
-}
+        if (level == PL_4K || entry_is_large_page(entry, level)) {
+            break;
+        }
 
-static void
-update_pdp_entry(vaddr_t vaddr, uint64_t pml4e, pt_entry_t map, uint64_t flags) {
-    uint64_t *pdp_table_ptr = (uint64_t *)(pml4e & X86_4KB_PAGE_FRAME);
-    uint32_t pdp_index = (((uint64_t)vaddr >> PDP_SHIFT) & ((1UL << ADDR_OFFSET) - 1));
-    
-    /* set the address and present bit */
-    pdp_table_ptr[pdp_index] = (uint64_t)map;
-    pdp_table_ptr[pdp_index] |= X86_MMU_PG_FLAGS;
+        *last_valid_entry = entry;
+        table = entry_to_table(entry);
+    }
 
-    if (flags & X86_PAGE_BIT_U)
-        pdp_table_ptr[pdp_index] |= X86_PAGE_BIT_U;
-}
+    /* frame of the 4 KiB, 2 MiB or 1 GiB page plus the offset in it */
+    size_t size = level_entry_size(level);
 
-static void
-update_pml4_entry(vaddr_t vaddr, uint64_t pml4_addr, pt_entry_t map, uint64_t flags) {
-    uint64_t *pml4_table_ptr = (uint64_t *)(pml4_addr);
-    uint32_t pml4_index = (((uint64_t)vaddr >> PML4_SHIFT) & ((1UL << ADDR_OFFSET) - 1));
-    
-    /* set the address and present bit */
-    pml4_table_ptr[pml4_index] = map;
-    pml4_table_ptr[pml4_index] |= X86_MMU_PG_FLAGS;
+    *last_valid_entry = (entry & X86_4KB_PAGE_FRAME & ~(size - 1)) + (vaddr & (size - 1));
+    *out_flags = (entry & X86_PAGE_ENTRY_FLAGS_MASK);
+    *out_level = PL_FRAME;
 
-    if (flags & X86_PAGE_BIT_U)
-        pml4_table_ptr[pml4_index] |= X86_PAGE_BIT_U;
+    return MMU_NO_ERROR;
 }
 
-/** 
- * @brief  Allocates a page table.
- */
-static pt_entry_t *allocate_page_table(void) {
-    paddr_t paddr;
-    vm_page_t *page;
-
-    pt_entry_t *page_ptr = pmm_alloc_kpage();
+mmu_status_t mmu_check_mapping(vaddr_t vaddr, paddr_t paddr, addr_t pml4_base_addr) {
+    pt_entry_t mapped;
+    uint64_t flags;
+    uint32_t level;
 
-    if (page_ptr)
-        memset(page_ptr, 0, PAGE_SIZE);
+    mmu_status_t ret = mmu_get_mapping(vaddr, pml4_base_addr, &mapped, &flags, &level);
+    if (ret != MMU_NO_ERROR)
+        return ret;
 
-    return page_ptr;
+    return mapped == paddr ? MMU_NO_ERROR : ERR_MMU_ENTRY_NOT_PRESENT;
 }
 
-mmu_status_t mmu_map_addr(vaddr_t vaddr, paddr_t paddr, addr_t pml4, uint64_t mmu_flags) {
-    /* check if vaddr and paddr are cannonical and page aligned */
-    if (!mmu_check_vaddr(vaddr) && !mmu_check_paddr(paddr)) {
-        return ERR_INVALID_ARGS;
-    }
+/* ---------------------- Address mapping routines ---------------------- */
 
-    uint64_t pml4e, pdpe, pde, pte;
-    uint32_t created_pdp = 0, created_pd = 0;
+/**
+ * @returns True if a present translation was replaced or lost permissions,
+ *          the caller has to shoot it down. Upgrades only cost a spurious
+ *          fault on cpus with the old entry cached.
+ */
+static bool
+update_pt_entry(pt_entry_t *pte, paddr_t paddr, uint64_t flags) {
+    pt_entry_t old = *pte;
 
-    mmu_status_t ret = NO_ERROR;
+    /* one store of the whole entry, other cpus may be walking the table */
+    pt_entry_t entry = (uint64_t)paddr | X86_PAGE_BIT_P | (flags & X86_PAGE_LEAF_FLAGS);
 
-    pt_entry_t *m = NULL;   /* used to create tables */
+    *pte = entry;
 
-    pml4e = get_pml4e_from_pml4_table(vaddr, pml4);
-    
-    /* check for present flag bit in the entry */
-    if (!(pml4e & X86_PAGE_BIT_P)) {
-        /* create a new pdp table */
-        m = _map_alloc_page();
-        if (m == NULL) {
-            ret = ERR_OUT_OF_MEMORY;
-            goto done;
-        }
+    if (!(old & X86_PAGE_BIT_P))
+        return false;
 
-        update_pml4_entry(vaddr, pml4, X86_VIRT_TO_PHYS(m), );
-        pml4e = (uint64_t)m;
-        created_pdp = 1;
-    }
+    return (old & X86_4KB_PAGE_FRAME) != (entry & X86_4KB_PAGE_FRAME) ||
+           (old & ~entry & (X86_PAGE_BIT_RW | X86_PAGE_BIT_U));
+}
 
-    if (!created_pdp) {
-        /* in case pdpe was not created retrieve the pdp entry */
-        pdpe = get_pdpe_from_pdp_table(vaddr, pml4e);
+/* The table below entry, created or split out of a large page if needed. */
+static pt_entry_t *
+get_next_table(pt_entry_t *entry, page_level_t level, vaddr_t vaddr, uint64_t flags,
+               tlb_batch_t *tlb) {
+    if (!(*entry & X86_PAGE_BIT_P)) {
+        pt_entry_t *table = allocate_page_table();
+        if (!table)
+            return NULL;
+
+        /* zeroed before the store makes it visible to table walks */
+        *entry = table_to_entry(table, flags);
+        return table;
     }
 
-    /* create a pd table if the pdp table was just created 
-       or the pdp entry does not exist */
-    if (created_pdp || !(pdpe & X86_PAGE_BIT_P)) {
-        /* Create a new pd table */
-        m = _map_alloc_page();
-        if (m == NULL) {
-            ret = ERR_OUT_OF_MEMORY;
-
-            if (created_pdp)
-                goto clean_pdp;
+    if (entry_is_large_page(*entry, level))
+        return split_large_page(entry, level, vaddr, tlb);
 
-            goto done;
-        }
+    if (flags & X86_PAGE_BIT_U)
+        *entry |= X86_PAGE_BIT_U;
 
-        /* TODO: maybe expand 1GiB Pages */
+    return entry_to_table(*entry);
+}
 
-        update_pdp_entry(vaddr, pml4e, X86_VIRT_TO_PHYS(m));
-        pdpe = (uint64_t)m;
-        created_pd = 1;
-    }
+static mmu_status_t
+mmu_map_table(pt_entry_t *table, page_level_t level, vaddr_t vaddr, paddr_t paddr,
+              size_t len, uint64_t flags, tlb_batch_t *tlb) {
+    size_t size = level_entry_size(level);
+
+    while (len) {
+        /* up to the end of the range or of this entry */
+        size_t chunk = size - (vaddr & (size - 1));
+        if (chunk > len)
+            chunk = len;
+
+        pt_entry_t *entry = &table[vaddr_to_index(vaddr, level)];
+
+        if (level == PL_4K) {
+            if (update_pt_entry(entry, paddr, flags))
+                tlb_batch_add(tlb, vaddr, 1);
+        } else {
+            pt_entry_t *next = get_next_table(entry, level, vaddr, flags, tlb);
+            if (!next)
+                return ERR_MMU_OUT_OF_MEMORY;
+
+            mmu_status_t ret = mmu_map_table(next, level - 1, vaddr, paddr, chunk, flags, tlb);
+            if (ret != MMU_NO_ERROR)
+                return ret;
+        }
 
-    if (!created_pd) {
-        pde = get_pdpe_from_pdp_table(vaddr, pdpe);
+        vaddr += chunk;
+        paddr += chunk;
+        len -= chunk;
     }
 
-    if (created_pd || !(pde & X86_PAGE_BIT_P)) {
-        /* Create a new page table */
-        bool is_2mib_page = !!(pde & X86_PAGE_BIT_PS);
-
-        m = _map_alloc_page();
-        if (m == NULL) {
-            ret = ERR_OUT_OF_MEMORY;
+    return MMU_NO_ERROR;
+}
 
-            if (created_pd)
-                goto clean_pd;
+/* Page aligned, canonical and on one side of the non canonical hole. */
+static bool mmu_check_range(vaddr_t vaddr, paddr_t paddr, size_t count) {
+    vaddr_t vlast = vaddr + (count - 1) * PAGE_SIZE;
+    paddr_t plast = paddr + (count - 1) * PAGE_SIZE;
 
-            goto done;
-        }
+    if (count == 0 || vlast < vaddr || plast < paddr)
+        return false;
 
-        /* if the page directory entry was pointing to a 2MiB page expand 
-           it to 4KiB pages */
-        if (is_2mib_page) {
-            uint64_t pd_paddr = X86_VIRT_TO_PHYS(pde) & X86_4KB_PAGE_FRAME;
-            uint64_t *pt_table = (uint64_t *)((uint64_t)m & X86_4KB_PAGE_FRAME);
-            uint32_t index;
+    if (!mmu_check_vaddr(vaddr) || !mmu_check_vaddr(vlast) ||
+        !mmu_check_paddr(paddr) || !mmu_check_paddr(plast))
+        return false;
 
-            /* fill up the 512 entires with 4KiB pages */
-            for (index = 0; index < NUM_PT_ENTRIES; ++index) {
-                pt_table[index] = (uint64_t) pd_paddr;
-                pt_table[index] |= X86_PAGE_BIT_P;
+    return !((vaddr ^ vlast) & (1UL << (PML4_SHIFT + ADDR_OFFSET - 1)));
+}
 
-                paddr += PAGE_SIZE;
-            }
-        }
+mmu_status_t mmu_map_range(vaddr_t vaddr, paddr_t paddr, size_t count, addr_t pml4,
+                           uint64_t mmu_flags) {
+    tlb_batch_t batch;
 
-        update_pd_entry(vaddr, pdpe, X86_VIRT_TO_PHYS(m));
-        pde = (uint64_t)m;
+    if (!pml4 || !mmu_check_range(vaddr, paddr, count)) {
+        return ERR_MMU_INVALID_ARGS;
     }
 
-    /* finally update the page table with the physical address */
-    update_pt_entry(vaddr, pde, paddr);
+    TRACE("mmu: map %#lx -> %#lx, %zu pages flags %#lx", vaddr, paddr, count,
+          (unsigned long)mmu_flags);
 
-    /* update/flush TLB */
+    tlb_batch_init(&batch, X86_VIRT_TO_PHYS(pml4));
 
-clean_pd:
-    if (created_pd)
-        pmm_free_page(paddr_to_page(X86_PHYS_TO_VIRT(pdpe)));
+    mmu_status_t ret = mmu_map_table((pt_entry_t *)pml4, PL_512G, vaddr, paddr,
+                                     count * PAGE_SIZE, mmu_flags, &batch);
 
-clean_pdp:
-    if (created_pdp)
-        pmm_free_page(paddr_to_page(X86_PHYS_TO_VIRT(pml4e)));
+    /* one shootdown for every replaced translation and split large page */
+    tlb_batch_flush(&batch);
 
-done:
     return ret;
 }
 
-/**
- * @brief   Check wall the entires of the page table for present bit.
- * @returns True if none of the entries has present bit set.
+mmu_status_t mmu_map_addr(vaddr_t vaddr, paddr_t paddr, addr_t pml4, uint64_t mmu_flags) {
+    return mmu_map_range(vaddr, paddr, 1, pml4, mmu_flags);
+}
+
+/* --------------------- Address unmapping routines --------------------- */
+
+/* Translations and page tables dropped by an unmap. The tables are freed
+ * only after the shootdown, until then other cpus may still walk them.
  */
-static inline bool
-is_page_table_clear(const pt_entry_t* page_table) {
-    uint32_t lower_idx;
-    for (lower_idx = 0; lower_idx < NUM_PT_ENTRIES; ++lower_idx) {
-        if (page_table[lower_idx] & X86_PAGE_BIT_P) {
-            return false;
+typedef struct mmu_unmap_ctx {
+    tlb_batch_t     tlb;
+    list_node_t     tables;     /* vm_page_t of the unlinked tables */
+    uint32_t        num_tables;
+} mmu_unmap_ctx_t;
+
+static mmu_status_t
+mmu_unmap_table(pt_entry_t *table, page_level_t level, vaddr_t vaddr, size_t len,
+                mmu_unmap_ctx_t *ctx) {
+    size_t size = level_entry_size(level);
+
+    while (len) {
+        size_t chunk = size - (vaddr & (size - 1));
+        if (chunk > len)
+            chunk = len;
+
+        pt_entry_t *entry = &table[vaddr_to_index(vaddr, level)];
+
+        if (!(*entry & X86_PAGE_BIT_P)) {
+            /* nothing mapped below */
+        } else if (level == PL_4K || (entry_is_large_page(*entry, level) && chunk == size)) {
+            /* invlpg of the address also drops the cached upper level entries */
+            *entry = 0;
+            tlb_batch_add(&ctx->tlb, vaddr, chunk / PAGE_SIZE);
+        } else {
+            pt_entry_t *next;
+
+            if (entry_is_large_page(*entry, level))
+                next = split_large_page(entry, level, vaddr, &ctx->tlb);
+            else
+                next = entry_to_table(*entry);
+
+            if (!next)
+                return ERR_MMU_OUT_OF_MEMORY;
+
+            mmu_status_t ret = mmu_unmap_table(next, level - 1, vaddr, chunk, ctx);
+            if (ret != MMU_NO_ERROR)
+                return ret;
+
+            /* the kernel pdp tables are shared by every pml4, they stay.
+               So do the boot tables, they are not pmm pages. */
+            vm_page_t *page = paddr_to_page(X86_VIRT_TO_PHYS(next));
+            bool shared = level == PL_512G && vaddr >= KERNEL_ASPACE_BASE;
+
+            if (page && !shared && is_page_table_clear(next)) {
+                *entry = 0;
+
+                list_add_tail(&ctx->tables, &page->node);
+                ctx->num_tables++;
+                ctx->tlb.tables = true;
+            }
         }
+
+        vaddr += chunk;
+        len -= chunk;
     }
 
-    return true;
+    return MMU_NO_ERROR;
 }
 
-static void
-mmu_unmap_entry(vaddr_t vaddr, page_level_t level, vaddr_t table_entry) {
-    uint32_t offset = 0, next_level_offset = 0;
-    vaddr_t *table, *next_table_addr, value;
-
-    next_table_addr = NULL;
-    table = (vaddr_t *)(table_entry & X86_4KB_PAGE_FRAME);
-
-    switch (level) {
-    case PL_4K:
-        offset = (((uint64_t)vaddr >> PT_SHIFT) & ((1UL << ADDR_OFFSET) - 1));
-        next_table_addr = (vaddr_t *)X86_PHYS_TO_VIRT(table[offset]);
-    
-        /* if not present return */
-        if (!((X86_PHYS_TO_VIRT(table[offset]) & X86_PAGE_BIT_P)))
-            return;
-    
-        break;
-
-    case PL_2M:
-        offset = (((uint64_t)vaddr >> PD_SHIFT) & ((1UL << ADDR_OFFSET) - 1));
-        next_table_addr = (vaddr_t *)X86_PHYS_TO_VIRT(table[offset]);
-    
-        /* if not present return */
-        if (!((X86_PHYS_TO_VIRT(table[offset]) & X86_PAGE_BIT_P)))
-            return;
-    
-        break;
+mmu_status_t mmu_unmap_range(vaddr_t vaddr, size_t count, addr_t pml4_base_addr) {
+    mmu_unmap_ctx_t ctx;
 
-    case PL_1G:
-        offset = (((uint64_t)vaddr >> PDP_SHIFT) & ((1UL << ADDR_OFFSET) - 1));
-        next_table_addr = (vaddr_t *)X86_PHYS_TO_VIRT(table[offset]);
-    
-        /* if not present return */
-        if (!((X86_PHYS_TO_VIRT(table[offset]) & X86_PAGE_BIT_P)))
-            return;
-    
-        break;
+    if (!pml4_base_addr || !mmu_check_range(vaddr, 0, count)) {
+        return ERR_MMU_INVALID_ARGS;
+    }
 
-    case PL_512G:
-        offset = (((uint64_t)vaddr >> PML4_SHIFT) & ((1UL << ADDR_OFFSET) - 1));
-        next_table_addr = (vaddr_t *)X86_PHYS_TO_VIRT(table[offset]);
-    
-        /* if not present return */
-        if (!((X86_PHYS_TO_VIRT(table[offset]) & X86_PAGE_BIT_P)))
-            return;
-    
-        break;
+    tlb_batch_init(&ctx.tlb, X86_VIRT_TO_PHYS(pml4_base_addr));
+    list_initialize(&ctx.tables);
+    ctx.num_tables = 0;
 
-    case PL_FRAME:
-    default:
-        return;
-    }
+    mmu_status_t ret = mmu_unmap_table((pt_entry_t *)pml4_base_addr, PL_512G, vaddr,
+                                       count * PAGE_SIZE, &ctx);
 
-    /* unmap any lower level entries */
-    mmu_unmap_entry(vaddr, level - 1, (vaddr_t) next_table_addr);
+    TRACE("mmu: unmap %#lx, %zu pages, %u tables freed", vaddr, count, ctx.num_tables);
 
-    next_table_addr = (vaddr_t *)((vaddr)(next_table_addr) & X86_4KB_PAGE_FRAME);
-    if (level > PL_4K) {
-        if (!is_page_table_clear(next_table_addr)) {
-            return;
-        }
+    /* one shootdown for the pages and every table that went with them */
+    tlb_batch_flush(&ctx.tlb);
 
-        pmm_free_page(paddr_to_page(X86_VIRT_TO_PHYS(next_table_addr)));
-    }
+    pmm_free(&ctx.tables);
 
-    if (X86_PHYS_TO_VIRT(table[offset]) & X86_PAGE_BIT_P) {
-        /* TODO: disable interrupts */
-        value = table[offset];
-        value = value;
-        table[offset] = value;
-        /* TODO: enable interrupts */
-    }
+    return ret;
 }
 
 mmu_status_t mmu_unmap_addr(vaddr_t vaddr, paddr_t paddr, addr_t pml4_base_addr) {
-    
+    return mmu_unmap_range(vaddr, 1, pml4_base_addr);
 }
 
 int mmu_init(void) {
-    /* query the address sizes */
-    uint32_t addr_width = cpuid_get_addr_width();
-
-    /* Bits 07-00: Physical Address bits */
-    /* Bits 15-08: Linear Address bits */    
-    uint8_t vaddr_width = (uint8_t)(addr_width & 0xff);
-    uint8_t paddr_width = (uint8_t)((addr_width >> 8) & 0xff);
+    /* address sizes from cpuid 80000008h, see x86_feature_init() */
+    uint8_t vaddr_width = x86_cpu_info.vaddr_bits;
+    uint8_t paddr_width = x86_cpu_info.paddr_bits;
 
     if (g_vaddr_width < vaddr_width) {
         g_vaddr_width = vaddr_width;
@@ -465,6 +433,11 @@ int mmu_init(void) {
         g_paddr_width = paddr_width;
     }
 
+    supported_1gb_pages = x86_feature_test(X86_FEATURE_HUGE_PAGE);
+
     /* flush tlb */
     set_cr3(get_cr3());
+
+    boot_mark("mmu");
+    return 0;
 }
@@ -1,6 +1,10 @@
 #ifndef _X86_MMU_H_
 #define _X86_MMU_H_
 
+#ifndef __ASSEMBLER__
+#include "../../types.h"
+#endif
+
 /* physical memory is mapped at the base of the kernel address space */
 #define X86_PHYS_TO_VIRT(x)         ((uintptr_t)(x) + KERNEL_ASPACE_BASE)
 #define X86_VIRT_TO_PHYS(x)         ((uintptr_t)(x) - KERNEL_ASPACE_BASE)
@@ -76,14 +80,14 @@
 #define X86_1GB_PAGE_OFFSET_MASK    0x3fffffff
 
 /* extrating incides from vaddr */
-#define VADDR_TO_PML4_INDEX(vaddr)  ((vaddr) >> PML4_SHIFT) & (0x1FF)
-#define VADDR_TO_PDP_INDEX(vaddr)   ((vaddr) >> PDP_SHIFT) & (0x1FF)
-#define VADDR_TO_PD_INDEX(vaddr)    ((vaddr) >> PD_SHIFT) & (0x1FF)
-#define VADDR_TO_PT_INDEX(vaddr)    ((vaddr) >> PT_SHIFT) & (0x1FF)
+#define VADDR_TO_PML4_INDEX(vaddr)  (((vaddr) >> PML4_SHIFT) & (0x1FF))
+#define VADDR_TO_PDP_INDEX(vaddr)   (((vaddr) >> PDP_SHIFT) & (0x1FF))
+#define VADDR_TO_PD_INDEX(vaddr)    (((vaddr) >> PD_SHIFT) & (0x1FF))
+#define VADDR_TO_PT_INDEX(vaddr)    (((vaddr) >> PT_SHIFT) & (0x1FF))
 
 #define NUM_PT_ENTRIES              512
 
-#ifndef __ASSEMBLY__
+#ifndef __ASSEMBLER__
 typedef uint64_t pt_entry_t;
 
 /* 4 level paging */
@@ -97,10 +101,10 @@ typedef enum page_level {
 } page_level_t;
 
 typedef enum mmu_status {
-    NO_ERROR,
-    ERR_ENTRY_NOT_PRESENT,
-    ERR_OUT_OF_MEMORY,
-    ERR_INVALID_ARGS,
+    MMU_NO_ERROR,
+    ERR_MMU_ENTRY_NOT_PRESENT,
+    ERR_MMU_OUT_OF_MEMORY,
+    ERR_MMU_INVALID_ARGS,
 } mmu_status_t;
 
 /* ------------------------------------------------------------------------
@@ -130,8 +134,24 @@ mmu_status_t    mmu_map_addr(vaddr_t vaddr, paddr_t paddr, addr_t pml4_base_addr
                     uint64_t mmu_flags);
 mmu_status_t    mmu_unmap_addr(vaddr_t vaddr, paddr_t paddr, addr_t pml4_base_addr);
 
+/**
+ * @brief   Map count pages from paddr at vaddr with one shootdown for the
+ *          whole range. Large pages in the way are split. On failure the
+ *          pages mapped so far stay mapped, unmap the range to undo.
+ *
+ * @param mmu_flags X86_PAGE_BIT_RW, _U, _PWT, _PCD and _G of the pages.
+ */
+mmu_status_t    mmu_map_range(vaddr_t vaddr, paddr_t paddr, size_t count,
+                    addr_t pml4_base_addr, uint64_t mmu_flags);
+
+/**
+ * @brief   Unmap count pages at vaddr and free the page tables left empty,
+ *          after a single shootdown.
+ */
+mmu_status_t    mmu_unmap_range(vaddr_t vaddr, size_t count, addr_t pml4_base_addr);
+
 int             mmu_init(void);
 
-#endif /* !__ASSEMBLY__ */
+#endif /* !__ASSEMBLER__ */
 
 #endif /* _X86_MMU_H_ */
@@ -0,0 +1,80 @@
+#ifndef _X86_PERCPU_H_
+#define _X86_PERCPU_H_
+
+#include "defines.h"
+#include "../../compiler.h"
+#include "../../types.h"
+#include <stddef.h>
+
+struct thread;
+
+/**
+ * @brief   Per cpu state. The GS base of each cpu points to its entry in
+ *          percpu[], so fields can be read with a single gs relative load.
+ */
+typedef struct x86_percpu {
+    struct x86_percpu   *direct;            /* Points to itself, used to
+                                             * get the linear address.
+                                             */
+    struct thread       *current_thread;
+
+    uint32_t            cpu_num;
+    uint32_t            apic_id;
+
+    /* interrupted context of the irq or nmi being handled, 0 outside */
+    uintptr_t           int_ip;
+    uintptr_t           int_fp;
+} ALIGNED(CACHE_LINE_SIZE) x86_percpu_t;
+
+extern x86_percpu_t percpu[SMP_MAX_CPUS];
+
+#define X86_PERCPU_OFFSET(field)    offsetof(x86_percpu_t, field)
+
+static inline x86_percpu_t *x86_get_percpu(void) {
+    x86_percpu_t *p;
+
+    __asm__ __volatile__(
+        "mov %%gs:%c1, %0 \n\t"
+        : "=r"(p)
+        : "i"(X86_PERCPU_OFFSET(direct))
+    );
+
+    return p;
+}
+
+static inline uint32_t x86_get_percpu_cpu_num(void) {
+    uint32_t cpu_num;
+
+    __asm__ __volatile__(
+        "movl %%gs:%c1, %0 \n\t"
+        : "=r"(cpu_num)
+        : "i"(X86_PERCPU_OFFSET(cpu_num))
+    );
+
+    return cpu_num;
+}
+
+static inline struct thread *x86_get_percpu_current_thread(void) {
+    struct thread *t;
+
+    __asm__ __volatile__(
+        "mov %%gs:%c1, %0 \n\t"
+        : "=r"(t)
+        : "i"(X86_PERCPU_OFFSET(current_thread))
+    );
+
+    return t;
+}
+
+static inline void x86_set_percpu_current_thread(struct thread *t) {
+    __asm__ __volatile__(
+        "mov %0, %%gs:%c1 \n\t"
+        : : "r"(t), "i"(X86_PERCPU_OFFSET(current_thread))
+        : "memory"
+    );
+}
+
+/** @brief  Fill in the per cpu entry of cpu_num and load it into GS base. */
+void x86_init_percpu(uint32_t cpu_num);
+
+#endif /* _X86_PERCPU_H_ */
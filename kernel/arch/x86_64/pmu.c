@@ -0,0 +1,250 @@
+#include "apic.h"
+#include "feature.h"
+#include "idt.h"
+#include "pmu.h"
+#include "reg_defs.h"
+#include "x86.h"
+#include "../../interrupts.h"
+#include "../../pmu.h"
+#include "../../profile.h"
+#include "../../stdio.h"
+#include <string.h>
+
+_Static_assert(PMU_EVENT_COUNT <= X86_PMU_MAX_EVENTS, "more pmu events than counters");
+
+x86_pmu_t x86_pmu;
+
+/*
+ * Event select and unit mask of each event, the fixed counter that counts
+ * it and the bit of CPUID.0AH:EBX that says it is not available, -1 for
+ * none.
+ */
+static const struct {
+    uint8_t     event;
+    uint8_t     umask;
+    int8_t      fixed;
+    int8_t      arch_bit;
+} pmu_events[PMU_EVENT_COUNT] = {
+    [PMU_EVENT_CYCLES]          = { 0x3c, 0x00,  1,  0 },
+    [PMU_EVENT_INSTRUCTIONS]    = { 0xc0, 0x00,  0,  1 },
+    [PMU_EVENT_LLC_MISSES]      = { 0x2e, 0x41, -1,  4 },
+    [PMU_EVENT_DTLB_MISSES]     = { 0x00, 0x00, -1, -1 },   /* From dtlb_models[]. */
+    [PMU_EVENT_BRANCH_MISSES]   = { 0xc5, 0x00, -1,  6 },
+};
+
+/* DTLB_LOAD_MISSES.WALK_COMPLETED of intel family 6, the p-cores of hybrids */
+static const struct {
+    uint8_t     model;
+    uint8_t     event;
+    uint8_t     umask;
+} dtlb_models[] = {
+    /* haswell and broadwell */
+    { 0x3c, 0x08, 0x0e }, { 0x3f, 0x08, 0x0e }, { 0x45, 0x08, 0x0e }, { 0x46, 0x08, 0x0e },
+    { 0x3d, 0x08, 0x0e }, { 0x47, 0x08, 0x0e }, { 0x4f, 0x08, 0x0e }, { 0x56, 0x08, 0x0e },
+    /* skylake to comet lake */
+    { 0x4e, 0x08, 0x0e }, { 0x5e, 0x08, 0x0e }, { 0x55, 0x08, 0x0e }, { 0x8e, 0x08, 0x0e },
+    { 0x9e, 0x08, 0x0e }, { 0xa5, 0x08, 0x0e }, { 0xa6, 0x08, 0x0e },
+    /* ice lake and tiger lake */
+    { 0x7d, 0x08, 0x0e }, { 0x7e, 0x08, 0x0e }, { 0x6a, 0x08, 0x0e }, { 0x6c, 0x08, 0x0e },
+    { 0x8c, 0x08, 0x0e }, { 0x8d, 0x08, 0x0e },
+    /* golden cove and later moved it */
+    { 0x97, 0x12, 0x0e }, { 0x9a, 0x12, 0x0e }, { 0xb7, 0x12, 0x0e }, { 0xba, 0x12, 0x0e },
+    { 0xbf, 0x12, 0x0e }, { 0x8f, 0x12, 0x0e }, { 0xcf, 0x12, 0x0e },
+};
+
+#define NUM_DTLB_MODELS     (sizeof(dtlb_models) / sizeof(dtlb_models[0]))
+
+static uint64_t width_mask(uint32_t width) {
+    return width >= 64 ? ~0ULL : (1ULL << width) - 1;
+}
+
+static bool dtlb_event(uint8_t *event, uint8_t *umask) {
+    if (strcmp(x86_cpu_info.vendor, "GenuineIntel") != 0 || x86_cpu_info.family != 0x6)
+        return false;
+
+    for (size_t i = 0; i < NUM_DTLB_MODELS; ++i) {
+        if (dtlb_models[i].model == x86_cpu_info.model) {
+            *event = dtlb_models[i].event;
+            *umask = dtlb_models[i].umask;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* ------------------------------ Sampling ------------------------------ */
+
+static void sample_reload(x86_pmu_t *pmu) {
+    /* writes through IA32_PMCx sign extend bit 31, so -period is fine up to 2^31 */
+    write_msr(IA32_MSR_PMC0 + pmu->num_evtsel, -pmu->sample_period);
+
+    /* delivery masks the lvt entry */
+    apic_write(LAPIC_REG_LVT_PERF, LAPIC_LVT_DELIVERY_NMI);
+}
+
+static handler_return_t x86_pmu_nmi(void *arg) {
+    x86_pmu_t *pmu = &x86_pmu;
+    uint64_t bit = 1ULL << pmu->num_evtsel;
+
+    if (!pmu->sample_period)
+        return INT_NO_RESCHEDULE;
+
+    /* version 1 has no status, every nmi is taken for an overflow */
+    if (pmu->version >= 2) {
+        if (!(read_msr(IA32_MSR_PERF_GLOBAL_STATUS) & bit))
+            return INT_NO_RESCHEDULE;
+        write_msr(IA32_MSR_PERF_GLOBAL_OVF_CTRL, bit);
+    }
+
+    if (profile_interrupt())
+        sample_reload(pmu);
+
+    return INT_NO_RESCHEDULE;
+}
+
+bool x86_pmu_sample_start(uint64_t period) {
+    x86_pmu_t *pmu = &x86_pmu;
+    uint32_t n = pmu->num_evtsel;
+
+    if (!pmu->gp_cycles || n >= pmu->num_gp || !period || period >= (1ULL << 31))
+        return false;
+
+    pmu->sample_period = period;
+
+    write_msr(IA32_MSR_PERFEVTSEL0 + n, 0);
+    sample_reload(pmu);
+    write_msr(IA32_MSR_PERFEVTSEL0 + n, pmu_events[PMU_EVENT_CYCLES].event | PERFEVTSEL_USR |
+              PERFEVTSEL_OS | PERFEVTSEL_INT | PERFEVTSEL_EN);
+
+    if (pmu->version >= 2)
+        write_msr(IA32_MSR_PERF_GLOBAL_CTRL, pmu->global_ctrl | (1ULL << n));
+
+    return true;
+}
+
+void x86_pmu_sample_stop(void) {
+    x86_pmu_t *pmu = &x86_pmu;
+
+    if (!pmu->gp_cycles || pmu->num_evtsel >= pmu->num_gp)
+        return;
+
+    apic_write(LAPIC_REG_LVT_PERF, LAPIC_LVT_MASKED);
+    write_msr(IA32_MSR_PERFEVTSEL0 + pmu->num_evtsel, 0);
+
+    if (pmu->version >= 2)
+        write_msr(IA32_MSR_PERF_GLOBAL_CTRL, pmu->global_ctrl);
+}
+
+/* ------------------------------ Setup ------------------------------ */
+
+void x86_pmu_init(void) {
+    x86_pmu_t *pmu = &x86_pmu;
+    uint32_t eax, ebx, ecx, edx;
+
+    if (x86_cpu_info.max_leaf < 0xa)
+        return;
+
+    cpuid(0xa, &eax, &ebx, &ecx, &edx);
+
+    pmu->version = eax & 0xff;
+    if (!pmu->version)
+        return;
+
+    pmu->num_gp = (eax >> 8) & 0xff;
+    pmu->gp_width = (eax >> 16) & 0xff;
+    uint32_t ebx_len = (eax >> 24) & 0xff;
+
+    /* version 5 also has a bitmap of the fixed counters past num_fixed */
+    uint32_t fixed_bitmap = 0;
+    if (pmu->version >= 2) {
+        pmu->num_fixed = edx & 0x1f;
+        pmu->fixed_width = (edx >> 5) & 0xff;
+        fixed_bitmap = pmu->version >= 5 ? ecx : 0;
+    }
+
+    uint32_t max_gp = pmu->num_gp < X86_PMU_MAX_GP ? pmu->num_gp : X86_PMU_MAX_GP;
+
+    /* leave one for the profiler where there are enough */
+    if (max_gp > 2)
+        max_gp--;
+
+    pmu->gp_cycles = ebx_len > 0 && !(ebx & 0x1) && pmu->gp_width;
+
+    for (uint32_t e = 0; e < PMU_EVENT_COUNT; ++e) {
+        int fixed = pmu_events[e].fixed;
+        int bit = pmu_events[e].arch_bit;
+        uint8_t event = pmu_events[e].event, umask = pmu_events[e].umask;
+
+        if (fixed >= 0 && pmu->fixed_width &&
+            ((uint32_t)fixed < pmu->num_fixed || (fixed_bitmap & (1U << fixed)))) {
+            pmu->counters[e].index = (1U << 30) | fixed;
+            pmu->counters[e].mask = width_mask(pmu->fixed_width);
+            pmu->fixed_ctrl |= (uint64_t)(FIXED_CTR_CTRL_OS | FIXED_CTR_CTRL_USR) << (4 * fixed);
+            pmu->global_ctrl |= 1ULL << (32 + fixed);
+            continue;
+        }
+
+        if (bit >= 0 && ((uint32_t)bit >= ebx_len || (ebx & (1U << bit))))
+            continue;
+
+        if (e == PMU_EVENT_DTLB_MISSES && !dtlb_event(&event, &umask))
+            continue;
+
+        if (pmu->num_evtsel == max_gp || !pmu->gp_width)
+            continue;
+
+        uint32_t i = pmu->num_evtsel++;
+
+        pmu->evtsel[i] = event | ((uint64_t)umask << 8) |
+                         PERFEVTSEL_USR | PERFEVTSEL_OS | PERFEVTSEL_EN;
+        pmu->counters[e].index = i;
+        pmu->counters[e].mask = width_mask(pmu->gp_width);
+        pmu->global_ctrl |= 1ULL << i;
+    }
+
+    register_int_handler(X86_INT_NMI, x86_pmu_nmi, NULL);
+}
+
+void x86_pmu_init_percpu(void) {
+    x86_pmu_t *pmu = &x86_pmu;
+
+    if (!pmu->num_evtsel && !pmu->fixed_ctrl)
+        return;
+
+    /* stop everything, zero, program, then start them together */
+    if (pmu->version >= 2)
+        write_msr(IA32_MSR_PERF_GLOBAL_CTRL, 0);
+
+    for (uint32_t i = 0; i < pmu->num_evtsel; ++i) {
+        write_msr(IA32_MSR_PERFEVTSEL0 + i, 0);
+        write_msr(IA32_MSR_PMC0 + i, 0);
+        write_msr(IA32_MSR_PERFEVTSEL0 + i, pmu->evtsel[i]);
+    }
+
+    if (pmu->fixed_ctrl) {
+        write_msr(IA32_MSR_FIXED_CTR_CTRL, 0);
+        for (uint32_t j = 0; j < 16; ++j) {
+            if (pmu->fixed_ctrl & (0xfULL << (4 * j)))
+                write_msr(IA32_MSR_FIXED_CTR0 + j, 0);
+        }
+        write_msr(IA32_MSR_FIXED_CTR_CTRL, pmu->fixed_ctrl);
+    }
+
+    if (pmu->version >= 2)
+        write_msr(IA32_MSR_PERF_GLOBAL_CTRL, pmu->global_ctrl);
+
+    pmu->running = true;
+}
+
+void x86_pmu_dump(void) {
+    x86_pmu_t *pmu = &x86_pmu;
+
+    if (!pmu->version) {
+        printf("pmu: no architectural perfmon\n");
+        return;
+    }
+
+    printf("pmu: version %u, %u general counters of %u bits, %u fixed of %u bits\n",
+           pmu->version, pmu->num_gp, pmu->gp_width, pmu->num_fixed, pmu->fixed_width);
+}
@@ -0,0 +1,90 @@
+#ifndef _X86_PMU_H_
+#define _X86_PMU_H_
+
+#include "../../types.h"
+#include <stdbool.h>
+
+/*
+ * Architectural performance monitoring, CPUID leaf 0AH.
+ *
+ * x86_pmu_init() picks a counter for each event of pmu.h on the boot cpu:
+ * a fixed counter for cycles and instructions when version 2 has them, a
+ * general counter for the rest as long as there are enough. The dTLB walk
+ * event is not architectural and only gets one on the models it is known
+ * for. x86_pmu_init_percpu() then programs the same set on each cpu, and
+ * the counters run until reset.
+ *
+ * The profiler samples on the overflow of one more general counter, it
+ * comes in as an nmi through the local apic.
+ *
+ * AMD and TCG report version 0 and get no counters.
+ */
+
+#define X86_PMU_MAX_EVENTS      8
+#define X86_PMU_MAX_GP          8       /* General counters used at most. */
+
+typedef struct x86_pmu_counter {
+    uint32_t    index;          /* For rdpmc, bit 30 selects the fixed ones. */
+    uint64_t    mask;           /* Counter width, 0 if the event is not counted. */
+} x86_pmu_counter_t;
+
+typedef struct x86_pmu {
+    uint32_t    version;
+    uint32_t    num_gp;
+    uint32_t    gp_width;
+    uint32_t    num_fixed;
+    uint32_t    fixed_width;
+    bool        running;        /* Programmed on the boot cpu. */
+
+    /* what x86_pmu_init_percpu() writes */
+    uint32_t    num_evtsel;
+    uint64_t    evtsel[X86_PMU_MAX_GP];
+    uint64_t    fixed_ctrl;
+    uint64_t    global_ctrl;
+
+    /* sampling, on general counter num_evtsel */
+    bool        gp_cycles;      /* Core cycles can go on a general counter. */
+    uint64_t    sample_period;
+
+    x86_pmu_counter_t   counters[X86_PMU_MAX_EVENTS];
+} x86_pmu_t;
+
+extern x86_pmu_t x86_pmu;
+
+static inline uint64_t rdpmc(uint32_t index) {
+    uint32_t lo, hi;
+
+    __asm__ __volatile__(
+        "rdpmc \n\t"
+        : "=a"(lo), "=d"(hi)
+        : "c"(index)
+    );
+
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/** @brief  Read the counters of the first count events, 0 for the ones not counted. */
+static inline void x86_pmu_read(uint64_t *values, uint32_t count) {
+    for (uint32_t i = 0; i < count; ++i)
+        values[i] = x86_pmu.counters[i].mask ? rdpmc(x86_pmu.counters[i].index) : 0;
+}
+
+/** @brief  Detect the pmu and pick the counters, boot cpu, after x86_feature_init(). */
+void x86_pmu_init(void);
+
+/** @brief  Program and start the counters on the current cpu. */
+void x86_pmu_init_percpu(void);
+
+/**
+ * @brief   Count core cycles on the general counter after the ones of the
+ *          events, current cpu, and raise an nmi every period of them.
+ * @returns False if there is no such counter or period does not fit in 31 bits.
+ */
+bool x86_pmu_sample_start(uint64_t period);
+
+void x86_pmu_sample_stop(void);
+
+/** @brief  Print the version and the counters the cpu has. */
+void x86_pmu_dump(void);
+
+#endif /* _X86_PMU_H_ */
@@ -3,13 +3,73 @@
 
 /* Control Register 0 */
 #define CR0_PE_BIT          0x00000001  /* Protected Mode Enable    */
+#define CR0_MP_BIT          0x00000002  /* Monitor Coprocessor      */
+#define CR0_EM_BIT          0x00000004  /* x87 Emulation            */
+#define CR0_WP_BIT          0x00010000  /* Write Protect in ring 0  */
 #define CR0_PG_BIT          0x80000000  /* Paging enabled           */
 
 /* Control Register 4 */
 #define CR4_PAE_BIT         0x00000020  /* Physical Address Extensions */
+#define CR4_PGE_BIT         0x00000080  /* Page Global Enable       */
+#define CR4_OSFXSR_BIT      0x00000200  /* fxsave and SSE enabled   */
+#define CR4_OSXMMEXCPT_BIT  0x00000400  /* SIMD fp exceptions       */
+#define CR4_OSXSAVE_BIT     0x00040000  /* xsave and XCR0 enabled   */
+
+/* Extended Control Register 0, the state components xsave manages */
+#define XCR0_X87            0x1
+#define XCR0_SSE            0x2
+#define XCR0_AVX            0x4
+
+/*
+ * Save area of the components above, in the standard xsave layout: the
+ * fxsave area, the xsave header and the upper halves of the ymm registers.
+ */
+#define X86_FPU_STATE_SIZE  832
+#define X86_FPU_STATE_ALIGN 64
+#define X86_FPU_FCW         0       /* x87 control word offset */
+#define X86_FPU_MXCSR       24      /* SSE control and status offset */
+#define X86_FPU_XSAVE_HDR   512     /* Header offset, zero before the first xsave */
+#define X86_FPU_FCW_INIT    0x037f
+#define X86_FPU_MXCSR_INIT  0x1f80
+
+/* Control Register 3, the low bits are cache control flags */
+#define CR3_PML4_MASK       0x000ffffffffff000ULL
+
+/* RFLAGS */
+#define X86_FLAGS_IF        0x00000200  /* Interrupt Enable */
 
 /* Memory specific register */
 #define IA32_MSR_EFER       0xc0000080
 #define IA32_MSR_EFER_LME   0x00000100
 
+#define IA32_MSR_APIC_BASE      0x0000001b
+#define IA32_MSR_TSC_DEADLINE   0x000006e0
+
+#define IA32_MSR_GS_BASE        0xc0000101
+#define IA32_MSR_KERNEL_GS_BASE 0xc0000102
+
+/* Architectural performance monitoring, CPUID.0AH */
+#define IA32_MSR_PMC0               0x000000c1  /* General counters, one after the other */
+#define IA32_MSR_PERFEVTSEL0        0x00000186  /* Their event selects */
+#define IA32_MSR_FIXED_CTR0         0x00000309  /* Fixed counters, version 2 */
+#define IA32_MSR_FIXED_CTR_CTRL     0x0000038d
+#define IA32_MSR_PERF_GLOBAL_STATUS 0x0000038e
+#define IA32_MSR_PERF_GLOBAL_CTRL   0x0000038f
+#define IA32_MSR_PERF_GLOBAL_OVF_CTRL 0x00000390
+
+#define PERFEVTSEL_USR              (1U << 16)
+#define PERFEVTSEL_OS               (1U << 17)
+#define PERFEVTSEL_INT              (1U << 20)  /* Interrupt on overflow */
+#define PERFEVTSEL_EN               (1U << 22)
+
+#define FIXED_CTR_CTRL_OS           0x1         /* 4 bits per fixed counter */
+#define FIXED_CTR_CTRL_USR          0x2
+
+/*
+ * CPUID.01H feature bits x86_simd_init_percpu() needs on every cpu, before
+ * there is a registry. Everything else goes through feature.h.
+ */
+#define X86_CPUID1_ECX_XSAVE            (1U << 26)
+#define X86_CPUID1_ECX_AVX              (1U << 28)
+
 #endif /* _X86_REG_DEFS_H_ */
\ No newline at end of file
@@ -0,0 +1,45 @@
+#include "x86.h"
+#include "../../thread.h"
+#include "../../stdlib.h"
+#include <string.h>
+
+/* Callee saved registers pushed by x86_64_context_switch */
+#define CONTEXT_SWITCH_FRAME_REGS   6
+
+void x86_64_context_switch(vaddr_t *old_sp, vaddr_t new_sp);
+
+void arch_thread_initialize(thread_t *t, void (*entry_point)(void)) {
+    vaddr_t stack_top = ROUNDDOWN((vaddr_t)t->stack + t->stack_size, 16);
+    uint64_t *sp = (uint64_t *)stack_top;
+
+    /* fake return address, keeps the ABI stack alignment at entry_point */
+    *--sp = 0;
+    *--sp = (uint64_t)entry_point;
+
+    for (int i = 0; i < CONTEXT_SWITCH_FRAME_REGS; ++i)
+        *--sp = 0;
+
+    t->arch.sp = (vaddr_t)sp;
+
+    /* default control words, the xsave header says the rest is in its init state */
+    memset(t->arch.fpu_state, 0, sizeof(t->arch.fpu_state));
+    *(uint16_t *)&t->arch.fpu_state[X86_FPU_FCW] = X86_FPU_FCW_INIT;
+    *(uint32_t *)&t->arch.fpu_state[X86_FPU_MXCSR] = X86_FPU_MXCSR_INIT;
+}
+
+/*
+ * The FPU state is switched with every thread, the kernel is built with
+ * SSE and AVX and any function may hold live vector registers. The save
+ * area header is only written by the cpu, xrstor faults on garbage in it.
+ */
+void arch_context_switch(thread_t *old_thread, thread_t *new_thread) {
+    if (x86_fpu_xsave) {
+        xsave(old_thread->arch.fpu_state);
+        xrstor(new_thread->arch.fpu_state);
+    } else {
+        fxsave(old_thread->arch.fpu_state);
+        fxrstor(new_thread->arch.fpu_state);
+    }
+
+    x86_64_context_switch(&old_thread->arch.sp, new_thread->arch.sp);
+}
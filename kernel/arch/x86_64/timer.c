@@ -0,0 +1,113 @@
+#include "apic.h"
+#include "feature.h"
+#include "reg_defs.h"
+#include "tsc.h"
+#include "x86.h"
+#include "../../boot_trace.h"
+#include "../../debug.h"
+#include "../../interrupts.h"
+#include "../../timer.h"
+
+x86_tsc_clock_t tsc_clock;
+
+/* PIT channel 2, gated through the keyboard controller's port b */
+#define PIT_FREQ_HZ             1193182
+#define PIT_CH2_DATA_PORT       0x42
+#define PIT_CMD_PORT            0x43
+#define PIT_PORT_B              0x61
+#define PIT_PORT_B_GATE2        0x01
+#define PIT_PORT_B_SPEAKER      0x02
+#define PIT_PORT_B_OUT2         0x20
+
+#define PIT_CALIBRATE_MS        10
+#define PIT_CALIBRATE_RUNS      3
+
+#define HYPERVISOR_CPUID_BASE   0x40000000
+#define HYPERVISOR_CPUID_TIMING 0x40000010  /* eax: TSC kHz */
+
+/** @brief  TSC frequency as reported by the cpu or the hypervisor, 0 if unknown. */
+static uint64_t tsc_freq_from_cpuid(void) {
+    uint32_t max, eax, ebx, ecx, edx;
+
+    /* crystal clock and TSC/crystal ratio */
+    if (x86_cpu_info.max_leaf >= 0x15) {
+        cpuid(0x15, &eax, &ebx, &ecx, &edx);
+        if (eax && ebx && ecx)
+            return (uint64_t)ecx * ebx / eax;
+    }
+
+    if (x86_feature_test(X86_FEATURE_HYPERVISOR)) {
+        cpuid(HYPERVISOR_CPUID_BASE, &max, &ebx, &ecx, &edx);
+        if (max >= HYPERVISOR_CPUID_TIMING) {
+            cpuid(HYPERVISOR_CPUID_TIMING, &eax, &ebx, &ecx, &edx);
+            if (eax)
+                return (uint64_t)eax * 1000;
+        }
+    }
+
+    return 0;
+}
+
+/** @brief  Count TSC cycles while the PIT counts down PIT_CALIBRATE_MS. */
+static uint64_t tsc_calibrate_pit(void) {
+    uint32_t latch = PIT_FREQ_HZ * PIT_CALIBRATE_MS / 1000;
+    uint64_t best = UINT64_MAX;
+
+    for (int i = 0; i < PIT_CALIBRATE_RUNS; ++i) {
+        /* gate on, speaker off */
+        outb(PIT_PORT_B, (inb(PIT_PORT_B) & ~PIT_PORT_B_SPEAKER) | PIT_PORT_B_GATE2);
+
+        /* channel 2, lo/hi byte, mode 0 (interrupt on terminal count) */
+        outb(PIT_CMD_PORT, 0xb0);
+        outb(PIT_CH2_DATA_PORT, latch & 0xff);
+        outb(PIT_CH2_DATA_PORT, (latch >> 8) & 0xff);
+
+        uint64_t start = rdtsc();
+        while (!(inb(PIT_PORT_B) & PIT_PORT_B_OUT2))
+            ;
+        uint64_t cycles = rdtsc() - start;
+
+        /* an smi only ever makes a run longer */
+        if (cycles < best)
+            best = cycles;
+    }
+
+    return best * 1000 / PIT_CALIBRATE_MS;
+}
+
+void x86_tsc_init(void) {
+    tsc_clock.invariant = x86_feature_test(X86_FEATURE_INVARIANT_TSC);
+
+    uint64_t freq = tsc_freq_from_cpuid();
+    if (!freq)
+        freq = tsc_calibrate_pit();
+
+    tsc_clock.freq_hz = freq;
+    tsc_clock.ns_mult = (1000000000ULL << 32) / freq;
+    /* (freq << 32) / 1e9 without overflowing, kHz precision is plenty */
+    tsc_clock.cycles_mult = ((freq / 1000) << 32) / 1000000;
+    tsc_clock.boot_tsc = rdtsc();
+    boot_mark("tsc_calibrated");
+
+    if (!tsc_clock.invariant)
+        printf("tsc: not invariant, time may drift in deep idle states\n");
+}
+
+static handler_return_t x86_timer_irq(void *arg) {
+    return timer_tick();
+}
+
+void x86_timer_init_percpu(void) {
+    apic_init_percpu();
+    register_int_handler(APIC_TIMER_VECTOR, x86_timer_irq, NULL);
+}
+
+/* ------------------------------------------------------------------------ */
+
+void arch_timer_set_oneshot(ktime_t deadline) {
+    apic_timer_set_tsc_deadline(tsc_clock.boot_tsc + ns_to_tsc(deadline));
+}
+
+void arch_timer_cancel(void) {
+    apic_timer_stop();
+}
@@ -0,0 +1,322 @@
+#include "alternative.h"
+#include "apic.h"
+#include "aspace.h"
+#include "tlb.h"
+#include "x86.h"
+#include "../../arch.h"
+#include "../../atomic.h"
+#include "../../interrupts.h"
+#include "../../spinlock.h"
+#include "../../stdio.h"
+
+/** Per cpu shootdown state. */
+typedef struct tlb_cpu {
+    spin_lock_t     lock;           /* Protects queue and queued_seq. */
+    tlb_batch_t     queue;          /* Ranges other cpus want dropped here. */
+    uint64_t        queued_seq;     /* Last request queued. */
+    uint64_t        done_seq;       /* Last request invalidated. */
+
+    int             online;
+    paddr_t         active_pml4;
+    int             lazy;
+    int             need_flush;     /* A shootdown skipped us while lazy. */
+
+    tlb_stats_t     stats;
+} ALIGNED(CACHE_LINE_SIZE) tlb_cpu_t;
+
+static tlb_cpu_t tlb_cpus[SMP_MAX_CPUS];
+
+static inline tlb_cpu_t *tlb_this_cpu(void) {
+    return &tlb_cpus[arch_curr_cpu_num()];
+}
+
+/* ------------------------------ Batches ------------------------------ */
+
+void tlb_batch_init(tlb_batch_t *batch, paddr_t pml4_phys) {
+    batch->pml4_phys = pml4_phys;
+    batch->count = 0;
+    batch->pages = 0;
+    batch->full = false;
+    batch->global = false;
+    batch->tables = false;
+}
+
+static inline bool tlb_batch_empty(const tlb_batch_t *batch) {
+    return !batch->count && !batch->full;
+}
+
+void tlb_batch_add(tlb_batch_t *batch, vaddr_t base, size_t pages) {
+    if (base >= KERNEL_ASPACE_BASE)
+        batch->global = true;
+
+    batch->pages += pages;
+    if (batch->full || batch->pages > TLB_FULL_FLUSH_PAGES) {
+        batch->full = true;
+        return;
+    }
+
+    if (batch->count) {
+        tlb_range_t *last = &batch->ranges[batch->count - 1];
+        if (last->base + last->pages * PAGE_SIZE == base) {
+            last->pages += pages;
+            return;
+        }
+    }
+
+    if (batch->count == TLB_BATCH_MAX_RANGES) {
+        batch->full = true;
+        return;
+    }
+
+    batch->ranges[batch->count].base = base;
+    batch->ranges[batch->count].pages = pages;
+    batch->count++;
+}
+
+static void tlb_batch_merge(tlb_batch_t *dst, const tlb_batch_t *src) {
+    dst->global |= src->global;
+    dst->tables |= src->tables;
+
+    if (src->full) {
+        dst->full = true;
+        return;
+    }
+
+    for (uint32_t i = 0; i < src->count; ++i)
+        tlb_batch_add(dst, src->ranges[i].base, src->ranges[i].pages);
+}
+
+/* --------------------------- Invalidation --------------------------- */
+
+static void tlb_flush_all(bool global) {
+    /* one instruction for either kind, no cr3 reload or pair of cr4 writes */
+    if (x86_feature_static(X86_FEATURE_INVPCID)) {
+        invpcid(global ? INVPCID_TYPE_ALL_GLOBAL : INVPCID_TYPE_ALL_NON_GLOBAL, 0, 0);
+        return;
+    }
+
+    unsigned long cr4 = get_cr4();
+
+    /* toggling PGE is the only way to drop global entries without invlpg */
+    if (global && (cr4 & CR4_PGE_BIT)) {
+        set_cr4(cr4 & ~CR4_PGE_BIT);
+        set_cr4(cr4);
+    } else {
+        set_cr3(get_cr3());
+    }
+}
+
+static void tlb_invalidate_local(const tlb_batch_t *batch, tlb_stats_t *s) {
+    if (batch->full) {
+        tlb_flush_all(batch->global);
+        s->full_flushes++;
+        return;
+    }
+
+    for (uint32_t i = 0; i < batch->count; ++i) {
+        const tlb_range_t *r = &batch->ranges[i];
+
+        for (size_t p = 0; p < r->pages; ++p)
+            invlpg(r->base + p * PAGE_SIZE);
+    }
+
+    s->invlpg += batch->pages;
+}
+
+/** @brief  Drain the requests queued on the current cpu, interrupts off. */
+static void tlb_process_queue(tlb_cpu_t *c) {
+    tlb_batch_t batch;
+    uint64_t seq;
+
+    if (atomic_load_acquire(&c->queued_seq) == c->done_seq)
+        return;
+
+    spin_lock(&c->lock);
+    seq = c->queued_seq;
+    batch = c->queue;
+    tlb_batch_init(&c->queue, 0);
+    spin_unlock(&c->lock);
+
+    tlb_invalidate_local(&batch, &c->stats);
+
+    atomic_store_release(&c->done_seq, seq);
+}
+
+static handler_return_t tlb_shootdown_irq(void *arg) {
+    tlb_process_queue(tlb_this_cpu());
+    return INT_NO_RESCHEDULE;
+}
+
+/**
+ * @brief   Queue a batch on a remote cpu.
+ * @returns The sequence number that completes it, *send is set if the
+ *          target has no ipi on the way yet.
+ */
+static uint64_t tlb_queue(tlb_cpu_t *c, const tlb_batch_t *batch, bool *send) {
+    uint64_t seq;
+
+    spin_lock(&c->lock);
+
+    /* the queue is only emptied by the target, a pending one has an ipi coming */
+    *send = tlb_batch_empty(&c->queue);
+    tlb_batch_merge(&c->queue, batch);
+    seq = ++c->queued_seq;
+
+    spin_unlock(&c->lock);
+
+    return seq;
+}
+
+/**
+ * @brief   Whether a lazy cpu can be left alone. It is told to flush when it
+ *          leaves lazy mode, the second look catches it leaving in between.
+ */
+static bool tlb_skip_lazy(tlb_cpu_t *c) {
+    if (!atomic_load(&c->lazy))
+        return false;
+
+    atomic_store(&c->need_flush, 1);
+    return atomic_load(&c->lazy);
+}
+
+void tlb_batch_flush(tlb_batch_t *batch) {
+    uint64_t seqs[SMP_MAX_CPUS];
+    uint32_t targets = 0;
+
+    if (tlb_batch_empty(batch))
+        return;
+
+    arch_irq_state_t state = arch_irq_save();
+
+    uint32_t self = arch_curr_cpu_num();
+    tlb_stats_t *s = &tlb_cpus[self].stats;
+
+    /* the page table stores before the reads of who has them loaded */
+    smp_mb();
+
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; ++cpu) {
+        tlb_cpu_t *c = &tlb_cpus[cpu];
+        bool send;
+
+        seqs[cpu] = 0;
+
+        if (!atomic_load_relaxed(&c->online))
+            continue;
+
+        if (!batch->global && atomic_load(&c->active_pml4) != batch->pml4_phys)
+            continue;
+
+        if (cpu == self) {
+            tlb_invalidate_local(batch, s);
+            continue;
+        }
+
+        /* a lazy cpu may still walk freed page tables speculatively */
+        if (!batch->global && !batch->tables && tlb_skip_lazy(c)) {
+            s->lazy_skipped++;
+            continue;
+        }
+
+        seqs[cpu] = tlb_queue(c, batch, &send);
+        targets++;
+
+        if (send) {
+            apic_send_ipi(cpu, APIC_TLB_SHOOTDOWN_VECTOR);
+            s->ipis++;
+        } else {
+            s->ipis_merged++;
+        }
+    }
+
+    uint64_t start = rdtsc();
+
+    /* keep serving our own queue, a target may be waiting on us with interrupts off */
+    for (uint32_t cpu = 0; targets; ++cpu) {
+        if (!seqs[cpu])
+            continue;
+
+        while (atomic_load_acquire(&tlb_cpus[cpu].done_seq) < seqs[cpu]) {
+            tlb_process_queue(&tlb_cpus[self]);
+            arch_spinloop_pause();
+        }
+
+        targets--;
+    }
+
+    s->wait_cycles += rdtsc() - start;
+    s->shootdowns++;
+
+    arch_irq_restore(state);
+
+    tlb_batch_init(batch, batch->pml4_phys);
+}
+
+/* ----------------------------- Lazy TLB ----------------------------- */
+
+void x86_tlb_init_percpu(void) {
+    tlb_cpu_t *c = tlb_this_cpu();
+
+    spin_lock_init(&c->lock);
+    tlb_batch_init(&c->queue, 0);
+    c->active_pml4 = get_cr3() & CR3_PML4_MASK;
+
+    /* the handler is shared, installing it again is harmless */
+    register_int_handler(APIC_TLB_SHOOTDOWN_VECTOR, tlb_shootdown_irq, NULL);
+
+    atomic_store(&c->online, 1);
+}
+
+/* the following run with interrupts off, on the context switch and idle paths */
+
+void x86_tlb_switch_aspace(paddr_t pml4_phys) {
+    tlb_cpu_t *c = tlb_this_cpu();
+
+    /* a shootdown that still sees the old pml4 is fine, the walks after
+       the cr3 load see the new entries */
+    atomic_store(&c->active_pml4, pml4_phys);
+    atomic_store(&c->lazy, 0);
+    atomic_store_relaxed(&c->need_flush, 0);
+
+    set_cr3(pml4_phys);
+}
+
+void x86_tlb_enter_lazy(void) {
+    atomic_store(&tlb_this_cpu()->lazy, 1);
+}
+
+void x86_tlb_leave_lazy(void) {
+    tlb_cpu_t *c = tlb_this_cpu();
+
+    /* pairs with tlb_skip_lazy(): either it sees us back or we see its flag */
+    atomic_store(&c->lazy, 0);
+
+    if (atomic_exchange(&c->need_flush, 0)) {
+        tlb_flush_all(false);
+        c->stats.full_flushes++;
+    }
+}
+
+/* ------------------------------ Stats ------------------------------ */
+
+void x86_tlb_get_stats(uint32_t cpu, tlb_stats_t *out) {
+    *out = tlb_cpus[cpu].stats;
+}
+
+void x86_tlb_dump_stats(void) {
+    printf("cpu shootdowns       ipis     merged  lazy skip  avg wait cyc     invlpg  full flush\n");
+
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; ++cpu) {
+        tlb_cpu_t *c = &tlb_cpus[cpu];
+        if (!c->online)
+            continue;
+
+        tlb_stats_t *s = &c->stats;
+        uint64_t avg = s->shootdowns ? s->wait_cycles / s->shootdowns : 0;
+
+        printf("%3u %10llu %10llu %10llu %10llu %13llu %10llu %11llu\n", cpu,
+               (unsigned long long)s->shootdowns, (unsigned long long)s->ipis,
+               (unsigned long long)s->ipis_merged, (unsigned long long)s->lazy_skipped,
+               (unsigned long long)avg, (unsigned long long)s->invlpg,
+               (unsigned long long)s->full_flushes);
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef _X86_TLB_H_
+#define _X86_TLB_H_
+
+#include "../../types.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * TLB shootdown.
+ *
+ * Page table updates that remove a translation or take permissions away
+ * collect the affected pages in a batch. Flushing the batch invalidates the
+ * local TLB and queues the ranges on every other cpu that may still cache
+ * them, with at most one ipi per target cpu, then waits for the targets to
+ * acknowledge. A target drains everything queued on it in one go and picks
+ * invlpg per page or a full flush depending on the size.
+ *
+ * Kernel addresses are mapped everywhere and go to every online cpu. User
+ * addresses only go to cpus with that pml4 loaded, minus the lazy ones: a
+ * halted idle cpu keeps the last address space loaded but touches none of
+ * it, it is skipped and does a full flush when it leaves lazy mode.
+ */
+
+#define TLB_BATCH_MAX_RANGES    16
+#define TLB_FULL_FLUSH_PAGES    32      /* Past this many pages reloading cr3 is cheaper. */
+
+typedef struct tlb_range {
+    vaddr_t     base;
+    size_t      pages;
+} tlb_range_t;
+
+typedef struct tlb_batch {
+    paddr_t     pml4_phys;      /* Address space of the user ranges. */
+    uint32_t    count;
+    size_t      pages;
+    bool        full;           /* Ran out of ranges, flush everything. */
+    bool        global;         /* Has kernel addresses. */
+    bool        tables;         /* Page tables were unlinked, lazy cpus too. */
+    tlb_range_t ranges[TLB_BATCH_MAX_RANGES];
+} tlb_batch_t;
+
+void tlb_batch_init(tlb_batch_t *batch, paddr_t pml4_phys);
+
+/** @brief  Queue pages for invalidation, adjacent ranges are merged. */
+void tlb_batch_add(tlb_batch_t *batch, vaddr_t base, size_t pages);
+
+/**
+ * @brief   Invalidate the batch on every cpu that may have it cached and
+ *          wait until they are done, the batch is empty afterwards. The
+ *          page table stores must be done before the call.
+ */
+void tlb_batch_flush(tlb_batch_t *batch);
+
+/** @brief  Take part in shootdowns, with the address space in cr3 active. */
+void x86_tlb_init_percpu(void);
+
+/**
+ * @brief   Load another address space on the current cpu. Threads do not
+ *          have address spaces of their own yet, nothing switches.
+ */
+void x86_tlb_switch_aspace(paddr_t pml4_phys);
+
+/** @brief  Keep the current address space loaded while halted, from arch_idle(). */
+void x86_tlb_enter_lazy(void);
+
+/** @brief  Back from the halt, catch up on skipped flushes. */
+void x86_tlb_leave_lazy(void);
+
+typedef struct tlb_stats {
+    uint64_t    shootdowns;     /* Batches flushed from this cpu. */
+    uint64_t    ipis;           /* Sent, at most one per target and batch. */
+    uint64_t    ipis_merged;    /* Target already had an ipi on the way. */
+    uint64_t    lazy_skipped;
+    uint64_t    wait_cycles;
+    uint64_t    invlpg;         /* Pages invalidated one by one on this cpu. */
+    uint64_t    full_flushes;
+} tlb_stats_t;
+
+void x86_tlb_get_stats(uint32_t cpu, tlb_stats_t *out);
+void x86_tlb_dump_stats(void);
+
+#endif /* _X86_TLB_H_ */
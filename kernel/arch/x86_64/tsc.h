@@ -0,0 +1,37 @@
+#ifndef _X86_TSC_H_
+#define _X86_TSC_H_
+
+#include "../../types.h"
+#include <stdbool.h>
+
+/*
+ * The TSC is the clocksource. It is assumed to be invariant and in sync
+ * across cpus, conversions are a multiply and a shift with 32.32 fixed
+ * point factors set up by the calibration.
+ */
+
+typedef struct x86_tsc_clock {
+    uint64_t    freq_hz;
+    uint64_t    ns_mult;        /* ns = (cycles * ns_mult) >> 32 */
+    uint64_t    cycles_mult;    /* cycles = (ns * cycles_mult) >> 32 */
+    uint64_t    boot_tsc;       /* TSC value at time 0. */
+    bool        invariant;      /* Keeps ticking at a constant rate in deep C states. */
+} x86_tsc_clock_t;
+
+extern x86_tsc_clock_t tsc_clock;
+
+static inline ktime_t tsc_to_ns(uint64_t cycles) {
+    return (ktime_t)(((unsigned __int128)cycles * tsc_clock.ns_mult) >> 32);
+}
+
+static inline uint64_t ns_to_tsc(ktime_t ns) {
+    return (uint64_t)(((unsigned __int128)ns * tsc_clock.cycles_mult) >> 32);
+}
+
+/** @brief  Calibrate the TSC frequency, boot cpu only, before any timer use. */
+void x86_tsc_init(void);
+
+/** @brief  Bring up the local apic timer of the current cpu. */
+void x86_timer_init_percpu(void);
+
+#endif /* _X86_TSC_H_ */
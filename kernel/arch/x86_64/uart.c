@@ -0,0 +1,292 @@
+#include "ioapic.h"
+#include "uart.h"
+#include "x86.h"
+#include "../../boot_trace.h"
+#include "../../console.h"
+#include "../../interrupts.h"
+#include "../../spinlock.h"
+#include "../../stdio.h"
+
+/* Registers, offsets from the base port */
+#define UART_REG_DATA           0       /* THR on write, RBR on read. */
+#define UART_REG_IER            1
+#define UART_REG_IIR            2       /* FCR on write. */
+#define UART_REG_LCR            3
+#define UART_REG_MCR            4
+#define UART_REG_LSR            5
+#define UART_REG_DLL            0       /* With LCR_DLAB set. */
+#define UART_REG_DLM            1
+
+#define UART_IER_THRE           0x02
+
+#define UART_IIR_FIFO_MASK      0xc0    /* Both set on a 16550A with working FIFOs. */
+
+#define UART_FCR_ENABLE         0x01
+#define UART_FCR_CLEAR_RX       0x02
+#define UART_FCR_CLEAR_TX       0x04
+#define UART_FCR_TRIGGER_14     0xc0
+
+#define UART_LCR_8N1            0x03
+#define UART_LCR_DLAB           0x80
+
+#define UART_MCR_DTR            0x01
+#define UART_MCR_RTS            0x02
+#define UART_MCR_OUT2           0x08    /* Gates the irq line on PCs. */
+
+#define UART_LSR_THRE           0x20    /* Transmit FIFO empty. */
+#define UART_LSR_TEMT           0x40    /* Shift register empty too. */
+
+#define UART_CLOCK_HZ           115200  /* Divisor latch base. */
+#define UART_FIFO_SIZE          16
+
+#define UART_TX_RING_MASK       (UART_TX_RING_SIZE - 1)
+
+static spin_lock_t uart_lock = SPIN_LOCK_INITIAL_VALUE;
+
+/* under uart_lock */
+static char tx_ring[UART_TX_RING_SIZE];
+static uint32_t tx_head, tx_tail;
+static uint8_t uart_ier;
+static uart_stats_t uart_stats;
+
+static uint32_t fifo_size = 1;
+static bool irq_mode;
+
+static inline uint8_t uart_in(uint32_t reg) {
+    return inb(UART_COM1_PORT + reg);
+}
+
+static inline void uart_out(uint32_t reg, uint8_t val) {
+    outb(UART_COM1_PORT + reg, val);
+}
+
+void uart_init_early(void) {
+    uint16_t divisor = UART_CLOCK_HZ / UART_BAUD;
+
+    uart_out(UART_REG_IER, 0);
+    uart_out(UART_REG_LCR, UART_LCR_DLAB);
+    uart_out(UART_REG_DLL, divisor & 0xff);
+    uart_out(UART_REG_DLM, divisor >> 8);
+    uart_out(UART_REG_LCR, UART_LCR_8N1);
+    uart_out(UART_REG_MCR, UART_MCR_DTR | UART_MCR_RTS);
+
+    uart_out(UART_REG_IIR, UART_FCR_ENABLE | UART_FCR_CLEAR_RX | UART_FCR_CLEAR_TX |
+                           UART_FCR_TRIGGER_14);
+
+    /* a plain 16450, or a 16550 with the broken FIFO, takes one byte at a time */
+    if ((uart_in(UART_REG_IIR) & UART_IIR_FIFO_MASK) == UART_IIR_FIFO_MASK)
+        fifo_size = UART_FIFO_SIZE;
+
+    /* printf works from here on */
+    boot_mark("console");
+}
+
+/* ------------------------------ Transmit ------------------------------ */
+
+/**
+ * @brief   Move up to a FIFO load from the ring to the device if the FIFO
+ *          is empty, with uart_lock held.
+ * @returns True if the ring is empty.
+ */
+static bool uart_fill_fifo(void) {
+    if (!(uart_in(UART_REG_LSR) & UART_LSR_THRE))
+        return tx_head == tx_tail;
+
+    for (uint32_t n = 0; n < fifo_size && tx_tail != tx_head; ++n)
+        uart_out(UART_REG_DATA, tx_ring[tx_tail++ & UART_TX_RING_MASK]);
+
+    return tx_head == tx_tail;
+}
+
+static inline uint32_t uart_ring_room(void) {
+    return UART_TX_RING_SIZE - (tx_head - tx_tail);
+}
+
+/** @brief  Copy str into the ring, with uart_lock held. @returns Bytes taken. */
+static size_t uart_ring_put(const char *str, size_t len) {
+    size_t done = 0;
+
+    while (done < len) {
+        uint32_t room = uart_ring_room();
+
+        /* the terminal wants a carriage return before every newline */
+        if (str[done] == '\n') {
+            if (room < 2)
+                break;
+            tx_ring[tx_head++ & UART_TX_RING_MASK] = '\r';
+        } else if (room < 1) {
+            break;
+        }
+
+        tx_ring[tx_head++ & UART_TX_RING_MASK] = str[done++];
+    }
+
+    return done;
+}
+
+/** @brief  Write str straight to the device, a FIFO load per wait. */
+static void uart_write_polled(const char *str, size_t len) {
+    bool cr = false;
+
+    while (len) {
+        while (!(uart_in(UART_REG_LSR) & UART_LSR_THRE))
+            cpu_pause();
+
+        for (uint32_t n = 0; n < fifo_size && len; ++n) {
+            if (*str == '\n' && !cr) {
+                uart_out(UART_REG_DATA, '\r');
+                cr = true;
+                continue;
+            }
+
+            uart_out(UART_REG_DATA, *str++);
+            cr = false;
+            len--;
+        }
+    }
+}
+
+void console_write(const char *str, size_t len) {
+    spin_lock_saved_state_t state;
+
+    if (!irq_mode) {
+        console_write_polled(str, len);
+        return;
+    }
+
+    uint64_t start = rdtsc();
+
+    spin_lock_irqsave(&uart_lock, state);
+
+    uart_stats.tx_bytes += len;
+
+    for (;;) {
+        size_t n = uart_ring_put(str, len);
+        str += n;
+        len -= n;
+
+        if (!len)
+            break;
+
+        /* full, the interrupt cannot run here, make room ourselves */
+        uart_stats.ring_full++;
+        while (!uart_fill_fifo() && uart_ring_room() < 2)
+            cpu_pause();
+    }
+
+    /* start the transmitter, the THR empty interrupt keeps it going */
+    if (!uart_fill_fifo() && !(uart_ier & UART_IER_THRE)) {
+        uart_ier |= UART_IER_THRE;
+        uart_out(UART_REG_IER, uart_ier);
+    }
+
+    uint64_t cycles = rdtsc() - start;
+
+    uart_stats.writes++;
+    uart_stats.write_cycles += cycles;
+    if (cycles > uart_stats.max_write_cycles)
+        uart_stats.max_write_cycles = cycles;
+
+    spin_unlock_irqrestore(&uart_lock, state);
+}
+
+void console_write_polled(const char *str, size_t len) {
+    arch_irq_state_t state = arch_irq_save();
+
+    /* a panic in the middle of console_write() must still get out */
+    bool locked = spin_trylock(&uart_lock);
+
+    if (locked) {
+        while (!uart_fill_fifo())
+            cpu_pause();
+    }
+
+    uart_write_polled(str, len);
+
+    if (locked) {
+        uart_stats.tx_bytes += len;
+        spin_unlock(&uart_lock);
+    }
+
+    arch_irq_restore(state);
+}
+
+void console_flush(void) {
+    for (;;) {
+        spin_lock_saved_state_t state;
+        spin_lock_irqsave(&uart_lock, state);
+
+        /* fill in for the interrupt, it may be off on the cpu it goes to */
+        bool idle = uart_fill_fifo() && (uart_in(UART_REG_LSR) & UART_LSR_TEMT);
+
+        spin_unlock_irqrestore(&uart_lock, state);
+
+        if (idle)
+            return;
+
+        cpu_pause();
+    }
+}
+
+static handler_return_t uart_irq(void *arg) {
+    spin_lock(&uart_lock);
+
+    /* reading the identification clears a pending THR empty interrupt */
+    (void)uart_in(UART_REG_IIR);
+
+    uart_stats.tx_irqs++;
+    if (tx_head != tx_tail)
+        uart_stats.fifo_loads++;
+
+    /* drained, the next console_write() turns it back on */
+    if (uart_fill_fifo() && (uart_ier & UART_IER_THRE)) {
+        uart_ier &= ~UART_IER_THRE;
+        uart_out(UART_REG_IER, uart_ier);
+    }
+
+    spin_unlock(&uart_lock);
+
+    return INT_NO_RESCHEDULE;
+}
+
+void uart_init(void) {
+    uint32_t vector = IOAPIC_ISA_VECTOR(IOAPIC_ISA_IRQ_COM1);
+
+    register_int_handler(vector, uart_irq, NULL);
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&uart_lock, state);
+
+    uart_out(UART_REG_MCR, UART_MCR_DTR | UART_MCR_RTS | UART_MCR_OUT2);
+    ioapic_route(IOAPIC_ISA_IRQ_COM1, vector, 0);
+    irq_mode = true;
+
+    spin_unlock_irqrestore(&uart_lock, state);
+}
+
+/* ------------------------------ Stats ------------------------------ */
+
+void uart_get_stats(uart_stats_t *out) {
+    spin_lock_saved_state_t state;
+
+    spin_lock_irqsave(&uart_lock, state);
+    *out = uart_stats;
+    spin_unlock_irqrestore(&uart_lock, state);
+}
+
+void uart_dump_stats(void) {
+    uart_stats_t s;
+
+    uart_get_stats(&s);
+
+    uint64_t avg = s.writes ? s.write_cycles / s.writes : 0;
+    uint64_t per_irq = s.fifo_loads ? (s.tx_bytes / s.fifo_loads) : 0;
+
+    printf("uart: fifo %u, %s, %llu bytes\n", fifo_size, irq_mode ? "irq" : "polled",
+           (unsigned long long)s.tx_bytes);
+    printf("uart: %llu irqs, %llu fifo loads, ~%llu bytes per load, %llu ring full\n",
+           (unsigned long long)s.tx_irqs, (unsigned long long)s.fifo_loads,
+           (unsigned long long)per_irq, (unsigned long long)s.ring_full);
+    printf("uart: %llu writes, avg %llu cycles, max %llu cycles\n", (unsigned long long)s.writes,
+           (unsigned long long)avg, (unsigned long long)s.max_write_cycles);
+}
@@ -0,0 +1,42 @@
+#ifndef _X86_UART_H_
+#define _X86_UART_H_
+
+#include "../../types.h"
+
+/*
+ * 16550 serial console on COM1, the console device of the platform.
+ *
+ * console_write() copies into a transmit ring and returns. The ring is
+ * drained by the THR empty interrupt a FIFO load at a time, so the line
+ * status register is looked at once per 16 bytes, not per byte. A writer
+ * that finds the ring full moves the data itself with interrupts off
+ * instead of waiting for the interrupt.
+ *
+ * Until uart_init() the console is polled, and console_write_polled() is
+ * always polled: it flushes the ring first to keep the output in order.
+ */
+
+#define UART_COM1_PORT          0x3f8
+#define UART_BAUD               115200
+#define UART_TX_RING_SIZE       16384   /* Power of 2. */
+
+/** @brief  Program the port for polled output, boot cpu, before any printing. */
+void uart_init_early(void);
+
+/** @brief  Switch to interrupt driven output, after the I/O apic is up. */
+void uart_init(void);
+
+typedef struct uart_stats {
+    uint64_t    tx_bytes;       /* Into the ring or written polled. */
+    uint64_t    tx_irqs;
+    uint64_t    fifo_loads;     /* From the interrupt. */
+    uint64_t    ring_full;      /* Writes that had to make room themselves. */
+    uint64_t    writes;
+    uint64_t    write_cycles;   /* Time spent in console_write(). */
+    uint64_t    max_write_cycles;
+} uart_stats_t;
+
+void uart_get_stats(uart_stats_t *out);
+void uart_dump_stats(void);
+
+#endif /* _X86_UART_H_ */
@@ -25,12 +25,6 @@ static inline void cpuid_c(uint32_t leaf, uint32_t csel,
     );
 }
 
-static inline unsigned long cpuid_get_addr_width(void) {
-    uint32_t eax, ebx, ecx, edx; 
-    cpuid(0x80000008, &eax, &ebx, &ecx, &edx);
-    return (eax & 0xff);
-}
-
 static inline unsigned long get_cr0(void) {
     unsigned long rv;
 
@@ -85,6 +79,135 @@ static inline void set_cr4(unsigned long val) {
     );
 }
 
+static inline uint64_t read_msr(uint32_t msr) {
+    uint32_t low, high;
+
+    __asm__ __volatile__(
+        "rdmsr \n\t"
+        : "=a"(low), "=d"(high)
+        : "c"(msr)
+    );
+
+    return ((uint64_t)high << 32) | low;
+}
+
+static inline void write_msr(uint32_t msr, uint64_t val) {
+    __asm__ __volatile__(
+        "wrmsr \n\t"
+        : : "c"(msr), "a"((uint32_t)val), "d"((uint32_t)(val >> 32))
+        : "memory"
+    );
+}
+
+static inline uint64_t xgetbv(uint32_t reg) {
+    uint32_t lo, hi;
+
+    __asm__ __volatile__(
+        "xgetbv \n\t"
+        : "=a"(lo), "=d"(hi)
+        : "c"(reg)
+    );
+
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void xsetbv(uint32_t reg, uint64_t val) {
+    __asm__ __volatile__(
+        "xsetbv \n\t"
+        : : "c"(reg), "a"((uint32_t)val), "d"((uint32_t)(val >> 32))
+    );
+}
+
+/* Set on the boot cpu when xsave is enabled, fxsave covers the FPU otherwise. */
+extern bool x86_fpu_xsave;
+
+/* Save and load every component enabled in XCR0, area 64 byte aligned. */
+static inline void xsave(void *area) {
+    __asm__ __volatile__(
+        "xsave64 (%0) \n\t"
+        : : "r"(area), "a"(-1), "d"(-1) : "memory"
+    );
+}
+
+static inline void xrstor(const void *area) {
+    __asm__ __volatile__(
+        "xrstor64 (%0) \n\t"
+        : : "r"(area), "a"(-1), "d"(-1) : "memory"
+    );
+}
+
+/* x87 and SSE state only, area 16 byte aligned. */
+static inline void fxsave(void *area) {
+    __asm__ __volatile__(
+        "fxsave64 (%0) \n\t"
+        : : "r"(area) : "memory"
+    );
+}
+
+static inline void fxrstor(const void *area) {
+    __asm__ __volatile__(
+        "fxrstor64 (%0) \n\t"
+        : : "r"(area) : "memory"
+    );
+}
+
+static inline uint8_t inb(uint16_t port) {
+    uint8_t rv;
+
+    __asm__ __volatile__(
+        "inb %1, %0 \n\t"
+        : "=a"(rv)
+        : "dN"(port)
+    );
+
+    return rv;
+}
+
+static inline void outb(uint16_t port, uint8_t val) {
+    __asm__ __volatile__(
+        "outb %1, %0 \n\t"
+        : : "dN"(port), "a"(val)
+    );
+}
+
+/* Drop the translation of one page, global or not, from the local TLB. */
+static inline void invlpg(vaddr_t vaddr) {
+    __asm__ __volatile__(
+        "invlpg (%0) \n\t"
+        : : "r"(vaddr) : "memory"
+    );
+}
+
+#define INVPCID_TYPE_ALL_GLOBAL     2   /* Every context, global entries too. */
+#define INVPCID_TYPE_ALL_NON_GLOBAL 3
+
+/* Drop translations by process context id, needs X86_FEATURE_INVPCID. */
+static inline void invpcid(unsigned long type, uint64_t pcid, vaddr_t vaddr) {
+    struct { uint64_t pcid; uint64_t vaddr; } desc = { pcid, vaddr };
+
+    __asm__ __volatile__(
+        "invpcid %0, %1 \n\t"
+        : : "m"(desc), "r"(type) : "memory"
+    );
+}
+
+/* Read the time stamp counter. */
+static inline uint64_t rdtsc(void) {
+    uint32_t low, high;
+
+    __asm__ __volatile__(
+        "rdtsc \n\t"
+        : "=a"(low), "=d"(high)
+    );
+
+    return ((uint64_t)high << 32) | low;
+}
+
+/* Spin-wait hint, lets the sibling hyperthread run while we busy loop. */
+static inline void cpu_pause(void) {
+    __asm__ __volatile__("pause" ::: "memory");
+}
+
 static inline bool is_paging_enabled(void) {
     if (get_cr0() & CR0_PG_BIT)
         return true;
@@ -102,6 +225,14 @@ static inline bool is_PAE_enabled(void) {
     return false;
 }
 
+static inline void cli(void) {
+    __asm__ __volatile__("cli" ::: "memory");
+}
+
+static inline void sti(void) {
+    __asm__ __volatile__("sti" ::: "memory");
+}
+
 typedef unsigned long x86_flags_t;
 
 static inline x86_flags_t save_flags(void) {
@@ -0,0 +1,54 @@
+#ifndef _ATOMIC_H_
+#define _ATOMIC_H_
+
+#include <stdbool.h>
+
+/*
+ * Thin wrappers around the compiler's __atomic builtins. They are type
+ * generic, so they work on any naturally aligned integer or pointer.
+ *
+ * The plain variants are sequentially consistent, the suffixed ones use
+ * the weaker ordering named by the suffix.
+ */
+
+#define atomic_load(ptr)                __atomic_load_n((ptr), __ATOMIC_SEQ_CST)
+#define atomic_load_relaxed(ptr)        __atomic_load_n((ptr), __ATOMIC_RELAXED)
+#define atomic_load_acquire(ptr)        __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+
+#define atomic_store(ptr, val)          __atomic_store_n((ptr), (val), __ATOMIC_SEQ_CST)
+#define atomic_store_relaxed(ptr, val)  __atomic_store_n((ptr), (val), __ATOMIC_RELAXED)
+#define atomic_store_release(ptr, val)  __atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+
+#define atomic_exchange(ptr, val)       __atomic_exchange_n((ptr), (val), __ATOMIC_SEQ_CST)
+
+#define atomic_fetch_add(ptr, val)      __atomic_fetch_add((ptr), (val), __ATOMIC_SEQ_CST)
+#define atomic_fetch_sub(ptr, val)      __atomic_fetch_sub((ptr), (val), __ATOMIC_SEQ_CST)
+#define atomic_fetch_or(ptr, val)       __atomic_fetch_or((ptr), (val), __ATOMIC_SEQ_CST)
+#define atomic_fetch_and(ptr, val)      __atomic_fetch_and((ptr), (val), __ATOMIC_SEQ_CST)
+
+#define atomic_add_relaxed(ptr, val)    ((void)__atomic_fetch_add((ptr), (val), __ATOMIC_RELAXED))
+
+/**
+ * @brief   Compare *ptr with *expected and, if equal, store desired.
+ *          On failure the current value is written back to *expected.
+ * @returns True if the exchange happened.
+ */
+#define atomic_cmpxchg(ptr, expected, desired)                              \
+    __atomic_compare_exchange_n((ptr), (expected), (desired), false,        \
+                                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)
+
+#define atomic_cmpxchg_acquire(ptr, expected, desired)                      \
+    __atomic_compare_exchange_n((ptr), (expected), (desired), false,        \
+                                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)
+
+#define atomic_cmpxchg_release(ptr, expected, desired)                      \
+    __atomic_compare_exchange_n((ptr), (expected), (desired), false,        \
+                                __ATOMIC_RELEASE, __ATOMIC_RELAXED)
+
+/* Full memory barrier */
+#define smp_mb()                        __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+/* Compiler barrier, no instructions are emitted */
+#define barrier()                       __asm__ __volatile__("" ::: "memory")
+
+#endif /* _ATOMIC_H_ */
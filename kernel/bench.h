@@ -0,0 +1,55 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include "types.h"
+
+/*
+ * In kernel microbenchmarks. They print their results to the console and
+ * have to run from a kernel thread, after the timers are up.
+ *
+ * Results meant for scripts/bench-qemu also go out as one line each,
+ *
+ *     @bench <suite> <name> <value> <unit>
+ *
+ * between "@bench begin" and "@bench end". Values are integers, units in
+ * cycles or ns are better lower, rates are better higher.
+ */
+
+/** @brief  Print one machine readable result, suite and name without spaces. */
+void bench_report(const char *suite, const char *name, uint64_t value, const char *unit);
+
+/**
+ * @brief   Run the pmm, mmu, memops and lock suites, the ones that take a
+ *          bounded time, bracketed by "@bench begin" and "@bench end".
+ *          The boot checkpoints go out first, see boot_trace.h.
+ */
+void bench_run_all(void);
+
+/** @brief  Timer insert and cancel cost in cycles, and sleep accuracy. */
+void bench_timer(void);
+
+/** @brief  TRACE() cost per record against formatting it, and the deferred rendering. */
+void bench_trace(void);
+
+/**
+ * @brief   Console write latency seen by the caller and the throughput to
+ *          the device, buffered against polled, for a few line lengths.
+ */
+void bench_console(void);
+
+/**
+ * @brief   memset and memcpy bytes per cycle of every cpu variant and of the
+ *          dispatch, per size class, and of the page clear and copy.
+ */
+void bench_memops(void);
+
+/** @brief  Cycles per page of single, batched and contiguous pmm allocations. */
+void bench_pmm(void);
+
+/** @brief  Cycles per page to map, look up and unmap ranges in a scratch pml4. */
+void bench_mmu(void);
+
+/** @brief  Uncontended acquire and release cycles of the spinlocks and the mutex. */
+void bench_locks(void);
+
+#endif /* _BENCH_H_ */
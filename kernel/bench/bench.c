@@ -0,0 +1,29 @@
+#include "../bench.h"
+#include "../arch.h"
+#include "../boot_trace.h"
+#include "../pmu.h"
+#include "../stdio.h"
+
+void bench_report(const char *suite, const char *name, uint64_t value, const char *unit) {
+    printf("@bench %s %s %llu %s\n", suite, name, (unsigned long long)value, unit);
+}
+
+void bench_run_all(void) {
+    /* cycles are TSC ticks, the scripts need the rate to turn them into time */
+    printf("@bench begin %llu\n", (unsigned long long)tsc_clock.freq_hz);
+
+    /* boot is over by now, the harness reports the phases with the results */
+    boot_trace_dump(true);
+
+    /* the events of the instrumented sites during the suites, for the log */
+    pmu_reset();
+
+    bench_pmm();
+    bench_mmu();
+    bench_memops();
+    bench_locks();
+
+    pmu_dump();
+
+    printf("@bench end\n");
+}
@@ -0,0 +1,74 @@
+#include "../bench.h"
+#include "../arch.h"
+#include "../console.h"
+#include "../stdio.h"
+#include "../timer.h"
+
+#define BENCH_BYTES             8192    /* Fits the uart ring, the callers never wait. */
+
+static const size_t bench_line_sizes[] = { 16, 80, 512 };
+
+static char bench_line[512];
+
+typedef struct console_result {
+    uint64_t    avg_cycles;     /* Per call, what the caller sees. */
+    uint64_t    max_cycles;
+    ktime_t     drain_ns;       /* First byte in to last byte out. */
+} console_result_t;
+
+static void bench_console_run(size_t line, bool polled, console_result_t *res) {
+    size_t calls = BENCH_BYTES / line;
+    uint64_t total = 0, worst = 0;
+
+    console_flush();
+
+    ktime_t start = current_time();
+
+    for (size_t i = 0; i < calls; ++i) {
+        uint64_t t = arch_cycle_count();
+
+        if (polled)
+            console_write_polled(bench_line + sizeof(bench_line) - line, line);
+        else
+            console_write(bench_line + sizeof(bench_line) - line, line);
+
+        t = arch_cycle_count() - t;
+        total += t;
+        if (t > worst)
+            worst = t;
+    }
+
+    console_flush();
+
+    res->avg_cycles = total / calls;
+    res->max_cycles = worst;
+    res->drain_ns = current_time() - start;
+}
+
+void bench_console(void) {
+    console_result_t res[2][sizeof(bench_line_sizes) / sizeof(bench_line_sizes[0])];
+
+    for (size_t i = 0; i < sizeof(bench_line) - 1; ++i)
+        bench_line[i] = 'a' + i % 26;
+    bench_line[sizeof(bench_line) - 1] = '\n';
+
+    for (int polled = 0; polled < 2; ++polled) {
+        for (size_t s = 0; s < sizeof(bench_line_sizes) / sizeof(bench_line_sizes[0]); ++s)
+            bench_console_run(bench_line_sizes[s], polled, &res[polled][s]);
+    }
+
+    /* printed after the runs, the klog drain goes through the console too */
+    printf("console: %d bytes per run\n", BENCH_BYTES);
+    printf("%8s %6s %14s %14s %12s\n", "mode", "line", "avg cycles", "max cycles", "KiB/s");
+
+    for (int polled = 0; polled < 2; ++polled) {
+        for (size_t s = 0; s < sizeof(bench_line_sizes) / sizeof(bench_line_sizes[0]); ++s) {
+            console_result_t *r = &res[polled][s];
+            uint64_t kib_s = r->drain_ns ? (uint64_t)BENCH_BYTES * 1000000000 / r->drain_ns / 1024 : 0;
+
+            printf("%8s %6zu %14llu %14llu %12llu\n", polled ? "polled" : "buffered",
+                   bench_line_sizes[s], (unsigned long long)r->avg_cycles,
+                   (unsigned long long)r->max_cycles, (unsigned long long)kib_s);
+        }
+    }
+}
@@ -0,0 +1,78 @@
+#include "../bench.h"
+#include "../arch.h"
+#include "../mutex.h"
+#include "../spinlock.h"
+#include "../stdio.h"
+
+#define BENCH_ITERATIONS        100000
+
+static spin_lock_t bench_spin = SPIN_LOCK_INITIAL_VALUE;
+static mcs_lock_t bench_mcs = MCS_LOCK_INITIAL_VALUE;
+static mutex_t bench_mutex = MUTEX_INTIAL_VALUE(bench_mutex);
+
+static uint64_t bench_spin_lock(void) {
+    uint64_t start = arch_cycle_count();
+
+    for (int i = 0; i < BENCH_ITERATIONS; ++i) {
+        spin_lock(&bench_spin);
+        spin_unlock(&bench_spin);
+    }
+
+    return (arch_cycle_count() - start) / BENCH_ITERATIONS;
+}
+
+static uint64_t bench_spin_lock_irqsave(void) {
+    spin_lock_saved_state_t state;
+    uint64_t start = arch_cycle_count();
+
+    for (int i = 0; i < BENCH_ITERATIONS; ++i) {
+        spin_lock_irqsave(&bench_spin, state);
+        spin_unlock_irqrestore(&bench_spin, state);
+    }
+
+    return (arch_cycle_count() - start) / BENCH_ITERATIONS;
+}
+
+static uint64_t bench_mcs_lock(void) {
+    mcs_node_t node;
+    uint64_t start = arch_cycle_count();
+
+    for (int i = 0; i < BENCH_ITERATIONS; ++i) {
+        mcs_lock(&bench_mcs, &node);
+        mcs_unlock(&bench_mcs, &node);
+    }
+
+    return (arch_cycle_count() - start) / BENCH_ITERATIONS;
+}
+
+static uint64_t bench_mutex_lock(void) {
+    uint64_t start = arch_cycle_count();
+
+    for (int i = 0; i < BENCH_ITERATIONS; ++i) {
+        mutex_acquire(&bench_mutex);
+        mutex_release(&bench_mutex);
+    }
+
+    return (arch_cycle_count() - start) / BENCH_ITERATIONS;
+}
+
+void bench_locks(void) {
+    static const struct {
+        const char  *name;
+        uint64_t    (*run)(void);
+    } benches[] = {
+        { "spin_lock",          bench_spin_lock },
+        { "spin_lock_irqsave",  bench_spin_lock_irqsave },
+        { "mcs_lock",           bench_mcs_lock },
+        { "mutex",              bench_mutex_lock },
+    };
+
+    printf("locks: uncontended acquire + release cycles\n");
+
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); ++i) {
+        uint64_t cycles = benches[i].run();
+
+        printf("%20s %8llu\n", benches[i].name, (unsigned long long)cycles);
+        bench_report("locks", benches[i].name, cycles, "cycles");
+    }
+}
@@ -0,0 +1,152 @@
+#include "../bench.h"
+#include "../arch.h"
+#include "../stdio.h"
+
+#include <string.h>
+
+#define BENCH_BUF_SIZE          (256 * 1024)
+#define BENCH_BYTES_PER_RUN     (8 * 1024 * 1024)   /* Per size and variant. */
+
+static const size_t bench_sizes[] = {
+    16, 64, 256, 1024, 4096, 16384, 65536, BENCH_BUF_SIZE,
+};
+
+static uint8_t bench_src[BENCH_BUF_SIZE] ALIGNED(PAGE_SIZE);
+static uint8_t bench_dst[BENCH_BUF_SIZE] ALIGNED(PAGE_SIZE);
+
+/* the last column is what memset() and memcpy() pick for the size */
+#define BENCH_DISPATCH          MEMOPS_NUM_IMPLS
+
+static void bench_print_rate(size_t bytes, uint64_t cycles) {
+    /* bytes per cycle with two decimals */
+    uint64_t rate = cycles ? bytes * 100 / cycles : 0;
+
+    printf(" %5llu.%02llu", (unsigned long long)(rate / 100), (unsigned long long)(rate % 100));
+}
+
+static uint64_t bench_memset_run(int impl, size_t size) {
+    size_t iterations = BENCH_BYTES_PER_RUN / size;
+    size_t slots = BENCH_BUF_SIZE / size;
+    uint64_t start = arch_cycle_count();
+
+    /* walk the buffer so the larger sizes are not all cache hits */
+    for (size_t i = 0; i < iterations; ++i) {
+        uint8_t *dst = bench_dst + (i % slots) * size;
+
+        if (impl == BENCH_DISPATCH)
+            memset(dst, (int)i, size);
+        else
+            x86_memset_impl(impl, dst, (int)i, size);
+    }
+
+    return arch_cycle_count() - start;
+}
+
+static uint64_t bench_memcpy_run(int impl, size_t size) {
+    size_t iterations = BENCH_BYTES_PER_RUN / size;
+    size_t slots = BENCH_BUF_SIZE / size;
+    uint64_t start = arch_cycle_count();
+
+    for (size_t i = 0; i < iterations; ++i) {
+        size_t off = (i % slots) * size;
+
+        if (impl == BENCH_DISPATCH)
+            memcpy(bench_dst + off, bench_src + off, size);
+        else
+            x86_memcpy_impl(impl, bench_dst + off, bench_src + off, size);
+    }
+
+    return arch_cycle_count() - start;
+}
+
+static void bench_memops_table(const char *op, uint64_t (*run)(int impl, size_t size)) {
+    uint64_t dispatch[sizeof(bench_sizes) / sizeof(bench_sizes[0])];
+
+    printf("%s bytes/cycle\n%8s", op, "size");
+    for (int impl = 0; impl < MEMOPS_NUM_IMPLS; ++impl)
+        printf(" %8s", x86_memops_name(impl));
+    printf(" %8s\n", "dispatch");
+
+    for (size_t s = 0; s < sizeof(bench_sizes) / sizeof(bench_sizes[0]); ++s) {
+        size_t size = bench_sizes[s];
+        size_t bytes = BENCH_BYTES_PER_RUN / size * size;
+
+        printf("%8zu", size);
+
+        for (int impl = 0; impl <= BENCH_DISPATCH; ++impl) {
+            if (impl != BENCH_DISPATCH && !x86_memops_supported(impl)) {
+                printf(" %8s", "-");
+                continue;
+            }
+
+            /* one pass to warm up, the second is timed */
+            run(impl, size);
+            uint64_t cycles = run(impl, size);
+
+            bench_print_rate(bytes, cycles);
+            if (impl == BENCH_DISPATCH)
+                dispatch[s] = cycles ? bytes * 1000 / cycles : 0;
+        }
+
+        printf("\n");
+    }
+
+    /* after the table, so the lines do not break it up */
+    for (size_t s = 0; s < sizeof(bench_sizes) / sizeof(bench_sizes[0]); ++s) {
+        char name[32];
+
+        snprintf(name, sizeof(name), "%s_%zu", op, bench_sizes[s]);
+        bench_report("memops", name, dispatch[s], "B/kcycle");
+    }
+}
+
+static void bench_pages(void) {
+    size_t pages = BENCH_BUF_SIZE / PAGE_SIZE;
+    size_t rounds = BENCH_BYTES_PER_RUN / BENCH_BUF_SIZE;
+    uint64_t cycles[4] = { 0 };
+
+    for (size_t r = 0; r < rounds; ++r) {
+        for (int v = 0; v < 4; ++v) {
+            uint64_t start = arch_cycle_count();
+
+            for (size_t p = 0; p < pages; ++p) {
+                void *dst = bench_dst + p * PAGE_SIZE;
+                const void *src = bench_src + p * PAGE_SIZE;
+
+                switch (v) {
+                case 0: arch_clear_page(dst); break;
+                case 1: arch_clear_page_nt(dst); break;
+                case 2: arch_copy_page(dst, src); break;
+                case 3: arch_copy_page_nt(dst, src); break;
+                }
+            }
+
+            cycles[v] += arch_cycle_count() - start;
+        }
+    }
+
+    printf("pages bytes/cycle, %zu KiB working set\n", (size_t)BENCH_BUF_SIZE / 1024);
+    printf("   clear");
+    bench_print_rate(BENCH_BYTES_PER_RUN, cycles[0]);
+    printf("   clear nt");
+    bench_print_rate(BENCH_BYTES_PER_RUN, cycles[1]);
+    printf("   copy");
+    bench_print_rate(BENCH_BYTES_PER_RUN, cycles[2]);
+    printf("   copy nt");
+    bench_print_rate(BENCH_BYTES_PER_RUN, cycles[3]);
+    printf("\n");
+
+    static const char *const names[] = { "clear_page", "clear_page_nt", "copy_page", "copy_page_nt" };
+
+    for (int v = 0; v < 4; ++v)
+        bench_report("memops", names[v], cycles[v] ? BENCH_BYTES_PER_RUN * 1000ULL / cycles[v] : 0,
+                     "B/kcycle");
+}
+
+void bench_memops(void) {
+    memset(bench_src, 0xa5, sizeof(bench_src));
+
+    bench_memops_table("memset", bench_memset_run);
+    bench_memops_table("memcpy", bench_memcpy_run);
+    bench_pages();
+}
@@ -0,0 +1,83 @@
+#include "../bench.h"
+#include "../arch.h"
+#include "../stdio.h"
+#include "../vm/pmm.h"
+
+#define BENCH_ROUNDS            64
+#define BENCH_VADDR             0x0000400000000000UL    /* Never loaded in cr3. */
+#define BENCH_PADDR             0x0000000040000000UL    /* Only mapped, never touched. */
+
+static const size_t bench_range_pages[] = { 1, 16, 512 };
+
+typedef struct mmu_result {
+    uint64_t    map;
+    uint64_t    lookup;
+    uint64_t    unmap;
+} mmu_result_t;
+
+static bool bench_mmu_range(addr_t pml4, size_t pages, mmu_result_t *res) {
+    uint64_t map = 0, lookup = 0, unmap = 0;
+
+    for (int r = 0; r < BENCH_ROUNDS; ++r) {
+        /* a new 1 GiB region each round, so the tables are created and freed too */
+        vaddr_t vaddr = BENCH_VADDR + ((vaddr_t)r << PDP_SHIFT);
+        pt_entry_t pa;
+        uint64_t flags;
+        uint32_t level;
+
+        uint64_t t0 = arch_cycle_count();
+        if (mmu_map_range(vaddr, BENCH_PADDR, pages, pml4, X86_PAGE_BIT_RW) != MMU_NO_ERROR)
+            return false;
+        uint64_t t1 = arch_cycle_count();
+
+        for (size_t p = 0; p < pages; ++p)
+            mmu_get_mapping(vaddr + p * PAGE_SIZE, pml4, &pa, &flags, &level);
+        uint64_t t2 = arch_cycle_count();
+
+        mmu_unmap_range(vaddr, pages, pml4);
+        uint64_t t3 = arch_cycle_count();
+
+        map += t1 - t0;
+        lookup += t2 - t1;
+        unmap += t3 - t2;
+    }
+
+    res->map = map / (BENCH_ROUNDS * pages);
+    res->lookup = lookup / (BENCH_ROUNDS * pages);
+    res->unmap = unmap / (BENCH_ROUNDS * pages);
+    return true;
+}
+
+void bench_mmu(void) {
+    pt_entry_t *pml4 = pmm_alloc_kpage(ALLOC_TAG_PAGE_TABLE);
+    if (!pml4) {
+        printf("mmu: no page for the pml4\n");
+        return;
+    }
+    arch_clear_page(pml4);
+
+    printf("mmu: cycles/page %8s %8s %8s\n", "map", "lookup", "unmap");
+
+    for (size_t i = 0; i < sizeof(bench_range_pages) / sizeof(bench_range_pages[0]); ++i) {
+        size_t pages = bench_range_pages[i];
+        mmu_result_t res;
+        char name[32];
+
+        if (!bench_mmu_range((addr_t)pml4, pages, &res)) {
+            printf("mmu: mapping %zu pages failed\n", pages);
+            break;
+        }
+
+        printf("%10zu pages %8llu %8llu %8llu\n", pages, (unsigned long long)res.map,
+               (unsigned long long)res.lookup, (unsigned long long)res.unmap);
+
+        snprintf(name, sizeof(name), "map_%zu", pages);
+        bench_report("mmu", name, res.map, "cycles");
+        snprintf(name, sizeof(name), "lookup_%zu", pages);
+        bench_report("mmu", name, res.lookup, "cycles");
+        snprintf(name, sizeof(name), "unmap_%zu", pages);
+        bench_report("mmu", name, res.unmap, "cycles");
+    }
+
+    pmm_free_kpages(pml4, 1);
+}
@@ -0,0 +1,76 @@
+#include "../bench.h"
+#include "../arch.h"
+#include "../list.h"
+#include "../stdio.h"
+#include "../vm/pmm.h"
+
+#define BENCH_ITERATIONS        4096
+#define BENCH_BATCH_PAGES       64
+#define BENCH_CONTIG_PAGES      16
+#define BENCH_CONTIG_ALIGN_LOG2 16      /* 64 KiB */
+
+static uint64_t bench_pmm_single(void) {
+    uint64_t start = arch_cycle_count();
+
+    for (int i = 0; i < BENCH_ITERATIONS; ++i) {
+        vm_page_t *page = pmm_alloc_page(ALLOC_TAG_BENCH);
+        if (!page)
+            return 0;
+
+        pmm_free_page(page);
+    }
+
+    return (arch_cycle_count() - start) / BENCH_ITERATIONS;
+}
+
+static uint64_t bench_pmm_batch(void) {
+    uint64_t total = 0;
+
+    for (int i = 0; i < BENCH_ITERATIONS / BENCH_BATCH_PAGES; ++i) {
+        LIST_NODE(list);
+        uint64_t start = arch_cycle_count();
+
+        int got = pmm_alloc_pages(BENCH_BATCH_PAGES, &list, ALLOC_TAG_BENCH);
+        pmm_free(&list);
+
+        total += arch_cycle_count() - start;
+        if (got != BENCH_BATCH_PAGES)
+            return 0;
+    }
+
+    return total / BENCH_ITERATIONS;
+}
+
+static uint64_t bench_pmm_contiguous(void) {
+    uint64_t start = arch_cycle_count();
+
+    for (int i = 0; i < BENCH_ITERATIONS / BENCH_CONTIG_PAGES; ++i) {
+        LIST_NODE(list);
+
+        if (pmm_alloc_contiguous(BENCH_CONTIG_PAGES, BENCH_CONTIG_ALIGN_LOG2, NULL, NULL,
+                                 &list, ALLOC_TAG_BENCH) != NO_ERROR)
+            return 0;
+
+        pmm_free(&list);
+    }
+
+    return (arch_cycle_count() - start) / BENCH_ITERATIONS;
+}
+
+void bench_pmm(void) {
+    /* 0 if the pmm ran out, nothing is reported for those */
+    uint64_t single = bench_pmm_single();
+    uint64_t batch = bench_pmm_batch();
+    uint64_t contig = bench_pmm_contiguous();
+
+    printf("pmm: cycles/page alloc + free single %llu, batch of %d %llu, contiguous %d %llu\n",
+           (unsigned long long)single, BENCH_BATCH_PAGES, (unsigned long long)batch,
+           BENCH_CONTIG_PAGES, (unsigned long long)contig);
+
+    if (single)
+        bench_report("pmm", "alloc_free_page", single, "cycles");
+    if (batch)
+        bench_report("pmm", "alloc_free_batch64", batch, "cycles");
+    if (contig)
+        bench_report("pmm", "alloc_free_contig16", contig, "cycles");
+}
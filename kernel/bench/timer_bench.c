@@ -0,0 +1,89 @@
+#include "../bench.h"
+#include "../arch.h"
+#include "../stdio.h"
+#include "../thread.h"
+#include "../timer.h"
+
+#define BENCH_TIMERS            1024
+#define BENCH_ROUNDS            16
+#define BENCH_SLEEPS            8
+
+static timer_t bench_timers[BENCH_TIMERS];
+
+static void bench_timer_nop(timer_t *timer, ktime_t now, void *arg) {
+}
+
+static uint64_t bench_rand(uint64_t *seed) {
+    uint64_t x = *seed;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+
+    return *seed = x;
+}
+
+/** @brief  Deadlines from 1ms to about 2 minutes, so every wheel level is used. */
+static void bench_timer_insert_cancel(void) {
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+    uint64_t insert = 0, cancel = 0;
+
+    for (int i = 0; i < BENCH_TIMERS; ++i)
+        timer_initialize(&bench_timers[i]);
+
+    for (int round = 0; round < BENCH_ROUNDS; ++round) {
+        uint64_t start = arch_cycle_count();
+
+        for (int i = 0; i < BENCH_TIMERS; ++i) {
+            uint64_t r = bench_rand(&seed);
+            ktime_t delay = (1000000LL << (r % 17)) + (ktime_t)(r >> 44);
+
+            timer_set_oneshot(&bench_timers[i], delay, bench_timer_nop, NULL);
+        }
+
+        uint64_t mid = arch_cycle_count();
+
+        for (int i = 0; i < BENCH_TIMERS; ++i)
+            timer_cancel(&bench_timers[i]);
+
+        insert += mid - start;
+        cancel += arch_cycle_count() - mid;
+    }
+
+    uint64_t ops = (uint64_t)BENCH_TIMERS * BENCH_ROUNDS;
+
+    printf("timer: %d pending, insert %llu cycles/op, cancel %llu cycles/op\n", BENCH_TIMERS,
+           (unsigned long long)(insert / ops), (unsigned long long)(cancel / ops));
+}
+
+/** @brief  How late thread_sleep() wakes up, timer slack plus the wakeup. */
+static void bench_timer_accuracy(void) {
+    static const ktime_t delays[] = {
+        50000, 200000, 1000000, 5000000, 20000000, 100000000,
+    };
+
+    printf("%12s %14s %14s\n", "sleep us", "avg late us", "max late us");
+
+    for (size_t d = 0; d < sizeof(delays) / sizeof(delays[0]); ++d) {
+        ktime_t total = 0, worst = 0;
+
+        for (int i = 0; i < BENCH_SLEEPS; ++i) {
+            ktime_t start = current_time();
+            thread_sleep(delays[d]);
+            ktime_t late = current_time() - start - delays[d];
+
+            total += late;
+            if (late > worst)
+                worst = late;
+        }
+
+        printf("%12lld %14lld %14lld\n", (long long)(delays[d] / 1000),
+               (long long)(total / BENCH_SLEEPS / 1000), (long long)(worst / 1000));
+    }
+}
+
+void bench_timer(void) {
+    bench_timer_insert_cancel();
+    bench_timer_accuracy();
+    timer_dump_stats();
+}
@@ -0,0 +1,67 @@
+#include "../bench.h"
+#include "../arch.h"
+#include "../stdio.h"
+#include "../trace.h"
+
+#define BENCH_RECORDS           (TRACE_BUF_RECORDS * 8)
+
+static int bench_null_out(const char *str, size_t len, void *arg) {
+    return 0;
+}
+
+/* volatile so the arguments are loaded like on a real call site */
+static volatile uint64_t bench_addr = 0xffff800012345000ULL;
+static volatile uint32_t bench_count = 16;
+
+void bench_trace(void) {
+    uint64_t start, cycles[4];
+    trace_record_t rec;
+    char buf[64];
+
+    trace_reset();
+    trace_start();
+
+    start = arch_cycle_count();
+    for (int i = 0; i < BENCH_RECORDS; ++i)
+        TRACE("bench: empty");
+    cycles[0] = arch_cycle_count() - start;
+
+    start = arch_cycle_count();
+    for (int i = 0; i < BENCH_RECORDS; ++i)
+        TRACE("bench: map %#lx count %u", (unsigned long)bench_addr, bench_count);
+    cycles[1] = arch_cycle_count() - start;
+
+    start = arch_cycle_count();
+    for (int i = 0; i < BENCH_RECORDS; ++i)
+        TRACE("bench: %lx %lx %u %u %d %p", (unsigned long)bench_addr,
+              (unsigned long)bench_addr, bench_count, bench_count, i, (void *)bench_addr);
+    cycles[2] = arch_cycle_count() - start;
+
+    trace_stop();
+
+    /* what formatting the same record on the spot costs, before klog copies it */
+    start = arch_cycle_count();
+    for (int i = 0; i < TRACE_BUF_RECORDS; ++i)
+        snprintf(buf, sizeof(buf), "bench: map %#lx count %u", (unsigned long)bench_addr,
+                 bench_count);
+    cycles[3] = arch_cycle_count() - start;
+
+    printf("trace: %llu cycles/record no args, %llu with 2, %llu with 6\n",
+           (unsigned long long)(cycles[0] / BENCH_RECORDS),
+           (unsigned long long)(cycles[1] / BENCH_RECORDS),
+           (unsigned long long)(cycles[2] / BENCH_RECORDS));
+    printf("trace: snprintf of the 2 argument record %llu cycles\n",
+           (unsigned long long)(cycles[3] / TRACE_BUF_RECORDS));
+
+    /* the deferred half, rendering the last record over and over */
+    rec = trace_bufs[arch_curr_cpu_num()].records[(BENCH_RECORDS - 1) & (TRACE_BUF_RECORDS - 1)];
+
+    start = arch_cycle_count();
+    for (int i = 0; i < TRACE_BUF_RECORDS; ++i)
+        trace_format(bench_null_out, NULL, &rec);
+
+    printf("trace: rendering a 6 argument record %llu cycles\n",
+           (unsigned long long)((arch_cycle_count() - start) / TRACE_BUF_RECORDS));
+
+    trace_reset();
+}
@@ -0,0 +1,57 @@
+#ifndef _BOOT_TRACE_H_
+#define _BOOT_TRACE_H_
+
+/*
+ * Boot time checkpoints.
+ *
+ * boot_mark() records the cycle counter and a label. That works from the
+ * start of the boot, long before the TSC is calibrated, and
+ * boot_trace_dump() turns the marks into a per phase breakdown at the end
+ * of init. The entry code records into fixed slots with BOOT_MARK_ASM(),
+ * before there is a stack, and the array lives in .data so zeroing the
+ * bss does not wipe them.
+ *
+ * Only the boot cpu records, before the others are started, so there is
+ * no locking. Marks after the dump or past BOOT_TRACE_MAX are dropped.
+ */
+
+/* Fixed slots of the assembly checkpoints. */
+#define BOOT_TRACE_ENTRY        0   /* First instruction of _start. */
+#define BOOT_TRACE_PAGING       1   /* Boot page tables built, paging on. */
+#define BOOT_TRACE_NUM_FIXED    2
+
+#define BOOT_TRACE_MAX          32
+
+#ifdef __ASSEMBLER__
+
+/*
+ * Clobbers eax and edx, for 32 and 64 bit code before the kernel is
+ * mapped high. Stores to the physical address, with the PHY_ADDR() of
+ * the including entry code.
+ */
+#define BOOT_MARK_ASM(slot)                                     \
+    rdtsc;                                                      \
+    mov %eax, (PHY_ADDR(boot_trace_tsc) + (slot) * 8);          \
+    mov %edx, (PHY_ADDR(boot_trace_tsc) + (slot) * 8 + 4)
+
+#else
+
+#include "types.h"
+#include <stdbool.h>
+
+extern uint64_t boot_trace_tsc[BOOT_TRACE_MAX];
+
+/** @brief  Record a checkpoint, label is a string literal without spaces. */
+void boot_mark(const char *label);
+
+/**
+ * @brief   Print the time from the first checkpoint to each one and between
+ *          them, the cycle counter must be calibrated. With machine set the
+ *          lines are "@boot <label> <ns since the first>" for
+ *          scripts/bench-qemu instead.
+ */
+void boot_trace_dump(bool machine);
+
+#endif /* __ASSEMBLER__ */
+
+#endif /* _BOOT_TRACE_H_ */
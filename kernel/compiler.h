@@ -25,6 +25,8 @@
 
 #define ISCONSTANT(x)   __builtin_constant_p(x)
 
+#define CLEANUP(fn)     __attribute__((cleanup(fn)))
+
 #define CONSTRUCTOR     __attribute__((constructor))
 #define DESTRUCTOR      __attribute__((destructor))
 
@@ -0,0 +1,20 @@
+#ifndef _CONSOLE_H_
+#define _CONSOLE_H_
+
+#include <stddef.h>
+
+/*
+ * Console device, provided by the platform. The weak defaults drop the
+ * output.
+ */
+
+/** @brief  Write to the console. May spin for room, never blocks the thread. */
+void console_write(const char *str, size_t len);
+
+/** @brief  Write with interrupts off, for early boot and panic. */
+void console_write_polled(const char *str, size_t len);
+
+/** @brief  Wait until everything written so far has left the device. */
+void console_flush(void);
+
+#endif /* _CONSOLE_H_ */
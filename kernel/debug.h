@@ -2,6 +2,7 @@
 #define _DEBUG_H_
 
 #include "compiler.h"
+#include "klog.h"
 #include "stdio.h"
 
 #define DEBUG_LEVEL 1   /* ALWAYS */
@@ -12,12 +13,14 @@ typedef enum log_level {
     INFO
 } log_level_t;
 
-#define debug_printf(level, x...)                   \
-    do {                                            \
-        if ((level) <= DEBUG_LEVEL) { printf(x); }  \
+#define debug_printf(level, x...)                              \
+    do {                                                       \
+        if ((level) <= DEBUG_LEVEL) { klog_printf(level, x); } \
     } while (0)
 
-/* System-wide halt and prints to log buffer. */
+/* Halts the cpu after dumping the tail of the log buffer and the message
+ * with the polled console.
+ */
 void panic(const char *fmt, ...) PRINTFLIKE(1, 2) NORETURN;
 
 #endif /* _DEBUG_H_ */
\ No newline at end of file
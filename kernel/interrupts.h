@@ -0,0 +1,48 @@
+#ifndef _INTERRUPTS_H_
+#define _INTERRUPTS_H_
+
+#include "types.h"
+#include <stdbool.h>
+
+typedef enum handler_return {
+    INT_NO_RESCHEDULE,
+    INT_RESCHEDULE,     /* Preempt the interrupted thread on exit. */
+} handler_return_t;
+
+typedef handler_return_t (*int_handler)(void *arg);
+
+/**
+ * @brief   Install the handler of an interrupt vector, shared by all cpus.
+ *          Handlers run with interrupts disabled, the end of interrupt is
+ *          sent after they return.
+ */
+void register_int_handler(uint32_t vector, int_handler handler, void *arg);
+
+/** @brief  Entry count and time spent in handlers, per cpu and vector. */
+typedef struct int_stats {
+    uint64_t    count;
+    uint64_t    cycles;
+    uint64_t    max_cycles;
+} int_stats_t;
+
+void int_get_stats(uint32_t cpu, uint32_t vector, int_stats_t *out);
+void int_dump_stats(void);
+
+/* ------------------------------------------------------------------------
+ *  Page faults
+ * ------------------------------------------------------------------------
+ */
+
+#define VM_FAULT_FLAG_PRESENT       0x1     /* Protection fault on a mapped page. */
+#define VM_FAULT_FLAG_WRITE         0x2
+#define VM_FAULT_FLAG_USER          0x4
+#define VM_FAULT_FLAG_INSTRUCTION   0x8
+
+/**
+ * @brief   Resolve a fault at addr, called straight from the fault entry.
+ *          Weak, the default fails every fault.
+ * @returns 0 if the access can be retried.
+ */
+int vm_page_fault(vaddr_t addr, uint32_t flags);
+
+#endif /* _INTERRUPTS_H_ */
@@ -0,0 +1,48 @@
+#ifndef _INTERVAL_TREE_H_
+#define _INTERVAL_TREE_H_
+
+#include "rbtree.h"
+#include "types.h"
+
+/*
+ * Interval tree, a red-black tree of closed ranges [start, last] ordered
+ * by start, each node augmented with the largest last in its subtree.
+ * Finding the ranges that overlap a query skips every subtree that ends
+ * before it, O(log n) plus the number of matches.
+ *
+ * Ranges may overlap and repeat, the tree is intrusive like rbtree.h.
+ */
+
+typedef struct interval_node {
+    rb_node_t   rb;
+    uint64_t    start;
+    uint64_t    last;           /* Inclusive. */
+    uint64_t    subtree_last;   /* Largest last in the subtree, kept by the tree. */
+} interval_node_t;
+
+typedef struct interval_tree {
+    rb_root_t   root;
+} interval_tree_t;
+
+#define INTERVAL_TREE_INITIAL_VALUE { RB_ROOT_INITIAL_VALUE }
+
+/** @brief  Insert a node with start and last set. */
+void interval_tree_insert(interval_tree_t *tree, interval_node_t *node);
+void interval_tree_remove(interval_tree_t *tree, interval_node_t *node);
+
+/**
+ * @brief   First range, lowest start first, that overlaps [start, last].
+ * @returns NULL if none does.
+ */
+interval_node_t *interval_tree_iter_first(const interval_tree_t *tree, uint64_t start,
+                                          uint64_t last);
+
+/** @brief  Next range after node that overlaps [start, last]. */
+interval_node_t *interval_tree_iter_next(const interval_node_t *node, uint64_t start,
+                                         uint64_t last);
+
+#define interval_tree_for_each(node, tree, start, last)                  \
+    for (node = interval_tree_iter_first(tree, start, last); node;       \
+         node = interval_tree_iter_next(node, start, last))
+
+#endif /* _INTERVAL_TREE_H_ */
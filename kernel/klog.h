@@ -0,0 +1,54 @@
+#ifndef _KLOG_H_
+#define _KLOG_H_
+
+#include "compiler.h"
+#include "types.h"
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Kernel log. Every cpu appends records to its own ring buffer, reserving
+ * a slot is one atomic add on a cpu local counter, so logging never waits
+ * for the console or for other cpus and works from interrupt handlers. The
+ * rings are merged in timestamp order and written to the console later by
+ * klog_drain(), from the idle loop or by anyone who needs the output now.
+ *
+ * A full ring overwrites its oldest records, the drain reports how many
+ * were lost. Messages longer than a record continue in the next one.
+ */
+
+#define KLOG_RECORD_SIZE    128
+#define KLOG_RING_RECORDS   256     /* Per cpu, power of 2. */
+#define KLOG_TEXT_MAX       (KLOG_RECORD_SIZE - 20)
+
+#define KLOG_PANIC_RECORDS  32      /* Dumped by panic(). */
+
+typedef struct klog_record {
+    uint64_t    seq;        /* Ring index + 1 once complete, 0 while written. */
+    ktime_t     time;
+    uint16_t    len;
+    uint8_t     level;
+    uint8_t     rsvd;
+    char        text[KLOG_TEXT_MAX];
+} klog_record_t;
+
+int klog_printf(int level, const char *fmt, ...) PRINTFLIKE(2, 3);
+int klog_vprintf(int level, const char *fmt, va_list ap);
+
+/**
+ * @brief   Write the records of all cpus to the console in time order.
+ *          Returns at once if another cpu is draining.
+ */
+void klog_drain(void);
+
+/** @brief  Whether some cpu has records the console has not seen. */
+bool klog_has_pending(void);
+
+/**
+ * @brief   Write the last count records, drained or not, with the polled
+ *          console. For the panic path, takes no locks.
+ */
+void klog_dump_last(size_t count);
+
+#endif /* _KLOG_H_ */
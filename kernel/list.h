@@ -170,7 +170,7 @@ static inline list_node_t* list_peek_tail(list_node_t* list) {
 
 /** Iterate over the list backwards */
 #define list_for_each_prev(pos, head)                                   \
-    for (pos = head->prev; pos != (head); pos = pos->pev)
+    for (pos = head->prev; pos != (head); pos = pos->prev)
 
 /* Iterates of over every list, entry should be the container structure type */
 #define list_for_each_entry(pos, head, member)                          \
@@ -180,8 +180,8 @@ static inline list_node_t* list_peek_tail(list_node_t* list) {
 
 static inline size_t list_length(const list_node_t* list) {
     size_t cnt = 0;
-    const list_node_t* node = list;
-    list_for_each(list, node) { cnt++; }
+    const list_node_t* node;
+    list_for_each(node, list) { cnt++; }
     return cnt;
 }
 
@@ -201,10 +201,85 @@ static inline void list_split_after(list_node_t* list, list_node_t* pos, list_no
     list->prev = pos;
 }
 
+/* Move the contents of splice_from in after pos, splice_from is left empty */
 static inline void list_splice_after(list_node_t* splice_from, list_node_t* pos) {
     if (list_is_empty(splice_from)) {
-        list_initialize(splice_from);
+        return;
     }
+
+    splice_from->next->prev = pos;
+    splice_from->prev->next = pos->next;
+    pos->next->prev = splice_from->prev;
+    pos->next = splice_from->next;
+
+    list_initialize(splice_from);
+}
+
+/* ------------------------- Counted list ------------------------- */
+
+/** List head that keeps the number of entries, so the length is O(1). */
+typedef struct counted_list {
+    list_node_t head;
+    size_t      count;
+} counted_list_t;
+
+#define COUNTED_LIST_INITIAL_VALUE(value) { LIST_INITIAL_VALUE((value).head), 0 }
+
+static inline void counted_list_initialize(counted_list_t *list) {
+    list_initialize(&list->head);
+    list->count = 0;
+}
+
+static inline size_t counted_list_length(const counted_list_t *list) {
+    return list->count;
+}
+
+static inline int counted_list_is_empty(const counted_list_t *list) {
+    return list->count == 0;
+}
+
+static inline void counted_list_add(counted_list_t *list, list_node_t *item) {
+    list_add(&list->head, item);
+    list->count++;
+}
+
+static inline void counted_list_add_tail(counted_list_t *list, list_node_t *item) {
+    list_add_tail(&list->head, item);
+    list->count++;
+}
+
+/** The entry must be on this list. */
+static inline void counted_list_delete(counted_list_t *list, list_node_t *entry) {
+    list_delete(entry);
+    list->count--;
+}
+
+static inline list_node_t *counted_list_remove_head(counted_list_t *list) {
+    list_node_t *item = list_remove_head(&list->head);
+    if (item)
+        list->count--;
+    return item;
+}
+
+static inline list_node_t *counted_list_remove_tail(counted_list_t *list) {
+    list_node_t *item = list_remove_tail(&list->head);
+    if (item)
+        list->count--;
+    return item;
+}
+
+/** Move all the entries of splice_from to the front of list. */
+static inline void counted_list_splice(counted_list_t *splice_from, counted_list_t *list) {
+    list_splice_after(&splice_from->head, &list->head);
+    list->count += splice_from->count;
+    splice_from->count = 0;
+}
+
+/** Move all the entries of splice_from to the back of list. */
+static inline void counted_list_splice_tail(counted_list_t *splice_from, counted_list_t *list) {
+    list_splice_after(&splice_from->head, list->head.prev);
+    list->count += splice_from->count;
+    splice_from->count = 0;
 }
 
 #endif /* _LIST_H_ */
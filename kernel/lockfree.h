@@ -0,0 +1,273 @@
+#ifndef _LOCKFREE_H_
+#define _LOCKFREE_H_
+
+#include "arch.h"
+#include "atomic.h"
+#include "compiler.h"
+#include "types.h"
+#include <stdbool.h>
+
+/*
+ * Lock-free intrusive containers. Like list.h the nodes are embedded in
+ * the containing structure, use container_of() to get back to it.
+ *
+ * Nodes popped off a stack may still be read by a concurrent pop, so
+ * their memory must stay mapped (type stable), which holds for vm_page_t
+ * and anything else living in the kernel's direct map.
+ */
+
+/* ------------------------------------------------------------------------
+ *  Treiber stack
+ * ------------------------------------------------------------------------
+ */
+
+/*
+ * The top of the stack is a tagged pointer: the low 48 bits hold the
+ * node pointer and the high 16 bits a sequence that is bumped on every
+ * pop, so a node that is popped and pushed back in between a load and a
+ * cmpxchg of another cpu (ABA) makes that cmpxchg fail. Canonical
+ * addresses are sign extended from bit 47 on the way out.
+ */
+#define LF_TAG_SHIFT        48
+#define LF_PTR_MASK         ((1ULL << LF_TAG_SHIFT) - 1)
+
+typedef struct lf_stack_node {
+    struct lf_stack_node *next;
+} lf_stack_node_t;
+
+typedef struct lf_stack {
+    uint64_t top;           /* Tagged pointer to the top node. */
+} ALIGNED(CACHE_LINE_SIZE) lf_stack_t;
+
+#define LF_STACK_INITIAL_VALUE  { .top = 0 }
+
+static inline lf_stack_node_t *lf_tagged_ptr(uint64_t tagged) {
+    return (lf_stack_node_t *)(((int64_t)(tagged << (64 - LF_TAG_SHIFT))) >> (64 - LF_TAG_SHIFT));
+}
+
+static inline uint64_t lf_make_tagged(lf_stack_node_t *node, uint64_t tag) {
+    return ((uint64_t)node & LF_PTR_MASK) | (tag << LF_TAG_SHIFT);
+}
+
+static inline uint64_t lf_tag(uint64_t tagged) {
+    return tagged >> LF_TAG_SHIFT;
+}
+
+static inline void lf_stack_init(lf_stack_t *stack) {
+    stack->top = 0;
+}
+
+static inline bool lf_stack_is_empty(const lf_stack_t *stack) {
+    return lf_tagged_ptr(atomic_load_relaxed(&stack->top)) == NULL;
+}
+
+static inline void lf_stack_push(lf_stack_t *stack, lf_stack_node_t *node) {
+    uint64_t top = atomic_load_relaxed(&stack->top);
+
+    do {
+        node->next = lf_tagged_ptr(top);
+    } while (!atomic_cmpxchg_release(&stack->top, &top, lf_make_tagged(node, lf_tag(top))));
+}
+
+/** Push an already linked chain of nodes, first ... last, in one go. */
+static inline void lf_stack_push_chain(lf_stack_t *stack, lf_stack_node_t *first,
+                                       lf_stack_node_t *last) {
+    uint64_t top = atomic_load_relaxed(&stack->top);
+
+    do {
+        last->next = lf_tagged_ptr(top);
+    } while (!atomic_cmpxchg_release(&stack->top, &top, lf_make_tagged(first, lf_tag(top))));
+}
+
+static inline lf_stack_node_t *lf_stack_pop(lf_stack_t *stack) {
+    uint64_t top = atomic_load_acquire(&stack->top);
+    lf_stack_node_t *node;
+
+    do {
+        node = lf_tagged_ptr(top);
+        if (!node)
+            return NULL;
+    } while (!atomic_cmpxchg_acquire(&stack->top, &top,
+                                     lf_make_tagged(node->next, lf_tag(top) + 1)));
+
+    return node;
+}
+
+/**
+ * Detach the whole stack and return it as a NULL terminated chain, most
+ * recently pushed first. Never suffers from ABA, so it is the cheapest
+ * way for a single consumer to drain remote frees.
+ */
+static inline lf_stack_node_t *lf_stack_pop_all(lf_stack_t *stack) {
+    uint64_t top = atomic_load_relaxed(&stack->top);
+
+    do {
+        if (!lf_tagged_ptr(top))
+            return NULL;
+    } while (!atomic_cmpxchg_acquire(&stack->top, &top, lf_make_tagged(NULL, lf_tag(top) + 1)));
+
+    return lf_tagged_ptr(top);
+}
+
+/* ------------------------------------------------------------------------
+ *  Multi producer, single consumer queue
+ * ------------------------------------------------------------------------
+ */
+
+/*
+ * Intrusive FIFO after Vyukov's MPSC queue. A push is a single exchange
+ * and never waits. The consumer owns the tail. A producer that was
+ * interrupted between its exchange and linking the node makes the queue
+ * look empty to the consumer until it finishes.
+ */
+
+typedef struct mpsc_node {
+    struct mpsc_node *next;
+} mpsc_node_t;
+
+typedef struct mpsc_queue {
+    mpsc_node_t *head ALIGNED(CACHE_LINE_SIZE);    /* Producers push here. */
+    mpsc_node_t *tail ALIGNED(CACHE_LINE_SIZE);    /* Consumer pops here. */
+    mpsc_node_t stub;
+} mpsc_queue_t;
+
+static inline void mpsc_queue_init(mpsc_queue_t *q) {
+    q->stub.next = NULL;
+    q->head = &q->stub;
+    q->tail = &q->stub;
+}
+
+static inline void mpsc_queue_push(mpsc_queue_t *q, mpsc_node_t *node) {
+    node->next = NULL;
+
+    mpsc_node_t *prev = atomic_exchange(&q->head, node);
+    atomic_store_release(&prev->next, node);
+}
+
+/** @brief  Only the consumer may pop. Returns NULL if empty. */
+static inline mpsc_node_t *mpsc_queue_pop(mpsc_queue_t *q) {
+    mpsc_node_t *tail = q->tail;
+    mpsc_node_t *next = atomic_load_acquire(&tail->next);
+
+    /* skip over the stub */
+    if (tail == &q->stub) {
+        if (!next)
+            return NULL;
+
+        q->tail = next;
+        tail = next;
+        next = atomic_load_acquire(&next->next);
+    }
+
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+
+    /* a producer is between its exchange and linking the node */
+    if (tail != atomic_load_acquire(&q->head))
+        return NULL;
+
+    /* tail is the last node, put the stub behind it so it can be popped */
+    mpsc_queue_push(q, &q->stub);
+
+    next = atomic_load_acquire(&tail->next);
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
+
+static inline bool mpsc_queue_is_empty(mpsc_queue_t *q) {
+    return q->tail == &q->stub && atomic_load_acquire(&q->stub.next) == NULL;
+}
+
+/* ------------------------------------------------------------------------
+ *  Work stealing deque
+ * ------------------------------------------------------------------------
+ */
+
+/*
+ * Bounded Chase-Lev deque of pointers. The owning cpu pushes and pops at
+ * the bottom (LIFO, cache hot), other cpus steal from the top (FIFO).
+ * Only the cmpxchg on top is contended, and only when racing for the
+ * last entry or between thieves.
+ */
+
+#define WS_DEQUE_SIZE       256     /* Must be a power of 2 */
+
+typedef struct ws_deque {
+    int64_t top ALIGNED(CACHE_LINE_SIZE);       /* Thieves take from here. */
+    int64_t bottom ALIGNED(CACHE_LINE_SIZE);    /* Owner pushes and pops here. */
+    void    *buf[WS_DEQUE_SIZE];
+} ws_deque_t;
+
+static inline void ws_deque_init(ws_deque_t *dq) {
+    dq->top = 0;
+    dq->bottom = 0;
+}
+
+static inline size_t ws_deque_size(ws_deque_t *dq) {
+    int64_t b = atomic_load_relaxed(&dq->bottom);
+    int64_t t = atomic_load_relaxed(&dq->top);
+    return b > t ? (size_t)(b - t) : 0;
+}
+
+/** @brief  Owner only. Returns false if the deque is full. */
+static inline bool ws_deque_push(ws_deque_t *dq, void *item) {
+    int64_t b = atomic_load_relaxed(&dq->bottom);
+    int64_t t = atomic_load_acquire(&dq->top);
+
+    if (b - t >= WS_DEQUE_SIZE)
+        return false;
+
+    atomic_store_relaxed(&dq->buf[b & (WS_DEQUE_SIZE - 1)], item);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    atomic_store_relaxed(&dq->bottom, b + 1);
+
+    return true;
+}
+
+/** @brief  Owner only. Returns NULL if the deque is empty. */
+static inline void *ws_deque_pop(ws_deque_t *dq) {
+    int64_t b = atomic_load_relaxed(&dq->bottom) - 1;
+    atomic_store_relaxed(&dq->bottom, b);
+    smp_mb();
+    int64_t t = atomic_load_relaxed(&dq->top);
+
+    if (t > b) {
+        /* empty */
+        atomic_store_relaxed(&dq->bottom, b + 1);
+        return NULL;
+    }
+
+    void *item = atomic_load_relaxed(&dq->buf[b & (WS_DEQUE_SIZE - 1)]);
+    if (t == b) {
+        /* last entry, race the thieves for it */
+        if (!atomic_cmpxchg(&dq->top, &t, t + 1))
+            item = NULL;
+        atomic_store_relaxed(&dq->bottom, b + 1);
+    }
+
+    return item;
+}
+
+/** @brief  Any cpu. Returns NULL if empty or if it lost a race. */
+static inline void *ws_deque_steal(ws_deque_t *dq) {
+    int64_t t = atomic_load_acquire(&dq->top);
+    smp_mb();
+    int64_t b = atomic_load_acquire(&dq->bottom);
+
+    if (t >= b)
+        return NULL;
+
+    void *item = atomic_load_relaxed(&dq->buf[t & (WS_DEQUE_SIZE - 1)]);
+    if (!atomic_cmpxchg(&dq->top, &t, t + 1))
+        return NULL;
+
+    return item;
+}
+
+#endif /* _LOCKFREE_H_ */
@@ -1,23 +1,90 @@
 #ifndef _MUTEX_H_
 #define _MUTEX_H_
 
+#include "list.h"
+#include "spinlock.h"
+#include "types.h"
+#include <stdbool.h>
+
+/* Keep per lock contention statistics */
+#ifndef MUTEX_STATS
+#define MUTEX_STATS 1
+#endif
+
+/*
+ * The owner word holds the owning thread pointer. Threads are at least
+ * word aligned, so the low bit is free to mark that there are queued
+ * waiters and the release has to take the slow path.
+ */
+#define MUTEX_FLAG_CONTENDED    ((uintptr_t)0x1)
+#define MUTEX_OWNER_MASK        (~MUTEX_FLAG_CONTENDED)
+
+/* Max cycles to spin on a running owner before queueing up. */
+#define MUTEX_SPIN_MAX_CYCLES   20000
+
+typedef enum mutex_status {
+    MUTEX_NO_ERROR,
+    ERR_MUTEX_TIMED_OUT,
+    ERR_MUTEX_NOT_OWNER,
+} mutex_status_t;
+
+typedef struct mutex_stats {
+    uint64_t    acquires;       /* Successful acquisitions. */
+    uint64_t    contended;      /* Acquisitions that missed the fast path. */
+    uint64_t    spin_cycles;    /* Cycles spent spinning on a running owner. */
+    uint64_t    wait_cycles;    /* Cycles spent queued up behind others. */
+} mutex_stats_t;
+
 typedef struct mutex {
-    long *owner;
+    uintptr_t       owner;      /* Owner thread | MUTEX_FLAG_CONTENDED */
+
+    spin_lock_t     wait_lock;  /* Protects the wait queue. */
+    list_node_t     wait_queue; /* FIFO of blocked waiters. */
+
+#if MUTEX_STATS
+    mutex_stats_t   stats;
+#endif
 } mutex_t;
 
-#define MUTEX_INTIAL_VALUE(m)   \
-{                               \
-    .owner = NULL,              \
+#define MUTEX_INTIAL_VALUE(m)                           \
+{                                                       \
+    .owner = 0,                                         \
+    .wait_lock = SPIN_LOCK_INITIAL_VALUE,               \
+    .wait_queue = LIST_INITIAL_VALUE((m).wait_queue),   \
 }
 
 void mutex_init(mutex_t *);
 void mutex_destroy(mutex_t *);
 
-int mutex_acquire_timeout(mutex_t *, __time_t);
+/**
+ * @brief   Acquire the mutex. An uncontended acquire is a single atomic.
+ *          Otherwise spin while the owner is running on another cpu and
+ *          then block in FIFO order.
+ *
+ * @param timeout In ns from the call. 0 only tries once, INFINITE_TIME
+ *                waits forever.
+ * @returns MUTEX_NO_ERROR or ERR_MUTEX_TIMED_OUT.
+ */
+int mutex_acquire_timeout(mutex_t *, ktime_t);
+
+/**
+ * @brief   Release the mutex. If there are waiters the ownership is
+ *          handed directly to the one at the head of the queue.
+ */
 int mutex_release(mutex_t *);
 
-static inline mutex_acquire(mutex_t *m) {
-    return mutex_acquire_timeout(m, INT64_MAX);
+static inline int mutex_acquire(mutex_t *m) {
+    return mutex_acquire_timeout(m, INFINITE_TIME);
+}
+
+static inline int mutex_try_acquire(mutex_t *m) {
+    return mutex_acquire_timeout(m, 0);
 }
 
-#endif /* _MUTEX_H_ */
\ No newline at end of file
+/** @brief  Whether or not the current thread owns the mutex. */
+bool is_mutex_held(const mutex_t *m);
+
+/** @brief  Copy out the contention statistics of the mutex. */
+void mutex_get_stats(const mutex_t *m, mutex_stats_t *out);
+
+#endif /* _MUTEX_H_ */
@@ -0,0 +1,133 @@
+#ifndef _PMU_H_
+#define _PMU_H_
+
+#include "arch.h"
+#include "atomic.h"
+#include "compiler.h"
+#include "types.h"
+#include <stdbool.h>
+
+/*
+ * Hardware event counts around code regions.
+ *
+ * The arch code programs one counter per pmu_event_t on every cpu and lets
+ * them run, kernel and user, for good. A site is a static descriptor in the
+ * pmu_site section. A scope reads all the counters at the start, again at
+ * the end, and adds the difference and one call to its site, so scopes can
+ * nest and cost a few rdpmc each.
+ *
+ * A scope counts whatever the cpu did in between, interrupts included. One
+ * that ends on another cpu than it started is dropped and only counted in
+ * migrated. The sites are shared by all cpus and take atomic adds, keep
+ * them off paths that run millions of times a second on every cpu.
+ *
+ * Without a pmu, under TCG or with the counters hidden from the guest,
+ * scopes are a load and a branch and pmu_dump() says so. Events the cpu
+ * has no counter for stay at 0 and print as "-".
+ */
+
+#ifndef PMU_ENABLE
+#define PMU_ENABLE          1
+#endif
+
+typedef enum pmu_event {
+    PMU_EVENT_CYCLES,           /* Unhalted core cycles. */
+    PMU_EVENT_INSTRUCTIONS,     /* Instructions retired. */
+    PMU_EVENT_LLC_MISSES,       /* Last level cache misses. */
+    PMU_EVENT_DTLB_MISSES,      /* Data TLB misses that completed a page walk. */
+    PMU_EVENT_BRANCH_MISSES,    /* Mispredicted branches retired. */
+    PMU_EVENT_COUNT,
+} pmu_event_t;
+
+typedef struct pmu_site {
+    const char  *name;
+    const char  *file;
+    uint32_t    line;
+    uint64_t    calls;
+    uint64_t    migrated;
+    uint64_t    totals[PMU_EVENT_COUNT];
+} pmu_site_t;
+
+typedef struct pmu_scope {
+    pmu_site_t  *site;          /* NULL when nothing is counted. */
+    uint32_t    cpu;
+    uint64_t    start[PMU_EVENT_COUNT];
+} pmu_scope_t;
+
+/** @returns True if the cpu has counters and they are running. */
+static inline bool pmu_available(void) {
+    return arch_pmu_available();
+}
+
+static inline void pmu_scope_begin(pmu_scope_t *scope, pmu_site_t *site) {
+    if (!arch_pmu_available()) {
+        scope->site = NULL;
+        return;
+    }
+
+    scope->site = site;
+    scope->cpu = arch_curr_cpu_num();
+    arch_pmu_read(scope->start, PMU_EVENT_COUNT);
+}
+
+static inline void pmu_scope_end(pmu_scope_t *scope) {
+    pmu_site_t *site = scope->site;
+    uint64_t end[PMU_EVENT_COUNT];
+
+    if (!site)
+        return;
+
+    arch_pmu_read(end, PMU_EVENT_COUNT);
+
+    if (arch_curr_cpu_num() != scope->cpu) {
+        atomic_add_relaxed(&site->migrated, 1);
+        return;
+    }
+
+    for (uint32_t i = 0; i < PMU_EVENT_COUNT; ++i)
+        atomic_add_relaxed(&site->totals[i], arch_pmu_delta(i, scope->start[i], end[i]));
+    atomic_add_relaxed(&site->calls, 1);
+}
+
+#if PMU_ENABLE
+
+#define PMU_SITE(var, name_)                                                \
+    static pmu_site_t var SECTION("pmu_site") = {                           \
+        .name = name_, .file = __FILE__, .line = __LINE__,                  \
+    }
+
+/**
+ * @brief   Start counting for the site called name, a string literal, up
+ *          to the PMU_END() of the same scope variable.
+ */
+#define PMU_BEGIN(scope, name)                                              \
+    PMU_SITE(scope##_site, name);                                           \
+    pmu_scope_t scope;                                                      \
+    pmu_scope_begin(&scope, &scope##_site)
+
+#define PMU_END(scope)          pmu_scope_end(&scope)
+
+/** @brief  Count from here to the end of the enclosing block, any return included. */
+#define PMU_SCOPE(name)                                                     \
+    PMU_SITE(_pmu_site, name);                                              \
+    pmu_scope_t _pmu_scope CLEANUP(pmu_scope_end);                          \
+    pmu_scope_begin(&_pmu_scope, &_pmu_site)
+
+#else
+
+#define PMU_BEGIN(scope, name)  do { } while (0)
+#define PMU_END(scope)          do { } while (0)
+#define PMU_SCOPE(name)         do { } while (0)
+
+#endif /* PMU_ENABLE */
+
+/** @brief  Short name of an event, as pmu_dump() prints it. */
+const char *pmu_event_name(pmu_event_t event);
+
+/** @brief  Zero the counts of every site. */
+void pmu_reset(void);
+
+/** @brief  Print the pmu and, for every site that ran, the events per call. */
+void pmu_dump(void);
+
+#endif /* _PMU_H_ */
@@ -3,7 +3,17 @@
 
 #include "compiler.h"
 #include <stdarg.h>
+#include <stddef.h>
 
-int printf_core(const char *fmt, va_list ap);
+/**
+ * @brief   Output callback of printf_core. Gets runs of formatted text, not
+ *          nul terminated, straight from the format string or the number
+ *          conversion buffers.
+ * @returns Negative to stop formatting, printf_core returns the value.
+ */
+typedef int (*printf_out_t)(const char *str, size_t len, void *arg);
 
-#endif /* _PRINTF_CORE_H_ */
\ No newline at end of file
+/** @returns The number of characters passed to out. */
+int printf_core(printf_out_t out, void *arg, const char *fmt, va_list ap);
+
+#endif /* _PRINTF_CORE_H_ */
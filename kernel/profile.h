@@ -0,0 +1,75 @@
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include "types.h"
+#include <stdbool.h>
+
+/*
+ * Sampling profiler.
+ *
+ * Every period the current cpu is interrupted, either by a timer or by a
+ * performance counter overflowing, and the interrupted ip and the return
+ * addresses of up to PROFILE_MAX_DEPTH - 1 frames are copied into its
+ * buffer. Nothing is symbolized in the kernel: profile_dump() writes the
+ * stacks as "@prof" lines of raw addresses, identical ones merged, and
+ * scripts/prof-fold turns them into folded stacks for flamegraph.pl with
+ * the symbols of the kernel ELF.
+ *
+ * The call chain comes from the frame pointers, so the kernel has to be
+ * built with -fno-omit-frame-pointer. The walk stays on the stack of the
+ * current thread and stops at the first frame that leaves it, a leaf that
+ * does not set up its frame loses its caller.
+ *
+ * A full buffer drops new samples and counts them. profile_start() starts
+ * the calling cpu, any other cpu joins with profile_start_percpu().
+ */
+
+#define PROFILE_MAX_DEPTH       15
+#define PROFILE_BUF_SAMPLES     1024    /* Per cpu. */
+
+typedef enum profile_source {
+    PROFILE_SOURCE_TIMER,       /* Period in ns. */
+    PROFILE_SOURCE_PMU,         /* Period in unhalted core cycles, an nmi. */
+} profile_source_t;
+
+typedef enum profile_status {
+    PROFILE_NO_ERROR,
+    ERR_PROFILE_RUNNING,
+    ERR_PROFILE_INVALID_ARGS,
+    ERR_PROFILE_NOT_SUPPORTED,  /* No counter left for the pmu source. */
+} profile_status_t;
+
+typedef struct profile_sample {
+    uint64_t    depth;
+    uintptr_t   pcs[PROFILE_MAX_DEPTH];     /* Interrupted ip first, then the callers. */
+} profile_sample_t;
+
+/** @brief  Drop the samples of every cpu and start sampling the current one. */
+profile_status_t profile_start(profile_source_t source, uint64_t period);
+
+/** @brief  Start sampling the current cpu in a running profile. */
+profile_status_t profile_start_percpu(void);
+
+/** @brief  Stop sampling, the other cpus stop at their next sample. */
+void profile_stop(void);
+
+/**
+ * @brief   Take a sample of the interrupted context, from the interrupt
+ *          of the pmu source.
+ * @returns True while the profile runs and the source should fire again.
+ */
+bool profile_interrupt(void);
+
+/**
+ * @brief   Write the samples of every cpu, while stopped:
+ *
+ *              @prof begin <timer|pmu> <period>
+ *              @prof <cpu> <count> <outermost caller>;...;<interrupted ip>
+ *              @prof end <samples> <dropped>
+ *
+ *          Addresses are hex without a prefix. The buffers are sorted in
+ *          place to merge identical stacks.
+ */
+void profile_dump(void);
+
+#endif /* _PROFILE_H_ */
@@ -0,0 +1,277 @@
+#ifndef _RBTREE_H_
+#define _RBTREE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "list.h"
+#include "types.h"
+
+/*
+ * Intrusive red-black tree.
+ *
+ * Like list.h, the node is embedded in the object and rb_entry() gets the
+ * object back, the tree never allocates. The caller does the search, so
+ * the tree knows nothing about keys:
+ *
+ *     rb_node_t **link = &root->node, *parent = NULL;
+ *
+ *     while (*link) {
+ *         parent = *link;
+ *         if (key < rb_entry(parent, obj_t, rb)->key)
+ *             link = &parent->left;
+ *         else
+ *             link = &parent->right;
+ *     }
+ *
+ *     rb_link_node(&obj->rb, parent, link);
+ *     rb_insert_color(&obj->rb, root);
+ *
+ * or rb_add() and rb_find() with a comparison function that the compiler
+ * inlines. Lookups are O(log n) and insert and erase do at most three
+ * rotations.
+ *
+ * An augmented tree keeps a value per node computed from the node and its
+ * subtree, like the largest end of the intervals below it. The callbacks
+ * keep it right through rotations, see RB_DECLARE_CALLBACKS() and
+ * interval_tree.h.
+ *
+ * Nothing here locks, the tree is protected by whatever owns it.
+ */
+
+typedef struct rb_node {
+    uintptr_t       parent_color;   /* Parent, the color in bit 0. */
+    struct rb_node  *left;
+    struct rb_node  *right;
+} rb_node_t;
+
+typedef struct rb_root {
+    rb_node_t       *node;
+} rb_root_t;
+
+/* A tree that also keeps its smallest node, for the first deadline and the like */
+typedef struct rb_root_cached {
+    rb_root_t       root;
+    rb_node_t       *leftmost;
+} rb_root_cached_t;
+
+#define RB_RED      0
+#define RB_BLACK    1
+
+#define RB_ROOT_INITIAL_VALUE           { NULL }
+#define RB_ROOT_CACHED_INITIAL_VALUE    { RB_ROOT_INITIAL_VALUE, NULL }
+
+#define rb_entry(ptr, type, member)     container_of(ptr, type, member)
+
+/* rb_entry() that passes NULL through */
+#define rb_entry_safe(ptr, type, member)                        \
+    ({                                                          \
+        rb_node_t *__n = (ptr);                                 \
+        __n ? rb_entry(__n, type, member) : (type *)NULL;       \
+    })
+
+static inline rb_node_t *rb_parent(const rb_node_t *node) {
+    return (rb_node_t *)(node->parent_color & ~(uintptr_t)1);
+}
+
+static inline bool rb_is_empty(const rb_root_t *root) {
+    return root->node == NULL;
+}
+
+/* Nodes not in a tree point to themselves, see rb_clear_node(). */
+static inline void rb_clear_node(rb_node_t *node) {
+    node->parent_color = (uintptr_t)node;
+}
+
+static inline bool rb_is_in_tree(const rb_node_t *node) {
+    return node->parent_color != (uintptr_t)node;
+}
+
+/** @brief  Put a red node at link, a NULL child pointer of parent the search found. */
+static inline void rb_link_node(rb_node_t *node, rb_node_t *parent, rb_node_t **link) {
+    node->parent_color = (uintptr_t)parent | RB_RED;
+    node->left = node->right = NULL;
+    *link = node;
+}
+
+/** @brief  Rebalance after rb_link_node(). */
+void rb_insert_color(rb_node_t *node, rb_root_t *root);
+
+void rb_erase(rb_node_t *node, rb_root_t *root);
+
+/** @brief  Put new where old is, they must compare the same. */
+void rb_replace_node(rb_node_t *old, rb_node_t *new, rb_root_t *root);
+
+/* ------------------------------ Iteration ------------------------------ */
+
+/* In order, NULL past the end. */
+rb_node_t *rb_first(const rb_root_t *root);
+rb_node_t *rb_last(const rb_root_t *root);
+rb_node_t *rb_next(const rb_node_t *node);
+rb_node_t *rb_prev(const rb_node_t *node);
+
+/* Children before parents, so every node can be freed as it is visited. */
+rb_node_t *rb_first_postorder(const rb_root_t *root);
+rb_node_t *rb_next_postorder(const rb_node_t *node);
+
+#define rb_for_each(node, root) \
+    for (node = rb_first(root); node; node = rb_next(node))
+
+#define rb_for_each_entry(pos, root, member)                                    \
+    for (pos = rb_entry_safe(rb_first(root), __typeof__(*pos), member); pos;    \
+         pos = rb_entry_safe(rb_next(&pos->member), __typeof__(*pos), member))
+
+/* The tree is not rebalanced on the way, only for tearing it all down. */
+#define rb_for_each_entry_safe_postorder(pos, n, root, member)                          \
+    for (pos = rb_entry_safe(rb_first_postorder(root), __typeof__(*pos), member);       \
+         pos && ({ n = rb_entry_safe(rb_next_postorder(&pos->member),                   \
+                                     __typeof__(*pos), member); 1; });                   \
+         pos = n)
+
+/* ------------------------------ Helpers ------------------------------ */
+
+/**
+ * @brief   Insert node after the ones it is not less than.
+ * @param less  Whether a goes before b, inlined along with this.
+ */
+static inline void rb_add(rb_node_t *node, rb_root_t *root,
+                          bool (*less)(const rb_node_t *a, const rb_node_t *b)) {
+    rb_node_t **link = &root->node, *parent = NULL;
+
+    while (*link) {
+        parent = *link;
+        link = less(node, parent) ? &parent->left : &parent->right;
+    }
+
+    rb_link_node(node, parent, link);
+    rb_insert_color(node, root);
+}
+
+/**
+ * @brief   Find a node that matches key.
+ * @param cmp   Negative if key goes before the node, 0 on a match.
+ */
+static inline rb_node_t *rb_find(const void *key, const rb_root_t *root,
+                                 int (*cmp)(const void *key, const rb_node_t *node)) {
+    rb_node_t *node = root->node;
+
+    while (node) {
+        int c = cmp(key, node);
+
+        if (c < 0)
+            node = node->left;
+        else if (c > 0)
+            node = node->right;
+        else
+            return node;
+    }
+
+    return NULL;
+}
+
+/** @brief  Find the first node that is not before key, NULL if there is none. */
+static inline rb_node_t *rb_find_first_ge(const void *key, const rb_root_t *root,
+                                          int (*cmp)(const void *key, const rb_node_t *node)) {
+    rb_node_t *node = root->node, *match = NULL;
+
+    while (node) {
+        if (cmp(key, node) <= 0) {
+            match = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+
+    return match;
+}
+
+static inline rb_node_t *rb_first_cached(const rb_root_cached_t *root) {
+    return root->leftmost;
+}
+
+static inline void rb_add_cached(rb_node_t *node, rb_root_cached_t *root,
+                                 bool (*less)(const rb_node_t *a, const rb_node_t *b)) {
+    rb_node_t **link = &root->root.node, *parent = NULL;
+    bool leftmost = true;
+
+    while (*link) {
+        parent = *link;
+        if (less(node, parent)) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+            leftmost = false;
+        }
+    }
+
+    if (leftmost)
+        root->leftmost = node;
+
+    rb_link_node(node, parent, link);
+    rb_insert_color(node, &root->root);
+}
+
+static inline void rb_erase_cached(rb_node_t *node, rb_root_cached_t *root) {
+    if (root->leftmost == node)
+        root->leftmost = rb_next(node);
+
+    rb_erase(node, &root->root);
+}
+
+/* ------------------------------ Augmented ------------------------------ */
+
+typedef struct rb_augment_callbacks {
+    /* Recompute from node up to, not including, stop, or until a value holds. */
+    void (*propagate)(rb_node_t *node, rb_node_t *stop);
+    /* new takes the place of old in the tree. */
+    void (*copy)(rb_node_t *old, rb_node_t *new);
+    /* new was rotated above old and now holds its subtree. */
+    void (*rotate)(rb_node_t *old, rb_node_t *new);
+} rb_augment_callbacks_t;
+
+/**
+ * @brief   Rebalance after rb_link_node() in an augmented tree. The new
+ *          node's value must be set, it is propagated to its ancestors.
+ */
+void rb_insert_augmented(rb_node_t *node, rb_root_t *root, const rb_augment_callbacks_t *aug);
+
+void rb_erase_augmented(rb_node_t *node, rb_root_t *root, const rb_augment_callbacks_t *aug);
+
+/**
+ * Define the callbacks, as a const rb_augment_callbacks_t called name, for
+ * a value of aug_type in field aug_field of type that compute(type *)
+ * works out from the node and its children.
+ */
+#define RB_DECLARE_CALLBACKS(storage, name, type, rb_field, aug_type, aug_field, compute)  \
+                                                                                            \
+static void name##_propagate(rb_node_t *rb, rb_node_t *stop) {                              \
+    while (rb != stop) {                                                                    \
+        type *node = rb_entry(rb, type, rb_field);                                          \
+        aug_type val = compute(node);                                                       \
+                                                                                            \
+        if (node->aug_field == val)                                                         \
+            break;                                                                          \
+        node->aug_field = val;                                                              \
+        rb = rb_parent(&node->rb_field);                                                    \
+    }                                                                                       \
+}                                                                                           \
+                                                                                            \
+static void name##_copy(rb_node_t *rb_old, rb_node_t *rb_new) {                             \
+    rb_entry(rb_new, type, rb_field)->aug_field = rb_entry(rb_old, type, rb_field)->aug_field; \
+}                                                                                           \
+                                                                                            \
+static void name##_rotate(rb_node_t *rb_old, rb_node_t *rb_new) {                           \
+    type *old = rb_entry(rb_old, type, rb_field);                                           \
+                                                                                            \
+    rb_entry(rb_new, type, rb_field)->aug_field = old->aug_field;                           \
+    old->aug_field = compute(old);                                                          \
+}                                                                                           \
+                                                                                            \
+storage const rb_augment_callbacks_t name = {                                               \
+    .propagate  = name##_propagate,                                                         \
+    .copy       = name##_copy,                                                              \
+    .rotate     = name##_rotate,                                                            \
+}
+
+#endif /* _RBTREE_H_ */
@@ -0,0 +1,128 @@
+#ifndef _RCU_H_
+#define _RCU_H_
+
+#include "atomic.h"
+#include "compiler.h"
+#include "list.h"
+#include "thread.h"
+#include "types.h"
+
+/*
+ * Quiescent state based read-copy-update.
+ *
+ * Readers take no locks and do no atomic writes, they only must not
+ * block or report a quiescent state inside the read side section. Each
+ * cpu reports quiescent states at points where it cannot hold any RCU
+ * protected reference, the context switch and the idle loop. A grace
+ * period ends once every online cpu that is not idle has reported one
+ * after the grace period started.
+ */
+
+/* Track read side nesting and catch quiescent states reported inside it */
+#ifndef RCU_DEBUG
+#define RCU_DEBUG 0
+#endif
+
+#if RCU_DEBUG
+void rcu_read_lock_debug(void);
+void rcu_read_unlock_debug(void);
+#else
+#define rcu_read_lock_debug()   do { } while (0)
+#define rcu_read_unlock_debug() do { } while (0)
+#endif
+
+/* A context switch is a quiescent state, so readers cannot be preempted. */
+static inline void rcu_read_lock(void) {
+    thread_preempt_disable();
+    rcu_read_lock_debug();
+}
+
+static inline void rcu_read_unlock(void) {
+    rcu_read_unlock_debug();
+    thread_preempt_enable();
+}
+
+/**
+ * @brief   Publish a pointer to an initialized object. The stores that
+ *          initialized the object are visible before the pointer.
+ */
+#define rcu_assign_pointer(p, v)    atomic_store_release(&(p), (v))
+
+/** @brief  Load an RCU protected pointer inside a read side section. */
+#define rcu_dereference(p)          __atomic_load_n(&(p), __ATOMIC_CONSUME)
+
+/* ------------------------------------------------------------------------
+ *  Grace periods
+ * ------------------------------------------------------------------------
+ */
+
+/** @brief  Report that the current cpu holds no RCU protected references. */
+void rcu_quiescent_state(void);
+
+/**
+ * @brief   Idle cpus are in an extended quiescent state and do not hold
+ *          up grace periods. Call around the idle halt.
+ */
+void rcu_idle_enter(void);
+void rcu_idle_exit(void);
+
+void rcu_cpu_online(uint32_t cpu);
+void rcu_cpu_offline(uint32_t cpu);
+
+/** @brief  Wait until all the read side sections running now are done. */
+void synchronize_rcu(void);
+
+/**
+ * @brief   Run func(head) once a grace period has passed. The callback
+ *          runs from rcu_quiescent_state() on the calling cpu.
+ */
+void call_rcu(rcu_head_t *head, void (*func)(rcu_head_t *head));
+
+void rcu_init(void);
+
+/* ------------------------------------------------------------------------
+ *  RCU protected lists
+ * ------------------------------------------------------------------------
+ */
+
+/*
+ * Writers serialize among themselves with a lock and use the _rcu
+ * variants, readers walk the list forward with list_for_each_entry_rcu().
+ */
+
+/** Insert a new entry after the specified head. */
+static inline void list_add_rcu(list_node_t *head, list_node_t *item) {
+    item->next = head->next;
+    item->prev = head;
+
+    rcu_assign_pointer(head->next, item);
+    item->next->prev = item;
+}
+
+/** Insert a new entry before the specified head. */
+static inline void list_add_tail_rcu(list_node_t *head, list_node_t *item) {
+    item->prev = head->prev;
+    item->next = head;
+
+    rcu_assign_pointer(head->prev->next, item);
+    head->prev = item;
+}
+
+/**
+ * Delete the entry from the list. The next pointer is left intact for
+ * readers still on the entry, it must not be reused until a grace
+ * period has passed.
+ */
+static inline void list_delete_rcu(list_node_t *entry) {
+    entry->next->prev = entry->prev;
+    atomic_store_relaxed(&entry->prev->next, entry->next);
+
+    entry->prev = NULL;
+}
+
+#define list_for_each_entry_rcu(pos, head, member)                                  \
+    for (pos = container_of(rcu_dereference((head)->next), typeof(*pos), member);   \
+         &pos->member != (head);                                                    \
+         pos = container_of(rcu_dereference((pos)->member.next), typeof(*pos), member))
+
+#endif /* _RCU_H_ */
@@ -0,0 +1,71 @@
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+#include "thread.h"
+#include "types.h"
+
+/*
+ * Per cpu work stealing scheduler.
+ *
+ * Each cpu owns a Chase-Lev deque of ready threads. Threads woken on a
+ * cpu go to its deque, yielding threads and threads that did not fit go
+ * to its MPSC inbox. A cpu runs its own deque first, then its inbox and
+ * steals from the top of other cpus' deques when both are empty.
+ *
+ * A cpu with nothing to run or steal halts. Queueing a thread on a deque
+ * sends a reschedule ipi to one halted cpu, so that it can steal it.
+ *
+ * A pinned thread always goes to the inbox of its cpu, which only that
+ * cpu takes from, with an ipi if it is woken somewhere else.
+ */
+
+/** @brief  Scheduler counters, per cpu and only written by that cpu. */
+typedef struct sched_stats {
+    uint64_t    context_switches;
+    uint64_t    wakeups;                /* Threads that ran after a wakeup. */
+    uint64_t    wakeup_latency_cycles;  /* Ready to running, summed. */
+    uint64_t    wakeup_latency_max;
+    uint64_t    steal_attempts;
+    uint64_t    steals;                 /* Successful steals. */
+    uint64_t    idle_loops;
+} sched_stats_t;
+
+/** @brief  Set up the run queues of the current cpu and mark it online. */
+void sched_init_percpu(thread_t *idle_thread);
+
+/** @brief  Queue a ready thread on the current cpu, or the one it is pinned to. */
+void sched_enqueue(thread_t *t);
+
+/** @brief  Queue a ready thread behind the other runnable threads. */
+void sched_enqueue_tail(thread_t *t);
+
+/**
+ * @brief   Switch to the next runnable thread. A running current thread
+ *          is requeued, a blocked or dead one is not.
+ */
+void sched_reschedule(void);
+
+/** @brief  Must be called first thing by a thread switched to for the first time. */
+void sched_finish_switch(void);
+
+/** @brief  Idle loop of the current cpu, halts until there is work. */
+void sched_idle(void) NORETURN;
+
+/** @brief  Whether or not there is a thread waiting to run on this cpu. */
+bool sched_has_work(void);
+
+/** @brief  Whether the cpu has run sched_init_percpu(). */
+bool sched_cpu_online(uint32_t cpu);
+
+void sched_get_stats(uint32_t cpu, sched_stats_t *out);
+void sched_dump_stats(void);
+
+/* ------------------------------------------------------------------------
+ *  Architecture hooks
+ * ------------------------------------------------------------------------
+ */
+
+/** @brief  Interrupt another cpu, it reschedules on the way out. */
+void arch_reschedule_cpu(uint32_t cpu);
+
+#endif /* _SCHED_H_ */
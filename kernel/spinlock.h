@@ -0,0 +1,241 @@
+#ifndef _SPINLOCK_H_
+#define _SPINLOCK_H_
+
+#include "arch.h"
+#include "atomic.h"
+#include "compiler.h"
+#include "types.h"
+#include <stdbool.h>
+
+/*
+ * Lockdep-lite. Catches recursive acquisition, release by a cpu that
+ * does not hold the lock and acquisition against the rank order. Costs
+ * a call per lock operation, so it is compiled out by default.
+ */
+#ifndef SPINLOCK_DEBUG
+#define SPINLOCK_DEBUG 0
+#endif
+
+/* Locks without a rank are not checked for ordering. */
+#define SPIN_LOCK_RANK_NONE     0
+
+#if SPINLOCK_DEBUG
+typedef struct spin_lock_debug {
+    const char  *name;
+    uint32_t    rank;       /* Locks must be taken in increasing rank. */
+    uint32_t    holder;     /* Holding cpu + 1, 0 if free. */
+} spin_lock_debug_t;
+
+#define SPIN_LOCK_DEBUG_INITIAL_VALUE(_name, _rank)    \
+    .debug = { .name = (_name), .rank = (_rank), .holder = 0 },
+
+/* Called before waiting for the lock, so a deadlock is reported instead of spinning. */
+void spin_lock_debug_acquire(const void *lock, spin_lock_debug_t *debug);
+void spin_lock_debug_release(const void *lock, spin_lock_debug_t *debug);
+#else
+#define SPIN_LOCK_DEBUG_INITIAL_VALUE(_name, _rank)
+#define spin_lock_debug_acquire(lock, debug)    do { } while (0)
+#define spin_lock_debug_release(lock, debug)    do { } while (0)
+#endif
+
+/* ------------------------------------------------------------------------
+ *  Ticket lock
+ * ------------------------------------------------------------------------
+ */
+
+/**
+ * @brief   Fair spinlock for short critical sections. Cpus take a ticket
+ *          and are served in order. All waiters spin on the same word, so
+ *          prefer the MCS lock for heavily contended locks.
+ */
+typedef struct spin_lock {
+    union {
+        uint32_t    val;
+        struct {
+            uint16_t    owner;  /* Ticket being served. */
+            uint16_t    next;   /* Next ticket to hand out. */
+        };
+    };
+
+#if SPINLOCK_DEBUG
+    spin_lock_debug_t debug;
+#endif
+} spin_lock_t;
+
+#define SPIN_LOCK_TICKET_INC    (1U << 16)
+
+#define SPIN_LOCK_INITIAL_VALUE_RANKED(_name, _rank)    \
+{                                                       \
+    .val = 0,                                           \
+    SPIN_LOCK_DEBUG_INITIAL_VALUE(_name, _rank)         \
+}
+
+#define SPIN_LOCK_INITIAL_VALUE \
+    SPIN_LOCK_INITIAL_VALUE_RANKED(NULL, SPIN_LOCK_RANK_NONE)
+
+static inline void spin_lock_init(spin_lock_t *lock) {
+    *lock = (spin_lock_t)SPIN_LOCK_INITIAL_VALUE;
+}
+
+static inline void spin_lock(spin_lock_t *lock) {
+    spin_lock_debug_acquire(lock, &lock->debug);
+
+    uint32_t val = atomic_fetch_add(&lock->val, SPIN_LOCK_TICKET_INC);
+    uint16_t ticket = (uint16_t)(val >> 16);
+
+    while (atomic_load_acquire(&lock->owner) != ticket)
+        arch_spinloop_pause();
+}
+
+/** @returns True if the lock was acquired. */
+static inline bool spin_trylock(spin_lock_t *lock) {
+    uint32_t val = atomic_load_relaxed(&lock->val);
+
+    if ((uint16_t)val != (uint16_t)(val >> 16))
+        return false;
+
+    if (!atomic_cmpxchg_acquire(&lock->val, &val, val + SPIN_LOCK_TICKET_INC))
+        return false;
+
+    spin_lock_debug_acquire(lock, &lock->debug);
+    return true;
+}
+
+static inline void spin_unlock(spin_lock_t *lock) {
+    spin_lock_debug_release(lock, &lock->debug);
+
+    /* only the holder writes owner */
+    atomic_store_release(&lock->owner, (uint16_t)(lock->owner + 1));
+}
+
+static inline bool spin_lock_is_locked(const spin_lock_t *lock) {
+    uint32_t val = atomic_load_relaxed(&lock->val);
+    return (uint16_t)val != (uint16_t)(val >> 16);
+}
+
+/* ------------------------------------------------------------------------
+ *  MCS queue lock
+ * ------------------------------------------------------------------------
+ */
+
+/**
+ * @brief   Queue entry of an MCS lock waiter. Each waiter spins on its own
+ *          node, so a release touches a single remote cache line. Usually
+ *          lives on the stack of the locking function.
+ */
+typedef struct mcs_node {
+    struct mcs_node *next;
+    int             locked;
+} ALIGNED(CACHE_LINE_SIZE) mcs_node_t;
+
+/** @brief  Spinlock for highly contended locks. */
+typedef struct mcs_lock {
+    mcs_node_t  *tail;
+
+#if SPINLOCK_DEBUG
+    spin_lock_debug_t debug;
+#endif
+} mcs_lock_t;
+
+#define MCS_LOCK_INITIAL_VALUE_RANKED(_name, _rank)     \
+{                                                       \
+    .tail = NULL,                                       \
+    SPIN_LOCK_DEBUG_INITIAL_VALUE(_name, _rank)         \
+}
+
+#define MCS_LOCK_INITIAL_VALUE  \
+    MCS_LOCK_INITIAL_VALUE_RANKED(NULL, SPIN_LOCK_RANK_NONE)
+
+static inline void mcs_lock_init(mcs_lock_t *lock) {
+    *lock = (mcs_lock_t)MCS_LOCK_INITIAL_VALUE;
+}
+
+static inline void mcs_lock(mcs_lock_t *lock, mcs_node_t *node) {
+    spin_lock_debug_acquire(lock, &lock->debug);
+
+    node->next = NULL;
+    node->locked = 0;
+
+    mcs_node_t *prev = atomic_exchange(&lock->tail, node);
+    if (prev) {
+        /* queue behind the previous tail and wait to be handed the lock */
+        atomic_store_release(&prev->next, node);
+
+        while (!atomic_load_acquire(&node->locked))
+            arch_spinloop_pause();
+    }
+}
+
+/** @returns True if the lock was acquired. */
+static inline bool mcs_trylock(mcs_lock_t *lock, mcs_node_t *node) {
+    mcs_node_t *expected = NULL;
+
+    node->next = NULL;
+    node->locked = 0;
+
+    if (!atomic_cmpxchg_acquire(&lock->tail, &expected, node))
+        return false;
+
+    spin_lock_debug_acquire(lock, &lock->debug);
+    return true;
+}
+
+static inline void mcs_unlock(mcs_lock_t *lock, mcs_node_t *node) {
+    spin_lock_debug_release(lock, &lock->debug);
+
+    mcs_node_t *next = atomic_load_acquire(&node->next);
+    if (!next) {
+        /* no known successor, try to mark the lock free */
+        mcs_node_t *expected = node;
+        if (atomic_cmpxchg_release(&lock->tail, &expected, NULL))
+            return;
+
+        /* a waiter swapped the tail but has not linked itself yet */
+        while (!(next = atomic_load_acquire(&node->next)))
+            arch_spinloop_pause();
+    }
+
+    atomic_store_release(&next->locked, 1);
+}
+
+static inline bool mcs_lock_is_locked(const mcs_lock_t *lock) {
+    return atomic_load_relaxed(&lock->tail) != NULL;
+}
+
+/* ------------------------------------------------------------------------
+ *  Interrupt safe variants
+ * ------------------------------------------------------------------------
+ */
+
+typedef arch_irq_state_t spin_lock_saved_state_t;
+
+/*
+ * Disable interrupts on the local cpu before taking the lock, so an
+ * interrupt handler taking the same lock cannot deadlock against us.
+ * The previous interrupt state is stored in state.
+ */
+#define spin_lock_irqsave(lock, state)              \
+    do {                                            \
+        (state) = arch_irq_save();                  \
+        spin_lock(lock);                            \
+    } while (0)
+
+#define spin_unlock_irqrestore(lock, state)         \
+    do {                                            \
+        spin_unlock(lock);                          \
+        arch_irq_restore(state);                    \
+    } while (0)
+
+#define mcs_lock_irqsave(lock, node, state)         \
+    do {                                            \
+        (state) = arch_irq_save();                  \
+        mcs_lock(lock, node);                       \
+    } while (0)
+
+#define mcs_unlock_irqrestore(lock, node, state)    \
+    do {                                            \
+        mcs_unlock(lock, node);                     \
+        arch_irq_restore(state);                    \
+    } while (0)
+
+#endif /* _SPINLOCK_H_ */
@@ -3,8 +3,13 @@
 
 #include "compiler.h"
 #include <stdarg.h>
+#include <stddef.h>
 
 int printf(const char* fmt, ...) PRINTFLIKE(1, 2);
 int vprintf(const char* fmt, va_list ap);
 
-#endif
\ No newline at end of file
+/** @brief  Format into str, always nul terminated if len is not 0. */
+int snprintf(char *str, size_t len, const char *fmt, ...) PRINTFLIKE(3, 4);
+int vsnprintf(char *str, size_t len, const char *fmt, va_list ap);
+
+#endif
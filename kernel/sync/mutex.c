@@ -0,0 +1,261 @@
+#include "../mutex.h"
+#include "../atomic.h"
+#include "../compiler.h"
+#include "../debug.h"
+#include "../rcu.h"
+#include "../thread.h"
+#include "../timer.h"
+
+/** A thread blocked on the mutex, lives on the waiter's stack. */
+typedef struct mutex_waiter {
+    list_node_t node;
+    thread_t    *thread;
+    int         granted;    /* Set by the releasing thread on hand-off. */
+    int         timed_out;  /* Set by the timeout timer. */
+} mutex_waiter_t;
+
+#if MUTEX_STATS
+#define MUTEX_STAT_ADD(m, field, val)   ((m)->stats.field += (val))
+#else
+#define MUTEX_STAT_ADD(m, field, val)   do { } while (0)
+#endif
+
+/* ------------------------------------------------------------------------ */
+
+void mutex_init(mutex_t *m) {
+    *m = (mutex_t)MUTEX_INTIAL_VALUE(*m);
+}
+
+void mutex_destroy(mutex_t *m) {
+    if (unlikely(atomic_load(&m->owner) != 0)) {
+        panic("mutex_destroy: mutex %p is still held\n", m);
+    }
+
+    m->owner = 0;
+}
+
+bool is_mutex_held(const mutex_t *m) {
+    uintptr_t owner = atomic_load_relaxed(&m->owner) & MUTEX_OWNER_MASK;
+    return owner == (uintptr_t)get_current_thread();
+}
+
+/**
+ * @brief   Spin as long as the owner is running on another cpu, since it
+ *          is likely to drop the lock soon. Gives up once there are queued
+ *          waiters so they are not starved by spinners.
+ * @returns True if the mutex was acquired. The stats are only updated
+ *          by the owner, so the time spent is passed back in spun.
+ *
+ * The owner may exit while we look at it, exited threads are freed
+ * after a grace period so the read side section keeps it around.
+ */
+static bool mutex_spin_on_owner(mutex_t *m, uintptr_t self, uint64_t *spun) {
+    uint64_t start = arch_cycle_count();
+    bool acquired = false;
+
+    rcu_read_lock();
+
+    for (;;) {
+        uintptr_t val = atomic_load_relaxed(&m->owner);
+
+        if (val == 0) {
+            if (atomic_cmpxchg_acquire(&m->owner, &val, self)) {
+                acquired = true;
+                break;
+            }
+            continue;
+        }
+
+        if (val & MUTEX_FLAG_CONTENDED)
+            break;
+
+        thread_t *owner = (thread_t *)(val & MUTEX_OWNER_MASK);
+        if (!thread_is_running(owner))
+            break;
+
+        if (arch_cycle_count() - start > MUTEX_SPIN_MAX_CYCLES)
+            break;
+
+        arch_spinloop_pause();
+    }
+
+    rcu_read_unlock();
+
+    *spun = arch_cycle_count() - start;
+    return acquired;
+}
+
+static void mutex_timeout_handler(timer_t *timer, ktime_t now, void *arg) {
+    mutex_waiter_t *waiter = arg;
+
+    atomic_store_release(&waiter->timed_out, 1);
+    thread_unblock(waiter->thread);
+}
+
+static int mutex_acquire_slow(mutex_t *m, uintptr_t self, ktime_t timeout) {
+    uint64_t spun;
+
+    if (mutex_spin_on_owner(m, self, &spun)) {
+        MUTEX_STAT_ADD(m, spin_cycles, spun);
+        return MUTEX_NO_ERROR;
+    }
+
+    if (timeout == 0)
+        return ERR_MUTEX_TIMED_OUT;
+
+    /* the timeout counts from the call, not from when spinning gave up */
+    ktime_t deadline = INFINITE_TIME;
+    if (timeout != INFINITE_TIME) {
+        ktime_t now = current_time();
+        deadline = timeout >= INFINITE_TIME - now ? INFINITE_TIME : now + timeout;
+    }
+
+    mutex_waiter_t waiter = {
+        .thread = (thread_t *)self,
+        .granted = 0,
+        .timed_out = 0,
+    };
+    timer_t timer = TIMER_INITIAL_VALUE(timer);
+    spin_lock_saved_state_t state;
+
+    /* interrupts stay off, the holder must not be preempted */
+    spin_lock_irqsave(&m->wait_lock, state);
+
+    /* tell the owner that it has to hand the lock off on release */
+    uintptr_t val = atomic_fetch_or(&m->owner, MUTEX_FLAG_CONTENDED);
+
+    if ((val & MUTEX_OWNER_MASK) == 0) {
+        /* released in the meantime, take it without queueing */
+        uintptr_t flags = list_is_empty(&m->wait_queue) ? 0 : MUTEX_FLAG_CONTENDED;
+        atomic_store(&m->owner, self | flags);
+        spin_unlock_irqrestore(&m->wait_lock, state);
+
+        MUTEX_STAT_ADD(m, spin_cycles, spun);
+        return MUTEX_NO_ERROR;
+    }
+
+    list_add_tail(&m->wait_queue, &waiter.node);
+    spin_unlock_irqrestore(&m->wait_lock, state);
+
+    if (deadline != INFINITE_TIME)
+        timer_set_deadline(&timer, deadline, mutex_timeout_handler, &waiter);
+
+    uint64_t start = arch_cycle_count();
+    int ret = MUTEX_NO_ERROR;
+
+    while (!atomic_load_acquire(&waiter.granted)) {
+        thread_prepare_block();
+
+        if (atomic_load_acquire(&waiter.granted) || atomic_load_acquire(&waiter.timed_out))
+            thread_cancel_block();
+        else
+            thread_block();
+
+        if (atomic_load_acquire(&waiter.timed_out)) {
+            spin_lock_irqsave(&m->wait_lock, state);
+
+            /* a hand-off that beat the timeout wins, we own the mutex then */
+            if (!waiter.granted) {
+                list_delete(&waiter.node);
+                ret = ERR_MUTEX_TIMED_OUT;
+            }
+
+            spin_unlock_irqrestore(&m->wait_lock, state);
+            break;
+        }
+    }
+
+    /*
+     * The releaser wakes us with the wait lock held, wait for it to drop
+     * the lock so that it is done with the mutex and with this thread
+     * before we return and maybe block on something else.
+     */
+    if (ret == MUTEX_NO_ERROR) {
+        spin_lock_irqsave(&m->wait_lock, state);
+        spin_unlock_irqrestore(&m->wait_lock, state);
+    }
+
+    /* the waiter is on our stack, the handler must be done with it */
+    if (deadline != INFINITE_TIME)
+        timer_cancel(&timer);
+
+    /* only the owner updates the stats */
+    if (ret == MUTEX_NO_ERROR) {
+        MUTEX_STAT_ADD(m, spin_cycles, spun);
+        MUTEX_STAT_ADD(m, wait_cycles, arch_cycle_count() - start);
+    }
+
+    return ret;
+}
+
+int mutex_acquire_timeout(mutex_t *m, ktime_t timeout) {
+    uintptr_t self = (uintptr_t)get_current_thread();
+    uintptr_t expected = 0;
+
+    /* fast path, uncontended */
+    if (likely(atomic_cmpxchg_acquire(&m->owner, &expected, self))) {
+        MUTEX_STAT_ADD(m, acquires, 1);
+        return MUTEX_NO_ERROR;
+    }
+
+    if (unlikely((expected & MUTEX_OWNER_MASK) == self)) {
+        panic("mutex_acquire: thread %p tried to acquire mutex %p it already owns\n",
+              (void *)self, m);
+    }
+
+    int ret = mutex_acquire_slow(m, self, timeout);
+    if (ret == MUTEX_NO_ERROR) {
+        MUTEX_STAT_ADD(m, acquires, 1);
+        MUTEX_STAT_ADD(m, contended, 1);
+    }
+
+    return ret;
+}
+
+int mutex_release(mutex_t *m) {
+    uintptr_t self = (uintptr_t)get_current_thread();
+    uintptr_t expected = self;
+
+    /* fast path, no waiters */
+    if (likely(atomic_cmpxchg_release(&m->owner, &expected, 0)))
+        return MUTEX_NO_ERROR;
+
+    if (unlikely((expected & MUTEX_OWNER_MASK) != self))
+        return ERR_MUTEX_NOT_OWNER;
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&m->wait_lock, state);
+
+    mutex_waiter_t *waiter = list_remove_head_type(&m->wait_queue, mutex_waiter_t, node);
+    if (waiter) {
+        /* hand off straight to the oldest waiter, nobody can barge in */
+        uintptr_t flags = list_is_empty(&m->wait_queue) ? 0 : MUTEX_FLAG_CONTENDED;
+        thread_t *next = waiter->thread;
+
+        atomic_store(&m->owner, (uintptr_t)next | flags);
+
+        /* the waiter's stack entry is gone once it sees this */
+        atomic_store_release(&waiter->granted, 1);
+
+        /*
+         * Still under the wait lock, which the waiter takes before it
+         * returns. A wake up after the unlock could hit the thread
+         * while it is blocked on something else.
+         */
+        thread_unblock(next);
+    } else {
+        atomic_store_release(&m->owner, 0);
+    }
+
+    spin_unlock_irqrestore(&m->wait_lock, state);
+
+    return MUTEX_NO_ERROR;
+}
+
+void mutex_get_stats(const mutex_t *m, mutex_stats_t *out) {
+#if MUTEX_STATS
+    *out = m->stats;
+#else
+    *out = (mutex_stats_t) { 0 };
+#endif
+}
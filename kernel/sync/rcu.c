@@ -0,0 +1,162 @@
+#include "../rcu.h"
+#include "../arch.h"
+#include "../debug.h"
+#include "../thread.h"
+#include <stdbool.h>
+
+/** Per cpu RCU state, only written by its own cpu. */
+typedef struct rcu_cpu {
+    uint64_t    qs_seq;         /* Grace period seen at the last quiescent state. */
+    int         idle;           /* In an extended quiescent state. */
+    int         online;
+
+    uint32_t    nesting;        /* Read side nesting, RCU_DEBUG only. */
+
+    rcu_head_t  *cb_head;       /* Pending callbacks, oldest first. */
+    rcu_head_t  **cb_tail;
+} ALIGNED(CACHE_LINE_SIZE) rcu_cpu_t;
+
+static rcu_cpu_t rcu_cpu_data[SMP_MAX_CPUS];
+
+/* Most recently started grace period. */
+static uint64_t rcu_gp_seq;
+
+static inline rcu_cpu_t *rcu_this_cpu(void) {
+    return &rcu_cpu_data[arch_curr_cpu_num()];
+}
+
+#if RCU_DEBUG
+void rcu_read_lock_debug(void) {
+    rcu_this_cpu()->nesting++;
+}
+
+void rcu_read_unlock_debug(void) {
+    rcu_cpu_t *rc = rcu_this_cpu();
+
+    if (rc->nesting == 0) {
+        panic("rcu: unbalanced rcu_read_unlock on cpu %u\n", arch_curr_cpu_num());
+    }
+
+    rc->nesting--;
+}
+#endif
+
+/* ------------------------------------------------------------------------ */
+
+/** @brief  Start a new grace period and return its sequence number. */
+static inline uint64_t rcu_start_gp(void) {
+    return atomic_fetch_add(&rcu_gp_seq, 1) + 1;
+}
+
+/** @brief  Whether or not every cpu has passed through grace period seq. */
+static bool rcu_gp_completed(uint64_t seq) {
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; ++cpu) {
+        rcu_cpu_t *rc = &rcu_cpu_data[cpu];
+
+        if (!atomic_load_relaxed(&rc->online) || atomic_load_acquire(&rc->idle))
+            continue;
+
+        if (atomic_load_acquire(&rc->qs_seq) < seq)
+            return false;
+    }
+
+    return true;
+}
+
+static void rcu_process_callbacks(rcu_cpu_t *rc) {
+    arch_irq_state_t state = arch_irq_save();
+
+    while (rc->cb_head && rcu_gp_completed(rc->cb_head->seq)) {
+        rcu_head_t *head = rc->cb_head;
+
+        rc->cb_head = head->next;
+        if (!rc->cb_head)
+            rc->cb_tail = &rc->cb_head;
+
+        /* callbacks may queue more callbacks */
+        arch_irq_restore(state);
+        head->func(head);
+        state = arch_irq_save();
+    }
+
+    arch_irq_restore(state);
+}
+
+void rcu_quiescent_state(void) {
+    rcu_cpu_t *rc = rcu_this_cpu();
+
+#if RCU_DEBUG
+    if (rc->nesting != 0) {
+        panic("rcu: quiescent state inside read side section on cpu %u\n",
+              arch_curr_cpu_num());
+    }
+#endif
+
+    /* orders the reads of this cpu before the report */
+    atomic_store_release(&rc->qs_seq, atomic_load(&rcu_gp_seq));
+
+    if (rc->cb_head)
+        rcu_process_callbacks(rc);
+}
+
+void rcu_idle_enter(void) {
+    rcu_cpu_t *rc = rcu_this_cpu();
+
+    rcu_quiescent_state();
+    atomic_store_release(&rc->idle, 1);
+}
+
+void rcu_idle_exit(void) {
+    rcu_cpu_t *rc = rcu_this_cpu();
+
+    /* no RCU protected loads can pass the exit */
+    atomic_store(&rc->idle, 0);
+    smp_mb();
+}
+
+void rcu_cpu_online(uint32_t cpu) {
+    rcu_cpu_t *rc = &rcu_cpu_data[cpu];
+
+    rc->qs_seq = atomic_load(&rcu_gp_seq);
+    rc->idle = 0;
+    if (!rc->cb_tail)
+        rc->cb_tail = &rc->cb_head;
+
+    atomic_store(&rc->online, 1);
+}
+
+void rcu_cpu_offline(uint32_t cpu) {
+    atomic_store(&rcu_cpu_data[cpu].online, 0);
+}
+
+void synchronize_rcu(void) {
+    uint64_t seq = rcu_start_gp();
+
+    /* the caller is not inside a read side section */
+    rcu_quiescent_state();
+
+    /* let other threads run, the context switches are quiescent states */
+    while (!rcu_gp_completed(seq))
+        thread_yield();
+}
+
+void call_rcu(rcu_head_t *head, void (*func)(rcu_head_t *head)) {
+    head->next = NULL;
+    head->func = func;
+    head->seq = rcu_start_gp();
+
+    arch_irq_state_t state = arch_irq_save();
+    rcu_cpu_t *rc = rcu_this_cpu();
+
+    *rc->cb_tail = head;
+    rc->cb_tail = &head->next;
+
+    arch_irq_restore(state);
+}
+
+void rcu_init(void) {
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; ++cpu)
+        rcu_cpu_data[cpu].cb_tail = &rcu_cpu_data[cpu].cb_head;
+
+    rcu_cpu_online(arch_curr_cpu_num());
+}
@@ -0,0 +1,81 @@
+#include "../spinlock.h"
+#include "../debug.h"
+
+#if SPINLOCK_DEBUG
+
+/* Max number of spinlocks a cpu can hold at the same time. */
+#define SPINLOCK_DEBUG_MAX_HELD 16
+
+/** Stack of the locks held by a cpu, most recent on top. */
+typedef struct held_locks {
+    uint32_t            depth;
+    const void          *lock[SPINLOCK_DEBUG_MAX_HELD];
+    spin_lock_debug_t   *debug[SPINLOCK_DEBUG_MAX_HELD];
+} ALIGNED(CACHE_LINE_SIZE) held_locks_t;
+
+static held_locks_t held_locks[SMP_MAX_CPUS];
+
+static inline const char *lock_name(const spin_lock_debug_t *debug) {
+    return debug->name ? debug->name : "<anon>";
+}
+
+void spin_lock_debug_acquire(const void *lock, spin_lock_debug_t *debug) {
+    uint32_t cpu = arch_curr_cpu_num();
+    held_locks_t *held = &held_locks[cpu];
+
+    /* this cpu would spin forever waiting on itself */
+    for (uint32_t i = 0; i < held->depth; ++i) {
+        if (held->lock[i] == lock) {
+            panic("spinlock: recursive acquire of %s (%p) on cpu %u\n",
+                  lock_name(debug), lock, cpu);
+        }
+    }
+
+    if (held->depth > 0 && debug->rank != SPIN_LOCK_RANK_NONE) {
+        spin_lock_debug_t *top = held->debug[held->depth - 1];
+
+        if (top->rank != SPIN_LOCK_RANK_NONE && top->rank >= debug->rank) {
+            panic("spinlock: %s (rank %u) acquired while holding %s (rank %u) on cpu %u\n",
+                  lock_name(debug), debug->rank, lock_name(top), top->rank, cpu);
+        }
+    }
+
+    if (held->depth == SPINLOCK_DEBUG_MAX_HELD) {
+        panic("spinlock: cpu %u holds too many locks\n", cpu);
+    }
+
+    held->lock[held->depth] = lock;
+    held->debug[held->depth] = debug;
+    held->depth++;
+
+    debug->holder = cpu + 1;
+}
+
+void spin_lock_debug_release(const void *lock, spin_lock_debug_t *debug) {
+    uint32_t cpu = arch_curr_cpu_num();
+    held_locks_t *held = &held_locks[cpu];
+
+    if (debug->holder != cpu + 1) {
+        panic("spinlock: %s (%p) released by cpu %u, held by cpu %d\n",
+              lock_name(debug), lock, cpu, (int)debug->holder - 1);
+    }
+
+    /* locks may be released out of order, remove it from wherever it is */
+    for (uint32_t i = held->depth; i-- > 0; ) {
+        if (held->lock[i] == lock) {
+            for (; i + 1 < held->depth; ++i) {
+                held->lock[i] = held->lock[i + 1];
+                held->debug[i] = held->debug[i + 1];
+            }
+
+            held->depth--;
+            debug->holder = 0;
+            return;
+        }
+    }
+
+    panic("spinlock: %s (%p) is not on the held stack of cpu %u\n",
+          lock_name(debug), lock, cpu);
+}
+
+#endif /* SPINLOCK_DEBUG */
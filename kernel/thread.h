@@ -0,0 +1,194 @@
+#ifndef _THREAD_H_
+#define _THREAD_H_
+
+#include "arch.h"
+#include "atomic.h"
+#include "compiler.h"
+#include "list.h"
+#include "lockfree.h"
+#include "types.h"
+#include <stdbool.h>
+
+typedef enum thread_state {
+    THREAD_SUSPENDED,
+    THREAD_READY,
+    THREAD_RUNNING,
+    THREAD_BLOCKED,
+    THREAD_DEATH,
+} thread_state_t;
+
+typedef int (*thread_start_routine)(void *arg);
+
+#define THREAD_MAGIC                0x74687264  /* 'thrd' */
+
+#define THREAD_NAME_LEN             32
+
+/* thread flags */
+#define THREAD_FLAG_IDLE            0x1
+#define THREAD_FLAG_FREE_STACK      0x2     /* Stack and struct allocated by
+                                             * thread_create().
+                                             */
+#define THREAD_FLAG_RECLAIM         0x4     /* In a shrinker, its allocations
+                                             * do not reclaim again.
+                                             */
+#define THREAD_FLAG_PINNED          0x8     /* Only runs on curr_cpu. */
+
+#define DEFAULT_STACK_SIZE          ARCH_DEFAULT_STACK_SIZE
+
+/**
+ * @brief   Kernel thread. Each cpu starts out running a bootstrap thread
+ *          that becomes its idle thread.
+ */
+typedef struct thread {
+    uint32_t        magic;
+    char            name[THREAD_NAME_LEN];
+    uint32_t        flags;
+
+    volatile int    state;          /* thread_state_t */
+    volatile uint32_t curr_cpu;     /* Cpu the thread last ran on. */
+    int             on_cpu;         /* Set until the thread's context has
+                                     * been saved after switching away.
+                                     */
+    int             preempt_disable;    /* Interrupts may not switch away
+                                         * from the thread while non zero.
+                                         */
+    int             preempt_pending;    /* Preemption deferred by the above. */
+
+    mpsc_node_t     inbox_node;     /* Remote run queue link. */
+    uint64_t        wakeup_cycles;  /* When it was made ready. */
+
+    thread_start_routine entry;
+    void            *arg;
+    int             retcode;
+
+    void            *stack;
+    size_t          stack_size;
+    size_t          alloc_pages;    /* THREAD_FLAG_FREE_STACK allocation. */
+    rcu_head_t      free_rcu;       /* Frees it once nothing can still
+                                     * look at an exited thread.
+                                     */
+
+    struct arch_thread arch;
+} thread_t;
+
+static inline thread_t *get_current_thread(void) {
+    return arch_get_current_thread();
+}
+
+/** @brief  Whether or not the thread is executing on a cpu right now. */
+static inline bool thread_is_running(const thread_t *t) {
+    return t->state == THREAD_RUNNING;
+}
+
+/* ------------------------------------------------------------------------
+ *  Thread routines
+ * ------------------------------------------------------------------------
+ */
+
+/**
+ * @brief   Turn the code running on the current cpu into its bootstrap
+ *          thread. Must run after the per cpu data is set up.
+ */
+void thread_init_early(void);
+
+/**
+ * @brief   Set up a thread in caller provided memory. The thread starts
+ *          out suspended, use thread_resume() to run it.
+ */
+thread_t *thread_create_etc(thread_t *t, const char *name, thread_start_routine entry,
+                    void *arg, void *stack, size_t stack_size);
+
+/** @brief  Allocate and set up a thread, freed when it exits. */
+thread_t *thread_create(const char *name, thread_start_routine entry, void *arg,
+                    size_t stack_size);
+
+/**
+ * @brief   Bind a suspended thread to cpu. It is queued there wherever it
+ *          is woken and is never stolen.
+ */
+void thread_set_cpu(thread_t *t, uint32_t cpu);
+
+/** @brief  Make a suspended thread runnable. */
+void thread_resume(thread_t *t);
+
+void thread_exit(int retcode) NORETURN;
+
+/** @brief  Put the current thread at the back of the local run queue. */
+void thread_yield(void);
+
+/**
+ * @brief   Switch away from the current thread on interrupt exit, or
+ *          defer it to thread_preempt_enable() if preemption is off.
+ */
+void thread_preempt(void);
+
+/*
+ * Nestable. Read side RCU sections and the blocking protocol run with
+ * preemption off, spinlocks held with interrupts enabled would need it
+ * too, so those have to use the irqsave variants.
+ */
+static inline void thread_preempt_disable(void) {
+    get_current_thread()->preempt_disable++;
+    barrier();
+}
+
+static inline void thread_preempt_enable(void) {
+    thread_t *t = get_current_thread();
+
+    barrier();
+    if (--t->preempt_disable == 0 && t->preempt_pending && !arch_ints_disabled())
+        thread_yield();
+}
+
+/** @brief  Block the current thread for at least delay ns. */
+void thread_sleep(ktime_t delay);
+
+/**
+ * @brief   Turn the bootstrap thread of the current cpu into its idle
+ *          thread and start scheduling. Does not return.
+ */
+void thread_become_idle(void) NORETURN;
+
+/* ------------------------------------------------------------------------
+ *  Blocking
+ * ------------------------------------------------------------------------
+ *
+ * A thread waiting for a condition announces it is about to block, then
+ * checks the condition and either cancels or blocks:
+ *
+ *      thread_prepare_block();
+ *      if (condition)
+ *          thread_cancel_block();
+ *      else
+ *          thread_block();
+ *
+ * The waker makes the condition true and calls thread_unblock(). If the
+ * wakeup wins the race with the cancel, the thread is switched out and
+ * queued again by the waker, so no wakeup is lost.
+ */
+
+/* Preemption stays off until the thread is done blocking. */
+static inline void thread_prepare_block(void) {
+    thread_preempt_disable();
+    atomic_store(&get_current_thread()->state, THREAD_BLOCKED);
+}
+
+void thread_cancel_block(void);
+void thread_block(void);
+
+/**
+ * @brief   Make a blocked thread runnable on the current cpu.
+ * @returns False if the thread was not blocked.
+ */
+bool thread_unblock(thread_t *t);
+
+/* ------------------------------------------------------------------------
+ *  Architecture hooks
+ * ------------------------------------------------------------------------
+ */
+
+/** @brief  Set up the stack so the first switch to t runs entry_point. */
+void arch_thread_initialize(thread_t *t, void (*entry_point)(void));
+void arch_context_switch(thread_t *old_thread, thread_t *new_thread);
+
+#endif /* _THREAD_H_ */
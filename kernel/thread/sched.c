@@ -0,0 +1,306 @@
+#include "../sched.h"
+#include "../debug.h"
+#include "../klog.h"
+#include "../rcu.h"
+#include "../stdio.h"
+#include "../timer.h"
+#include "../vm/pmm.h"
+
+/** Per cpu run queues. */
+typedef struct sched_cpu {
+    ws_deque_t      runq;           /* Owner pops the bottom, others steal. */
+    mpsc_queue_t    inbox;          /* FIFO of yielded and overflow threads. */
+
+    thread_t        *idle_thread;
+    thread_t        *switch_prev;   /* Switched away from, finished by the
+                                     * thread that runs next.
+                                     */
+    int             online;
+
+    sched_stats_t   stats;
+} ALIGNED(CACHE_LINE_SIZE) sched_cpu_t;
+
+static sched_cpu_t sched_cpus[SMP_MAX_CPUS];
+
+_Static_assert(SMP_MAX_CPUS <= 64, "the halted cpus are kept in a 64 bit mask");
+
+/* Cpus halted in sched_idle(), or about to. */
+static uint64_t sched_idle_mask;
+
+static inline sched_cpu_t *sched_this_cpu(void) {
+    return &sched_cpus[arch_curr_cpu_num()];
+}
+
+void sched_init_percpu(thread_t *idle_thread) {
+    sched_cpu_t *sc = sched_this_cpu();
+
+    ws_deque_init(&sc->runq);
+    mpsc_queue_init(&sc->inbox);
+
+    sc->idle_thread = idle_thread;
+    sc->switch_prev = NULL;
+
+    atomic_store(&sc->online, 1);
+}
+
+/* ------------------------------------------------------------------------ */
+
+/** @brief  Wake one halted cpu other than self to steal a thread just queued. */
+static void sched_kick_idle(uint32_t self) {
+    /* the push before the read of the mask, pairs with sched_idle() */
+    smp_mb();
+
+    uint64_t idle = atomic_load_relaxed(&sched_idle_mask) & ~(1ULL << self);
+
+    while (idle) {
+        uint32_t cpu = __builtin_ctzll(idle);
+        uint64_t bit = 1ULL << cpu;
+
+        /* whoever clears the bit sends the one ipi of this halt */
+        if (atomic_fetch_and(&sched_idle_mask, ~bit) & bit) {
+            arch_reschedule_cpu(cpu);
+            return;
+        }
+
+        idle &= ~bit;
+    }
+}
+
+void sched_enqueue(thread_t *t) {
+    arch_irq_state_t state = arch_irq_save();
+    uint32_t cpu = arch_curr_cpu_num();
+    sched_cpu_t *sc = &sched_cpus[cpu];
+
+    t->wakeup_cycles = arch_cycle_count();
+
+    if (t->flags & THREAD_FLAG_PINNED) {
+        /* nobody steals from an inbox */
+        mpsc_queue_push(&sched_cpus[t->curr_cpu].inbox, &t->inbox_node);
+        if (t->curr_cpu != cpu)
+            arch_reschedule_cpu(t->curr_cpu);
+    } else if (ws_deque_push(&sc->runq, t))
+        sched_kick_idle(cpu);
+    else
+        mpsc_queue_push(&sc->inbox, &t->inbox_node);
+
+    arch_irq_restore(state);
+}
+
+void sched_enqueue_tail(thread_t *t) {
+    arch_irq_state_t state = arch_irq_save();
+    sched_cpu_t *sc = sched_this_cpu();
+
+    t->wakeup_cycles = arch_cycle_count();
+    mpsc_queue_push(&sc->inbox, &t->inbox_node);
+
+    arch_irq_restore(state);
+}
+
+bool sched_has_work(void) {
+    sched_cpu_t *sc = sched_this_cpu();
+    return ws_deque_size(&sc->runq) > 0 || !mpsc_queue_is_empty(&sc->inbox);
+}
+
+bool sched_cpu_online(uint32_t cpu) {
+    return atomic_load_relaxed(&sched_cpus[cpu].online);
+}
+
+/** @brief  Whether another cpu has a thread to steal. */
+static bool sched_can_steal(uint32_t cpu) {
+    for (uint32_t i = 1; i < SMP_MAX_CPUS; ++i) {
+        sched_cpu_t *victim = &sched_cpus[(cpu + i) % SMP_MAX_CPUS];
+
+        if (atomic_load_relaxed(&victim->online) && ws_deque_size(&victim->runq) > 0)
+            return true;
+    }
+
+    return false;
+}
+
+static thread_t *sched_steal(sched_cpu_t *sc, uint32_t cpu) {
+    for (uint32_t i = 1; i < SMP_MAX_CPUS; ++i) {
+        sched_cpu_t *victim = &sched_cpus[(cpu + i) % SMP_MAX_CPUS];
+
+        if (!atomic_load_relaxed(&victim->online))
+            continue;
+
+        if (ws_deque_size(&victim->runq) == 0)
+            continue;
+
+        sc->stats.steal_attempts++;
+
+        thread_t *t = ws_deque_steal(&victim->runq);
+        if (t) {
+            sc->stats.steals++;
+            return t;
+        }
+    }
+
+    return NULL;
+}
+
+static thread_t *sched_pick_next(sched_cpu_t *sc, uint32_t cpu) {
+    thread_t *t = ws_deque_pop(&sc->runq);
+    if (t)
+        return t;
+
+    mpsc_node_t *node = mpsc_queue_pop(&sc->inbox);
+    if (node)
+        return container_of(node, thread_t, inbox_node);
+
+    return sched_steal(sc, cpu);
+}
+
+static void sched_free_thread(rcu_head_t *head) {
+    thread_t *t = container_of(head, thread_t, free_rcu);
+
+    pmm_free_kpages(t, t->alloc_pages);
+}
+
+/**
+ * @brief   Runs on the new thread right after a switch. Lets other cpus
+ *          run the previous thread now that its context is saved and
+ *          frees it if it exited.
+ */
+void sched_finish_switch(void) {
+    sched_cpu_t *sc = sched_this_cpu();
+    thread_t *prev = sc->switch_prev;
+
+    sc->switch_prev = NULL;
+    atomic_store_release(&prev->on_cpu, 0);
+
+    if (prev->state == THREAD_DEATH && (prev->flags & THREAD_FLAG_FREE_STACK)) {
+        /* mutex_spin_on_owner() may still be reading it */
+        prev->magic = 0;
+        call_rcu(&prev->free_rcu, sched_free_thread);
+    }
+
+    /* a context switch is a quiescent state */
+    rcu_quiescent_state();
+}
+
+void sched_reschedule(void) {
+    arch_irq_state_t state = arch_irq_save();
+
+    uint32_t cpu = arch_curr_cpu_num();
+    sched_cpu_t *sc = &sched_cpus[cpu];
+    thread_t *curr = get_current_thread();
+
+    if (unlikely(curr->magic != THREAD_MAGIC)) {
+        panic("sched: thread %p is corrupt, stack overflow?\n", curr);
+    }
+
+    bool curr_idle = !!(curr->flags & THREAD_FLAG_IDLE);
+
+    /* a deferred preemption is satisfied by this reschedule */
+    curr->preempt_pending = 0;
+
+    /* preempted, let the other runnable threads go first */
+    if (curr->state == THREAD_RUNNING && !curr_idle) {
+        curr->state = THREAD_READY;
+        sched_enqueue_tail(curr);
+    }
+
+    thread_t *next = sched_pick_next(sc, cpu);
+    if (!next) {
+        /* nothing else to run, keep running the current thread if we can */
+        next = curr->state == THREAD_RUNNING ? curr : sc->idle_thread;
+    }
+
+    if (next == curr) {
+        curr->state = THREAD_RUNNING;
+        arch_irq_restore(state);
+        return;
+    }
+
+    /* the cpu that switched away from next may not have saved it yet */
+    while (atomic_load_acquire(&next->on_cpu))
+        arch_spinloop_pause();
+
+    if (curr_idle && curr->state == THREAD_RUNNING)
+        curr->state = THREAD_READY;
+
+    next->on_cpu = 1;
+    next->curr_cpu = cpu;
+    next->state = THREAD_RUNNING;
+
+    sc->stats.context_switches++;
+    if (!(next->flags & THREAD_FLAG_IDLE)) {
+        uint64_t latency = arch_cycle_count() - next->wakeup_cycles;
+
+        sc->stats.wakeups++;
+        sc->stats.wakeup_latency_cycles += latency;
+        if (latency > sc->stats.wakeup_latency_max)
+            sc->stats.wakeup_latency_max = latency;
+    }
+
+    sc->switch_prev = curr;
+    arch_set_current_thread(next);
+    arch_context_switch(curr, next);
+
+    /* back on curr, possibly on another cpu */
+    sched_finish_switch();
+    arch_irq_restore(state);
+}
+
+/* ------------------------------------------------------------------------ */
+
+void sched_idle(void) {
+    uint32_t cpu = arch_curr_cpu_num();
+    uint64_t bit = 1ULL << cpu;
+
+    /* the loop picks up new work by itself, interrupts only break the halt */
+    thread_preempt_disable();
+
+    for (;;) {
+        sched_reschedule();
+
+        /* nothing local and nothing to steal */
+        sched_cpus[cpu].stats.idle_loops++;
+
+        /* nothing better to do than catching the console up */
+        if (klog_has_pending())
+            klog_drain();
+
+        timer_idle_enter();
+        rcu_idle_enter();
+
+        /*
+         * Announce the halt before the last look for work: a thread queued
+         * after the look sees the bit and sends an ipi, which stays pending
+         * until the halt with interrupts off.
+         */
+        arch_disable_ints();
+        atomic_fetch_or(&sched_idle_mask, bit);
+
+        if (sched_has_work() || sched_can_steal(cpu))
+            arch_enable_ints();
+        else
+            arch_idle();
+
+        atomic_fetch_and(&sched_idle_mask, ~bit);
+        rcu_idle_exit();
+    }
+}
+
+void sched_get_stats(uint32_t cpu, sched_stats_t *out) {
+    *out = sched_cpus[cpu].stats;
+}
+
+void sched_dump_stats(void) {
+    printf("cpu   switches    wakeups  avg lat cyc  max lat cyc   steal try     steals\n");
+
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; ++cpu) {
+        sched_cpu_t *sc = &sched_cpus[cpu];
+        if (!sc->online)
+            continue;
+
+        sched_stats_t *s = &sc->stats;
+        uint64_t avg = s->wakeups ? s->wakeup_latency_cycles / s->wakeups : 0;
+
+        printf("%3u %10llu %10llu %12llu %12llu %11llu %10llu\n", cpu,
+               (unsigned long long)s->context_switches, (unsigned long long)s->wakeups,
+               (unsigned long long)avg, (unsigned long long)s->wakeup_latency_max,
+               (unsigned long long)s->steal_attempts, (unsigned long long)s->steals);
+    }
+}
@@ -0,0 +1,177 @@
+#include "../thread.h"
+#include "../debug.h"
+#include "../sched.h"
+#include "../stdlib.h"
+#include "../timer.h"
+#include "../vm/pmm.h"
+
+static thread_t bootstrap_thread[SMP_MAX_CPUS];
+
+static void thread_set_name(thread_t *t, const char *name) {
+    size_t i;
+    for (i = 0; name && name[i] != 0 && i < THREAD_NAME_LEN - 1; ++i)
+        t->name[i] = name[i];
+    t->name[i] = 0;
+}
+
+void thread_init_early(void) {
+    uint32_t cpu = arch_curr_cpu_num();
+    thread_t *t = &bootstrap_thread[cpu];
+
+    t->magic = THREAD_MAGIC;
+    thread_set_name(t, "bootstrap");
+    t->flags = THREAD_FLAG_IDLE;
+    t->curr_cpu = cpu;
+    t->on_cpu = 1;
+    t->state = THREAD_RUNNING;
+
+    arch_set_current_thread(t);
+    sched_init_percpu(t);
+}
+
+/** First code to run on a new thread. */
+static void initial_thread_func(void) NORETURN;
+static void initial_thread_func(void) {
+    sched_finish_switch();
+    arch_enable_ints();
+
+    thread_t *t = get_current_thread();
+    int ret = t->entry(t->arg);
+
+    thread_exit(ret);
+}
+
+thread_t *thread_create_etc(thread_t *t, const char *name, thread_start_routine entry,
+                    void *arg, void *stack, size_t stack_size) {
+    t->magic = THREAD_MAGIC;
+    thread_set_name(t, name);
+    t->flags = 0;
+
+    t->state = THREAD_SUSPENDED;
+    t->curr_cpu = 0;
+    t->on_cpu = 0;
+    t->preempt_disable = 0;
+    t->preempt_pending = 0;
+    t->wakeup_cycles = 0;
+
+    t->entry = entry;
+    t->arg = arg;
+    t->retcode = 0;
+
+    t->stack = stack;
+    t->stack_size = stack_size;
+    t->alloc_pages = 0;
+
+    arch_thread_initialize(t, initial_thread_func);
+
+    return t;
+}
+
+thread_t *thread_create(const char *name, thread_start_routine entry, void *arg,
+                    size_t stack_size) {
+    /* the thread structure sits below its stack in one allocation */
+    size_t header = ROUNDUP(sizeof(thread_t), 16);
+    size_t pages = ROUNDUP(header + stack_size, PAGE_SIZE) / PAGE_SIZE;
+
+    void *mem = pmm_alloc_kpages(pages, NULL, ALLOC_TAG_STACK);
+    if (!mem)
+        return NULL;
+
+    thread_t *t = mem;
+    thread_create_etc(t, name, entry, arg, (char *)mem + header, pages * PAGE_SIZE - header);
+
+    t->flags |= THREAD_FLAG_FREE_STACK;
+    t->alloc_pages = pages;
+
+    return t;
+}
+
+void thread_set_cpu(thread_t *t, uint32_t cpu) {
+    t->curr_cpu = cpu;
+    t->flags |= THREAD_FLAG_PINNED;
+}
+
+void thread_resume(thread_t *t) {
+    int expected = THREAD_SUSPENDED;
+
+    if (atomic_cmpxchg(&t->state, &expected, THREAD_READY))
+        sched_enqueue(t);
+}
+
+void thread_exit(int retcode) {
+    thread_t *t = get_current_thread();
+
+    t->retcode = retcode;
+    atomic_store(&t->state, THREAD_DEATH);
+
+    /* the next thread on this cpu frees us */
+    sched_reschedule();
+
+    panic("thread_exit: dead thread %s rescheduled\n", t->name);
+}
+
+void thread_yield(void) {
+    sched_reschedule();
+}
+
+void thread_preempt(void) {
+    thread_t *t = get_current_thread();
+
+    if (t->preempt_disable) {
+        t->preempt_pending = 1;
+        return;
+    }
+
+    sched_reschedule();
+}
+
+static void thread_sleep_handler(timer_t *timer, ktime_t now, void *arg) {
+    thread_unblock(arg);
+}
+
+void thread_sleep(ktime_t delay) {
+    timer_t timer = TIMER_INITIAL_VALUE(timer);
+
+    thread_prepare_block();
+    timer_set_oneshot(&timer, delay, thread_sleep_handler, get_current_thread());
+    thread_block();
+
+    /* the handler may still be returning on another cpu */
+    timer_cancel(&timer);
+}
+
+void thread_become_idle(void) {
+    arch_enable_ints();
+    sched_idle();
+}
+
+/* ------------------------------ Blocking ------------------------------ */
+
+void thread_cancel_block(void) {
+    thread_t *t = get_current_thread();
+    int expected = THREAD_BLOCKED;
+
+    if (!atomic_cmpxchg(&t->state, &expected, THREAD_RUNNING)) {
+        /* lost the race against thread_unblock(), which already queued us */
+        sched_reschedule();
+    }
+
+    t->preempt_disable--;
+}
+
+void thread_block(void) {
+    /* a thread that is not running is not requeued */
+    sched_reschedule();
+
+    get_current_thread()->preempt_disable--;
+}
+
+bool thread_unblock(thread_t *t) {
+    int expected = THREAD_BLOCKED;
+
+    if (!atomic_cmpxchg(&t->state, &expected, THREAD_READY))
+        return false;
+
+    sched_enqueue(t);
+    return true;
+}
@@ -0,0 +1,79 @@
+#include "../workqueue.h"
+#include "../sched.h"
+
+workqueue_t system_wq;
+
+static int worker_thread(void *arg) {
+    workqueue_cpu_t *wc = arg;
+
+    for (;;) {
+        mpsc_node_t *node;
+
+        while ((node = mpsc_queue_pop(&wc->queue))) {
+            work_t *work = container_of(node, work_t, node);
+
+            /* may be queued again from here on */
+            atomic_store(&work->pending, 0);
+            work->func(work);
+            wc->executed++;
+        }
+
+        thread_prepare_block();
+
+        if (!mpsc_queue_is_empty(&wc->queue))
+            thread_cancel_block();
+        else
+            thread_block();
+    }
+
+    return 0;
+}
+
+int workqueue_init(workqueue_t *wq, const char *name) {
+    wq->name = name;
+
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; ++cpu) {
+        workqueue_cpu_t *wc = &wq->cpu[cpu];
+
+        mpsc_queue_init(&wc->queue);
+        wc->executed = 0;
+        wc->worker = NULL;
+
+        if (!sched_cpu_online(cpu))
+            continue;
+
+        thread_t *t = thread_create(name, worker_thread, wc, DEFAULT_STACK_SIZE);
+        if (!t)
+            return -1;
+
+        thread_set_cpu(t, cpu);
+        thread_resume(t);
+
+        /* queue_work_on() takes a cpu with a worker as ready */
+        atomic_store_release(&wc->worker, t);
+    }
+
+    return 0;
+}
+
+bool workqueue_ready(workqueue_t *wq) {
+    return atomic_load_acquire(&wq->cpu[0].worker) != NULL;
+}
+
+bool queue_work_on(uint32_t cpu, workqueue_t *wq, work_t *work) {
+    if (atomic_exchange(&work->pending, 1))
+        return false;
+
+    workqueue_cpu_t *wc = &wq->cpu[cpu];
+    if (!atomic_load_acquire(&wc->worker))
+        wc = &wq->cpu[0];
+
+    mpsc_queue_push(&wc->queue, &work->node);
+    thread_unblock(wc->worker);
+
+    return true;
+}
+
+bool queue_work(workqueue_t *wq, work_t *work) {
+    return queue_work_on(arch_curr_cpu_num(), wq, work);
+}
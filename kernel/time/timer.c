@@ -0,0 +1,433 @@
+#include "../timer.h"
+#include "../atomic.h"
+#include "../compiler.h"
+#include "../debug.h"
+#include "../sched.h"
+#include "../spinlock.h"
+#include "../stdio.h"
+
+#define WHEEL_LVL_BITS          6
+#define WHEEL_LVL_SIZE          (1U << WHEEL_LVL_BITS)
+#define WHEEL_LVL_MASK          (WHEEL_LVL_SIZE - 1)
+#define WHEEL_SIZE              (WHEEL_LVL_SIZE * TIMER_WHEEL_DEPTH)
+
+/* each level is 8 times coarser than the one below */
+#define WHEEL_LVL_CLK_SHIFT     3
+#define WHEEL_LVL_CLK_DIV       (1U << WHEEL_LVL_CLK_SHIFT)
+#define WHEEL_LVL_CLK_MASK      (WHEEL_LVL_CLK_DIV - 1)
+#define WHEEL_LVL_SHIFT(n)      ((n) * WHEEL_LVL_CLK_SHIFT)
+#define WHEEL_LVL_GRAN(n)       (1ULL << WHEEL_LVL_SHIFT(n))
+
+/* smallest delta, in ticks, that goes to level n */
+#define WHEEL_LVL_START(n)      ((uint64_t)(WHEEL_LVL_SIZE - 1) << (((n) - 1) * WHEEL_LVL_CLK_SHIFT))
+
+/* timers further out are parked in the last level and requeued when popped */
+#define WHEEL_TIMEOUT_CUTOFF    WHEEL_LVL_START(TIMER_WHEEL_DEPTH)
+#define WHEEL_TIMEOUT_MAX       (WHEEL_TIMEOUT_CUTOFF - WHEEL_LVL_GRAN(TIMER_WHEEL_DEPTH - 1))
+
+#define WHEEL_NO_EXPIRY         UINT64_MAX
+
+/** Per cpu timer wheel. */
+typedef struct timer_base {
+    spin_lock_t     lock;
+    uint32_t        cpu;
+    int             online;
+
+    uint64_t        clk;            /* Next wheel tick to process. */
+    uint64_t        next_expiry;    /* Earliest pending slot, may be early
+                                     * after cancels.
+                                     */
+    ktime_t         programmed;     /* Hardware deadline, INFINITE_TIME if off. */
+    timer_t         *running;       /* Callback in progress. */
+
+    uint64_t        pending_map[TIMER_WHEEL_DEPTH];     /* Non empty slots. */
+    list_node_t     slots[WHEEL_SIZE];
+
+    timer_stats_t   stats;
+} ALIGNED(CACHE_LINE_SIZE) timer_base_t;
+
+static timer_base_t timer_bases[SMP_MAX_CPUS];
+
+static inline timer_base_t *timer_this_base(void) {
+    return &timer_bases[arch_curr_cpu_num()];
+}
+
+static inline uint64_t ns_to_wheel(ktime_t ns) {
+    return ns < 0 ? 0 : (uint64_t)ns >> TIMER_WHEEL_SHIFT;
+}
+
+/* ------------------------------ Wheel ------------------------------ */
+
+static inline unsigned wheel_calc_slot(uint64_t expires, unsigned lvl, uint64_t *slot_expiry) {
+    /* round up to the next slot boundary, timers never fire early */
+    expires = (expires >> WHEEL_LVL_SHIFT(lvl)) + 1;
+    *slot_expiry = expires << WHEEL_LVL_SHIFT(lvl);
+
+    return lvl * WHEEL_LVL_SIZE + (expires & WHEEL_LVL_MASK);
+}
+
+/** @brief  Slot for a timer and the tick at which that slot is processed. */
+static unsigned wheel_slot(uint64_t expires, uint64_t clk, uint64_t *slot_expiry) {
+    if (expires < clk) {
+        /* already due, goes in the slot processed next */
+        *slot_expiry = clk;
+        return clk & WHEEL_LVL_MASK;
+    }
+
+    uint64_t delta = expires - clk;
+
+    for (unsigned lvl = 0; lvl < TIMER_WHEEL_DEPTH - 1; ++lvl) {
+        if (delta < WHEEL_LVL_START(lvl + 1))
+            return wheel_calc_slot(expires, lvl, slot_expiry);
+    }
+
+    if (delta >= WHEEL_TIMEOUT_CUTOFF)
+        expires = clk + WHEEL_TIMEOUT_MAX;
+
+    return wheel_calc_slot(expires, TIMER_WHEEL_DEPTH - 1, slot_expiry);
+}
+
+static void wheel_enqueue(timer_base_t *base, timer_t *timer) {
+    uint64_t slot_expiry;
+    unsigned slot = wheel_slot(timer->expires, base->clk, &slot_expiry);
+
+    list_add_tail(&base->slots[slot], &timer->node);
+    base->pending_map[slot / WHEEL_LVL_SIZE] |= 1ULL << (slot % WHEEL_LVL_SIZE);
+
+    timer->slot = slot;
+    timer->base_cpu = base->cpu;
+    atomic_store(&timer->cpu, (int)base->cpu);
+
+    if (slot_expiry < base->next_expiry)
+        base->next_expiry = slot_expiry;
+}
+
+/** The next expiry is left alone, it is fixed up lazily by the next run. */
+static void wheel_dequeue(timer_base_t *base, timer_t *timer) {
+    unsigned slot = timer->slot;
+
+    list_delete(&timer->node);
+    if (list_is_empty(&base->slots[slot]))
+        base->pending_map[slot / WHEEL_LVL_SIZE] &= ~(1ULL << (slot % WHEEL_LVL_SIZE));
+
+    atomic_store(&timer->cpu, -1);
+}
+
+/** @brief  Skip the ticks an idle cpu slept through, never past a pending slot. */
+static void wheel_forward(timer_base_t *base, uint64_t now) {
+    if (now <= base->clk)
+        return;
+
+    base->clk = base->next_expiry > now ? now : base->next_expiry;
+}
+
+/** @returns Offset of the next pending slot of lvl at or after pos, -1 if none. */
+static inline int wheel_next_pending(timer_base_t *base, unsigned lvl, unsigned pos) {
+    uint64_t map = base->pending_map[lvl];
+
+    if (!map)
+        return -1;
+
+    uint64_t ahead = map >> pos;
+    if (ahead)
+        return __builtin_ctzll(ahead);
+
+    return __builtin_ctzll(map) + WHEEL_LVL_SIZE - pos;
+}
+
+/** @brief  Tick at which the earliest pending slot is processed. */
+static uint64_t wheel_next_expiry(timer_base_t *base) {
+    uint64_t clk = base->clk;
+    uint64_t next = WHEEL_NO_EXPIRY;
+
+    for (unsigned lvl = 0; lvl < TIMER_WHEEL_DEPTH; ++lvl) {
+        int pos = wheel_next_pending(base, lvl, clk & WHEEL_LVL_MASK);
+        unsigned lvl_clk = clk & WHEEL_LVL_CLK_MASK;
+
+        if (pos >= 0) {
+            uint64_t expiry = (clk + pos) << WHEEL_LVL_SHIFT(lvl);
+
+            if (expiry < next)
+                next = expiry;
+
+            /* nothing on a coarser level can be due before this slot */
+            if ((unsigned)pos <= ((WHEEL_LVL_CLK_DIV - lvl_clk) & WHEEL_LVL_CLK_MASK))
+                break;
+        }
+
+        /*
+         * Position on the next level. If this level is not at a slot
+         * boundary, the current slot of the next level was processed
+         * already and the next one up is due first.
+         */
+        clk >>= WHEEL_LVL_CLK_SHIFT;
+        clk += lvl_clk ? 1 : 0;
+    }
+
+    return next;
+}
+
+/** @brief  Move the slots due at base->clk to heads, one per level. */
+static unsigned wheel_collect(timer_base_t *base, list_node_t *heads) {
+    uint64_t clk = base->clk;
+    unsigned levels = 0;
+
+    for (unsigned lvl = 0; lvl < TIMER_WHEEL_DEPTH; ++lvl) {
+        unsigned pos = clk & WHEEL_LVL_MASK;
+        uint64_t bit = 1ULL << pos;
+
+        if (base->pending_map[lvl] & bit) {
+            base->pending_map[lvl] &= ~bit;
+
+            list_initialize(&heads[levels]);
+            list_splice_after(&base->slots[lvl * WHEEL_LVL_SIZE + pos], &heads[levels]);
+            levels++;
+        }
+
+        /* a coarser level only has a slot due when this one wraps */
+        if (clk & WHEEL_LVL_CLK_MASK)
+            break;
+
+        clk >>= WHEEL_LVL_CLK_SHIFT;
+    }
+
+    return levels;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/** @brief  Arm the hardware for the next expiry. Called with the base locked. */
+static void timer_program(timer_base_t *base, bool exact) {
+    ktime_t deadline = INFINITE_TIME;
+
+    if (base->next_expiry != WHEEL_NO_EXPIRY)
+        deadline = (ktime_t)(base->next_expiry << TIMER_WHEEL_SHIFT);
+
+    if (deadline == base->programmed)
+        return;
+
+    /* while busy only ever arm earlier, a stale early interrupt is cheap */
+    if (!exact && deadline > base->programmed)
+        return;
+
+    base->programmed = deadline;
+    base->stats.hw_programs++;
+
+    if (deadline == INFINITE_TIME)
+        arch_timer_cancel();
+    else
+        arch_timer_set_oneshot(deadline);
+}
+
+/** @brief  Run the callbacks of one collected slot, drops the base lock around each. */
+static void timer_expire_list(timer_base_t *base, list_node_t *head, ktime_t now) {
+    timer_t *timer;
+
+    while ((timer = list_remove_head_type(head, timer_t, node))) {
+        if (timer->deadline > now) {
+            /* parked past the end of the wheel */
+            wheel_enqueue(base, timer);
+            base->stats.requeued++;
+            continue;
+        }
+
+        atomic_store(&timer->cpu, -1);
+        base->running = timer;
+
+        timer_callback callback = timer->callback;
+        void *arg = timer->arg;
+
+        uint64_t late = (uint64_t)(current_time() - timer->deadline);
+        base->stats.fired++;
+        base->stats.late_ns += late;
+        if (late > base->stats.late_ns_max)
+            base->stats.late_ns_max = late;
+
+        /* the callback may set or cancel timers, including this one */
+        spin_unlock(&base->lock);
+        callback(timer, now, arg);
+        spin_lock(&base->lock);
+
+        atomic_store(&base->running, NULL);
+    }
+}
+
+static void timer_run_expired(timer_base_t *base, ktime_t now) {
+    uint64_t now_tick = ns_to_wheel(now);
+    list_node_t heads[TIMER_WHEEL_DEPTH];
+
+    while (base->next_expiry <= now_tick) {
+        /* nothing is pending before next_expiry, jump straight to it */
+        base->clk = base->next_expiry;
+
+        unsigned levels = wheel_collect(base, heads);
+
+        base->clk++;
+        base->next_expiry = wheel_next_expiry(base);
+
+        while (levels--)
+            timer_expire_list(base, &heads[levels], now);
+    }
+}
+
+/* ------------------------------------------------------------------------ */
+
+void timer_init_percpu(void) {
+    uint32_t cpu = arch_curr_cpu_num();
+    timer_base_t *base = &timer_bases[cpu];
+
+    spin_lock_init(&base->lock);
+    base->cpu = cpu;
+    base->clk = ns_to_wheel(current_time());
+    base->next_expiry = WHEEL_NO_EXPIRY;
+    base->programmed = INFINITE_TIME;
+    base->running = NULL;
+
+    for (unsigned i = 0; i < WHEEL_SIZE; ++i)
+        list_initialize(&base->slots[i]);
+
+    atomic_store(&base->online, 1);
+}
+
+void timer_initialize(timer_t *timer) {
+    *timer = (timer_t)TIMER_INITIAL_VALUE(*timer);
+}
+
+void timer_set_deadline(timer_t *timer, ktime_t deadline, timer_callback callback, void *arg) {
+    if (unlikely(timer->magic != TIMER_MAGIC)) {
+        panic("timer_set_deadline: timer %p is not initialized\n", timer);
+    }
+
+    timer_cancel(timer);
+
+    arch_irq_state_t state = arch_irq_save();
+    timer_base_t *base = timer_this_base();
+
+    spin_lock(&base->lock);
+
+    timer->deadline = deadline;
+    timer->expires = ns_to_wheel(deadline);
+    timer->callback = callback;
+    timer->arg = arg;
+
+    wheel_forward(base, ns_to_wheel(current_time()));
+    wheel_enqueue(base, timer);
+    base->stats.inserts++;
+
+    timer_program(base, false);
+
+    spin_unlock(&base->lock);
+    arch_irq_restore(state);
+}
+
+void timer_set_oneshot(timer_t *timer, ktime_t delay, timer_callback callback, void *arg) {
+    ktime_t now = current_time();
+    ktime_t deadline = delay >= INFINITE_TIME - now ? INFINITE_TIME : now + delay;
+
+    timer_set_deadline(timer, deadline, callback, arg);
+}
+
+bool timer_cancel(timer_t *timer) {
+    bool pending = false;
+
+    arch_irq_state_t state = arch_irq_save();
+
+    for (;;) {
+        int cpu = atomic_load(&timer->cpu);
+        if (cpu < 0)
+            break;
+
+        timer_base_t *base = &timer_bases[cpu];
+        spin_lock(&base->lock);
+
+        /* it may have fired or moved to another cpu before we got the lock */
+        if (timer->cpu == cpu) {
+            wheel_dequeue(base, timer);
+            base->stats.cancels++;
+            pending = true;
+            spin_unlock(&base->lock);
+            break;
+        }
+
+        spin_unlock(&base->lock);
+    }
+
+    uint32_t base_cpu = timer->base_cpu;
+    bool remote = base_cpu != arch_curr_cpu_num();
+
+    arch_irq_restore(state);
+
+    /* on this cpu the callback either finished or is our caller */
+    if (remote) {
+        while (atomic_load_acquire(&timer_bases[base_cpu].running) == timer)
+            arch_spinloop_pause();
+    }
+
+    return pending;
+}
+
+handler_return_t timer_tick(void) {
+    timer_base_t *base = timer_this_base();
+
+    spin_lock(&base->lock);
+
+    /* the one-shot timer has fired */
+    base->programmed = INFINITE_TIME;
+
+    uint64_t fired = base->stats.fired;
+    timer_run_expired(base, current_time());
+    fired = base->stats.fired - fired;
+
+    timer_program(base, true);
+
+    spin_unlock(&base->lock);
+
+    return fired && sched_has_work() ? INT_RESCHEDULE : INT_NO_RESCHEDULE;
+}
+
+void timer_idle_enter(void) {
+    arch_irq_state_t state = arch_irq_save();
+    timer_base_t *base = timer_this_base();
+
+    spin_lock(&base->lock);
+
+    /* drop the early deadlines left behind by cancels */
+    if (base->next_expiry != WHEEL_NO_EXPIRY)
+        base->next_expiry = wheel_next_expiry(base);
+
+    timer_program(base, true);
+
+    spin_unlock(&base->lock);
+    arch_irq_restore(state);
+}
+
+void timer_get_stats(uint32_t cpu, timer_stats_t *out) {
+    timer_base_t *base = &timer_bases[cpu];
+    arch_irq_state_t state = arch_irq_save();
+
+    spin_lock(&base->lock);
+    *out = base->stats;
+    spin_unlock(&base->lock);
+
+    arch_irq_restore(state);
+}
+
+void timer_dump_stats(void) {
+    printf("cpu    inserts    cancels      fired   requeued   programs  avg late ns  max late ns\n");
+
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; ++cpu) {
+        timer_stats_t s;
+
+        if (!timer_bases[cpu].online)
+            continue;
+
+        timer_get_stats(cpu, &s);
+        uint64_t avg = s.fired ? s.late_ns / s.fired : 0;
+
+        printf("%3u %10llu %10llu %10llu %10llu %10llu %12llu %12llu\n", cpu,
+               (unsigned long long)s.inserts, (unsigned long long)s.cancels,
+               (unsigned long long)s.fired, (unsigned long long)s.requeued,
+               (unsigned long long)s.hw_programs, (unsigned long long)avg,
+               (unsigned long long)s.late_ns_max);
+    }
+}
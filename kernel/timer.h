@@ -0,0 +1,122 @@
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+#include "arch.h"
+#include "interrupts.h"
+#include "list.h"
+#include "types.h"
+#include <stdbool.h>
+
+/*
+ * Tickless one-shot timers.
+ *
+ * Each cpu keeps its timers in a hierarchical wheel of TIMER_WHEEL_DEPTH
+ * levels with 64 slots each. Level n slots are 8^n wheel ticks wide, so
+ * a timer goes straight into the level whose range covers its deadline
+ * and is never cascaded down. Insert and cancel are a list operation and
+ * a bit in the level's pending bitmap. The price is resolution: a timer
+ * on level n fires up to 8^n ticks late, about 1/8 of its timeout.
+ *
+ * There is no periodic tick. Whenever the earliest pending slot changes
+ * the cpu's one-shot timer is armed for it, and nothing is armed while
+ * a cpu has no timers.
+ */
+
+/* A wheel tick is 2^14 ns, about 16us */
+#define TIMER_WHEEL_SHIFT       14
+#define TIMER_WHEEL_DEPTH       8
+
+#define TIMER_MAGIC             0x74696d72  /* 'timr' */
+
+struct timer;
+typedef void (*timer_callback)(struct timer *timer, ktime_t now, void *arg);
+
+typedef struct timer {
+    uint32_t        magic;
+    list_node_t     node;           /* Wheel slot link. */
+
+    ktime_t         deadline;       /* Absolute, in ns. */
+    uint64_t        expires;        /* Deadline in wheel ticks. */
+    uint32_t        slot;
+
+    volatile int    cpu;            /* Wheel it is queued on, -1 if none. */
+    uint32_t        base_cpu;       /* Wheel it was last queued on. */
+
+    timer_callback  callback;
+    void            *arg;
+} timer_t;
+
+#define TIMER_INITIAL_VALUE(t)                          \
+{                                                       \
+    .magic = TIMER_MAGIC,                               \
+    .node = LIST_INITIAL_CLEARED_VALUE,                 \
+    .cpu = -1,                                          \
+}
+
+/** @brief  Timer counters, per cpu and protected by its wheel lock. */
+typedef struct timer_stats {
+    uint64_t    inserts;
+    uint64_t    cancels;            /* Pending timers removed. */
+    uint64_t    fired;
+    uint64_t    requeued;           /* Popped before the deadline and queued again. */
+    uint64_t    hw_programs;        /* One-shot timer writes. */
+    uint64_t    late_ns;            /* Deadline to callback, summed. */
+    uint64_t    late_ns_max;
+} timer_stats_t;
+
+/** @brief  Nanoseconds since boot. */
+static inline ktime_t current_time(void) {
+    return arch_current_time();
+}
+
+/** @brief  Set up the timer wheel of the current cpu. */
+void timer_init_percpu(void);
+
+void timer_initialize(timer_t *timer);
+
+/**
+ * @brief   Run callback once at the absolute time deadline, on the current
+ *          cpu and from interrupt context. A pending timer is moved.
+ */
+void timer_set_deadline(timer_t *timer, ktime_t deadline, timer_callback callback, void *arg);
+
+/** @brief  Run callback once, delay ns from now. */
+void timer_set_oneshot(timer_t *timer, ktime_t delay, timer_callback callback, void *arg);
+
+/**
+ * @brief   Remove a pending timer. If the callback is running on another
+ *          cpu wait for it to finish, so the timer can be freed on return.
+ * @returns True if the timer was pending.
+ */
+bool timer_cancel(timer_t *timer);
+
+static inline bool timer_is_pending(const timer_t *timer) {
+    return timer->cpu >= 0;
+}
+
+/**
+ * @brief   Run the expired timers and arm the next expiry, from the timer
+ *          interrupt. Asks for a reschedule if the callbacks made work.
+ */
+handler_return_t timer_tick(void);
+
+/**
+ * @brief   Called by an idle cpu before halting. While busy the hardware
+ *          may be left armed early after cancels, this arms it for the
+ *          actual next expiry so the cpu sleeps as long as it can.
+ */
+void timer_idle_enter(void);
+
+void timer_get_stats(uint32_t cpu, timer_stats_t *out);
+void timer_dump_stats(void);
+
+/* ------------------------------------------------------------------------
+ *  Architecture hooks
+ * ------------------------------------------------------------------------
+ */
+
+/** @brief  Arm the current cpu's one-shot timer, replacing any earlier one. */
+void arch_timer_set_oneshot(ktime_t deadline);
+void arch_timer_cancel(void);
+
+#endif /* _TIMER_H_ */
@@ -0,0 +1,166 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include "arch.h"
+#include "atomic.h"
+#include "compiler.h"
+#include "printf.h"
+#include "types.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Binary trace buffer, for hot paths where even formatting into the klog
+ * rings costs too much.
+ *
+ * A call site records a pointer to its static format descriptor, a
+ * timestamp and up to TRACE_MAX_ARGS raw argument words into a per cpu
+ * buffer, one cache line per record, nothing is formatted. The descriptors
+ * live in the trace_fmt section and the format string is checked against
+ * the arguments at compile time like any printf. Rendering happens later,
+ * in the kernel with trace_render() or on the host: trace_dump() writes the
+ * buffers and the descriptor table as hex lines the scripts/trace-decode
+ * script turns back into text.
+ *
+ * Records are never formatted in place, so %s arguments must point to
+ * strings that outlive the trace, literals in practice. The host decoder
+ * cannot read kernel memory and prints their address instead.
+ *
+ * A full buffer overwrites its oldest records. Render and dump while
+ * tracing is stopped, a record written during the copy may come out torn.
+ */
+
+#ifndef TRACE_ENABLE
+#define TRACE_ENABLE        1
+#endif
+
+#define TRACE_MAX_ARGS      6
+#define TRACE_BUF_RECORDS   1024    /* Per cpu, power of 2. */
+
+typedef struct trace_fmt {
+    const char  *fmt;
+    const char  *file;
+    uint32_t    line;
+    uint32_t    nargs;
+} trace_fmt_t;
+
+typedef struct trace_record {
+    const trace_fmt_t   *fmt;       /* NULL while written. */
+    ktime_t             time;
+    uint64_t            args[TRACE_MAX_ARGS];
+} trace_record_t;
+
+typedef struct trace_buf {
+    uint64_t        head ALIGNED(CACHE_LINE_SIZE);  /* Next index to write. */
+    trace_record_t  records[TRACE_BUF_RECORDS] ALIGNED(CACHE_LINE_SIZE);
+} trace_buf_t;
+
+extern trace_buf_t trace_bufs[SMP_MAX_CPUS];
+extern bool trace_enabled;
+
+/* -------------------------- Recording -------------------------- */
+
+static inline void trace_record(const trace_fmt_t *tf, const uint64_t *args) {
+    trace_buf_t *buf = &trace_bufs[arch_curr_cpu_num()];
+
+    /* interrupts on this cpu may trace in between, the add keeps them apart */
+    uint64_t idx = atomic_fetch_add(&buf->head, 1);
+    trace_record_t *rec = &buf->records[idx & (TRACE_BUF_RECORDS - 1)];
+
+    atomic_store_relaxed(&rec->fmt, NULL);
+    rec->time = arch_current_time();
+    memcpy(rec->args, args, sizeof(rec->args));
+    atomic_store_release(&rec->fmt, tf);
+}
+
+static inline uint64_t trace_double_word(double d) {
+    uint64_t w;
+
+    memcpy(&w, &d, sizeof(w));
+    return w;
+}
+
+/* floating point arguments keep their bits, everything else is widened */
+#define TRACE_WORD(x)                                                       \
+    _Generic((x),                                                           \
+        float: trace_double_word(_Generic((x), float: (x), double: (x), default: 0.0)), \
+        double: trace_double_word(_Generic((x), float: (x), double: (x), default: 0.0)), \
+        default: (uint64_t)(uintptr_t)(x))
+
+#define TRACE_NARGS(...)    TRACE_NARGS_(0, ##__VA_ARGS__, 7, 6, 5, 4, 3, 2, 1, 0)
+#define TRACE_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, n, ...)    n
+
+#define TRACE_CAT(a, b)     TRACE_CAT_(a, b)
+#define TRACE_CAT_(a, b)    a##b
+
+#define TRACE_WORDS_0()
+#define TRACE_WORDS_1(a)                TRACE_WORD(a)
+#define TRACE_WORDS_2(a, b)             TRACE_WORD(a), TRACE_WORD(b)
+#define TRACE_WORDS_3(a, b, c)          TRACE_WORDS_2(a, b), TRACE_WORD(c)
+#define TRACE_WORDS_4(a, b, c, d)       TRACE_WORDS_3(a, b, c), TRACE_WORD(d)
+#define TRACE_WORDS_5(a, b, c, d, e)    TRACE_WORDS_4(a, b, c, d), TRACE_WORD(e)
+#define TRACE_WORDS_6(a, b, c, d, e, f) TRACE_WORDS_5(a, b, c, d, e), TRACE_WORD(f)
+#define TRACE_WORDS(...)    TRACE_CAT(TRACE_WORDS_, TRACE_NARGS(__VA_ARGS__))(__VA_ARGS__)
+
+/* never called, gives the compiler a printf to check the call site against */
+static inline PRINTFLIKE(1, 2) void trace_check_format(const char *fmt, ...) {
+}
+
+#if TRACE_ENABLE
+
+/**
+ * @brief   Record fmt and its arguments, printf style. fmt must be a string
+ *          literal, up to TRACE_MAX_ARGS arguments of at most 64 bits.
+ */
+#define TRACE(fmt, ...)                                                     \
+    do {                                                                    \
+        _Static_assert(TRACE_NARGS(__VA_ARGS__) <= TRACE_MAX_ARGS,          \
+                       "too many trace arguments");                         \
+        static const trace_fmt_t _trace_fmt SECTION("trace_fmt") = {        \
+            fmt, __FILE__, __LINE__, TRACE_NARGS(__VA_ARGS__),              \
+        };                                                                  \
+        if (0)                                                              \
+            trace_check_format(fmt, ##__VA_ARGS__);                         \
+        if (atomic_load_relaxed(&trace_enabled)) {                          \
+            const uint64_t _trace_args[TRACE_MAX_ARGS] = { TRACE_WORDS(__VA_ARGS__) }; \
+            trace_record(&_trace_fmt, _trace_args);                         \
+        }                                                                   \
+    } while (0)
+
+#else
+
+#define TRACE(fmt, ...)                                                     \
+    do {                                                                    \
+        if (0)                                                              \
+            trace_check_format(fmt, ##__VA_ARGS__);                         \
+    } while (0)
+
+#endif /* TRACE_ENABLE */
+
+/* -------------------------- Control -------------------------- */
+
+void trace_start(void);
+void trace_stop(void);
+
+/** @brief  Drop every record, with tracing stopped. */
+void trace_reset(void);
+
+/* -------------------------- Rendering -------------------------- */
+
+/**
+ * @brief   Format one record into out.
+ * @returns The number of characters written.
+ */
+int trace_format(printf_out_t out, void *arg, const trace_record_t *rec);
+
+/** @brief  Format the records of all cpus in time order, one per line. */
+void trace_render(printf_out_t out, void *arg);
+
+/**
+ * @brief   Write the format descriptors and the raw records as "@trace"
+ *          hex lines for scripts/trace-decode.
+ */
+void trace_dump(printf_out_t out, void *arg);
+
+#endif /* _TRACE_H_ */
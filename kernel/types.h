@@ -1,30 +1,32 @@
 #ifndef _TYPES_H_
 #define _TYPES_H_
 
-typedef unsigned char uint8_t;
-typedef unsigned short uint16_t;
-typedef unsigned long uint32_t;
-typedef unsigned long long uint64_t;
-
-typedef char int8_t;
-typedef short int16_t;
-typedef int int32_t;
-typedef long long int64_t;
+/*
+ * The fixed width integer types come from the compiler's freestanding
+ * <stdint.h> so this header can be mixed with the files that already
+ * include it directly.
+ */
+#include <stdint.h>
+#include <stddef.h>
 
 typedef uintptr_t vaddr_t;
 typedef uintptr_t paddr_t;
 typedef uintptr_t addr_t;
 
-typedef int8_t int_least8_t;
-typedef int16_t int_least16_t;
-typedef int32_t int_least32_t;
-typedef int64_t int_least64_t;
-typedef uint8_t uint_least8_t;
-typedef uint16_t uint_least16_t;
-typedef uint32_t uint_least32_t;
-typedef uint64_t uint_least64_t;
+/* Kernel time in nanoseconds. */
+typedef int64_t ktime_t;
+
+#define INFINITE_TIME   INT64_MAX
 
-typedef long intptr_t;
-typedef unsigned long uintptr_t;
+/**
+ * @brief   Deferred callback, embed it in the object to be reclaimed.
+ *          Lives here so that rcu.h and the objects it frees can include
+ *          each other's headers, see call_rcu().
+ */
+typedef struct rcu_head {
+    struct rcu_head *next;
+    void            (*func)(struct rcu_head *head);
+    uint64_t        seq;    /* Grace period the callback waits for. */
+} rcu_head_t;
 
 #endif /* _TYPES_H_ */
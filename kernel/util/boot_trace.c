@@ -0,0 +1,68 @@
+#include "../boot_trace.h"
+#include "../arch.h"
+#include "../compiler.h"
+#include "../stdio.h"
+
+/* in .data, the fixed slots are written before the bss is cleared */
+uint64_t boot_trace_tsc[BOOT_TRACE_MAX] SECTION(".data");
+
+static const char *boot_trace_label[BOOT_TRACE_MAX] = {
+    [BOOT_TRACE_ENTRY]  = "entry",
+    [BOOT_TRACE_PAGING] = "paging",
+};
+
+static uint32_t boot_trace_count = BOOT_TRACE_NUM_FIXED;
+static bool boot_trace_done;
+
+void boot_mark(const char *label) {
+    if (boot_trace_done || boot_trace_count == BOOT_TRACE_MAX)
+        return;
+
+    boot_trace_tsc[boot_trace_count] = arch_cycle_count();
+    boot_trace_label[boot_trace_count] = label;
+    boot_trace_count++;
+}
+
+void boot_trace_dump(bool machine) {
+    uint32_t order[BOOT_TRACE_MAX], n = 0;
+
+    boot_trace_done = true;
+
+    /* fixed slots the entry code did not get to are 0 */
+    for (uint32_t i = 0; i < boot_trace_count; ++i) {
+        if (boot_trace_tsc[i])
+            order[n++] = i;
+    }
+
+    if (!n)
+        return;
+
+    /* the fixed slots come first in the array but not always in time */
+    for (uint32_t i = 1; i < n; ++i) {
+        uint32_t idx = order[i], j = i;
+
+        for (; j > 0 && boot_trace_tsc[order[j - 1]] > boot_trace_tsc[idx]; --j)
+            order[j] = order[j - 1];
+        order[j] = idx;
+    }
+
+    uint64_t first = boot_trace_tsc[order[0]], prev = first;
+
+    if (!machine)
+        printf("boot: %-20s %12s %12s\n", "phase", "at us", "took us");
+
+    for (uint32_t i = 0; i < n; ++i) {
+        uint64_t tsc = boot_trace_tsc[order[i]];
+        ktime_t at = arch_cycles_to_ns(tsc - first);
+        ktime_t took = arch_cycles_to_ns(tsc - prev);
+
+        if (machine)
+            printf("@boot %s %lld\n", boot_trace_label[order[i]], (long long)at);
+        else
+            printf("      %-20s %8lld.%03lld %8lld.%03lld\n", boot_trace_label[order[i]],
+                   (long long)(at / 1000), (long long)(at % 1000),
+                   (long long)(took / 1000), (long long)(took % 1000));
+
+        prev = tsc;
+    }
+}
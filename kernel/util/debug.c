@@ -0,0 +1,34 @@
+#include "../arch.h"
+#include "../atomic.h"
+#include "../console.h"
+#include "../debug.h"
+#include "../klog.h"
+#include "../printf.h"
+
+static int panicking;
+
+static int panic_out(const char *str, size_t len, void *arg) {
+    console_write_polled(str, len);
+    return 0;
+}
+
+void panic(const char *fmt, ...) {
+    va_list ap;
+
+    arch_disable_ints();
+
+    /* a fault while panicking must not recurse */
+    if (atomic_exchange(&panicking, 1))
+        arch_halt();
+
+    /* what led here, the console is likely behind the log */
+    klog_dump_last(KLOG_PANIC_RECORDS);
+
+    console_write_polled("panic: ", 7);
+
+    va_start(ap, fmt);
+    printf_core(panic_out, NULL, fmt, ap);
+    va_end(ap);
+
+    arch_halt();
+}
@@ -0,0 +1,114 @@
+#include "../interval_tree.h"
+
+#define interval_entry(ptr) rb_entry(ptr, interval_node_t, rb)
+
+static inline uint64_t interval_compute_last(const interval_node_t *node) {
+    uint64_t max = node->last;
+
+    if (node->rb.left && interval_entry(node->rb.left)->subtree_last > max)
+        max = interval_entry(node->rb.left)->subtree_last;
+    if (node->rb.right && interval_entry(node->rb.right)->subtree_last > max)
+        max = interval_entry(node->rb.right)->subtree_last;
+
+    return max;
+}
+
+RB_DECLARE_CALLBACKS(static, interval_augment, interval_node_t, rb, uint64_t, subtree_last,
+                     interval_compute_last);
+
+void interval_tree_insert(interval_tree_t *tree, interval_node_t *node) {
+    rb_node_t **link = &tree->root.node, *parent = NULL;
+
+    while (*link) {
+        parent = *link;
+        if (node->start < interval_entry(parent)->start)
+            link = &parent->left;
+        else
+            link = &parent->right;
+    }
+
+    node->subtree_last = node->last;
+    rb_link_node(&node->rb, parent, link);
+    rb_insert_augmented(&node->rb, &tree->root, &interval_augment);
+}
+
+void interval_tree_remove(interval_tree_t *tree, interval_node_t *node) {
+    rb_erase_augmented(&node->rb, &tree->root, &interval_augment);
+}
+
+/**
+ * @brief   Leftmost range in the subtree that overlaps [start, last], the
+ *          subtree must reach start.
+ */
+static interval_node_t *interval_subtree_search(interval_node_t *node, uint64_t start,
+                                                uint64_t last) {
+    for (;;) {
+        /* anything on the left starts earlier, look there first */
+        if (node->rb.left) {
+            interval_node_t *left = interval_entry(node->rb.left);
+
+            if (left->subtree_last >= start) {
+                node = left;
+                continue;
+            }
+        }
+
+        /* everything on the right starts after node does */
+        if (node->start > last)
+            return NULL;
+
+        if (node->last >= start)
+            return node;
+
+        if (!node->rb.right)
+            return NULL;
+
+        node = interval_entry(node->rb.right);
+        if (node->subtree_last < start)
+            return NULL;
+    }
+}
+
+interval_node_t *interval_tree_iter_first(const interval_tree_t *tree, uint64_t start,
+                                          uint64_t last) {
+    if (!tree->root.node)
+        return NULL;
+
+    interval_node_t *node = interval_entry(tree->root.node);
+    if (node->subtree_last < start)
+        return NULL;
+
+    return interval_subtree_search(node, start, last);
+}
+
+interval_node_t *interval_tree_iter_next(const interval_node_t *node, uint64_t start,
+                                         uint64_t last) {
+    rb_node_t *rb = node->rb.right, *prev;
+
+    for (;;) {
+        /* the right subtree holds the next ones in order */
+        if (rb) {
+            interval_node_t *right = interval_entry(rb);
+
+            if (right->subtree_last >= start)
+                return interval_subtree_search(right, start, last);
+        }
+
+        /* then the first ancestor we are on the left of */
+        do {
+            rb = rb_parent(&node->rb);
+            if (!rb)
+                return NULL;
+
+            prev = (rb_node_t *)&node->rb;
+            node = interval_entry(rb);
+            rb = node->rb.right;
+        } while (prev == rb);
+
+        if (node->start > last)
+            return NULL;
+
+        if (node->last >= start)
+            return (interval_node_t *)node;
+    }
+}
@@ -0,0 +1,316 @@
+#include "../arch.h"
+#include "../atomic.h"
+#include "../console.h"
+#include "../klog.h"
+#include "../printf.h"
+#include "../thread.h"
+
+#include <string.h>
+
+#define KLOG_RING_MASK      (KLOG_RING_RECORDS - 1)
+
+typedef struct klog_ring {
+    uint64_t        head ALIGNED(CACHE_LINE_SIZE);  /* Next index to reserve. */
+    uint64_t        tail ALIGNED(CACHE_LINE_SIZE);  /* Next index to drain,
+                                                     * drain only.
+                                                     */
+    klog_record_t   records[KLOG_RING_RECORDS] ALIGNED(CACHE_LINE_SIZE);
+} klog_ring_t;
+
+static klog_ring_t klog_rings[SMP_MAX_CPUS];
+
+/* one drain at a time, the state below belongs to it */
+static int klog_draining;
+static klog_record_t drain_heads[SMP_MAX_CPUS];
+static bool drain_valid[SMP_MAX_CPUS];
+static bool drain_line_start = true;
+
+WEAK void console_write(const char *str, size_t len) {
+}
+
+WEAK void console_write_polled(const char *str, size_t len) {
+}
+
+WEAK void console_flush(void) {
+}
+
+/* ------------------------------ Writing ------------------------------ */
+
+typedef struct klog_writer {
+    klog_ring_t     *ring;
+    klog_record_t   *rec;
+    uint64_t        idx;
+    int             level;
+} klog_writer_t;
+
+static void klog_reserve(klog_writer_t *w) {
+    /* interrupts on this cpu may log in between, the add keeps them apart */
+    w->idx = atomic_fetch_add(&w->ring->head, 1);
+    w->rec = &w->ring->records[w->idx & KLOG_RING_MASK];
+
+    /* invalidate before the contents change, a reader may be copying them */
+    atomic_store(&w->rec->seq, 0);
+    w->rec->time = arch_current_time();
+    w->rec->len = 0;
+    w->rec->level = (uint8_t)w->level;
+}
+
+static inline void klog_commit(klog_writer_t *w) {
+    atomic_store_release(&w->rec->seq, w->idx + 1);
+}
+
+/* formats straight into the ring */
+static int klog_out(const char *str, size_t len, void *arg) {
+    klog_writer_t *w = arg;
+
+    while (len) {
+        if (w->rec->len >= KLOG_TEXT_MAX) {
+            klog_commit(w);
+            klog_reserve(w);
+        }
+
+        size_t n = KLOG_TEXT_MAX - w->rec->len;
+        if (n > len)
+            n = len;
+
+        memcpy(&w->rec->text[w->rec->len], str, n);
+        w->rec->len += n;
+        str += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+int klog_vprintf(int level, const char *fmt, va_list ap) {
+    thread_t *t = get_current_thread();
+    arch_irq_state_t state = 0;
+
+    /*
+     * Stay on the cpu from reserve to commit, only interrupts may log
+     * into the ring in between. Early boot has no thread to mark yet.
+     */
+    if (t)
+        thread_preempt_disable();
+    else
+        state = arch_irq_save();
+
+    klog_writer_t w = {
+        .ring = &klog_rings[arch_curr_cpu_num()],
+        .level = level,
+    };
+
+    klog_reserve(&w);
+    int ret = printf_core(klog_out, &w, fmt, ap);
+    klog_commit(&w);
+
+    if (t)
+        thread_preempt_enable();
+    else
+        arch_irq_restore(state);
+
+    return ret;
+}
+
+int klog_printf(int level, const char *fmt, ...) {
+    int ret;
+    va_list ap;
+
+    va_start(ap, fmt);
+    ret = klog_vprintf(level, fmt, ap);
+    va_end(ap);
+
+    return ret;
+}
+
+/* ------------------------------ Reading ------------------------------ */
+
+/**
+ * @brief   Copy record idx out of a ring.
+ * @returns 1 if copied, 0 if it is still being written and -1 if it was
+ *          overwritten.
+ */
+static int klog_read(klog_ring_t *ring, uint64_t idx, klog_record_t *out) {
+    klog_record_t *rec = &ring->records[idx & KLOG_RING_MASK];
+
+    if (atomic_load_acquire(&rec->seq) != idx + 1) {
+        if (atomic_load_acquire(&ring->head) - idx > KLOG_RING_RECORDS)
+            return -1;
+
+        return 0;
+    }
+
+    memcpy(out, rec, sizeof(*out));
+
+    /* the copy before the second look, a writer that lapped us changed seq */
+    smp_mb();
+
+    if (atomic_load_relaxed(&rec->seq) != idx + 1)
+        return -1;
+
+    if (out->len > KLOG_TEXT_MAX)
+        out->len = KLOG_TEXT_MAX;
+
+    return 1;
+}
+
+static int console_out(const char *str, size_t len, void *arg) {
+    console_write(str, len);
+    return 0;
+}
+
+static int console_polled_out(const char *str, size_t len, void *arg) {
+    console_write_polled(str, len);
+    return 0;
+}
+
+static void out_printf(printf_out_t out, const char *fmt, ...) {
+    va_list ap;
+
+    va_start(ap, fmt);
+    printf_core(out, NULL, fmt, ap);
+    va_end(ap);
+}
+
+static void klog_emit(uint32_t cpu, const klog_record_t *rec, printf_out_t out,
+                      bool *line_start) {
+    if (!rec->len)
+        return;
+
+    if (*line_start) {
+        out_printf(out, "[%5lld.%06lld %2u] ", (long long)(rec->time / 1000000000),
+                   (long long)(rec->time % 1000000000) / 1000, cpu);
+    }
+
+    out(rec->text, rec->len, NULL);
+    *line_start = rec->text[rec->len - 1] == '\n';
+}
+
+/** @brief  Load the oldest undrained record of a cpu into drain_heads. */
+static bool klog_fetch(uint32_t cpu) {
+    klog_ring_t *ring = &klog_rings[cpu];
+    uint64_t lost = 0;
+    bool ret = false;
+
+    for (;;) {
+        uint64_t head = atomic_load_acquire(&ring->head);
+
+        if (ring->tail == head)
+            break;
+
+        if (head - ring->tail > KLOG_RING_RECORDS) {
+            lost += head - KLOG_RING_RECORDS - ring->tail;
+            ring->tail = head - KLOG_RING_RECORDS;
+        }
+
+        int r = klog_read(ring, ring->tail, &drain_heads[cpu]);
+        if (r > 0) {
+            ret = true;
+            break;
+        }
+
+        if (r == 0)
+            break;
+
+        lost++;
+        ring->tail++;
+    }
+
+    if (lost) {
+        out_printf(console_out, "%sklog: %llu records lost on cpu %u\n",
+                   drain_line_start ? "" : "\n", (unsigned long long)lost, cpu);
+        drain_line_start = true;
+    }
+
+    return ret;
+}
+
+void klog_drain(void) {
+    if (atomic_exchange(&klog_draining, 1))
+        return;
+
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; ++cpu)
+        drain_valid[cpu] = klog_fetch(cpu);
+
+    /* merge by timestamp, the TSC is in sync across cpus */
+    for (;;) {
+        uint32_t best = SMP_MAX_CPUS;
+
+        for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; ++cpu) {
+            if (drain_valid[cpu] &&
+                (best == SMP_MAX_CPUS || drain_heads[cpu].time < drain_heads[best].time))
+                best = cpu;
+        }
+
+        if (best == SMP_MAX_CPUS)
+            break;
+
+        klog_emit(best, &drain_heads[best], console_out, &drain_line_start);
+
+        klog_rings[best].tail++;
+        drain_valid[best] = klog_fetch(best);
+    }
+
+    atomic_store_release(&klog_draining, 0);
+}
+
+bool klog_has_pending(void) {
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; ++cpu) {
+        klog_ring_t *ring = &klog_rings[cpu];
+
+        if (atomic_load_relaxed(&ring->head) != atomic_load_relaxed(&ring->tail))
+            return true;
+    }
+
+    return false;
+}
+
+void klog_dump_last(size_t count) {
+    uint64_t pos[SMP_MAX_CPUS], end[SMP_MAX_CPUS];
+    uint64_t total = 0, skip;
+    bool line_start = true;
+    klog_record_t rec;
+
+    /* the newest count of every cpu, then skip the oldest of the merge */
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; ++cpu) {
+        uint64_t n = count < KLOG_RING_RECORDS ? count : KLOG_RING_RECORDS;
+
+        end[cpu] = atomic_load_acquire(&klog_rings[cpu].head);
+        pos[cpu] = end[cpu] > n ? end[cpu] - n : 0;
+        total += end[cpu] - pos[cpu];
+    }
+
+    skip = total > count ? total - count : 0;
+
+    for (;;) {
+        uint32_t best = SMP_MAX_CPUS;
+        ktime_t best_time = 0;
+
+        for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; ++cpu) {
+            if (pos[cpu] == end[cpu])
+                continue;
+
+            ktime_t t = klog_rings[cpu].records[pos[cpu] & KLOG_RING_MASK].time;
+            if (best == SMP_MAX_CPUS || t < best_time) {
+                best = cpu;
+                best_time = t;
+            }
+        }
+
+        if (best == SMP_MAX_CPUS)
+            break;
+
+        uint64_t idx = pos[best]++;
+
+        if (skip) {
+            skip--;
+            continue;
+        }
+
+        if (klog_read(&klog_rings[best], idx, &rec) > 0)
+            klog_emit(best, &rec, console_polled_out, &line_start);
+    }
+
+    if (!line_start)
+        console_write_polled("\n", 1);
+}
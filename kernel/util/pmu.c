@@ -0,0 +1,62 @@
+#include "../pmu.h"
+#include "../stdio.h"
+
+/* from kernel.ld, every PMU_SCOPE() and PMU_BEGIN() has one site in between */
+extern pmu_site_t __pmu_site_start[], __pmu_site_end[];
+
+static const char *const event_names[PMU_EVENT_COUNT] = {
+    [PMU_EVENT_CYCLES]          = "cycles",
+    [PMU_EVENT_INSTRUCTIONS]    = "instr",
+    [PMU_EVENT_LLC_MISSES]      = "llc_miss",
+    [PMU_EVENT_DTLB_MISSES]     = "dtlb_miss",
+    [PMU_EVENT_BRANCH_MISSES]   = "br_miss",
+};
+
+const char *pmu_event_name(pmu_event_t event) {
+    return event < PMU_EVENT_COUNT ? event_names[event] : "?";
+}
+
+void pmu_reset(void) {
+    for (pmu_site_t *site = __pmu_site_start; site < __pmu_site_end; ++site) {
+        atomic_store_relaxed(&site->calls, 0);
+        atomic_store_relaxed(&site->migrated, 0);
+        for (uint32_t i = 0; i < PMU_EVENT_COUNT; ++i)
+            atomic_store_relaxed(&site->totals[i], 0);
+    }
+}
+
+void pmu_dump(void) {
+    arch_pmu_dump();
+
+    if (!pmu_available())
+        return;
+
+    /* per call with two decimals, a miss every few calls still shows */
+    printf("%-24s %10s", "site", "calls");
+    for (uint32_t i = 0; i < PMU_EVENT_COUNT; ++i)
+        printf(" %12s", event_names[i]);
+    printf(" %8s\n", "migrated");
+
+    for (pmu_site_t *site = __pmu_site_start; site < __pmu_site_end; ++site) {
+        uint64_t calls = atomic_load_relaxed(&site->calls);
+        uint64_t migrated = atomic_load_relaxed(&site->migrated);
+
+        if (!calls && !migrated)
+            continue;
+
+        printf("%-24s %10llu", site->name, (unsigned long long)calls);
+
+        for (uint32_t i = 0; i < PMU_EVENT_COUNT; ++i) {
+            if (!arch_pmu_counts(i) || !calls) {
+                printf(" %12s", "-");
+                continue;
+            }
+
+            uint64_t hundredths = atomic_load_relaxed(&site->totals[i]) * 100 / calls;
+            printf(" %9llu.%02llu", (unsigned long long)(hundredths / 100),
+                   (unsigned long long)(hundredths % 100));
+        }
+
+        printf(" %8llu\n", (unsigned long long)migrated);
+    }
+}
@@ -5,218 +5,834 @@
 #include <stdbool.h>
 #include <string.h>
 
-#define LONG_FLAG           0x001
-#define LONGLONG_FLAG       0x002
-#define SIGNED_FLAG         0x004
-#define LEADINGZERO_FLAG    0x008
-#define LEFTFORMAT_FLAG     0x010
-#define SHOWSIGN_FLAG       0x020
-
-NOINLINE static char *longlong_to_string(char *buf, size_t len, unsigned long long ll,
-                                    uint32_t flags, char *signchar) {
-    size_t pos = len;
-    bool negative = 0;
-    
-    if ((flags & SIGNED_FLAG) && (long long)ll < 0) {
-        negative = true;
-        ll = -ll;
-    }
-
-    buf[--pos] = 0;
-
-    if (negative) {
-        *signchar = '-';
-    } else if (flags & SHOWSIGN_FLAG) {
-        *signchar = '+';
+#define LONG_FLAG           0x0001
+#define LONGLONG_FLAG       0x0002
+#define SIGNED_FLAG         0x0004
+#define LEADINGZERO_FLAG    0x0008
+#define LEFTFORMAT_FLAG     0x0010
+#define SHOWSIGN_FLAG       0x0020
+#define BLANKPOS_FLAG       0x0040
+#define ALTERNATE_FLAG      0x0080
+#define HALF_FLAG           0x0100
+#define HALFHALF_FLAG       0x0200
+#define SIZET_FLAG          0x0400
+#define INTMAX_FLAG         0x0800
+#define PTRDIFF_FLAG        0x1000
+
+/* large enough for a 64 bit number in octal */
+#define NUM_BUF_SIZE        32
+
+/* %f of DBL_MAX has 309 integer digits, precision is capped to keep the
+ * conversion buffers on the stack reasonable
+ */
+#define FP_MAX_PRECISION    128
+#define FP_BUF_SIZE         (309 + FP_MAX_PRECISION + 16)
+#define FP_DIGITS_MAX       (309 + FP_MAX_PRECISION + 16)
+
+/* a 1074 bit fraction or a 1024 bit integer, in 32 bit words */
+#define FP_WORDS            35
+
+#define FP_FRAC_MASK        ((1ULL << 52) - 1)
+
+static const char digit_pairs[200] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static const char hex_lower[16] = "0123456789abcdef";
+static const char hex_upper[16] = "0123456789ABCDEF";
+
+/* padding goes out in runs instead of a call per character */
+static const char pad_spaces[32] = "                                ";
+static const char pad_zeros[32]  = "00000000000000000000000000000000";
+
+/* hand the text to the sink, a negative return aborts the whole format */
+#define OUTPUT_STRING(str, len)                     \
+    do {                                            \
+        int _err = out((str), (len), arg);          \
+        if (_err < 0)                               \
+            return _err;                            \
+        ret += (int)(len);                          \
+    } while (0)
+
+#define OUTPUT_CHAR(c)                              \
+    do {                                            \
+        char _c = (c);                              \
+        OUTPUT_STRING(&_c, 1);                      \
+    } while (0)
+
+#define OUTPUT_PAD(pad, count)                      \
+    do {                                            \
+        size_t _left = (count);                     \
+        while (_left) {                             \
+            size_t _n = _left < sizeof(pad) ?       \
+                        _left : sizeof(pad);        \
+            OUTPUT_STRING(pad, _n);                 \
+            _left -= _n;                            \
+        }                                           \
+    } while (0)
+
+/* ------------------------------ Integers ------------------------------ */
+
+/* The converters write backwards from end and return the first digit. */
+
+static char *longlong_to_string(char *end, unsigned long long n) {
+    char *p = end;
+
+    /* two digits per division */
+    while (n >= 100) {
+        unsigned int i = (unsigned int)(n % 100) * 2;
+        n /= 100;
+        *--p = digit_pairs[i + 1];
+        *--p = digit_pairs[i];
+    }
+
+    if (n >= 10) {
+        unsigned int i = (unsigned int)n * 2;
+        *--p = digit_pairs[i + 1];
+        *--p = digit_pairs[i];
     } else {
-        *signchar = ' ';
+        *--p = (char)('0' + n);
     }
+
+    return p;
 }
 
+static char *longlong_to_hexstring(char *end, unsigned long long n, bool caps) {
+    const char *table = caps ? hex_upper : hex_lower;
+    char *p = end;
+
+    do {
+        *--p = table[n & 0xf];
+        n >>= 4;
+    } while (n);
+
+    return p;
+}
+
+static char *longlong_to_octstring(char *end, unsigned long long n) {
+    char *p = end;
+
+    do {
+        *--p = (char)('0' + (n & 0x7));
+        n >>= 3;
+    } while (n);
+
+    return p;
+}
+
+/**
+ * @brief   Output prefix (sign, 0x), zeros, then body, padded to width.
+ * @returns Characters written or the error of the sink.
+ */
+static int output_field(printf_out_t out, void *arg, const char *prefix, size_t prefix_len,
+                        size_t zeros, const char *body, size_t body_len, int width,
+                        uint32_t flags) {
+    int ret = 0;
+    size_t len = prefix_len + zeros + body_len;
+    size_t pad = (size_t)width > len ? (size_t)width - len : 0;
+
+    if (!(flags & (LEFTFORMAT_FLAG | LEADINGZERO_FLAG)))
+        OUTPUT_PAD(pad_spaces, pad);
+
+    if (prefix_len)
+        OUTPUT_STRING(prefix, prefix_len);
+
+    /* zero padding goes between the sign and the digits */
+    if ((flags & (LEFTFORMAT_FLAG | LEADINGZERO_FLAG)) == LEADINGZERO_FLAG)
+        zeros += pad;
+
+    OUTPUT_PAD(pad_zeros, zeros);
+
+    if (body_len)
+        OUTPUT_STRING(body, body_len);
+
+    if (flags & LEFTFORMAT_FLAG)
+        OUTPUT_PAD(pad_spaces, pad);
+
+    return ret;
+}
+
+/* --------------------------- Floating point --------------------------- */
+
 union double_int {
     double d;
     uint64_t i;
 };
 
-#define OUT_STR(str)                            \
-    do {                                        \
-        for (size_t i = 0; str[i] != 0; ++i) {  \
-            buf[++pos] = (str)[i];              \
-        }                                       \
-    } while(0)
+/*
+ * Exact decimal expansion of a double. The integer part is converted with
+ * big integer division by 10^9, the fraction is kept as a binary fixed
+ * point number and multiplied by 10^9 to pull out nine digits at a time,
+ * only as many as the precision needs. Rounding looks at the digits left
+ * over and whatever remains of the fraction, so results are correctly
+ * rounded, ties to even.
+ */
+typedef struct fp_digits {
+    int     n;
+    int     exp10;      /* Value is 0.d[0..n) * 10^exp10. */
+    bool    sticky;     /* Non zero digits follow d[n - 1]. */
+    char    d[FP_DIGITS_MAX];
+} fp_digits_t;
+
+/* nine digits, zero padded */
+static void put_chunk(char *p, uint32_t v) {
+    for (int i = 7; i >= 1; i -= 2) {
+        uint32_t r = (v % 100) * 2;
+        v /= 100;
+        p[i] = digit_pairs[r];
+        p[i + 1] = digit_pairs[r + 1];
+    }
 
-/* IEEE 754 Double-precision FP */
-NOINLINE static char *double_to_string(char *buf, size_t len, double d, uint32_t flags) {
-    size_t pos = 0;
+    p[0] = (char)('0' + v);
+}
 
-    union double_int du = { d };
+static inline int fp_need(const fp_digits_t *fp, bool fixed, int count) {
+    return fixed ? fp->exp10 + count + 1 : count + 1;
+}
 
-    uint32_t exponent = (du.i >> 52) & 0x7ff;
-    uint32_t fraction = (du.i & ((1ULL << 52) - 1));
-    bool negative = !!(du.i & (1ULL << 63));
+/**
+ * @brief   Generate the digits of |bits|, one more than needed for rounding
+ *          to count digits after the point (fixed) or count significant
+ *          digits.
+ */
+static void fp_to_digits(uint64_t bits, bool fixed, int count, fp_digits_t *fp) {
+    uint32_t exponent = (bits >> 52) & 0x7ff;
+    uint64_t m = bits & FP_FRAC_MASK;
+    int e2;
+
+    fp->n = 0;
+    fp->exp10 = 0;
+    fp->sticky = false;
+
+    /* value = m * 2^e2 */
+    if (exponent) {
+        m |= 1ULL << 52;
+        e2 = (int)exponent - 1075;
+    } else {
+        e2 = -1074;
+    }
+
+    if (!m)
+        return;
+
+    /* integer part */
+    if (e2 > 11) {
+        uint32_t w[FP_WORDS];
+        uint32_t chunks[FP_WORDS + 1];
+        int nw = e2 / 32 + 3, nc = 0;
+        unsigned __int128 v = (unsigned __int128)m << (e2 % 32);
+
+        memset(w, 0, sizeof(w));
+        w[e2 / 32] = (uint32_t)v;
+        w[e2 / 32 + 1] = (uint32_t)(v >> 32);
+        w[e2 / 32 + 2] = (uint32_t)(v >> 64);
+
+        while (nw && !w[nw - 1])
+            nw--;
+
+        while (nw) {
+            uint64_t rem = 0;
+
+            for (int i = nw - 1; i >= 0; --i) {
+                uint64_t cur = (rem << 32) | w[i];
+                w[i] = (uint32_t)(cur / 1000000000);
+                rem = cur % 1000000000;
+            }
+
+            chunks[nc++] = (uint32_t)rem;
+
+            while (nw && !w[nw - 1])
+                nw--;
+        }
 
-    if (negative) {
-        buf[++pos] = '-';
-        d = -d;
+        char tmp[NUM_BUF_SIZE];
+        char *s = longlong_to_string(tmp + sizeof(tmp), chunks[nc - 1]);
+
+        fp->n = (int)(tmp + sizeof(tmp) - s);
+        memcpy(fp->d, s, fp->n);
+
+        for (int i = nc - 2; i >= 0; --i) {
+            put_chunk(&fp->d[fp->n], chunks[i]);
+            fp->n += 9;
+        }
+
+        fp->exp10 = fp->n;
+        return;
     }
 
-    if (exponent == 0x7ff) {
-        if (fraction == 0) {
-            OUT_STR("inf");
-        } else {
-            OUT_STR("nan");
+    int k = -e2;
+    uint64_t ip = e2 >= 0 ? m << e2 : k < 64 ? m >> k : 0;
+
+    if (ip) {
+        char tmp[NUM_BUF_SIZE];
+        char *s = longlong_to_string(tmp + sizeof(tmp), ip);
+
+        fp->n = (int)(tmp + sizeof(tmp) - s);
+        memcpy(fp->d, s, fp->n);
+        fp->exp10 = fp->n;
+    }
+
+    if (e2 >= 0)
+        return;
+
+    /* fraction, f / 2^k as a fixed point number of nw words */
+    uint64_t f = k < 64 ? m & ((1ULL << k) - 1) : m;
+    if (!f)
+        return;
+
+    uint32_t w[FP_WORDS];
+    int nw = (k + 31) / 32, lo = 0;
+    unsigned __int128 v = (unsigned __int128)f << (32 * nw - k);
+
+    memset(w, 0, sizeof(w));
+    for (int i = 0; i < nw && i < 3; ++i)
+        w[i] = (uint32_t)(v >> (32 * i));
+
+    while (!w[lo])
+        lo++;
+
+    while (lo < nw && fp->n < fp_need(fp, fixed, count)) {
+        uint64_t carry = 0;
+
+        for (int i = lo; i < nw; ++i) {
+            uint64_t t = (uint64_t)w[i] * 1000000000 + carry;
+            w[i] = (uint32_t)t;
+            carry = t >> 32;
         }
-    } else if (exponent == 0) {
-        if (fraction == 0) {
-            OUT_STR("0.000000");
-        } else {
-            /* denormalized */
-            OUT_STR("den");
+
+        /* each step clears at least nine low bits */
+        while (lo < nw && !w[lo])
+            lo++;
+
+        if (fp->n) {
+            put_chunk(&fp->d[fp->n], (uint32_t)carry);
+            fp->n += 9;
+            continue;
         }
+
+        /* no significant digit yet */
+        if (!carry) {
+            fp->exp10 -= 9;
+            continue;
+        }
+
+        char tmp[9];
+        int z = 0;
+
+        put_chunk(tmp, (uint32_t)carry);
+        while (tmp[z] == '0')
+            z++;
+
+        memcpy(fp->d, tmp + z, 9 - z);
+        fp->n = 9 - z;
+        fp->exp10 -= z;
+    }
+
+    fp->sticky = lo < nw;
+}
+
+/** @brief  Keep the first keep digits, rounding half to even. */
+static void fp_round(fp_digits_t *fp, int keep) {
+    /* only exact values run out of digits early */
+    if (keep >= fp->n)
+        return;
+
+    if (keep < 0) {
+        fp->n = 0;
+        fp->exp10 = 0;
+        return;
+    }
+
+    char next = fp->d[keep];
+    bool rest = fp->sticky;
+
+    for (int i = keep + 1; i < fp->n && !rest; ++i)
+        rest = fp->d[i] != '0';
+
+    bool odd = keep > 0 && ((fp->d[keep - 1] - '0') & 1);
+
+    fp->n = keep;
+    fp->sticky = false;
+
+    if (next < '5' || (next == '5' && !rest && !odd))
+        return;
+
+    int i = keep - 1;
+    while (i >= 0 && fp->d[i] == '9')
+        fp->d[i--] = '0';
+
+    if (i >= 0) {
+        fp->d[i]++;
+        return;
+    }
+
+    /* 99.9 -> 100 */
+    fp->d[0] = '1';
+    if (!keep)
+        fp->n = 1;
+    fp->exp10++;
+}
+
+static inline char fp_digit(const fp_digits_t *fp, int i) {
+    return i >= 0 && i < fp->n ? fp->d[i] : '0';
+}
+
+static size_t fp_format_fixed(char *buf, const fp_digits_t *fp, int prec, bool point) {
+    int e = fp->n ? fp->exp10 : 0;
+    char *p = buf;
+
+    if (e <= 0) {
+        *p++ = '0';
     } else {
-        int exponent_signed = exponent - 1023;
-        if (exponent_signed < -52 || exponent_signed > 52) {
-            OUT_STR("<range>");
-        } else {  
-/* reverse output */
-#define OUT_REVERSE(ch)                     \
-    do {                                    \
-        if (&buf[pos] == buf) goto done;    \
-        else buf[--pos] = ch;               \
-    } while (0)
+        for (int i = 0; i < e; ++i)
+            *p++ = fp_digit(fp, i);
+    }
 
-            /* start by walking backwards through the string */
-            pos = len;
-            OUT_REVERSE('0');
+    if (prec || point)
+        *p++ = '.';
 
-            uint32_t i;
-            for (i = 0; i <= 6; ++i)
-                OUT_REVERSE('0');
+    for (int i = e; i < e + prec; ++i)
+        *p++ = fp_digit(fp, i);
 
-            size_t decimal_pos = pos;
+    return p - buf;
+}
 
-            /* integral portion */
-            uint64_t u;
-            if (exponent_signed >= 0) {
-                u = fraction;
-                u |= (1ULL << 52);
-                u >>= (52 - exponent_signed);
+static size_t fp_format_exp(char *buf, const fp_digits_t *fp, int prec, bool point, bool caps) {
+    int x = fp->n ? fp->exp10 - 1 : 0;
+    char *p = buf;
 
-                char *s = longlong_to_string(buf, pos + 1, u, flags, &(char) {0});
+    *p++ = fp_digit(fp, 0);
 
-                pos = s - buf;
-            } else {
-                u = 0;
-                OUT_REVERSE('0');
-            }
+    if (prec || point)
+        *p++ = '.';
+
+    for (int i = 1; i <= prec; ++i)
+        *p++ = fp_digit(fp, i);
+
+    *p++ = caps ? 'E' : 'e';
+    *p++ = x < 0 ? '-' : '+';
+
+    if (x < 0)
+        x = -x;
+
+    /* at least two exponent digits */
+    if (x < 10)
+        *p++ = '0';
+
+    char tmp[NUM_BUF_SIZE];
+    char *s = longlong_to_string(tmp + sizeof(tmp), (unsigned long long)x);
+
+    while (s < tmp + sizeof(tmp))
+        *p++ = *s++;
+
+    return p - buf;
+}
+
+/** @brief  %f, %e and %g of |bits|, without the sign. */
+NOINLINE static size_t double_to_string(char *buf, uint64_t bits, char conv, int prec,
+                                        uint32_t flags) {
+    fp_digits_t fp;
+    bool alt = !!(flags & ALTERNATE_FLAG);
+    bool caps = conv >= 'A' && conv <= 'Z';
+
+    if (prec < 0)
+        prec = 6;
+    if (prec > FP_MAX_PRECISION)
+        prec = FP_MAX_PRECISION;
 
-            buf[decimal_pos] = '.';
+    switch (conv | 0x20) {
+    case 'f':
+        fp_to_digits(bits, true, prec, &fp);
+        fp_round(&fp, fp.exp10 + prec);
+        return fp_format_fixed(buf, &fp, prec, alt);
 
-            /* fractional portion */
-            uint32_t frac = ((d - u) * 1000000) + 0.5;
+    case 'e':
+        fp_to_digits(bits, false, prec + 1, &fp);
+        fp_round(&fp, prec + 1);
+        return fp_format_exp(buf, &fp, prec, alt, caps);
+
+    default: {
+        /* %g, precision is the number of significant digits */
+        int p = prec ? prec : 1;
+
+        fp_to_digits(bits, false, p, &fp);
+        fp_round(&fp, p);
+
+        int x = fp.n ? fp.exp10 - 1 : 0;
+        int sig = fp.n;
+
+        /* trailing zeros are dropped unless # */
+        while (!alt && sig > 0 && fp.d[sig - 1] == '0')
+            sig--;
+
+        if (x >= -4 && x < p) {
+            int fprec = p - 1 - x;
+
+            if (!alt && fprec > sig - fp.exp10)
+                fprec = sig - fp.exp10 > 0 ? sig - fp.exp10 : 0;
+
+            return fp_format_fixed(buf, &fp, fprec, alt);
+        }
+
+        int eprec = p - 1;
+        if (!alt && eprec > sig - 1)
+            eprec = sig > 1 ? sig - 1 : 0;
+
+        return fp_format_exp(buf, &fp, eprec, alt, caps);
+    }
+    }
+}
 
-            i = decimal_pos + 6 + 1;
-            while (frac != 0) {
-                uint32_t digit = frac % 10;
-                buf[--i] = digit + '0';
-                frac /= 10;
+/** @brief  %a of |bits| without the sign and 0x, exact unless a precision is given. */
+NOINLINE static size_t double_to_hexstring(char *buf, uint64_t bits, int prec, uint32_t flags,
+                                           bool caps) {
+    const char *table = caps ? hex_upper : hex_lower;
+    uint32_t exponent = (bits >> 52) & 0x7ff;
+    uint64_t frac = bits & FP_FRAC_MASK;
+    unsigned int lead = exponent ? 1 : 0;
+    int e = exponent ? (int)exponent - 1023 : frac ? -1022 : 0;
+    int digits = 13;
+    char *p = buf;
+
+    if (prec >= 0 && prec < 13) {
+        int shift = (13 - prec) * 4;
+        uint64_t rem = frac & ((1ULL << shift) - 1);
+        uint64_t half = 1ULL << (shift - 1);
+
+        frac >>= shift;
+
+        /* with no digits left the leading one decides ties */
+        bool odd = prec ? (frac & 1) : (lead & 1);
+
+        if (rem > half || (rem == half && odd)) {
+            frac++;
+
+            /* carried into the leading digit, 0x1.f -> 0x2.0 */
+            if (frac >> (prec * 4)) {
+                frac &= (1ULL << (prec * 4)) - 1;
+                lead++;
             }
+        }
 
-            if (negative)
-                OUT_REVERSE('-');
-done:
-            return &buf[pos];
+        digits = prec;
+    } else if (prec < 0) {
+        while (digits && !(frac & 0xf)) {
+            frac >>= 4;
+            digits--;
         }
-#undef OUT_REVERSE
     }
 
-    buf[pos] = 0;
-    return buf;
+    int total = prec > digits ? prec : digits;
+
+    *p++ = (char)('0' + lead);
+
+    if (total || (flags & ALTERNATE_FLAG))
+        *p++ = '.';
+
+    for (int i = digits - 1; i >= 0; --i)
+        *p++ = table[(frac >> (4 * i)) & 0xf];
+
+    for (; total > digits; --total)
+        *p++ = '0';
+
+    *p++ = caps ? 'P' : 'p';
+    *p++ = e < 0 ? '-' : '+';
+
+    char tmp[NUM_BUF_SIZE];
+    char *s = longlong_to_string(tmp + sizeof(tmp), (unsigned long long)(e < 0 ? -e : e));
+
+    while (s < tmp + sizeof(tmp))
+        *p++ = *s++;
+
+    return p - buf;
 }
 
-NOINLINE static char *double_to_hexstring(char *buf, size_t len, double d, uint32_t flags) {
-    size_t pos = 0;
+NOINLINE static int output_double(printf_out_t out, void *arg, double d, char conv,
+                                  uint32_t flags, int width, int prec) {
+    char buf[FP_BUF_SIZE];
+    char prefix[3];
+    size_t prefix_len = 0, len;
+    union double_int du = { d };
+    bool caps = conv >= 'A' && conv <= 'Z';
 
-    
+    if (du.i >> 63)
+        prefix[prefix_len++] = '-';
+    else if (flags & SHOWSIGN_FLAG)
+        prefix[prefix_len++] = '+';
+    else if (flags & BLANKPOS_FLAG)
+        prefix[prefix_len++] = ' ';
+
+    if (((du.i >> 52) & 0x7ff) == 0x7ff) {
+        const char *s = (du.i & FP_FRAC_MASK) ? (caps ? "NAN" : "nan") : (caps ? "INF" : "inf");
+
+        return output_field(out, arg, prefix, prefix_len, 0, s, 3, width,
+                            flags & ~LEADINGZERO_FLAG);
+    }
+
+    if ((conv | 0x20) == 'a') {
+        prefix[prefix_len++] = '0';
+        prefix[prefix_len++] = caps ? 'X' : 'x';
+        len = double_to_hexstring(buf, du.i, prec, flags, caps);
+    } else {
+        len = double_to_string(buf, du.i, conv, prec, flags);
+    }
+
+    return output_field(out, arg, prefix, prefix_len, 0, buf, len, width, flags);
 }
 
-#undef OUT_STR
+/* ------------------------------------------------------------------------ */
 
-int printf_core(const char *fmt, va_list ap) {
+int printf_core(printf_out_t out, void *arg, const char *fmt, va_list ap) {
     int ret = 0;
+    int err;
 
     char c;
     const char *s;
     size_t str_len;
-    
-    unsigned int format_num;
-    int flags;
 
-    char sign_char;
-    
-    while (true) {
-        format_num = 0;
-        sign_char = '\0';
+    char num_buf[NUM_BUF_SIZE];
+    char *num_end = num_buf + sizeof(num_buf);
+    unsigned long long n;
+
+    uint32_t flags;
+    int width, prec;
+
+    char prefix[2];
+    size_t prefix_len, zeros;
 
-        /* handle regular chars that aren't format related */
+    for (;;) {
+        /* regular chars that aren't format related go out in one piece */
         s = fmt;
-        str_len = 0;
-        while ((c = *fmt++)) {
-            if (c == '%')
-                break;
-            str_len++;
+        while (*fmt && *fmt != '%')
+            fmt++;
+
+        if (fmt != s)
+            OUTPUT_STRING(s, (size_t)(fmt - s));
+
+        if (*fmt == 0)
+            break;
+
+        fmt++;
+
+        flags = 0;
+        width = 0;
+        prec = -1;
+        prefix_len = 0;
+        zeros = 0;
+
+        for (;; ++fmt) {
+            switch (*fmt) {
+            case '-': flags |= LEFTFORMAT_FLAG; continue;
+            case '+': flags |= SHOWSIGN_FLAG; continue;
+            case ' ': flags |= BLANKPOS_FLAG; continue;
+            case '#': flags |= ALTERNATE_FLAG; continue;
+            case '0': flags |= LEADINGZERO_FLAG; continue;
+            }
+            break;
         }
-        
-next:
-        c = *fmt++;
-        if (c == 0)
+
+        if (*fmt == '*') {
+            fmt++;
+            width = va_arg(ap, int);
+            if (width < 0) {
+                flags |= LEFTFORMAT_FLAG;
+                width = -width;
+            }
+        } else {
+            while (*fmt >= '0' && *fmt <= '9')
+                width = width * 10 + (*fmt++ - '0');
+        }
+
+        if (*fmt == '.') {
+            fmt++;
+            if (*fmt == '*') {
+                fmt++;
+                prec = va_arg(ap, int);
+                if (prec < 0)
+                    prec = -1;
+            } else {
+                prec = 0;
+                while (*fmt >= '0' && *fmt <= '9')
+                    prec = prec * 10 + (*fmt++ - '0');
+            }
+        }
+
+        switch (*fmt) {
+        case 'h':
+            if (*++fmt == 'h') {
+                fmt++;
+                flags |= HALFHALF_FLAG;
+            } else {
+                flags |= HALF_FLAG;
+            }
             break;
 
+        case 'l':
+            if (*++fmt == 'l') {
+                fmt++;
+                flags |= LONGLONG_FLAG;
+            } else {
+                flags |= LONG_FLAG;
+            }
+            break;
+
+        case 'z': fmt++; flags |= SIZET_FLAG; break;
+        case 'j': fmt++; flags |= INTMAX_FLAG; break;
+        case 't': fmt++; flags |= PTRDIFF_FLAG; break;
+        }
+
+        c = *fmt++;
+
         switch (c) {
-        case '0'...'9':
-            format_num *= 10;
-            format_num += c - '0';
-            goto next;
+        case 0:
+            return ret;
+
+        case '%':
+            OUTPUT_CHAR('%');
+            continue;
+
+        case 'c':
+            num_buf[0] = (char)va_arg(ap, int);
+            s = num_buf;
+            str_len = 1;
+            goto out_string;
 
         case 's':
             s = va_arg(ap, const char *);
             if (s == 0)
                 s = "<null>";
 
-        case 'F':
+            for (str_len = 0; (prec < 0 || str_len < (size_t)prec) && s[str_len]; ++str_len)
+                ;
+            goto out_string;
+
+        case 'd':
+        case 'i': {
+            long long v;
+
+            if (flags & LONGLONG_FLAG)
+                v = va_arg(ap, long long);
+            else if (flags & LONG_FLAG)
+                v = va_arg(ap, long);
+            else if (flags & (SIZET_FLAG | PTRDIFF_FLAG))
+                v = va_arg(ap, ptrdiff_t);
+            else if (flags & INTMAX_FLAG)
+                v = va_arg(ap, intmax_t);
+            else if (flags & HALFHALF_FLAG)
+                v = (signed char)va_arg(ap, int);
+            else if (flags & HALF_FLAG)
+                v = (short)va_arg(ap, int);
+            else
+                v = va_arg(ap, int);
+
+            n = v < 0 ? -(unsigned long long)v : (unsigned long long)v;
+
+            if (v < 0)
+                prefix[prefix_len++] = '-';
+            else if (flags & SHOWSIGN_FLAG)
+                prefix[prefix_len++] = '+';
+            else if (flags & BLANKPOS_FLAG)
+                prefix[prefix_len++] = ' ';
+
+            s = longlong_to_string(num_end, n);
+            goto out_number;
+        }
+
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            if (flags & LONGLONG_FLAG)
+                n = va_arg(ap, unsigned long long);
+            else if (flags & LONG_FLAG)
+                n = va_arg(ap, unsigned long);
+            else if (flags & (SIZET_FLAG | PTRDIFF_FLAG))
+                n = va_arg(ap, size_t);
+            else if (flags & INTMAX_FLAG)
+                n = va_arg(ap, uintmax_t);
+            else if (flags & HALFHALF_FLAG)
+                n = (unsigned char)va_arg(ap, unsigned int);
+            else if (flags & HALF_FLAG)
+                n = (unsigned short)va_arg(ap, unsigned int);
+            else
+                n = va_arg(ap, unsigned int);
+
+            if (c == 'u') {
+                s = longlong_to_string(num_end, n);
+            } else if (c == 'o') {
+                s = longlong_to_octstring(num_end, n);
+            } else {
+                s = longlong_to_hexstring(num_end, n, c == 'X');
+                if ((flags & ALTERNATE_FLAG) && n) {
+                    prefix[prefix_len++] = '0';
+                    prefix[prefix_len++] = c;
+                }
+            }
+            goto out_number;
+
+        case 'p':
+            n = (uintptr_t)va_arg(ap, void *);
+            s = longlong_to_hexstring(num_end, n, false);
+            prefix[prefix_len++] = '0';
+            prefix[prefix_len++] = 'x';
+            goto out_number;
+
         case 'f':
-            double d = va_arg(ap, double);
-            s = double_to_string();
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            err = output_double(out, arg, va_arg(ap, double), c, flags, width, prec);
+            if (err < 0)
+                return err;
+
+            ret += err;
+            continue;
 
         default:
-            break;
+            /* unknown conversion, show it as is */
+            OUTPUT_CHAR('%');
+            OUTPUT_CHAR(c);
+            continue;
         }
 
-        continue;
+out_number:
+        str_len = (size_t)(num_end - s);
 
-out_string:
-        str_len = strlen(s);
+        /* the precision is a minimum digit count and turns zero padding off */
+        if (prec >= 0) {
+            flags &= ~LEADINGZERO_FLAG;
 
-        if (flags & LEFTFORMAT_FLAG) {
-            /* left justify the text */
-            OUTPUT_STRING(s, str_len);
-            uint32_t written = ret;
+            if (prec == 0 && n == 0)
+                str_len = 0;
+            else if ((size_t)prec > str_len)
+                zeros = (size_t)prec - str_len;
+        }
 
-            /* padd to right if necessary */
-            for (; format_num > written; --format_num)
-                OUTPUT_CHAR(' ');
-        } else {
-            /* right justify the text */
-            if (flags & LEADINGZERO_FLAG && sign_char != '\0')
-                OUTPUT_CHAR(sign_char);
+        /* # makes the first octal digit a 0 */
+        if (c == 'o' && (flags & ALTERNATE_FLAG) && !zeros && (!str_len || *s != '0'))
+            zeros = 1;
 
-            /* pad according to the format string */
-            for (; format_num > str_len; --format_num)
-                OUTPUT_CHAR(flags & LEADINGZERO_FLAG ? '0' : ' ');
+        err = output_field(out, arg, prefix, prefix_len, zeros, s, str_len, width, flags);
+        if (err < 0)
+            return err;
 
-            /* if not leading zeros, output the sign char just before the number */
-            if (!(flags & LEADINGZERO_FLAG))
-                OUTPUT_CHAR();
-        }
+        ret += err;
+        continue;
+
+out_string:
+        err = output_field(out, arg, NULL, 0, 0, s, str_len, width, flags & ~LEADINGZERO_FLAG);
+        if (err < 0)
+            return err;
+
+        ret += err;
     }
-}
\ No newline at end of file
+
+    return ret;
+}
@@ -0,0 +1,207 @@
+#include "../profile.h"
+#include "../arch.h"
+#include "../atomic.h"
+#include "../stdio.h"
+#include "../thread.h"
+#include "../timer.h"
+
+typedef struct profile_cpu {
+    uint64_t            count;      /* Samples in the buffer. */
+    uint64_t            dropped;    /* Taken with the buffer full. */
+    bool                running;
+    timer_t             timer;
+    profile_sample_t    samples[PROFILE_BUF_SAMPLES] ALIGNED(CACHE_LINE_SIZE);
+} profile_cpu_t;
+
+static profile_cpu_t profile_cpus[SMP_MAX_CPUS];
+
+static bool profile_running;
+static profile_source_t profile_source;
+static uint64_t profile_period;
+
+/* ------------------------------ Sampling ------------------------------ */
+
+/** @brief  Copy ip and the return addresses of the frames above fp, interrupts off. */
+static void profile_record(uintptr_t ip, uintptr_t fp) {
+    profile_cpu_t *c = &profile_cpus[arch_curr_cpu_num()];
+
+    if (c->count == PROFILE_BUF_SAMPLES) {
+        c->dropped++;
+        return;
+    }
+
+    profile_sample_t *s = &c->samples[c->count];
+    thread_t *t = get_current_thread();
+    uint32_t depth = 0;
+
+    s->pcs[depth++] = ip;
+
+    /* a frame is the saved fp and the return address, in the thread's stack */
+    if (t && t->stack) {
+        uintptr_t lo = (uintptr_t)t->stack, hi = lo + t->stack_size;
+
+        while (depth < PROFILE_MAX_DEPTH && fp >= lo && fp <= hi - 16 && !(fp & 7)) {
+            const uintptr_t *frame = (const uintptr_t *)fp;
+
+            if (!frame[1])
+                break;
+            s->pcs[depth++] = frame[1];
+
+            /* the stack grows down, callers are further up */
+            if (frame[0] <= fp)
+                break;
+            fp = frame[0];
+        }
+    }
+
+    s->depth = depth;
+    c->count++;
+}
+
+bool profile_interrupt(void) {
+    uintptr_t ip, fp;
+
+    /* stopped from another cpu, this one is out once it returns */
+    if (!atomic_load_relaxed(&profile_running)) {
+        atomic_store(&profile_cpus[arch_curr_cpu_num()].running, false);
+        return false;
+    }
+
+    if (arch_interrupted_context(&ip, &fp))
+        profile_record(ip, fp);
+
+    return true;
+}
+
+static void profile_timer(timer_t *timer, ktime_t now, void *arg) {
+    if (profile_interrupt())
+        timer_set_oneshot(timer, (ktime_t)profile_period, profile_timer, NULL);
+}
+
+/* ------------------------------ Control ------------------------------ */
+
+profile_status_t profile_start_percpu(void) {
+    arch_irq_state_t state = arch_irq_save();
+    profile_cpu_t *c = &profile_cpus[arch_curr_cpu_num()];
+    profile_status_t ret = PROFILE_NO_ERROR;
+
+    if (!atomic_load(&profile_running) || c->running)
+        goto out;
+
+    if (profile_source == PROFILE_SOURCE_TIMER) {
+        if (c->timer.magic != TIMER_MAGIC)
+            timer_initialize(&c->timer);
+        timer_set_oneshot(&c->timer, (ktime_t)profile_period, profile_timer, NULL);
+    } else if (!arch_pmu_sample_start(profile_period)) {
+        ret = ERR_PROFILE_NOT_SUPPORTED;
+        goto out;
+    }
+
+    atomic_store(&c->running, true);
+
+out:
+    arch_irq_restore(state);
+    return ret;
+}
+
+profile_status_t profile_start(profile_source_t source, uint64_t period) {
+    if (!period || (source != PROFILE_SOURCE_TIMER && source != PROFILE_SOURCE_PMU))
+        return ERR_PROFILE_INVALID_ARGS;
+
+    if (atomic_load(&profile_running))
+        return ERR_PROFILE_RUNNING;
+
+    /* a cpu may still be on its way out of the last profile */
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; ++cpu) {
+        if (atomic_load(&profile_cpus[cpu].running))
+            return ERR_PROFILE_RUNNING;
+
+        profile_cpus[cpu].count = 0;
+        profile_cpus[cpu].dropped = 0;
+    }
+
+    profile_source = source;
+    profile_period = period;
+    atomic_store(&profile_running, true);
+
+    profile_status_t ret = profile_start_percpu();
+    if (ret != PROFILE_NO_ERROR)
+        atomic_store(&profile_running, false);
+
+    return ret;
+}
+
+void profile_stop(void) {
+    arch_irq_state_t state = arch_irq_save();
+    profile_cpu_t *c = &profile_cpus[arch_curr_cpu_num()];
+
+    atomic_store(&profile_running, false);
+
+    if (c->running) {
+        if (profile_source == PROFILE_SOURCE_TIMER)
+            timer_cancel(&c->timer);
+        else
+            arch_pmu_sample_stop();
+        atomic_store(&c->running, false);
+    }
+
+    arch_irq_restore(state);
+}
+
+/* ------------------------------ Export ------------------------------ */
+
+static int sample_compare(const profile_sample_t *a, const profile_sample_t *b) {
+    if (a->depth != b->depth)
+        return a->depth < b->depth ? -1 : 1;
+
+    for (uint32_t i = 0; i < a->depth; ++i) {
+        if (a->pcs[i] != b->pcs[i])
+            return a->pcs[i] < b->pcs[i] ? -1 : 1;
+    }
+
+    return 0;
+}
+
+static void sort_samples(profile_sample_t *samples, uint64_t count) {
+    for (uint64_t i = 1; i < count; ++i) {
+        profile_sample_t s = samples[i];
+        uint64_t j = i;
+
+        for (; j > 0 && sample_compare(&samples[j - 1], &s) > 0; --j)
+            samples[j] = samples[j - 1];
+        samples[j] = s;
+    }
+}
+
+void profile_dump(void) {
+    uint64_t total = 0, dropped = 0;
+
+    printf("@prof begin %s %llu\n", profile_source == PROFILE_SOURCE_PMU ? "pmu" : "timer",
+           (unsigned long long)profile_period);
+
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; ++cpu) {
+        profile_cpu_t *c = &profile_cpus[cpu];
+        uint64_t count = c->count;
+
+        sort_samples(c->samples, count);
+
+        for (uint64_t i = 0; i < count; ) {
+            const profile_sample_t *s = &c->samples[i];
+            uint64_t n = 1;
+
+            while (i + n < count && !sample_compare(s, &c->samples[i + n]))
+                n++;
+
+            printf("@prof %u %llu ", cpu, (unsigned long long)n);
+            for (uint32_t d = s->depth; d-- > 0; )
+                printf("%lx%c", (unsigned long)s->pcs[d], d ? ';' : '\n');
+
+            i += n;
+        }
+
+        total += count;
+        dropped += c->dropped;
+    }
+
+    printf("@prof end %llu %llu\n", (unsigned long long)total, (unsigned long long)dropped);
+}
@@ -0,0 +1,382 @@
+#include "../rbtree.h"
+
+/*
+ * Textbook insert and erase, with the NULL children black. The augmented
+ * versions share the code, plain trees pass no callbacks.
+ */
+
+static inline bool rb_is_red(const rb_node_t *node) {
+    return node && !(node->parent_color & RB_BLACK);
+}
+
+static inline bool rb_is_black(const rb_node_t *node) {
+    return !rb_is_red(node);
+}
+
+static inline void rb_set_black(rb_node_t *node) {
+    node->parent_color |= RB_BLACK;
+}
+
+static inline void rb_set_red(rb_node_t *node) {
+    node->parent_color &= ~(uintptr_t)RB_BLACK;
+}
+
+static inline void rb_set_color(rb_node_t *node, uintptr_t color) {
+    node->parent_color = (node->parent_color & ~(uintptr_t)RB_BLACK) | color;
+}
+
+static inline uintptr_t rb_color(const rb_node_t *node) {
+    return node->parent_color & RB_BLACK;
+}
+
+static inline void rb_set_parent(rb_node_t *node, rb_node_t *parent) {
+    node->parent_color = (uintptr_t)parent | rb_color(node);
+}
+
+/* Point whatever pointed to old, parent or root, at new. */
+static inline void rb_change_child(rb_node_t *old, rb_node_t *new, rb_node_t *parent,
+                                   rb_root_t *root) {
+    if (!parent)
+        root->node = new;
+    else if (parent->left == old)
+        parent->left = new;
+    else
+        parent->right = new;
+}
+
+/* ------------------------------ Rotations ------------------------------ */
+
+static void rb_rotate_left(rb_node_t *x, rb_root_t *root, const rb_augment_callbacks_t *aug) {
+    rb_node_t *y = x->right;
+    rb_node_t *parent = rb_parent(x);
+
+    x->right = y->left;
+    if (y->left)
+        rb_set_parent(y->left, x);
+
+    y->left = x;
+    rb_set_parent(y, parent);
+    rb_change_child(x, y, parent, root);
+    rb_set_parent(x, y);
+
+    if (aug)
+        aug->rotate(x, y);
+}
+
+static void rb_rotate_right(rb_node_t *x, rb_root_t *root, const rb_augment_callbacks_t *aug) {
+    rb_node_t *y = x->left;
+    rb_node_t *parent = rb_parent(x);
+
+    x->left = y->right;
+    if (y->right)
+        rb_set_parent(y->right, x);
+
+    y->right = x;
+    rb_set_parent(y, parent);
+    rb_change_child(x, y, parent, root);
+    rb_set_parent(x, y);
+
+    if (aug)
+        aug->rotate(x, y);
+}
+
+/* ------------------------------ Insert ------------------------------ */
+
+static void rb_insert_fixup(rb_node_t *node, rb_root_t *root, const rb_augment_callbacks_t *aug) {
+    rb_node_t *parent;
+
+    /* a red parent is never the root, so there is a grandparent */
+    while ((parent = rb_parent(node)) && rb_is_red(parent)) {
+        rb_node_t *gparent = rb_parent(parent);
+
+        if (parent == gparent->left) {
+            rb_node_t *uncle = gparent->right;
+
+            if (rb_is_red(uncle)) {
+                rb_set_black(parent);
+                rb_set_black(uncle);
+                rb_set_red(gparent);
+                node = gparent;
+                continue;
+            }
+
+            if (node == parent->right) {
+                rb_rotate_left(parent, root, aug);
+                node = parent;
+                parent = rb_parent(node);
+            }
+
+            rb_set_black(parent);
+            rb_set_red(gparent);
+            rb_rotate_right(gparent, root, aug);
+        } else {
+            rb_node_t *uncle = gparent->left;
+
+            if (rb_is_red(uncle)) {
+                rb_set_black(parent);
+                rb_set_black(uncle);
+                rb_set_red(gparent);
+                node = gparent;
+                continue;
+            }
+
+            if (node == parent->left) {
+                rb_rotate_right(parent, root, aug);
+                node = parent;
+                parent = rb_parent(node);
+            }
+
+            rb_set_black(parent);
+            rb_set_red(gparent);
+            rb_rotate_left(gparent, root, aug);
+        }
+    }
+
+    rb_set_black(root->node);
+}
+
+void rb_insert_color(rb_node_t *node, rb_root_t *root) {
+    rb_insert_fixup(node, root, NULL);
+}
+
+void rb_insert_augmented(rb_node_t *node, rb_root_t *root, const rb_augment_callbacks_t *aug) {
+    aug->propagate(rb_parent(node), NULL);
+    rb_insert_fixup(node, root, aug);
+}
+
+/* ------------------------------ Erase ------------------------------ */
+
+/* node took the place of a black node and is short one black, parent is its parent */
+static void rb_erase_fixup(rb_node_t *node, rb_node_t *parent, rb_root_t *root,
+                           const rb_augment_callbacks_t *aug) {
+    while (node != root->node && rb_is_black(node)) {
+        /* the sibling has a black height of at least one, it is there */
+        if (node == parent->left) {
+            rb_node_t *sibling = parent->right;
+
+            if (rb_is_red(sibling)) {
+                rb_set_black(sibling);
+                rb_set_red(parent);
+                rb_rotate_left(parent, root, aug);
+                sibling = parent->right;
+            }
+
+            if (rb_is_black(sibling->left) && rb_is_black(sibling->right)) {
+                rb_set_red(sibling);
+                node = parent;
+                parent = rb_parent(node);
+                continue;
+            }
+
+            if (rb_is_black(sibling->right)) {
+                rb_set_black(sibling->left);
+                rb_set_red(sibling);
+                rb_rotate_right(sibling, root, aug);
+                sibling = parent->right;
+            }
+
+            rb_set_color(sibling, rb_color(parent));
+            rb_set_black(parent);
+            rb_set_black(sibling->right);
+            rb_rotate_left(parent, root, aug);
+        } else {
+            rb_node_t *sibling = parent->left;
+
+            if (rb_is_red(sibling)) {
+                rb_set_black(sibling);
+                rb_set_red(parent);
+                rb_rotate_right(parent, root, aug);
+                sibling = parent->left;
+            }
+
+            if (rb_is_black(sibling->left) && rb_is_black(sibling->right)) {
+                rb_set_red(sibling);
+                node = parent;
+                parent = rb_parent(node);
+                continue;
+            }
+
+            if (rb_is_black(sibling->left)) {
+                rb_set_black(sibling->right);
+                rb_set_red(sibling);
+                rb_rotate_left(sibling, root, aug);
+                sibling = parent->left;
+            }
+
+            rb_set_color(sibling, rb_color(parent));
+            rb_set_black(parent);
+            rb_set_black(sibling->left);
+            rb_rotate_right(parent, root, aug);
+        }
+
+        node = root->node;
+    }
+
+    if (node)
+        rb_set_black(node);
+}
+
+static void rb_erase_node(rb_node_t *node, rb_root_t *root, const rb_augment_callbacks_t *aug) {
+    rb_node_t *child, *parent;
+    uintptr_t removed_color;
+
+    if (!node->left || !node->right) {
+        /* at most one child, it moves up */
+        child = node->left ? node->left : node->right;
+        parent = rb_parent(node);
+        removed_color = rb_color(node);
+
+        rb_change_child(node, child, parent, root);
+        if (child)
+            rb_set_parent(child, parent);
+
+        if (aug)
+            aug->propagate(parent, NULL);
+    } else {
+        /* the successor has no left child, it moves into node's place */
+        rb_node_t *succ = node->right;
+
+        while (succ->left)
+            succ = succ->left;
+
+        child = succ->right;
+        removed_color = rb_color(succ);
+
+        if (succ == node->right) {
+            parent = succ;
+        } else {
+            parent = rb_parent(succ);
+            parent->left = child;
+            if (child)
+                rb_set_parent(child, parent);
+
+            succ->right = node->right;
+            rb_set_parent(node->right, succ);
+        }
+
+        succ->left = node->left;
+        rb_set_parent(node->left, succ);
+
+        rb_change_child(node, succ, rb_parent(node), root);
+        succ->parent_color = node->parent_color;
+
+        if (aug) {
+            aug->copy(node, succ);
+            if (parent != succ)
+                aug->propagate(parent, succ);
+            aug->propagate(succ, NULL);
+        }
+    }
+
+    if (removed_color == RB_BLACK)
+        rb_erase_fixup(child, parent, root, aug);
+}
+
+void rb_erase(rb_node_t *node, rb_root_t *root) {
+    rb_erase_node(node, root, NULL);
+    rb_clear_node(node);
+}
+
+void rb_erase_augmented(rb_node_t *node, rb_root_t *root, const rb_augment_callbacks_t *aug) {
+    rb_erase_node(node, root, aug);
+    rb_clear_node(node);
+}
+
+void rb_replace_node(rb_node_t *old, rb_node_t *new, rb_root_t *root) {
+    rb_node_t *parent = rb_parent(old);
+
+    *new = *old;
+
+    if (old->left)
+        rb_set_parent(old->left, new);
+    if (old->right)
+        rb_set_parent(old->right, new);
+
+    rb_change_child(old, new, parent, root);
+    rb_clear_node(old);
+}
+
+/* ------------------------------ Iteration ------------------------------ */
+
+rb_node_t *rb_first(const rb_root_t *root) {
+    rb_node_t *node = root->node;
+
+    if (!node)
+        return NULL;
+
+    while (node->left)
+        node = node->left;
+
+    return node;
+}
+
+rb_node_t *rb_last(const rb_root_t *root) {
+    rb_node_t *node = root->node;
+
+    if (!node)
+        return NULL;
+
+    while (node->right)
+        node = node->right;
+
+    return node;
+}
+
+rb_node_t *rb_next(const rb_node_t *node) {
+    rb_node_t *parent;
+
+    /* the leftmost of the right subtree, or the first ancestor we are left of */
+    if (node->right) {
+        node = node->right;
+        while (node->left)
+            node = node->left;
+        return (rb_node_t *)node;
+    }
+
+    while ((parent = rb_parent(node)) && node == parent->right)
+        node = parent;
+
+    return parent;
+}
+
+rb_node_t *rb_prev(const rb_node_t *node) {
+    rb_node_t *parent;
+
+    if (node->left) {
+        node = node->left;
+        while (node->right)
+            node = node->right;
+        return (rb_node_t *)node;
+    }
+
+    while ((parent = rb_parent(node)) && node == parent->left)
+        node = parent;
+
+    return parent;
+}
+
+/* The deepest node on the left side of the subtree, left children first. */
+static rb_node_t *rb_left_deepest(const rb_node_t *node) {
+    for (;;) {
+        if (node->left)
+            node = node->left;
+        else if (node->right)
+            node = node->right;
+        else
+            return (rb_node_t *)node;
+    }
+}
+
+rb_node_t *rb_first_postorder(const rb_root_t *root) {
+    return root->node ? rb_left_deepest(root->node) : NULL;
+}
+
+rb_node_t *rb_next_postorder(const rb_node_t *node) {
+    rb_node_t *parent = rb_parent(node);
+
+    /* after a left child comes the right subtree of its parent, then the parent */
+    if (parent && node == parent->left && parent->right)
+        return rb_left_deepest(parent->right);
+
+    return parent;
+}
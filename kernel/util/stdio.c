@@ -1,5 +1,10 @@
+#include "../debug.h"
+#include "../klog.h"
+#include "../printf.h"
 #include "../stdio.h"
 
+#include <string.h>
+
 int printf(const char *fmt, ...) {
     int ret;
     va_list ap;
@@ -11,6 +16,48 @@ int printf(const char *fmt, ...) {
     return ret;
 }
 
+/* goes to the kernel log, the console catches up when it is drained */
 int vprintf(const char* fmt, va_list ap) {
-    
-}
\ No newline at end of file
+    return klog_vprintf(ALWAYS, fmt, ap);
+}
+
+typedef struct snprintf_state {
+    char    *str;
+    size_t  len;    /* Room left, without the terminator. */
+} snprintf_state_t;
+
+static int snprintf_out(const char *str, size_t len, void *arg) {
+    snprintf_state_t *state = arg;
+    size_t n = len < state->len ? len : state->len;
+
+    memcpy(state->str, str, n);
+    state->str += n;
+    state->len -= n;
+
+    return 0;
+}
+
+int vsnprintf(char *str, size_t len, const char *fmt, va_list ap) {
+    snprintf_state_t state = {
+        .str = str,
+        .len = len ? len - 1 : 0,
+    };
+
+    int ret = printf_core(snprintf_out, &state, fmt, ap);
+
+    if (len)
+        *state.str = 0;
+
+    return ret;
+}
+
+int snprintf(char *str, size_t len, const char *fmt, ...) {
+    int ret;
+    va_list ap;
+
+    va_start(ap, fmt);
+    ret = vsnprintf(str, len, fmt, ap);
+    va_end(ap);
+
+    return ret;
+}
@@ -0,0 +1,332 @@
+#include "../trace.h"
+
+#include <string.h>
+
+#define TRACE_BUF_MASK      (TRACE_BUF_RECORDS - 1)
+#define TRACE_SPEC_MAX      32
+
+trace_buf_t trace_bufs[SMP_MAX_CPUS];
+bool trace_enabled;
+
+/* from kernel.ld, every TRACE() call site has one descriptor in between */
+extern const trace_fmt_t __trace_fmt_start[], __trace_fmt_end[];
+
+void trace_start(void) {
+    atomic_store(&trace_enabled, true);
+}
+
+void trace_stop(void) {
+    atomic_store(&trace_enabled, false);
+}
+
+void trace_reset(void) {
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; ++cpu) {
+        memset(trace_bufs[cpu].records, 0, sizeof(trace_bufs[cpu].records));
+        atomic_store(&trace_bufs[cpu].head, 0);
+    }
+}
+
+static void out_printf(printf_out_t out, void *arg, const char *fmt, ...) {
+    va_list ap;
+
+    va_start(ap, fmt);
+    printf_core(out, arg, fmt, ap);
+    va_end(ap);
+}
+
+/** @brief  The oldest record still in the buffer of a cpu and the end. */
+static void trace_window(uint32_t cpu, uint64_t *start, uint64_t *end) {
+    *end = atomic_load_acquire(&trace_bufs[cpu].head);
+    *start = *end > TRACE_BUF_RECORDS ? *end - TRACE_BUF_RECORDS : 0;
+}
+
+static bool trace_read(uint32_t cpu, uint64_t idx, trace_record_t *out) {
+    const trace_record_t *rec = &trace_bufs[cpu].records[idx & TRACE_BUF_MASK];
+
+    out->fmt = atomic_load_acquire(&rec->fmt);
+    if (!out->fmt)
+        return false;
+
+    out->time = rec->time;
+    memcpy(out->args, rec->args, sizeof(out->args));
+
+    return true;
+}
+
+/* -------------------------- Formatting -------------------------- */
+
+static int spec_printf(printf_out_t out, void *arg, const char *spec, ...) {
+    va_list ap;
+    int ret;
+
+    va_start(ap, spec);
+    ret = printf_core(out, arg, spec, ap);
+    va_end(ap);
+
+    return ret;
+}
+
+static bool spec_is_flag(char c) {
+    return c == '-' || c == '+' || c == ' ' || c == '#' || c == '0';
+}
+
+static bool spec_is_length(char c) {
+    return c == 'h' || c == 'l' || c == 'L' || c == 'q' || c == 'j' || c == 'z' || c == 't';
+}
+
+/**
+ * @brief   Copy a '*' width or precision into spec as a number, the words
+ *          are passed one conversion at a time.
+ */
+static size_t spec_star(char *spec, size_t pos, int val) {
+    char digits[12];
+    size_t n = 0;
+    unsigned int u = val < 0 ? -(unsigned int)val : (unsigned int)val;
+
+    if (val < 0)
+        spec[pos++] = '-';
+
+    do {
+        digits[n++] = '0' + u % 10;
+        u /= 10;
+    } while (u);
+
+    while (n && pos < TRACE_SPEC_MAX - 8)
+        spec[pos++] = digits[--n];
+
+    return pos;
+}
+
+int trace_format(printf_out_t out, void *arg, const trace_record_t *rec) {
+    const char *fmt = rec->fmt->fmt;
+    uint32_t nargs = rec->fmt->nargs;
+    uint32_t next = 0;
+    int chars = 0;
+
+#define NEXT_WORD()     (next < nargs ? rec->args[next++] : 0)
+
+    while (*fmt) {
+        const char *lit = fmt;
+
+        while (*fmt && *fmt != '%')
+            fmt++;
+
+        if (fmt != lit) {
+            out(lit, fmt - lit, arg);
+            chars += fmt - lit;
+        }
+
+        if (!*fmt)
+            break;
+
+        char spec[TRACE_SPEC_MAX];
+        size_t pos = 0;
+        int longs = 0;
+
+        spec[pos++] = *fmt++;
+
+        /* flags and width */
+        while (spec_is_flag(*fmt) && pos < TRACE_SPEC_MAX - 8)
+            spec[pos++] = *fmt++;
+
+        if (*fmt == '*') {
+            pos = spec_star(spec, pos, (int)NEXT_WORD());
+            fmt++;
+        } else {
+            while (*fmt >= '0' && *fmt <= '9' && pos < TRACE_SPEC_MAX - 8)
+                spec[pos++] = *fmt++;
+        }
+
+        /* precision, a negative one counts as none */
+        if (*fmt == '.') {
+            fmt++;
+
+            if (*fmt == '*') {
+                int prec = (int)NEXT_WORD();
+                fmt++;
+
+                if (prec >= 0) {
+                    spec[pos++] = '.';
+                    pos = spec_star(spec, pos, prec);
+                }
+            } else {
+                spec[pos++] = '.';
+                while (*fmt >= '0' && *fmt <= '9' && pos < TRACE_SPEC_MAX - 8)
+                    spec[pos++] = *fmt++;
+            }
+        }
+
+        /* length, everything past int is 64 bits here */
+        while (spec_is_length(*fmt) && pos < TRACE_SPEC_MAX - 2) {
+            if (*fmt != 'h')
+                longs++;
+            spec[pos++] = *fmt++;
+        }
+
+        char conv = *fmt;
+        if (!conv)
+            break;
+
+        fmt++;
+        spec[pos++] = conv;
+        spec[pos] = 0;
+
+        switch (conv) {
+        case '%':
+            out("%", 1, arg);
+            chars++;
+            break;
+
+        case 'd':
+        case 'i':
+        case 'c':
+            if (longs)
+                chars += spec_printf(out, arg, spec, (long long)NEXT_WORD());
+            else
+                chars += spec_printf(out, arg, spec, (int)NEXT_WORD());
+            break;
+
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            if (longs)
+                chars += spec_printf(out, arg, spec, (unsigned long long)NEXT_WORD());
+            else
+                chars += spec_printf(out, arg, spec, (unsigned int)NEXT_WORD());
+            break;
+
+        case 's':
+        case 'p':
+            chars += spec_printf(out, arg, spec, (void *)(uintptr_t)NEXT_WORD());
+            break;
+
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A': {
+            uint64_t w = NEXT_WORD();
+            double d;
+
+            memcpy(&d, &w, sizeof(d));
+            chars += spec_printf(out, arg, spec, d);
+            break;
+        }
+
+        default:
+            /* %n and unknown conversions take their word and print nothing */
+            NEXT_WORD();
+            break;
+        }
+    }
+
+#undef NEXT_WORD
+
+    return chars;
+}
+
+/* -------------------------- Output -------------------------- */
+
+void trace_render(printf_out_t out, void *arg) {
+    uint64_t pos[SMP_MAX_CPUS], end[SMP_MAX_CPUS];
+    trace_record_t rec;
+
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; ++cpu)
+        trace_window(cpu, &pos[cpu], &end[cpu]);
+
+    /* merge by timestamp, the TSC is in sync across cpus */
+    for (;;) {
+        uint32_t best = SMP_MAX_CPUS;
+        ktime_t best_time = 0;
+
+        for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; ++cpu) {
+            if (pos[cpu] == end[cpu])
+                continue;
+
+            ktime_t t = trace_bufs[cpu].records[pos[cpu] & TRACE_BUF_MASK].time;
+            if (best == SMP_MAX_CPUS || t < best_time) {
+                best = cpu;
+                best_time = t;
+            }
+        }
+
+        if (best == SMP_MAX_CPUS)
+            break;
+
+        if (!trace_read(best, pos[best]++, &rec))
+            continue;
+
+        out_printf(out, arg, "[%5lld.%06lld %2u] ", (long long)(rec.time / 1000000000),
+                   (long long)(rec.time % 1000000000) / 1000, best);
+        trace_format(out, arg, &rec);
+        out("\n", 1, arg);
+    }
+}
+
+static void dump_hex_string(printf_out_t out, void *arg, const char *str) {
+    static const char hex[] = "0123456789abcdef";
+    char buf[64];
+    size_t n = 0;
+
+    out(" ", 1, arg);
+
+    /* an empty string still needs a field */
+    if (!*str) {
+        out("-", 1, arg);
+        return;
+    }
+
+    for (; *str; ++str) {
+        buf[n++] = hex[(uint8_t)*str >> 4];
+        buf[n++] = hex[(uint8_t)*str & 0xf];
+
+        if (n == sizeof(buf)) {
+            out(buf, n, arg);
+            n = 0;
+        }
+    }
+
+    out(buf, n, arg);
+}
+
+void trace_dump(printf_out_t out, void *arg) {
+    trace_record_t rec;
+
+    out_printf(out, arg, "@trace H 1 %u %u %u\n", SMP_MAX_CPUS, TRACE_BUF_RECORDS,
+               TRACE_MAX_ARGS);
+
+    /* F address line nargs format file, the strings in hex */
+    for (const trace_fmt_t *tf = __trace_fmt_start; tf < __trace_fmt_end; ++tf) {
+        out_printf(out, arg, "@trace F %lx %u %u", (unsigned long)(uintptr_t)tf, tf->line,
+                   tf->nargs);
+        dump_hex_string(out, arg, tf->fmt);
+        dump_hex_string(out, arg, tf->file);
+        out("\n", 1, arg);
+    }
+
+    /* R cpu descriptor time args */
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; ++cpu) {
+        uint64_t pos, end;
+
+        trace_window(cpu, &pos, &end);
+
+        for (; pos < end; ++pos) {
+            if (!trace_read(cpu, pos, &rec))
+                continue;
+
+            out_printf(out, arg, "@trace R %u %lx %llx", cpu,
+                       (unsigned long)(uintptr_t)rec.fmt, (unsigned long long)rec.time);
+
+            for (uint32_t i = 0; i < rec.fmt->nargs && i < TRACE_MAX_ARGS; ++i)
+                out_printf(out, arg, " %llx", (unsigned long long)rec.args[i]);
+
+            out("\n", 1, arg);
+        }
+    }
+
+    out("@trace E\n", 9, arg);
+}
@@ -0,0 +1,157 @@
+#include "alloc_tag.h"
+#include "../arch.h"
+#include "../atomic.h"
+#include "../stdio.h"
+
+_Static_assert(ALLOC_TAG_COUNT <= 255, "tags are kept in a byte of vm_page_t");
+
+typedef struct alloc_tag_cpu {
+    int64_t     delta[ALLOC_TAG_COUNT];
+} ALIGNED(CACHE_LINE_SIZE) alloc_tag_cpu_t;
+
+typedef struct alloc_tag_counter {
+    int64_t     pages;          /* Folded, a cpu that frees what another took goes below. */
+    int64_t     peak;
+    size_t      budget;
+    uint64_t    denied;
+    size_t      heap_bytes;
+} alloc_tag_counter_t;
+
+static alloc_tag_cpu_t tag_cpus[SMP_MAX_CPUS];
+static alloc_tag_counter_t tags[ALLOC_TAG_COUNT];
+
+static const char *const tag_names[ALLOC_TAG_COUNT] = {
+    [ALLOC_TAG_NONE]        = "untagged",
+    [ALLOC_TAG_BOOT]        = "boot",
+    [ALLOC_TAG_PAGE_TABLE]  = "page_table",
+    [ALLOC_TAG_STACK]       = "stack",
+    [ALLOC_TAG_SLAB]        = "slab",
+    [ALLOC_TAG_DMA]         = "dma",
+    [ALLOC_TAG_USER]        = "user",
+    [ALLOC_TAG_BENCH]       = "bench",
+};
+
+const char *alloc_tag_name(alloc_tag_t tag) {
+    return tag < ALLOC_TAG_COUNT ? tag_names[tag] : "?";
+}
+
+/*
+ * A fold adds to the shared count before it takes the delta off the cpu
+ * and a sum reads the cpus before the shared count, so a sum may count a
+ * fold twice but never miss it.
+ */
+static void tag_add(alloc_tag_t tag, int64_t pages) {
+    alloc_tag_counter_t *t = &tags[tag];
+    int64_t *delta = &tag_cpus[arch_curr_cpu_num()].delta[tag];
+    int64_t d = atomic_fetch_add(delta, pages) + pages;
+
+    if (d <= ALLOC_TAG_BATCH && d >= -ALLOC_TAG_BATCH)
+        return;
+
+    int64_t folded = atomic_fetch_add(&t->pages, d) + d;
+    atomic_fetch_sub(delta, d);
+
+    int64_t peak = atomic_load_relaxed(&t->peak);
+    while (folded > peak && !atomic_cmpxchg(&t->peak, &peak, folded))
+        ;
+}
+
+static int64_t tag_sum(alloc_tag_t tag) {
+    int64_t sum = 0;
+
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; ++cpu)
+        sum += atomic_load(&tag_cpus[cpu].delta[tag]);
+
+    return sum + atomic_load(&tags[tag].pages);
+}
+
+bool alloc_tag_charge(alloc_tag_t tag, size_t pages) {
+    alloc_tag_counter_t *t = &tags[tag];
+    size_t budget = atomic_load_relaxed(&t->budget);
+
+    tag_add(tag, (int64_t)pages);
+
+    if (!budget)
+        return true;
+
+    /* the deltas of the other cpus can only be that far off */
+    if (atomic_load(&t->pages) + (int64_t)ALLOC_TAG_BATCH * SMP_MAX_CPUS <= (int64_t)budget)
+        return true;
+
+    if (tag_sum(tag) <= (int64_t)budget)
+        return true;
+
+    tag_add(tag, -(int64_t)pages);
+    atomic_add_relaxed(&t->denied, 1);
+    return false;
+}
+
+void alloc_tag_uncharge(alloc_tag_t tag, size_t pages) {
+    if (pages)
+        tag_add(tag, -(int64_t)pages);
+}
+
+void alloc_tag_heap(alloc_tag_t tag, size_t bytes) {
+    atomic_add_relaxed(&tags[tag].heap_bytes, bytes);
+}
+
+void alloc_tag_set_budget(alloc_tag_t tag, size_t pages) {
+    atomic_store_relaxed(&tags[tag].budget, pages);
+}
+
+size_t alloc_tag_pages(alloc_tag_t tag) {
+    int64_t sum = tag_sum(tag);
+    return sum > 0 ? (size_t)sum : 0;
+}
+
+void alloc_tag_get_info(alloc_tag_t tag, alloc_tag_info_t *out) {
+    const alloc_tag_counter_t *t = &tags[tag];
+    int64_t peak = atomic_load_relaxed(&t->peak);
+
+    out->pages = alloc_tag_pages(tag);
+    out->peak = peak > (int64_t)out->pages ? (size_t)peak : out->pages;
+    out->budget = atomic_load_relaxed(&t->budget);
+    out->denied = atomic_load_relaxed(&t->denied);
+    out->heap_bytes = atomic_load_relaxed(&t->heap_bytes);
+}
+
+static bool uses_more(const alloc_tag_info_t *a, const alloc_tag_info_t *b) {
+    if (a->pages != b->pages)
+        return a->pages > b->pages;
+    return a->heap_bytes > b->heap_bytes;
+}
+
+void alloc_tag_dump(uint32_t top) {
+    alloc_tag_info_t info[ALLOC_TAG_COUNT];
+    alloc_tag_t order[ALLOC_TAG_COUNT];
+
+    /* few enough to insertion sort */
+    for (uint32_t i = 0; i < ALLOC_TAG_COUNT; ++i) {
+        uint32_t j = i;
+
+        alloc_tag_get_info(i, &info[i]);
+        for (; j > 0 && uses_more(&info[i], &info[order[j - 1]]); --j)
+            order[j] = order[j - 1];
+        order[j] = i;
+    }
+
+    if (!top || top > ALLOC_TAG_COUNT)
+        top = ALLOC_TAG_COUNT;
+
+    printf("tags: %-12s %10s %10s %10s %8s %12s\n", "tag", "pages", "peak", "budget",
+           "denied", "heap bytes");
+
+    for (uint32_t i = 0; i < top; ++i) {
+        const alloc_tag_info_t *t = &info[order[i]];
+
+        if (!t->pages && !t->peak && !t->denied && !t->heap_bytes)
+            continue;
+
+        printf("      %-12s %10zu %10zu ", tag_names[order[i]], t->pages, t->peak);
+        if (t->budget)
+            printf("%10zu", t->budget);
+        else
+            printf("%10s", "-");
+        printf(" %8llu %12zu\n", (unsigned long long)t->denied, t->heap_bytes);
+    }
+}
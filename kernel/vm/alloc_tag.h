@@ -0,0 +1,73 @@
+#ifndef _ALLOC_TAG_H_
+#define _ALLOC_TAG_H_
+
+#include "../types.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Allocation tags, who memory went out to.
+ *
+ * Every pmm allocation names the subsystem it is for, the pages remember
+ * their tag and pmm_free() gives them back to it. balloc() takes a tag as
+ * well and counts its bytes, it cannot fail and has no budget.
+ *
+ * The page counts are split like a per cpu counter: each cpu adds to its
+ * own delta and folds it into the shared count once it is more than
+ * ALLOC_TAG_BATCH pages either way, so the shared count is off by at most
+ * a batch per cpu. A tag with a budget checks against the shared count
+ * and only sums the deltas of every cpu when it is within that slack, the
+ * budget is never overrun.
+ */
+
+typedef enum alloc_tag {
+    ALLOC_TAG_NONE,
+    ALLOC_TAG_BOOT,
+    ALLOC_TAG_PAGE_TABLE,
+    ALLOC_TAG_STACK,            /* Thread structures and their stacks. */
+    ALLOC_TAG_SLAB,
+    ALLOC_TAG_DMA,
+    ALLOC_TAG_USER,
+    ALLOC_TAG_BENCH,
+    ALLOC_TAG_COUNT,
+} alloc_tag_t;
+
+#define ALLOC_TAG_BATCH     32      /* Pages a cpu keeps to itself per tag. */
+
+typedef struct alloc_tag_info {
+    size_t      pages;          /* Exact at the time of the call. */
+    size_t      peak;           /* Highest folded count, up to a batch per cpu low. */
+    size_t      budget;         /* 0 for none. */
+    uint64_t    denied;         /* Charges refused by the budget. */
+    size_t      heap_bytes;     /* From balloc(). */
+} alloc_tag_info_t;
+
+const char *    alloc_tag_name(alloc_tag_t tag);
+
+/**
+ * @brief   Charge pages to a tag before they are taken.
+ * @returns False, with nothing charged, if they do not fit in its budget.
+ */
+bool            alloc_tag_charge(alloc_tag_t tag, size_t pages);
+
+/** @brief  Give back pages charged to a tag. */
+void            alloc_tag_uncharge(alloc_tag_t tag, size_t pages);
+
+/** @brief  Count bytes handed out by balloc(). */
+void            alloc_tag_heap(alloc_tag_t tag, size_t bytes);
+
+/**
+ * @brief   Limit the pages of a tag, 0 for no limit. Pages it already
+ *          holds stay, new charges fail until it is back under.
+ */
+void            alloc_tag_set_budget(alloc_tag_t tag, size_t pages);
+
+/** @brief  Sum the pages of a tag over every cpu. */
+size_t          alloc_tag_pages(alloc_tag_t tag);
+
+void            alloc_tag_get_info(alloc_tag_t tag, alloc_tag_info_t *out);
+
+/** @brief  Print the top consumers, by pages and then heap bytes, all with 0. */
+void            alloc_tag_dump(uint32_t top);
+
+#endif /* _ALLOC_TAG_H_ */
@@ -1,4 +1,5 @@
 #include "balloc.h"
+#include "../stdlib.h"
 
 #include <stddef.h>
 
@@ -8,11 +9,13 @@ extern int __end;
 uintptr_t boot_alloc_start = (uintptr_t)&__end;
 uintptr_t boot_alloc_end = (uintptr_t)&__end;
 
-void *balloc(size_t len) {
+void *balloc(size_t len, alloc_tag_t tag) {
   uintptr_t ptr;
 
-  ptr = ALIGN(boot_alloc_end, 8);
-  boot_alloc_end = (ptr + ALIGN(len, 8));
+  ptr = ROUNDUP(boot_alloc_end, 8);
+  boot_alloc_end = (ptr + ROUNDUP(len, 8));
+
+  alloc_tag_heap(tag, ROUNDUP(len, 8));
 
   return (void *)ptr;
 }
\ No newline at end of file
@@ -1,9 +1,10 @@
 #pragma once
 
 #include <stdint.h>
+#include "alloc_tag.h"
 #include "../types.h"
 
-void *balloc(size_t len);
+void *balloc(size_t len, alloc_tag_t tag);
 
 extern uintptr_t boot_alloc_start;
 extern uintptr_t boot_alloc_end;
\ No newline at end of file
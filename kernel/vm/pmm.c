@@ -1,60 +1,177 @@
 #include "pmm.h"
 #include "balloc.h"
+#include "reclaim.h"
+#include "../atomic.h"
+#include "../boot_trace.h"
+#include "../interrupts.h"
 #include "../list.h"
 #include "../mutex.h"
+#include "../pmu.h"
+#include "../rcu.h"
+#include "../stdio.h"
+#include "../trace.h"
+#include "../workqueue.h"
 #include <stdbool.h>
 #include <string.h>
 
-/** Linked list of arenas. */
+/**
+ * Linked list of arenas. Changed under the lock, lookups that do not
+ * touch the free lists walk it under rcu_read_lock() only.
+ */
 static LIST_NODE(arena_list);
 
+/** Serializes the arena list, free lists and page flags of all the arenas. */
+static mutex_t lock = MUTEX_INTIAL_VALUE(lock);
+
+/* One compaction at a time, and no arena goes away under it. */
+static mutex_t compact_run_lock = MUTEX_INTIAL_VALUE(compact_run_lock);
+
+/* Held while a page moves, pmm_clear_movable() waits on it. Before the lock. */
+static mutex_t migrate_lock = MUTEX_INTIAL_VALUE(migrate_lock);
+
+/* Mapped read only while it moves, 0 for none. Under migrate_lock. */
+static vaddr_t migrating_vaddr;
+
+/* Written with the lock held, read without it to skip compaction. */
+static size_t movable_pages;
+
+static pmm_compact_stats_t compact_stats;
+static size_t compact_failures;
+
+static void compact_work(work_t *work);
+static work_t compact_async_work = WORK_INITIAL_VALUE(compact_work);
+
 #define PAGE_BELONGS_TO_ARENA(page, arena)                                              \
-    ((uintptr_t)(page) >= (uintptr_t)(arena)->page_array) &&                            \
-    ((uintptr_t)(page) < ((uintptr_t)(arena)->page_array + ARENA_PAGE_COUNT(arena)))
+    ((uintptr_t)(page) >= (uintptr_t)(arena)->page_array &&                             \
+     (uintptr_t)(page) < (uintptr_t)((arena)->page_array + ARENA_PAGE_COUNT(arena)))
 
 #define PAGE_INDEX_IN_ARENA(page, arena)                                                \
     (((uintptr_t)page - (uintptr_t)(arena)->page_array) / sizeof(vm_page_t))
 
 #define PAGE_ADDRESS_FROM_ARENA(page, arena)                                            \
-    (paddr_t)PAGE_INDEX_IN_ARENA(page, arena) * PAGE_SIZE + (arena)->base;
+    ((paddr_t)PAGE_INDEX_IN_ARENA(page, arena) * PAGE_SIZE + (arena)->base)
 
-#define ARENA_PAGE_COUNT(arena) (arena->size / PAGE_SIZE)
+#define ARENA_PAGE_COUNT(arena) ((arena)->size / PAGE_SIZE)
 
 #define ADDRESS_BELONGS_TO_ARENA(address, arena)                                        \
-    ((address) >= arena->base && (address) <= arena->base + arena->size - 1)
+    ((address) >= (arena)->base && (address) <= (arena)->base + (arena)->size - 1)
 
 
 static inline bool page_is_free(const vm_page_t *page) {
     return !(page->flags & VM_PAGE_FLAG_NONFREE);
 }
 
-void *paddr_to_kvaddr(paddr_t pa) {
+/* ------------------------------ Watermarks ------------------------------ */
+
+/** Sums over the arenas, written with the lock held and read without it. */
+static struct {
+    size_t      free;
+    size_t      min;
+    size_t      low;
+    size_t      high;
+} pool;
 
+/* with the lock held, take away with -n */
+static inline void pool_add(size_t *field, size_t n) {
+    atomic_store_relaxed(field, *field + n);
 }
 
-paddr_t vaddr_to_paddr(void *va) {
+/* with the lock held */
+static void pool_watermarks(const pmm_arena_t *arena, bool add) {
+    pool_add(&pool.min, add ? arena->wmark_min : -arena->wmark_min);
+    pool_add(&pool.low, add ? arena->wmark_low : -arena->wmark_low);
+    pool_add(&pool.high, add ? arena->wmark_high : -arena->wmark_high);
+}
+
+/* before taking count pages, without the lock */
+static void watermark_check(size_t count) {
+    size_t free = atomic_load_relaxed(&pool.free);
+    size_t min = atomic_load_relaxed(&pool.min);
 
+    if (free >= atomic_load_relaxed(&pool.low) + count)
+        return;
+
+    /* in place only what this allocation needs, the rest in the background */
+    if (free < min + count) {
+        size_t need = min + count - free;
+        reclaim_direct(need > RECLAIM_BATCH ? need : RECLAIM_BATCH);
+    }
+
+    reclaim_async(atomic_load_relaxed(&pool.high) + count - free);
+}
+
+/* ------------------------------ Accounting ------------------------------ */
+
+typedef struct pmm_cpu {
+    pmm_cpu_stats_t stats;
+} ALIGNED(CACHE_LINE_SIZE) pmm_cpu_t;
+
+static pmm_cpu_t pmm_cpus[SMP_MAX_CPUS];
+
+/* the caller may move to another cpu in between, the atomic adds keep the counts whole */
+static inline pmm_cpu_stats_t *this_cpu_stats(void) {
+    return &pmm_cpus[arch_curr_cpu_num()].stats;
+}
+
+static inline uint32_t latency_bucket(uint64_t cycles) {
+    uint32_t log2 = 63 - __builtin_clzll(cycles | 1);
+
+    if (log2 <= PMM_LATENCY_MIN_SHIFT)
+        return 0;
+
+    log2 -= PMM_LATENCY_MIN_SHIFT;
+    return log2 < PMM_LATENCY_BUCKETS ? log2 : PMM_LATENCY_BUCKETS - 1;
+}
+
+static void account_alloc(uint64_t start, size_t asked, size_t got) {
+    pmm_cpu_stats_t *s = this_cpu_stats();
+
+    atomic_add_relaxed(&s->alloc_calls, 1);
+    atomic_add_relaxed(&s->alloc_pages, got);
+    if (got < asked)
+        atomic_add_relaxed(&s->alloc_failures, 1);
+    atomic_add_relaxed(&s->latency[latency_bucket(arch_cycle_count() - start)], 1);
+}
+
+void *paddr_to_kvaddr(paddr_t pa) {
+    return arch_paddr_to_kvaddr(pa);
+}
+
+paddr_t vaddr_to_paddr(void *va) {
+    return arch_kvaddr_to_paddr(va);
 }
 
 paddr_t page_to_paddr(const vm_page_t *page) {
+    paddr_t pa = -1;
     pmm_arena_t *arena;
-    list_for_each_entry(arena, &arena_list, node) {
+
+    rcu_read_lock();
+    list_for_each_entry_rcu(arena, &arena_list, node) {
         if (PAGE_BELONGS_TO_ARENA(page, arena)) {
-            return PAGE_ADDRESS_FROM_ARENA(page, arena);
+            pa = PAGE_ADDRESS_FROM_ARENA(page, arena);
+            break;
         }
     }
-    return -1;
+    rcu_read_unlock();
+
+    return pa;
 }
 
 vm_page_t *paddr_to_page(paddr_t addr) {
+    vm_page_t *page = NULL;
     pmm_arena_t *arena;
-    list_for_each_entry(arena, &arena_list, node) {
+
+    rcu_read_lock();
+    list_for_each_entry_rcu(arena, &arena_list, node) {
         if (ADDRESS_BELONGS_TO_ARENA(addr, arena)) {
             size_t index = (addr - arena->base) / PAGE_SIZE;
-            return &arena->page_array[index];
+            page = &arena->page_array[index];
+            break;
         }
     }
-    return NULL;
+    rcu_read_unlock();
+
+    return page;
 }
 
 /* ------------------------- Page Arena Routines ------------------------- */
@@ -68,59 +185,126 @@ pmm_status_t pmm_add_arena(pmm_arena_t *arena) {
         return ERR_INVALID_ARENA_SIZE;
     }
 
+    size_t page_count = ARENA_PAGE_COUNT(arena);
+
+    if (!arena->wmark_min && !arena->wmark_low && !arena->wmark_high) {
+        arena->wmark_min = page_count >> PMM_WMARK_MIN_SHIFT;
+        arena->wmark_low = 2 * arena->wmark_min;
+        arena->wmark_high = 3 * arena->wmark_min;
+    } else if (arena->wmark_min > arena->wmark_low || arena->wmark_low > arena->wmark_high ||
+               arena->wmark_high > page_count) {
+        return ERR_INVALID_ARGS;
+    }
+
+    /* readers walk the list without the lock, so fully set up the arena
+       before it is published */
+    arena->free_count = 0;
+    list_initialize(&arena->free_list);
+    memset(&arena->stats, 0, sizeof(arena->stats));
+
+    /* allocate an array of pages */
+    arena->page_array = balloc(page_count * sizeof(vm_page_t), ALLOC_TAG_BOOT);
+
+    /* zero all the pages */
+    memset(arena->page_array, 0, page_count * sizeof(vm_page_t));
+
+    /* add the allocated pages to free list */
+    for (size_t i = 0; i < page_count; ++i) {
+        vm_page_t* page = &arena->page_array[i];
+
+        list_add_tail(&arena->free_list, &page->node);
+        arena->free_count++;
+    }
+
+    mutex_acquire(&lock);
+
     /* walk the arena list and add arena based on priority order */
     pmm_arena_t *a;
     list_for_each_entry(a, &arena_list, node) {
         /* add before the one with lower priority */
         if (a->priority > arena->priority) {
             /* add the new area before this arena */
-            list_add_tail(&a->node, &arena->node);
+            list_add_tail_rcu(&a->node, &arena->node);
             goto done_add;
         }
     }
 
     /* walked off the end, add it to the end of the list */
-    list_add_tail(&arena_list, &arena->node);
+    list_add_tail_rcu(&arena_list, &arena->node);
 
 done_add:
-    arena->free_count = 0;
-    list_initialize(&arena->free_list);
-
-    /* allocate an array of pages */
-    size_t page_count = ARENA_PAGE_COUNT(arena);
-    arena->page_array = balloc(page_count * sizeof(vm_page_t));
+    pool_add(&pool.free, arena->free_count);
+    pool_watermarks(arena, true);
+    mutex_release(&lock);
 
-    /* zero all the pages */
-    memset(&arena->page_array, 0, page_count * sizeof(vm_page_t));
+    boot_mark("pmm_arena");
+    return NO_ERROR;
+}
 
-    /* add the allocated pages to free list */
-    for (int i = 0; i < page_count; ++i) {
-        vm_page_t* page = &arena->page_array[i];
+pmm_status_t pmm_remove_arena(pmm_arena_t *arena) {
+    mutex_acquire(&compact_run_lock);
+    mutex_acquire(&lock);
 
-        list_add_tail(&arena->free_list, &page->node);
-        arena->free_count++;
+    if (arena->free_count != ARENA_PAGE_COUNT(arena)) {
+        mutex_release(&lock);
+        mutex_release(&compact_run_lock);
+        return ERR_ARENA_IN_USE;
     }
+
+    list_delete_rcu(&arena->node);
+    pool_add(&pool.free, -arena->free_count);
+    pool_watermarks(arena, false);
+    mutex_release(&lock);
+    mutex_release(&compact_run_lock);
+
+    /* wait for the lockless readers still walking over the arena */
+    synchronize_rcu();
+
+    return NO_ERROR;
+}
+
+pmm_status_t pmm_set_watermarks(pmm_arena_t *arena, size_t min, size_t low, size_t high) {
+    if (min > low || low > high || high > ARENA_PAGE_COUNT(arena))
+        return ERR_INVALID_ARGS;
+
+    mutex_acquire(&lock);
+
+    pool_watermarks(arena, false);
+    arena->wmark_min = min;
+    arena->wmark_low = low;
+    arena->wmark_high = high;
+    pool_watermarks(arena, true);
+
+    mutex_release(&lock);
+    return NO_ERROR;
 }
 
-int pmm_alloc_pages(uint32_t count, list_node_t *list) {
+int pmm_alloc_pages(uint32_t count, list_node_t *list, alloc_tag_t tag) {
     /* fast path */
     if (count == 0) {
-        return 1;
+        return 0;
     } else if (count == 1) {
-        vm_page_t* page;
-        int status = pmm_alloc_page(page);
-        if (status == 1) {
-            /* add allocated pages to the list */
-            list_add_tail(list, &page->node);
-        }
+        vm_page_t *page = pmm_alloc_page(tag);
+        if (!page)
+            return 0;
 
-        return status;
+        /* add allocated pages to the list */
+        list_add_tail(list, &page->node);
+        return 1;
     }
 
     /* num pages allocated */
     uint32_t num_pages_allocated = 0;
+    uint64_t start = arch_cycle_count();
 
-    /* mutex lock */
+    if (!alloc_tag_charge(tag, count)) {
+        account_alloc(start, count, 0);
+        return 0;
+    }
+
+    watermark_check(count);
+
+    mutex_acquire(&lock);
 
     /* remove pages from free list */
     pmm_arena_t *arena;
@@ -131,8 +315,10 @@ int pmm_alloc_pages(uint32_t count, list_node_t *list) {
                 goto done;
 
             arena->free_count--;
+            arena->stats.allocs++;
 
             page->flags |= VM_PAGE_FLAG_NONFREE;
+            page->tag = tag;
             list_add_tail(list, &page->node);
 
             num_pages_allocated++;
@@ -144,35 +330,53 @@ int pmm_alloc_pages(uint32_t count, list_node_t *list) {
     }
 
 done:
-    /* release lock */
+    pool_add(&pool.free, -(size_t)num_pages_allocated);
+    mutex_release(&lock);
+
+    alloc_tag_uncharge(tag, count - num_pages_allocated);
+    account_alloc(start, count, num_pages_allocated);
+
+    TRACE("pmm: alloc %u pages, got %u", count, num_pages_allocated);
     return num_pages_allocated;
 }
 
-int pmm_alloc_page(vm_page_t *page_out) {
-    /* mutex lock */
+vm_page_t *pmm_alloc_page(alloc_tag_t tag) {
+    vm_page_t *page = NULL;
+    uint64_t start = arch_cycle_count();
 
-    /* walk through the arena searching for free page */
+    if (!alloc_tag_charge(tag, 1)) {
+        account_alloc(start, 1, 0);
+        return NULL;
+    }
+
+    watermark_check(1);
+
+    mutex_acquire(&lock);
+
+    /* take the first free page, in arena priority order */
     pmm_arena_t *arena;
     list_for_each_entry(arena, &arena_list, node) {
-        /* allocate a page if the arena has free page */
         if (arena->free_count > 0) {
-            vm_page_t *page = list_remove_head_type(&arena->free_list, vm_page_t, node);
-            if (!page)
-                goto done;
-
+            page = list_remove_head_type(&arena->free_list, vm_page_t, node);
             arena->free_count--;
+            arena->stats.allocs++;
 
             page->flags |= VM_PAGE_FLAG_NONFREE;
-            page_out = page;
+            page->tag = tag;
+            pool_add(&pool.free, -1);
+            break;
         }
     }
 
-done:
-    /* mutex release */
-    return 1;
+    mutex_release(&lock);
+
+    if (!page)
+        alloc_tag_uncharge(tag, 1);
+    account_alloc(start, 1, page ? 1 : 0);
+    return page;
 }
 
-int pmm_alloc_range(paddr_t address, size_t count, list_node_t* list) {
+int pmm_alloc_range(paddr_t address, size_t count, list_node_t* list, alloc_tag_t tag) {
     /* make sure the address is page aligned */
     address = ROUNDDOWN(address, PAGE_SIZE);
 
@@ -180,7 +384,16 @@ int pmm_alloc_range(paddr_t address, size_t count, list_node_t* list) {
     if (count == 0)
         return 0;
 
-    /* mutex lock */
+    uint64_t start = arch_cycle_count();
+
+    if (!alloc_tag_charge(tag, count)) {
+        account_alloc(start, count, 0);
+        return 0;
+    }
+
+    watermark_check(count);
+
+    mutex_acquire(&lock);
 
     /* walk through the arena, see if the physical page belongs to it */
     pmm_arena_t *arena;
@@ -198,9 +411,11 @@ int pmm_alloc_range(paddr_t address, size_t count, list_node_t* list) {
 
             list_delete(&page->node);
             page->flags |= VM_PAGE_FLAG_NONFREE;
+            page->tag = tag;
             list_add_tail(list, &page->node);
 
             arena->free_count--;
+            arena->stats.allocs++;
             num_pages_allocated++;
 
             address += PAGE_SIZE;
@@ -210,13 +425,18 @@ int pmm_alloc_range(paddr_t address, size_t count, list_node_t* list) {
             break;
     }
 
-done:
-    /* mutex release */
+    pool_add(&pool.free, -num_pages_allocated);
+    mutex_release(&lock);
+
+    alloc_tag_uncharge(tag, count - num_pages_allocated);
+    account_alloc(start, count, num_pages_allocated);
     return num_pages_allocated;
 }
 
 size_t pmm_free(list_node_t *head) {
-    /* mutex lock */
+    size_t tagged[ALLOC_TAG_COUNT] = { 0 };
+
+    mutex_acquire(&lock);
 
     size_t count = 0;
     while(!list_is_empty(head)) {
@@ -226,44 +446,46 @@ size_t pmm_free(list_node_t *head) {
         pmm_arena_t *arena;
         list_for_each_entry(arena, &arena_list, node) {
             if (PAGE_BELONGS_TO_ARENA(page, arena)) {
-                page->flags &= ~VM_PAGE_FLAG_NONFREE;
+                if (page->flags & VM_PAGE_FLAG_MOVABLE)
+                    atomic_store_relaxed(&movable_pages, movable_pages - 1);
+                page->flags &= ~(VM_PAGE_FLAG_NONFREE | VM_PAGE_FLAG_MOVABLE);
                 
                 list_add(&arena->free_list, &page->node);
                 arena->free_count++;
+                arena->stats.frees++;
+                tagged[page->tag]++;
                 count++;
                 break;
             }
         }
     }
 
-    /* release mutex */
+    pool_add(&pool.free, count);
+    mutex_release(&lock);
+
+    for (uint32_t tag = 0; tag < ALLOC_TAG_COUNT; ++tag)
+        alloc_tag_uncharge(tag, tagged[tag]);
+    atomic_add_relaxed(&this_cpu_stats()->free_pages, count);
+
+    TRACE("pmm: freed %zu pages", count);
     return count;
 }
 
 size_t pmm_free_page(vm_page_t *page) {
     list_node_t list;
-    list_initalize(list);
+    list_initialize(&list);
 
     list_add(&list, &page->node);
 
     return pmm_free(&list);
 }
 
-pmm_status_t
-pmm_alloc_contiguous(size_t count, uint8_t align_log2, size_t* out_count,
-                    paddr_t *pa_out, list_node_t* list) {
-    if (count == 0)
-        return 0;
-
-    /* must be atleast 4KiB */
-    if (align_log2 < PAGE_SIZE_SHIFT)
-        align_log2 = PAGE_SIZE_SHIFT;
-
-    /* mutex lock */
-
+/* with the lock held */
+static bool take_contiguous(size_t count, uint8_t align_log2, paddr_t *pa_out,
+                            list_node_t *list, alloc_tag_t tag) {
     pmm_arena_t *arena;
     list_for_each_entry(arena, &arena_list, node) {
-        if (arena->flags) {
+        if (arena->flags & PMM_ARENA_FLAG_KMAP) {
             paddr_t rounded_base = ROUNDUP(arena->base, 1UL << align_log2);
             if (rounded_base < arena->base || rounded_base > arena->base + arena->size - 1)
                 continue;
@@ -285,12 +507,14 @@ retry:
                 }
 
                 /* remove the pages out of the free-list */
-                for (int i = start_idx; i < start_idx + count; ++i) {
+                for (size_t i = start_idx; i < start_idx + count; ++i) {
                     page = &arena->page_array[i];
 
                     list_delete(&page->node);
                     page->flags |= VM_PAGE_FLAG_NONFREE;
+                    page->tag = tag;
                     arena->free_count--;
+                    arena->stats.allocs++;
 
                     if (list)
                         list_add_tail(list, &page->node);
@@ -299,30 +523,488 @@ retry:
                 if (pa_out)
                     *pa_out = arena->base + start_idx * PAGE_SIZE;
 
-                /* mutex release */
-                *out_count = count;
-                return NO_ERROR;
+                pool_add(&pool.free, -count);
+                return true;
             }
+
+            arena->stats.contig_failures++;
         }
     }
 
-    /* mutex release */
+    return false;
+}
+
+pmm_status_t
+pmm_alloc_contiguous(size_t count, uint8_t align_log2, size_t* out_count,
+                    paddr_t *pa_out, list_node_t* list, alloc_tag_t tag) {
+    if (count == 0)
+        return ERR_INVALID_ARGS;
+
+    PMU_SCOPE("pmm_alloc_contiguous");
+
+    /* must be atleast 4KiB */
+    if (align_log2 < PAGE_SIZE_SHIFT)
+        align_log2 = PAGE_SIZE_SHIFT;
+
+    uint64_t start = arch_cycle_count();
+    pmm_cpu_stats_t *s = this_cpu_stats();
+
+    atomic_add_relaxed(&s->contig_calls, 1);
+
+    if (!alloc_tag_charge(tag, count)) {
+        account_alloc(start, count, 0);
+        return ERR_OVER_BUDGET;
+    }
+
+    watermark_check(count);
+
+    mutex_acquire(&lock);
+    bool found = take_contiguous(count, align_log2, pa_out, list, tag);
+    mutex_release(&lock);
+
+    /* move pages out of the way and look once more before failing a large request */
+    if (!found && count >= PMM_COMPACT_MIN_PAGES && pmm_compact(NULL)) {
+        mutex_acquire(&lock);
+        found = take_contiguous(count, align_log2, pa_out, list, tag);
+        mutex_release(&lock);
+
+        if (found)
+            atomic_add_relaxed(&compact_stats.rescued, 1);
+    }
+
+    if (found) {
+        account_alloc(start, count, count);
+        if (out_count)
+            *out_count = count;
+        return NO_ERROR;
+    }
+
+    alloc_tag_uncharge(tag, count);
+    account_alloc(start, count, 0);
+    atomic_add_relaxed(&s->contig_failures, 1);
+
+    /* the failures keep coming, compact in the background */
+    if (atomic_load_relaxed(&movable_pages) &&
+        atomic_fetch_add(&compact_failures, 1) + 1 >= PMM_COMPACT_FAILURES) {
+        atomic_store_relaxed(&compact_failures, 0);
+        queue_work(&system_wq, &compact_async_work);
+    }
+
     return ERR_CONTIGUOUS_PAGES_NOT_FOUND;
 }
 
-void *pmm_alloc_kpages(int count, list_node_t *list) {
+void *pmm_alloc_kpages(int count, list_node_t *list, alloc_tag_t tag) {
+    paddr_t pa;
+
+    if (count <= 0)
+        return NULL;
+
     if (count == 1) {
-        vm_page_t* page;
-        int status = pmm_alloc_page(page);
+        vm_page_t *page = pmm_alloc_page(tag);
+        if (!page)
+            return NULL;
 
-        if (!page) {
+        if (list)
+            list_add_tail(list, &page->node);
+
+        pa = page_to_paddr(page);
+    } else {
+        /* the caller gets one pointer, so the pages have to be contiguous */
+        if (pmm_alloc_contiguous(count, PAGE_SIZE_SHIFT, NULL, &pa, list, tag) != NO_ERROR)
             return NULL;
+    }
+
+    return paddr_to_kvaddr(pa);
+}
+
+void *pmm_alloc_kpage(alloc_tag_t tag) {
+    return pmm_alloc_kpages(1, NULL, tag);
+}
+
+size_t pmm_free_kpages(void *ptr, uint32_t count) {
+    list_node_t list;
+    list_initialize(&list);
+
+    paddr_t pa = vaddr_to_paddr(ptr);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        vm_page_t *page = paddr_to_page(pa + (paddr_t)i * PAGE_SIZE);
+        if (page)
+            list_add_tail(&list, &page->node);
+    }
+
+    return pmm_free(&list);
+}
+
+/* ------------------------------ Compaction ------------------------------ */
+
+pmm_status_t pmm_set_movable(vm_page_t *page, addr_t pml4, vaddr_t vaddr) {
+    pmm_status_t ret = NO_ERROR;
+
+    if (!pml4 || !IS_PAGE_ALIGNED(vaddr))
+        return ERR_INVALID_ARGS;
+
+    mutex_acquire(&lock);
+
+    if (!(page->flags & VM_PAGE_FLAG_NONFREE) || (page->flags & VM_PAGE_FLAG_MOVABLE)) {
+        ret = ERR_INVALID_ARGS;
+    } else {
+        page->map.pml4 = pml4;
+        page->map.vaddr = vaddr;
+        page->flags |= VM_PAGE_FLAG_MOVABLE;
+        atomic_store_relaxed(&movable_pages, movable_pages + 1);
+    }
+
+    mutex_release(&lock);
+    return ret;
+}
+
+vm_page_t *pmm_clear_movable(addr_t pml4, vaddr_t vaddr) {
+    vm_page_t *page = NULL;
+    pt_entry_t pa;
+    uint64_t flags;
+    uint32_t level;
+
+    mutex_acquire(&migrate_lock);
+
+    if (mmu_get_mapping(vaddr, pml4, &pa, &flags, &level) == MMU_NO_ERROR)
+        page = paddr_to_page(pa);
+
+    mutex_acquire(&lock);
+
+    if (page && (page->flags & VM_PAGE_FLAG_MOVABLE) &&
+        page->map.pml4 == pml4 && page->map.vaddr == vaddr) {
+        page->flags &= ~VM_PAGE_FLAG_MOVABLE;
+        atomic_store_relaxed(&movable_pages, movable_pages - 1);
+    } else {
+        page = NULL;
+    }
+
+    mutex_release(&lock);
+    mutex_release(&migrate_lock);
+
+    return page;
+}
+
+/*
+ * Copy a movable page to dst and point its mapping at the copy. The
+ * mapping is read only during the copy, so a write faults and waits in
+ * vm_page_fault() rather than going to the old page. Remapping a 4 KiB
+ * entry allocates no tables.
+ */
+static bool migrate_page(vm_page_t *src, paddr_t src_pa, vm_page_t *dst, paddr_t dst_pa) {
+    addr_t pml4 = src->map.pml4;
+    vaddr_t vaddr = src->map.vaddr;
+    pt_entry_t pa;
+    uint64_t flags;
+    uint32_t level;
+
+    if (mmu_get_mapping(vaddr, pml4, &pa, &flags, &level) != MMU_NO_ERROR ||
+        pa != src_pa || (flags & X86_PAGE_BIT_PS))
+        return false;
+
+    /* published before the entry goes read only, a faulting write sees it */
+    atomic_store(&migrating_vaddr, vaddr);
+
+    if (mmu_map_range(vaddr, src_pa, 1, pml4, flags & ~X86_PAGE_BIT_RW) != MMU_NO_ERROR) {
+        atomic_store(&migrating_vaddr, 0);
+        return false;
+    }
+
+    memcpy(paddr_to_kvaddr(dst_pa), paddr_to_kvaddr(src_pa), PAGE_SIZE);
+
+    bool ok = mmu_map_range(vaddr, dst_pa, 1, pml4, flags) == MMU_NO_ERROR;
+    if (!ok)
+        mmu_map_range(vaddr, src_pa, 1, pml4, flags);
+
+    atomic_store(&migrating_vaddr, 0);
+
+    if (!ok)
+        return false;
+
+    dst->map.pml4 = pml4;
+    dst->map.vaddr = vaddr;
+    return true;
+}
+
+/* with compact_run_lock held */
+static size_t compact_arena(pmm_arena_t *arena) {
+    size_t migrate = 0, free = ARENA_PAGE_COUNT(arena), moved = 0, skipped = 0;
+
+    if (!free--)
+        return 0;
+
+    for (;;) {
+        mutex_acquire(&migrate_lock);
+        mutex_acquire(&lock);
+
+        /* movable pages from the bottom, free pages from the top */
+        while (migrate < free && !(arena->page_array[migrate].flags & VM_PAGE_FLAG_MOVABLE))
+            migrate++;
+        while (free > migrate && !page_is_free(&arena->page_array[free]))
+            free--;
+
+        if (migrate >= free) {
+            mutex_release(&lock);
+            mutex_release(&migrate_lock);
+            break;
+        }
+
+        vm_page_t *src = &arena->page_array[migrate];
+        vm_page_t *dst = &arena->page_array[free];
+
+        list_delete(&dst->node);
+        dst->flags |= VM_PAGE_FLAG_NONFREE;
+        dst->tag = src->tag;
+        arena->free_count--;
+        pool_add(&pool.free, -1);
+
+        mutex_release(&lock);
+
+        bool ok = migrate_page(src, arena->base + migrate * PAGE_SIZE,
+                               dst, arena->base + free * PAGE_SIZE);
+
+        /* the old page goes back, or the new one if the move did not happen */
+        vm_page_t *back = ok ? src : dst;
+
+        mutex_acquire(&lock);
+
+        if (ok) {
+            dst->flags |= VM_PAGE_FLAG_MOVABLE;
+            arena->stats.compacted++;
+            moved++;
+        } else {
+            skipped++;
         }
 
-        return paddr_to_kvaddr(vm_page_to_vaddr());
+        /* at the tail, so that the pages just freed at the bottom are taken last */
+        back->flags &= ~(VM_PAGE_FLAG_NONFREE | VM_PAGE_FLAG_MOVABLE);
+        list_add_tail(&arena->free_list, &back->node);
+        arena->free_count++;
+        pool_add(&pool.free, 1);
+
+        mutex_release(&lock);
+        mutex_release(&migrate_lock);
+
+        migrate++;
     }
+
+    atomic_add_relaxed(&compact_stats.moved, moved);
+    atomic_add_relaxed(&compact_stats.skipped, skipped);
+    return moved;
 }
 
-size_t pmm_free_kpages(void *ptr, uint32_t count) {
+size_t pmm_compact(pmm_arena_t *arena) {
+    size_t moved = 0;
+
+    if (!atomic_load_relaxed(&movable_pages))
+        return 0;
+
+    mutex_acquire(&compact_run_lock);
+    atomic_add_relaxed(&compact_stats.runs, 1);
+
+    if (arena) {
+        moved = compact_arena(arena);
+    } else {
+        /* arenas are only added while this runs, and those are published whole */
+        list_for_each_entry_rcu(arena, &arena_list, node) {
+            if (arena->flags & PMM_ARENA_FLAG_KMAP)
+                moved += compact_arena(arena);
+        }
+    }
+
+    mutex_release(&compact_run_lock);
+
+    TRACE("pmm: compaction moved %zu pages", moved);
+    return moved;
+}
+
+/*
+ * The only faults the kernel resolves: a write to a page compaction is
+ * moving. Waiting for the move is enough, the retry writes to whichever
+ * page is mapped by then. The same address in another address space
+ * waits as well and then faults for real.
+ *
+ * The move may also be over by the time we look, or a failed move may
+ * have put the writable entry back without a shootdown. The entry is
+ * writable again then and this cpu retried on a stale read only one.
+ */
+int vm_page_fault(vaddr_t addr, uint32_t flags) {
+    uint32_t want = VM_FAULT_FLAG_PRESENT | VM_FAULT_FLAG_WRITE;
+    vaddr_t vaddr = ROUNDDOWN(addr, PAGE_SIZE);
+
+    if ((flags & want) != want || arch_ints_disabled())
+        return -1;
+
+    if (vaddr == atomic_load(&migrating_vaddr)) {
+        mutex_acquire(&migrate_lock);
+        mutex_release(&migrate_lock);
+        return 0;
+    }
+
+    addr_t pml4 = (addr_t)paddr_to_kvaddr(get_cr3() & CR3_PML4_MASK);
+    pt_entry_t pa;
+    uint64_t pte_flags;
+    uint32_t level;
+
+    if (mmu_get_mapping(vaddr, pml4, &pa, &pte_flags, &level) != MMU_NO_ERROR ||
+        !(pte_flags & X86_PAGE_BIT_RW))
+        return -1;
+
+    invlpg(vaddr);
+    return 0;
+}
+
+static void compact_work(work_t *work) {
+    atomic_add_relaxed(&compact_stats.background_runs, 1);
+    pmm_compact(NULL);
+}
+
+void pmm_get_compact_stats(pmm_compact_stats_t *out) {
+    out->runs = atomic_load_relaxed(&compact_stats.runs);
+    out->background_runs = atomic_load_relaxed(&compact_stats.background_runs);
+    out->moved = atomic_load_relaxed(&compact_stats.moved);
+    out->skipped = atomic_load_relaxed(&compact_stats.skipped);
+    out->rescued = atomic_load_relaxed(&compact_stats.rescued);
+}
+
+/* ------------------------------ Statistics ------------------------------ */
+
+void pmm_get_cpu_stats(uint32_t cpu, pmm_cpu_stats_t *out) {
+    const pmm_cpu_stats_t *s = &pmm_cpus[cpu].stats;
+
+    out->alloc_calls = atomic_load_relaxed(&s->alloc_calls);
+    out->alloc_pages = atomic_load_relaxed(&s->alloc_pages);
+    out->alloc_failures = atomic_load_relaxed(&s->alloc_failures);
+    out->free_pages = atomic_load_relaxed(&s->free_pages);
+    out->contig_calls = atomic_load_relaxed(&s->contig_calls);
+    out->contig_failures = atomic_load_relaxed(&s->contig_failures);
+
+    for (uint32_t i = 0; i < PMM_LATENCY_BUCKETS; ++i)
+        out->latency[i] = atomic_load_relaxed(&s->latency[i]);
+}
+
+void pmm_get_arena_stats(pmm_arena_t *arena, pmm_arena_stats_t *out) {
+    mutex_acquire(&lock);
+    *out = arena->stats;
+    mutex_release(&lock);
+}
+
+static inline uint32_t run_bucket(size_t pages) {
+    uint32_t log2 = 63 - __builtin_clzll(pages);
+    return log2 < PMM_RUN_BUCKETS ? log2 : PMM_RUN_BUCKETS - 1;
+}
 
-}
\ No newline at end of file
+/* with the lock held */
+static void frag_collect(const pmm_arena_t *arena, pmm_frag_info_t *out) {
+    size_t pages = ARENA_PAGE_COUNT(arena), run = 0;
+
+    memset(out, 0, sizeof(*out));
+
+    for (size_t i = 0; i <= pages; ++i) {
+        if (i < pages && page_is_free(&arena->page_array[i])) {
+            run++;
+            continue;
+        }
+
+        if (run) {
+            uint32_t b = run_bucket(run);
+
+            out->free_pages += run;
+            out->free_runs++;
+            out->runs[b]++;
+            out->pages[b] += run;
+            if (run > out->largest_run)
+                out->largest_run = run;
+        }
+        run = 0;
+    }
+}
+
+void pmm_get_frag_info(pmm_arena_t *arena, pmm_frag_info_t *out) {
+    mutex_acquire(&lock);
+    frag_collect(arena, out);
+    mutex_release(&lock);
+}
+
+uint32_t pmm_frag_index(const pmm_frag_info_t *info, uint32_t order) {
+    size_t usable = 0;
+
+    if (!info->free_pages)
+        return 1000;
+
+    /* a bucket holds runs of 2^b up to 2^(b+1) - 1 pages, all long enough from order up */
+    for (uint32_t b = order < PMM_RUN_BUCKETS ? order : PMM_RUN_BUCKETS; b < PMM_RUN_BUCKETS; ++b)
+        usable += info->pages[b];
+
+    return (uint32_t)((info->free_pages - usable) * 1000 / info->free_pages);
+}
+
+/** @returns Upper end in cycles of the bucket that holds the permille-th call. */
+static uint64_t latency_percentile(const pmm_cpu_stats_t *s, uint32_t permille) {
+    uint64_t want = (s->alloc_calls * permille + 999) / 1000, seen = 0;
+
+    for (uint32_t i = 0; i < PMM_LATENCY_BUCKETS; ++i) {
+        seen += s->latency[i];
+        if (seen >= want)
+            return 1ULL << (i + PMM_LATENCY_MIN_SHIFT + 1);
+    }
+
+    return 1ULL << (PMM_LATENCY_BUCKETS + PMM_LATENCY_MIN_SHIFT);
+}
+
+void pmm_dump_stats(void) {
+    pmm_arena_t *arena;
+    pmm_frag_info_t frag;
+
+    printf("pmm: %-18s %8s %8s %10s %10s %11s %6s %7s %6s\n", "arena", "pages", "free",
+           "allocs", "frees", "contig fail", "runs", "largest", "frag16");
+
+    mutex_acquire(&lock);
+    list_for_each_entry(arena, &arena_list, node) {
+        frag_collect(arena, &frag);
+
+        printf("     %#18lx %8zu %8zu %10llu %10llu %11llu %6zu %7zu %4u.%u\n",
+               (unsigned long)arena->base, ARENA_PAGE_COUNT(arena), arena->free_count,
+               (unsigned long long)arena->stats.allocs, (unsigned long long)arena->stats.frees,
+               (unsigned long long)arena->stats.contig_failures, frag.free_runs,
+               frag.largest_run, pmm_frag_index(&frag, 4) / 10, pmm_frag_index(&frag, 4) % 10);
+
+        printf("     watermarks: min %zu low %zu high %zu, %llu pages compacted\n",
+               arena->wmark_min, arena->wmark_low, arena->wmark_high,
+               (unsigned long long)arena->stats.compacted);
+
+        printf("     runs by length:");
+        for (uint32_t b = 0; b < PMM_RUN_BUCKETS; ++b)
+            printf(" %zu%s:%zu", (size_t)1 << b, b == PMM_RUN_BUCKETS - 1 ? "+" : "", frag.runs[b]);
+        printf("\n");
+    }
+    mutex_release(&lock);
+
+    pmm_compact_stats_t cs;
+    pmm_get_compact_stats(&cs);
+
+    printf("pmm: compaction %llu runs, %llu in the background, %llu pages moved, "
+           "%llu skipped, %llu requests rescued, %zu movable pages\n",
+           (unsigned long long)cs.runs, (unsigned long long)cs.background_runs,
+           (unsigned long long)cs.moved, (unsigned long long)cs.skipped,
+           (unsigned long long)cs.rescued, atomic_load_relaxed(&movable_pages));
+
+    printf("pmm: cpu %10s %10s %8s %10s %8s %8s %10s %10s\n", "allocs", "pages", "failed",
+           "freed", "contig", "c failed", "p50 cyc", "p99 cyc");
+
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; ++cpu) {
+        pmm_cpu_stats_t s;
+
+        pmm_get_cpu_stats(cpu, &s);
+        if (!s.alloc_calls && !s.free_pages)
+            continue;
+
+        printf("     %3u %10llu %10llu %8llu %10llu %8llu %8llu %10llu %10llu\n", cpu,
+               (unsigned long long)s.alloc_calls, (unsigned long long)s.alloc_pages,
+               (unsigned long long)s.alloc_failures, (unsigned long long)s.free_pages,
+               (unsigned long long)s.contig_calls, (unsigned long long)s.contig_failures,
+               (unsigned long long)latency_percentile(&s, 500),
+               (unsigned long long)latency_percentile(&s, 990));
+    }
+}
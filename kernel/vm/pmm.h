@@ -1,6 +1,7 @@
 #ifndef _PMM_H_
 #define _PMM_H_
 
+#include "alloc_tag.h"
 #include "../list.h"
 #include "../types.h"
 #include "../arch.h"
@@ -10,16 +11,26 @@
 /** Per page structure */
 typedef struct vm_page {
     uint32_t    flags;
-    list_node_t node;
+    uint8_t     tag;        /* alloc_tag_t it was allocated for. */
+    union {
+        list_node_t node;
+        struct {
+            addr_t  pml4;
+            vaddr_t vaddr;
+        } map;              /* The one mapping of a VM_PAGE_FLAG_MOVABLE page. */
+    };
 } vm_page_t;
 
 #define VM_PAGE_FLAG_NONFREE (0x1)
+#define VM_PAGE_FLAG_MOVABLE (0x2)  /* Compaction may move it, see pmm_set_movable(). */
 
 typedef enum pmm_status {
     NO_ERROR,
     ERR_INVALID_ARENA_SIZE,
     ERR_CONTIGUOUS_PAGES_NOT_FOUND,
-    ERR_INVLID_ARGS,
+    ERR_INVALID_ARGS,
+    ERR_ARENA_IN_USE,
+    ERR_OVER_BUDGET,                /* The tag has no budget left. */
 } pmm_status_t;
 
 /* ------------------------------------------------------------------------
@@ -27,6 +38,26 @@ typedef enum pmm_status {
  * ------------------------------------------------------------------------
  */
 
+/** @brief  Counters of an arena, under the pmm lock. */
+typedef struct pmm_arena_stats {
+    uint64_t    allocs;             /* Pages. */
+    uint64_t    frees;
+    uint64_t    contig_failures;    /* Searches of the arena that found no run. */
+    uint64_t    compacted;          /* Pages compaction moved out of the way. */
+} pmm_arena_stats_t;
+
+#define PMM_ARENA_FLAG_KMAP (0x1)  /* Mapped in the physmap, contiguous and
+                                     * kpages allocations come from it.
+                                     */
+
+/*
+ * Free page watermarks, summed over the arenas since an allocation takes
+ * from any of them. Below low, reclaim is queued to get back to high. An
+ * allocation that would go below min reclaims first, see reclaim.h. Left
+ * at 0 when the arena is added they default to 1, 2 and 3 pages in 256.
+ */
+#define PMM_WMARK_MIN_SHIFT 8
+
 /**
  * @brief   Holds a fixed-sized array of pages. Pages are allocated during
  *          addition to arena list. Once the pages are freed they are
@@ -49,6 +80,12 @@ typedef struct pmm_arena {
     
     vm_page_t   *page_array;/* Array of pages allocated by this arena. */
     list_node_t free_list;  
+
+    size_t      wmark_min;
+    size_t      wmark_low;
+    size_t      wmark_high;
+
+    pmm_arena_stats_t stats;
 } pmm_arena_t;
 
 /**
@@ -57,28 +94,52 @@ typedef struct pmm_arena {
  */
 pmm_status_t    pmm_add_arena(pmm_arena_t *arena);
 
+/**
+ * @brief   Removes a fully free arena from the arena list. Returns once no
+ *          lockless reader can still see it, after that the caller owns
+ *          the arena again.
+ */
+pmm_status_t    pmm_remove_arena(pmm_arena_t *arena);
+
+/**
+ * @brief   Set the watermarks of an added arena, min <= low <= high <= its
+ *          pages. Before it is added set the fields instead.
+ */
+pmm_status_t    pmm_set_watermarks(pmm_arena_t *arena, size_t min, size_t low, size_t high);
+
 /* ------------------------------------------------------------------------
  *  Allocator routines
+ *
+ *  Every allocation is charged to a tag, see alloc_tag.h, and fails like
+ *  an out of memory one when the tag has no budget left for it. The pages
+ *  keep the tag and pmm_free() gives them back to it. Allocations check
+ *  the watermarks first and may block in reclaim, see reclaim.h.
  * ------------------------------------------------------------------------
  */
 
 /** @brief  Allocates count non-contiguous pages of physical memory. */
-int             pmm_alloc_pages(uint32_t count, list_node_t* list);
-int             pmm_alloc_page(vm_page_t *page_out);
+int             pmm_alloc_pages(uint32_t count, list_node_t* list, alloc_tag_t tag);
+
+/** @brief  Allocates a single page, NULL if there is none left. */
+vm_page_t *     pmm_alloc_page(alloc_tag_t tag);
 
 /** @brief  Start allocating pages from the given address. */
-int             pmm_alloc_range(paddr_t address, size_t count, list_node_t* list);
+int             pmm_alloc_range(paddr_t address, size_t count, list_node_t* list,
+                    alloc_tag_t tag);
 
 /**
  * @brief   Allocate a run of contiguous pages, aligned on log2 byte boundary (0-31)
- * 
+ *          from the PMM_ARENA_FLAG_KMAP arenas.
+ *
+ * @param out_count If passed, set to the number of pages allocated.
  * @param pa_out If the optional physical address pointer is passed,
  *               return the address.
  * @param list  If the optional list is passed, append the allocate
  *              page structures to the tail of the list.
  */
 pmm_status_t    pmm_alloc_contiguous(size_t count, uint8_t align_log2,
-                    size_t* out_count, paddr_t *pa_out, list_node_t* list);
+                    size_t* out_count, paddr_t *pa_out, list_node_t* list,
+                    alloc_tag_t tag);
 
 /**
  * @brief   Frees pages in the given list starting from head.
@@ -88,18 +149,122 @@ size_t          pmm_free(list_node_t* head);
 size_t          pmm_free_page(vm_page_t* page);
 
 /**
- * @brief   Allocate pages from the kernel area and return the pointer
- *          in kernel space.
+ * @brief   Allocate physically contiguous pages and return the pointer
+ *          in kernel space. The optional list gets the page structures.
  */
-void *          pmm_alloc_kpages(int count, list_node_t *list);
-void *          pmm_alloc_kpage(void);
+void *          pmm_alloc_kpages(int count, list_node_t *list, alloc_tag_t tag);
+void *          pmm_alloc_kpage(alloc_tag_t tag);
 
+/** @brief  Frees count pages allocated by pmm_alloc_kpages(). */
 size_t          pmm_free_kpages(void *ptr, uint32_t count);
 
-/** @brief  Physical address to virtual address */
+/* ------------------------------------------------------------------------
+ *  Statistics
+ *
+ *  Each cpu counts the calls made on it and how long the allocations took,
+ *  a few relaxed atomic adds and two cycle counter reads per call, so they
+ *  stay on. The free runs are only looked at on demand, with a walk over
+ *  the page array of the arena under the lock.
+ * ------------------------------------------------------------------------
+ */
+
+#define PMM_LATENCY_BUCKETS     16      /* Log2 of the cycles, the ends are open. */
+#define PMM_LATENCY_MIN_SHIFT   6       /* Bucket 0 is below 2^7 cycles. */
+#define PMM_RUN_BUCKETS         12      /* Log2 of the run length, the last is open. */
+
+typedef struct pmm_cpu_stats {
+    uint64_t    alloc_calls;            /* Single page, batch and contiguous. */
+    uint64_t    alloc_pages;
+    uint64_t    alloc_failures;         /* Calls that got fewer pages than asked. */
+    uint64_t    free_pages;
+    uint64_t    contig_calls;
+    uint64_t    contig_failures;
+    uint64_t    latency[PMM_LATENCY_BUCKETS];   /* Alloc calls by log2 of their cycles. */
+} pmm_cpu_stats_t;
+
+typedef struct pmm_frag_info {
+    size_t      free_pages;
+    size_t      free_runs;
+    size_t      largest_run;
+    size_t      runs[PMM_RUN_BUCKETS];  /* Free runs by log2 of their length. */
+    size_t      pages[PMM_RUN_BUCKETS]; /* Free pages in them. */
+} pmm_frag_info_t;
+
+void            pmm_get_cpu_stats(uint32_t cpu, pmm_cpu_stats_t *out);
+void            pmm_get_arena_stats(pmm_arena_t *arena, pmm_arena_stats_t *out);
+
+/** @brief  Walk the pages of an arena for its free runs. */
+void            pmm_get_frag_info(pmm_arena_t *arena, pmm_frag_info_t *out);
+
+/**
+ * @brief   Fragmentation index for runs of 2^order pages: the permille of
+ *          free pages in shorter runs, that such an allocation cannot use.
+ *          1000 with no free pages.
+ */
+uint32_t        pmm_frag_index(const pmm_frag_info_t *info, uint32_t order);
+
+/** @brief  Print the arenas with their free runs and the per cpu counters. */
+void            pmm_dump_stats(void);
+
+/* ------------------------------------------------------------------------
+ *  Compaction
+ *
+ *  Frees up contiguous runs by moving movable pages out of the way. A
+ *  migrate scanner walks an arena up from the bottom for movable pages, a
+ *  free scanner walks down from the top for free pages, and each movable
+ *  page is copied to the free one and its mapping pointed at the copy
+ *  until the two meet. The runs open up at the bottom of the arena.
+ *
+ *  A page that is movable is known to its owner only by its mapping, the
+ *  node of the page is given over to the mapping. While a page moves its
+ *  mapping is read only, a write faults and vm_page_fault() waits for the
+ *  move to end before the write is retried. The writer has to be able to
+ *  block, so a movable mapping must not be written with interrupts off.
+ *  pmm_clear_movable() waits for a move in progress and pins the page
+ *  again before it is unmapped or freed.
+ *
+ *  A contiguous request of PMM_COMPACT_MIN_PAGES or more compacts before
+ *  it fails, and every PMM_COMPACT_FAILURES failed requests queue
+ *  compaction on system_wq.
+ * ------------------------------------------------------------------------
+ */
+
+#define PMM_COMPACT_MIN_PAGES   8
+#define PMM_COMPACT_FAILURES    8
+
+typedef struct pmm_compact_stats {
+    uint64_t    runs;
+    uint64_t    background_runs;
+    uint64_t    moved;                  /* Pages. */
+    uint64_t    skipped;                /* Movable pages not mapped as recorded. */
+    uint64_t    rescued;                /* Contiguous requests found after compacting. */
+} pmm_compact_stats_t;
+
+/**
+ * @brief   Let compaction move an allocated page, mapped once with a 4 KiB
+ *          entry at vaddr in pml4. The page must not be on a list.
+ */
+pmm_status_t    pmm_set_movable(vm_page_t *page, addr_t pml4, vaddr_t vaddr);
+
+/**
+ * @brief   Pin the movable page mapped at vaddr in pml4 again.
+ * @returns The page, which may not be the one made movable, or NULL if
+ *          there is no movable page mapped there.
+ */
+vm_page_t *     pmm_clear_movable(addr_t pml4, vaddr_t vaddr);
+
+/**
+ * @brief   Compact an arena, or every PMM_ARENA_FLAG_KMAP arena for NULL.
+ * @returns Pages moved.
+ */
+size_t          pmm_compact(pmm_arena_t *arena);
+
+void            pmm_get_compact_stats(pmm_compact_stats_t *out);
+
+/** @brief  Physical address to its virtual address in the physmap. */
 void *          paddr_to_kvaddr(paddr_t pa);
 
-/** @brief  Virtual address to physical address */
+/** @brief  Virtual address in the physmap to physical address. */
 paddr_t         vaddr_to_paddr(void *va);
 
 paddr_t         page_to_paddr(const vm_page_t *page);
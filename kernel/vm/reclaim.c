@@ -0,0 +1,148 @@
+#include "reclaim.h"
+#include "../arch.h"
+#include "../atomic.h"
+#include "../mutex.h"
+#include "../stdio.h"
+#include "../thread.h"
+#include "../workqueue.h"
+
+static LIST_NODE(shrinkers);
+
+/* held across the shrinkers, so registering waits for a reclaim to end */
+static mutex_t lock = MUTEX_INTIAL_VALUE(lock);
+
+static reclaim_stats_t stats;
+
+static void reclaim_work(work_t *work);
+
+static work_t async_work = WORK_INITIAL_VALUE(reclaim_work);
+static size_t async_target;
+
+void shrinker_register(shrinker_t *s) {
+    mutex_acquire(&lock);
+    s->freed = 0;
+    list_add_tail(&shrinkers, &s->node);
+    mutex_release(&lock);
+}
+
+void shrinker_unregister(shrinker_t *s) {
+    mutex_acquire(&lock);
+    list_delete(&s->node);
+    mutex_release(&lock);
+}
+
+static size_t shrink(shrinker_t *s, size_t nr) {
+    if (!nr)
+        return 0;
+
+    size_t freed = s->scan(s, nr);
+    s->freed += freed;
+    return freed;
+}
+
+/* with the lock held */
+static size_t shrink_all(size_t target) {
+    shrinker_t *s;
+    size_t total = 0, freed = 0;
+
+    list_for_each_entry(s, &shrinkers, node)
+        total += s->count(s);
+
+    if (!total)
+        return 0;
+
+    /* each its share first, rounded up so a small cache still gives some */
+    list_for_each_entry(s, &shrinkers, node) {
+        if (freed >= target)
+            break;
+
+        size_t share = (target * s->count(s) + total - 1) / total;
+        freed += shrink(s, share < target - freed ? share : target - freed);
+    }
+
+    list_for_each_entry(s, &shrinkers, node) {
+        if (freed >= target)
+            break;
+
+        freed += shrink(s, target - freed);
+    }
+
+    return freed;
+}
+
+static size_t reclaim(size_t target, bool direct) {
+    thread_t *t = get_current_thread();
+
+    /* before the first thread there is nothing to wait on the lock with */
+    if (!target || !t || (t->flags & THREAD_FLAG_RECLAIM))
+        return 0;
+
+    uint64_t start = arch_cycle_count();
+
+    mutex_acquire(&lock);
+    t->flags |= THREAD_FLAG_RECLAIM;
+
+    size_t freed = shrink_all(target);
+
+    t->flags &= ~THREAD_FLAG_RECLAIM;
+
+    if (direct) {
+        stats.direct_runs++;
+        stats.direct_pages += freed;
+        stats.direct_cycles += arch_cycle_count() - start;
+    } else {
+        stats.async_runs++;
+        stats.async_pages += freed;
+    }
+    if (freed < target)
+        stats.short_runs++;
+
+    mutex_release(&lock);
+
+    return freed;
+}
+
+size_t reclaim_direct(size_t target) {
+    return reclaim(target, true);
+}
+
+static void reclaim_work(work_t *work) {
+    reclaim(atomic_exchange(&async_target, 0), false);
+}
+
+void reclaim_async(size_t target) {
+    /* allocations during boot come before the workers */
+    if (!workqueue_ready(&system_wq))
+        return;
+
+    size_t queued = atomic_load_relaxed(&async_target);
+
+    while (queued < target && !atomic_cmpxchg(&async_target, &queued, target))
+        ;
+
+    queue_work(&system_wq, &async_work);
+}
+
+void reclaim_get_stats(reclaim_stats_t *out) {
+    mutex_acquire(&lock);
+    *out = stats;
+    mutex_release(&lock);
+}
+
+void reclaim_dump_stats(void) {
+    shrinker_t *s;
+
+    mutex_acquire(&lock);
+
+    printf("reclaim: async %llu runs %llu pages, direct %llu runs %llu pages %llu cycles, "
+           "%llu short\n",
+           (unsigned long long)stats.async_runs, (unsigned long long)stats.async_pages,
+           (unsigned long long)stats.direct_runs, (unsigned long long)stats.direct_pages,
+           (unsigned long long)stats.direct_cycles, (unsigned long long)stats.short_runs);
+
+    list_for_each_entry(s, &shrinkers, node)
+        printf("         %-20s %10zu now, %10llu freed\n", s->name, s->count(s),
+               (unsigned long long)s->freed);
+
+    mutex_release(&lock);
+}
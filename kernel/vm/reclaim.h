@@ -0,0 +1,73 @@
+#ifndef _RECLAIM_H_
+#define _RECLAIM_H_
+
+#include "../list.h"
+#include "../types.h"
+#include <stdint.h>
+
+/*
+ * Giving memory back before the pmm runs out.
+ *
+ * A kernel cache that holds on to pages it could do without registers a
+ * shrinker. When the free pages of the arenas fall below their low
+ * watermark the pmm queues reclaim on system_wq, which asks the shrinkers
+ * for pages until the free pages are back at the high watermark. An
+ * allocation that would take them below min reclaims in place first, so
+ * it stalls for as long as the shrinkers take instead of failing.
+ *
+ * Shrinkers are asked for a share of the target in proportion to what
+ * they could free, then in turn for whatever is still missing. They run
+ * one reclaim at a time, with THREAD_FLAG_RECLAIM set on the thread so
+ * that pages they allocate do not reclaim again.
+ */
+
+#define RECLAIM_BATCH       32      /* Least pages an allocation reclaims. */
+
+typedef struct shrinker {
+    const char  *name;
+
+    /** @returns Pages it could give back now, a guess is fine. */
+    size_t      (*count)(struct shrinker *s);
+
+    /**
+     * @brief   Free up to nr pages back to the pmm.
+     * @returns Pages freed.
+     */
+    size_t      (*scan)(struct shrinker *s, size_t nr);
+
+    list_node_t node;
+    uint64_t    freed;          /* Pages it gave back, under the reclaim lock. */
+} shrinker_t;
+
+typedef struct reclaim_stats {
+    uint64_t    async_runs;
+    uint64_t    direct_runs;    /* Allocations that reclaimed in place. */
+    uint64_t    async_pages;
+    uint64_t    direct_pages;
+    uint64_t    direct_cycles;  /* Spent reclaiming in place. */
+    uint64_t    short_runs;     /* Runs that got fewer pages than asked. */
+} reclaim_stats_t;
+
+void            shrinker_register(shrinker_t *s);
+void            shrinker_unregister(shrinker_t *s);
+
+/**
+ * @brief   Ask the shrinkers for target pages now, waiting for a reclaim
+ *          already running. Does nothing from inside a shrinker or before
+ *          the first thread.
+ * @returns Pages freed.
+ */
+size_t          reclaim_direct(size_t target);
+
+/**
+ * @brief   Reclaim target pages on system_wq, raising the target if one is
+ *          queued. Does nothing until system_wq has its workers.
+ */
+void            reclaim_async(size_t target);
+
+void            reclaim_get_stats(reclaim_stats_t *out);
+
+/** @brief  Print the reclaim counters and what each shrinker gave back. */
+void            reclaim_dump_stats(void);
+
+#endif /* _RECLAIM_H_ */
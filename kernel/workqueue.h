@@ -0,0 +1,60 @@
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+#include "arch.h"
+#include "lockfree.h"
+#include "thread.h"
+#include "types.h"
+#include <stdbool.h>
+
+/*
+ * Deferred work run from kernel worker threads. Each online cpu has its
+ * own lock-free queue and a worker pinned to it, queueing a work item is
+ * a single exchange plus a wakeup of the worker if it was blocked.
+ */
+
+typedef struct work {
+    mpsc_node_t node;
+    void        (*func)(struct work *work);
+    int         pending;    /* Queued and not started yet. */
+} work_t;
+
+#define WORK_INITIAL_VALUE(_func)   { .node = { NULL }, .func = (_func), .pending = 0 }
+
+typedef struct workqueue_cpu {
+    mpsc_queue_t    queue;
+    thread_t        *worker;
+    uint64_t        executed;
+} ALIGNED(CACHE_LINE_SIZE) workqueue_cpu_t;
+
+typedef struct workqueue {
+    const char      *name;
+    workqueue_cpu_t cpu[SMP_MAX_CPUS];
+} workqueue_t;
+
+/** @brief  Shared queue for short deferred tasks. */
+extern workqueue_t system_wq;
+
+static inline void work_init(work_t *work, void (*func)(work_t *work)) {
+    work->node.next = NULL;
+    work->func = func;
+    work->pending = 0;
+}
+
+/**
+ * @brief   Start a worker thread on each online cpu. Work for a cpu that
+ *          came up later runs on the worker of cpu 0.
+ */
+int workqueue_init(workqueue_t *wq, const char *name);
+
+/** @brief  Whether workqueue_init() has started the worker of cpu 0. */
+bool workqueue_ready(workqueue_t *wq);
+
+/**
+ * @brief   Queue work on the current cpu's worker.
+ * @returns False if the work was already pending.
+ */
+bool queue_work(workqueue_t *wq, work_t *work);
+bool queue_work_on(uint32_t cpu, workqueue_t *wq, work_t *work);
+
+#endif /* _WORKQUEUE_H_ */